@@ -0,0 +1,194 @@
+#pragma once
+
+#include "graft_constants.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <vector>
+
+namespace graft
+{
+    namespace ch = std::chrono;
+
+    //////////////
+    /// \brief The AdmissionQueue class
+    /// A bounded queue of items that wait for a free slot of the thread pool.
+    /// Each priority class has its own FIFO, pop takes the item from the highest non-empty class.
+    /// When the queue is full a new item pushes out the newest item of a lower class, otherwise it is rejected.
+    /// Items waiting too long are shed on pop according to CoDel (RFC 8289): when the queue delay
+    /// stays above target for a whole interval, the items are dropped with increasing rate until the delay
+    /// goes down. High priority items are never shed by CoDel.
+    /// The class also measures the drain rate (items leaving the pool per second) to estimate Retry-After.
+    ///
+    template<typename T>
+    class AdmissionQueue
+    {
+    public:
+        using clock = ch::steady_clock;
+
+        AdmissionQueue(size_t capacity, ch::milliseconds target, ch::milliseconds interval)
+            : m_capacity(capacity)
+            , m_target(target)
+            , m_interval(interval)
+        {
+        }
+
+        size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+        size_t capacity() const { return m_capacity; }
+
+        //returns false if the item is rejected, items pushed out are appended to shed
+        bool push(Priority priority, const T& item, std::vector<T>& shed, clock::time_point now = clock::now())
+        {
+            if(m_capacity <= m_size)
+            {
+                int lowest = PRIORITY_COUNT - 1;
+                for(; static_cast<int>(priority) < lowest && m_queues[lowest].empty(); --lowest);
+                if(lowest <= static_cast<int>(priority)) return false;
+                shed.emplace_back(std::move(m_queues[lowest].back().item));
+                m_queues[lowest].pop_back();
+                --m_size;
+            }
+            m_queues[static_cast<int>(priority)].push_back({item, now});
+            ++m_size;
+            return true;
+        }
+
+        //returns false if the queue is empty, items dropped by CoDel are appended to shed
+        bool pop(T& item, std::vector<T>& shed, clock::time_point now = clock::now())
+        {
+            Entry entry;
+            bool okToDrop = false;
+            bool res = doPop(entry, okToDrop, now);
+            if(!res)
+            {
+                m_dropping = false;
+                return false;
+            }
+
+            if(m_dropping)
+            {
+                if(!okToDrop)
+                {
+                    m_dropping = false;
+                }
+                while(m_dropping && m_dropNext <= now)
+                {
+                    shed.emplace_back(std::move(entry.item));
+                    ++m_dropCount;
+                    res = doPop(entry, okToDrop, now);
+                    if(!res || !okToDrop)
+                    {
+                        m_dropping = false;
+                    }
+                    else
+                    {
+                        m_dropNext = controlLaw(m_dropNext, m_dropCount);
+                    }
+                }
+            }
+            else if(okToDrop)
+            {
+                shed.emplace_back(std::move(entry.item));
+                res = doPop(entry, okToDrop, now);
+                m_dropping = true;
+                size_t delta = m_dropCount - m_lastDropCount;
+                m_dropCount = (1 < delta && now - m_dropNext < 16*m_interval)? delta : 1;
+                m_dropNext = controlLaw(now, m_dropCount);
+                m_lastDropCount = m_dropCount;
+            }
+            if(!res) return false;
+            item = std::move(entry.item);
+            return true;
+        }
+
+        //should be called when an item leaves the thread pool
+        void onDone(clock::time_point now = clock::now())
+        {
+            ++m_doneInWindow;
+            if(m_windowStart == clock::time_point()) m_windowStart = now;
+            auto elapsed = now - m_windowStart;
+            if(elapsed < m_rateWindow) return;
+            double rate = m_doneInWindow / ch::duration<double>(elapsed).count();
+            m_drainRate = (m_drainRate == 0)? rate : m_drainRate + (rate - m_drainRate) / 4;
+            m_doneInWindow = 0;
+            m_windowStart = now;
+        }
+
+        //items per second
+        double drainRate() const { return m_drainRate; }
+
+        //the number of seconds to wait until the queue is drained, for Retry-After header
+        int retryAfter() const
+        {
+            if(m_drainRate <= 0) return 1;
+            double sec = std::ceil((m_size + 1) / m_drainRate);
+            return static_cast<int>(std::max(1.0, std::min(sec, static_cast<double>(m_maxRetryAfter))));
+        }
+
+    private:
+        struct Entry
+        {
+            T item;
+            clock::time_point enqueued;
+        };
+
+        bool doPop(Entry& entry, bool& okToDrop, clock::time_point now)
+        {
+            okToDrop = false;
+            auto it = std::find_if(m_queues.begin(), m_queues.end(), [](auto& q){ return !q.empty(); });
+            if(it == m_queues.end())
+            {
+                m_firstAboveTime = clock::time_point();
+                return false;
+            }
+            entry = std::move(it->front());
+            it->pop_front();
+            --m_size;
+
+            if(now - entry.enqueued < m_target)
+            {
+                m_firstAboveTime = clock::time_point();
+            }
+            else if(m_firstAboveTime == clock::time_point())
+            {
+                m_firstAboveTime = now + m_interval;
+            }
+            else if(m_firstAboveTime <= now)
+            {
+                okToDrop = (it != m_queues.begin());
+            }
+            return true;
+        }
+
+        clock::time_point controlLaw(clock::time_point t, size_t count) const
+        {
+            auto step = ch::duration_cast<clock::duration>(m_interval / std::sqrt(static_cast<double>(count)));
+            return t + step;
+        }
+
+        static constexpr int m_maxRetryAfter = 60;
+
+        std::array<std::deque<Entry>, PRIORITY_COUNT> m_queues;
+        size_t m_size = 0;
+        const size_t m_capacity;
+        const clock::duration m_target;
+        const clock::duration m_interval;
+
+        //CoDel state
+        clock::time_point m_firstAboveTime;
+        clock::time_point m_dropNext;
+        size_t m_dropCount = 0;
+        size_t m_lastDropCount = 0;
+        bool m_dropping = false;
+
+        //drain rate measurement
+        const clock::duration m_rateWindow = ch::milliseconds(100);
+        clock::time_point m_windowStart;
+        size_t m_doneInWindow = 0;
+        double m_drainRate = 0;
+    };
+}
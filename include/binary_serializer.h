@@ -0,0 +1,107 @@
+#pragma once
+
+#include "json_sax.h"
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace graft { namespace serializer { namespace bin {
+
+/*!
+ * Binary encoding of the structures defined with GRAFT_DEFINE_IO_STRUCT, it is a subset of MessagePack.
+ * A structure is a map of the member names to the values, so the nodes of different versions read the members
+ * they know and skip the others, as with JSON. A string of lowercase hex digits (keys, signatures, tx blobs)
+ * is written as the bytes it encodes, in MessagePack ext type HEX_EXT, and it is read back as the same string.
+ * An encoded message starts with MAGIC, the byte MessagePack never uses, and VERSION; JSON never starts with it,
+ * so a reader tells the encodings apart by the first byte.
+ */
+constexpr char MAGIC = '\xc1';
+constexpr char VERSION = 1;
+constexpr int8_t HEX_EXT = 1;
+
+class BinaryParseError : public std::runtime_error
+{
+public:
+    BinaryParseError(const std::string& what, size_t offset)
+        : std::runtime_error("Binary parse error: " + what + ", offset: " + std::to_string(offset))
+    {
+    }
+};
+
+inline bool isBinary(const char* data, size_t size) { return 0 < size && data[0] == MAGIC; }
+inline bool isBinary(const std::string& s) { return isBinary(s.data(), s.size()); }
+
+//////////////
+/// \brief The Writer class
+/// Writes MessagePack to the end of a string, it has the interface of rapidjson::Writer used by sax::Emit.
+///
+class Writer
+{
+public:
+    explicit Writer(std::string& str) : m_str(str) { }
+
+    void Null() { put(0xc0); }
+    void Bool(bool v) { put(v? 0xc3 : 0xc2); }
+    void Int64(int64_t v);
+    void Uint64(uint64_t v);
+    void Double(double v);
+    void String(const char* s) { String(s, std::strlen(s)); }
+    void String(const char* s, size_t len);
+    void Key(const char* s, size_t len) { raw(s, len); }
+
+    void StartObject(size_t count) { header(count, 0x80, 0xde, 0xdf); }
+    void StartArray(size_t count) { header(count, 0x90, 0xdc, 0xdd); }
+private:
+    void put(unsigned char c) { m_str.push_back(static_cast<char>(c)); }
+    void putBE(uint64_t v, int bytes);
+    void header(size_t count, unsigned char fix, unsigned char b16, unsigned char b32);
+    void raw(const char* s, size_t len);
+
+    std::string& m_str;
+};
+
+inline void startObject(Writer& w, size_t count) { w.StartObject(count); }
+inline void endObject(Writer&) { }
+inline void startArray(Writer& w, size_t count) { w.StartArray(count); }
+inline void endArray(Writer&) { }
+
+/*!
+ * \brief parse - reads a message written by toBinary into the root target.
+ * Throws BinaryParseError if the message is malformed.
+ */
+void parse(const char* data, size_t size, sax::Target root);
+
+template<typename T>
+void toBinary(const T& t, std::string& str)
+{
+    str.push_back(MAGIC);
+    str.push_back(VERSION);
+    Writer w(str);
+    sax::emit(w, t);
+}
+
+template<typename T>
+std::string toBinary(const T& t)
+{
+    std::string res;
+    toBinary(t, res);
+    return res;
+}
+
+template<typename T>
+void fromBinary(const char* data, size_t size, T& t)
+{
+    t = T();
+    bin::parse(data, size, sax::target(t));
+}
+
+//reads both encodings
+template<typename T>
+void fromAny(const std::string& s, T& t)
+{
+    if(isBinary(s)) fromBinary(s.data(), s.size(), t);
+    else sax::fromJson(s, t);
+}
+
+} } } //namespace graft::serializer::bin
@@ -1,14 +1,72 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <cstddef>
+#include <cstring>
 #include <string>
 #include <random>
+#include <type_traits>
 
 namespace graft {
 namespace utils {
 
+/*!
+ * The base64 and hex codecs use SIMD (AVX2 or SSSE3) when the CPU supports it, it is detected at runtime,
+ * otherwise they are scalar. The results are the same as of epee::string_encoding and epee::string_tools.
+ */
+
+/*!
+ * \brief base64_decode - decodes the standard alphabet; as epee does, decoding stops at the first '=' or
+ * a character that is not base64, and the partial last group is decoded.
+ */
 std::string base64_decode(const std::string &encoded_data);
+std::string base64_decode(const char *encoded_data, size_t size);
 std::string base64_encode(const std::string &data);
+std::string base64_encode(const char *data, size_t size);
+
+//lower case hex, as epee::string_tools::buff_to_hex_nodelimer
+std::string to_hex(const void *data, size_t size);
+inline std::string to_hex(const std::string &data) { return to_hex(data.data(), data.size()); }
+
+/*!
+ * \brief from_hex - decodes hex of both cases to size / 2 bytes of out.
+ * \return false if the size is odd or a character is not hex, out is spoiled then
+ */
+bool from_hex(const char *hex, size_t size, void *out);
+
+//as epee::string_tools::parse_hexstr_to_binbuff
+bool from_hex(const std::string &hex, std::string &out);
+
+//as epee::string_tools::pod_to_hex
+template <typename T>
+std::string pod_to_hex(const T &t)
+{
+    static_assert(std::is_standard_layout<T>::value, "expected standard layout type");
+    return to_hex(&t, sizeof(T));
+}
+
+//as epee::string_tools::hex_to_pod, t is not changed on failure
+template <typename T>
+bool hex_to_pod(const std::string &hex, T &t)
+{
+    static_assert(std::is_standard_layout<T>::value, "expected standard layout type");
+    if (hex.size() != 2 * sizeof(T))
+        return false;
+    unsigned char pod[sizeof(T)];
+    if (!from_hex(hex.data(), hex.size(), pod))
+        return false;
+    std::memcpy(&t, pod, sizeof(T));
+    return true;
+}
+
+//name of the codec implementation in use: "avx2", "ssse3" or "scalar"
+const char *codec_implementation();
+
+/*!
+ * \brief force_scalar_codecs - switches the codecs to the scalar implementation or back to the best one the CPU
+ * supports, for benchmarks and tests.
+ */
+void force_scalar_codecs(bool scalar);
 
 template <typename T>
 T random_number(T startRange, T endRange)
@@ -0,0 +1,521 @@
+#pragma once
+
+#include "timing_wheel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace graft
+{
+    namespace ch = std::chrono;
+
+    //////////////
+    /// \brief The EpochManager class
+    /// Epoch-based reclamation of the memory that is read without locks.
+    /// A reader pins the current epoch for the time of the access with Guard. A writer unlinks an object
+    /// and retires it with the current epoch; it is safe to delete the object when the epoch has advanced
+    /// twice since then. The epoch advances only when all pinned readers are in the current one.
+    /// Each thread has its own slot, so pinning does not write shared cache lines.
+    ///
+    class EpochManager
+    {
+    public:
+        static constexpr size_t MAX_THREADS = 512;
+
+        static EpochManager& instance()
+        {
+            //never destroyed, it can be used by static objects on exit
+            static EpochManager* manager = new EpochManager();
+            return *manager;
+        }
+
+        class Guard
+        {
+        public:
+            Guard() : m_em(instance()) { m_em.enter(); }
+            ~Guard() { m_em.leave(); }
+            Guard(const Guard&) = delete;
+            Guard& operator = (const Guard&) = delete;
+        private:
+            EpochManager& m_em;
+        };
+
+        uint64_t epoch() const
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return m_epoch.load(std::memory_order_seq_cst);
+        }
+
+        //advances the epoch if there are no readers pinned in the previous one, returns the current epoch
+        uint64_t tryAdvance()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            uint64_t e = m_epoch.load(std::memory_order_seq_cst);
+            if(m_overflow.load(std::memory_order_seq_cst) != 0) return e;
+            const size_t count = m_slotCount.load(std::memory_order_acquire);
+            for(size_t i = 0; i < count; ++i)
+            {
+                uint64_t se = m_slots[i].epoch.load(std::memory_order_seq_cst);
+                if(se != IDLE && se != e) return e;
+            }
+            m_epoch.compare_exchange_strong(e, e + 1);
+            return m_epoch.load(std::memory_order_seq_cst);
+        }
+    private:
+        static constexpr uint64_t IDLE = std::numeric_limits<uint64_t>::max();
+
+        struct Slot
+        {
+            std::atomic<uint64_t> epoch{IDLE};
+            std::atomic<bool> used{false};
+            char padding[64 - sizeof(std::atomic<uint64_t>) - sizeof(std::atomic<bool>)]; //against false sharing
+        };
+
+        struct ThreadState
+        {
+            Slot* slot = nullptr;
+            bool overflow = false; //no free slot, the thread blocks advancing while it is inside
+            size_t nesting = 0;
+            ~ThreadState() { if(slot) slot->used.store(false, std::memory_order_release); }
+        };
+
+        EpochManager() = default;
+
+        ThreadState& state()
+        {
+            thread_local ThreadState ts;
+            return ts;
+        }
+
+        void acquireSlot(ThreadState& ts)
+        {
+            for(size_t i = 0; i < MAX_THREADS; ++i)
+            {
+                bool expected = false;
+                if(m_slots[i].used.load(std::memory_order_relaxed)
+                        || !m_slots[i].used.compare_exchange_strong(expected, true)) continue;
+                size_t count = m_slotCount.load();
+                while(count < i + 1 && !m_slotCount.compare_exchange_weak(count, i + 1));
+                ts.slot = &m_slots[i];
+                return;
+            }
+            ts.overflow = true;
+        }
+
+        void enter()
+        {
+            ThreadState& ts = state();
+            if(ts.nesting++) return;
+            if(!ts.slot && !ts.overflow) acquireSlot(ts);
+            if(ts.slot) ts.slot->epoch.store(m_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+            else m_overflow.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+        void leave()
+        {
+            ThreadState& ts = state();
+            if(--ts.nesting) return;
+            if(ts.slot) ts.slot->epoch.store(IDLE, std::memory_order_release);
+            else m_overflow.fetch_sub(1, std::memory_order_release);
+        }
+
+        std::atomic<uint64_t> m_epoch{0};
+        std::atomic<size_t> m_slotCount{0};
+        std::atomic<size_t> m_overflow{0};
+        Slot m_slots[MAX_THREADS];
+    };
+
+    //////////////
+    /// \brief The ConcurrentMap class
+    /// Sharded open-addressing hash map with lock-free reads, the replacement of TSHashtable.
+    /// Each shard is a linear probing table of pointers to immutable nodes. Writers of a shard are
+    /// serialized by its mutex; they publish new nodes and tables with atomic stores and retire the old
+    /// ones to EpochManager, so readers never lock and never see freed memory. An update, including
+    /// apply(), copies the node. A shard grows twice when its live and removed slots exceed 3/4 of the table.
+    /// An entry with non-zero ttl expires when it is not accessed for ttl; expired entries are not visible.
+    /// Each shard keeps the entries with ttl in a timing wheel of one second ticks, cleanup() advances
+    /// the wheels and removes the entries that are due. An access does not touch the wheel, an entry
+    /// accessed after it was scheduled is scheduled again when its slot comes.
+    ///
+    template <typename Key, typename Value, typename Hash=std::hash<Key> >
+    class ConcurrentMap
+    {
+    private:
+        struct Node : public TimingWheelHook
+        {
+            Node(const Key& k, Value v, uint64_t h, ch::seconds t)
+                : key(k), value(std::move(v)), hash(h), ttl(t), expires(std::numeric_limits<int64_t>::max())
+            {
+                touch();
+            }
+
+            bool expired(int64_t now_sec) const
+            {
+                return expires.load(std::memory_order_relaxed) <= now_sec;
+            }
+
+            void touch()
+            {
+                if(ttl != ch::seconds(0)) expires.store(nowSec() + ttl.count(), std::memory_order_relaxed);
+            }
+
+            const Key key;
+            const Value value;
+            const uint64_t hash;
+            const ch::seconds ttl;
+            std::atomic<int64_t> expires;
+        };
+
+        struct Table
+        {
+            explicit Table(size_t capacity)
+                : mask(capacity - 1)
+                , slots(new std::atomic<Node*>[capacity])
+            {
+                for(size_t i = 0; i < capacity; ++i) slots[i].store(nullptr, std::memory_order_relaxed);
+            }
+
+            size_t capacity() const { return mask + 1; }
+
+            const size_t mask;
+            std::unique_ptr<std::atomic<Node*>[]> slots;
+        };
+
+        struct Retired
+        {
+            uint64_t epoch;
+            void* ptr;
+            void (*deleter)(void*);
+        };
+
+        struct Shard
+        {
+            Shard() : wheel(nowSec()) { }
+
+            std::mutex mutex;
+            std::atomic<Table*> table;
+            size_t used = 0; //live and removed slots
+            std::atomic<size_t> live{0};
+            std::atomic<uint64_t> expired{0};
+            std::vector<Retired> retired;
+            TimingWheel<> wheel;
+        };
+
+        static constexpr size_t INITIAL_CAPACITY = 16;
+        static constexpr size_t RECLAIM_THRESHOLD = 32;
+        static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+        std::vector<std::unique_ptr<Shard>> m_shards;
+        size_t m_shardMask;
+        Hash m_hasher;
+
+        static Node* removed() { return reinterpret_cast<Node*>(uintptr_t(1)); }
+
+        static int64_t nowSec()
+        {
+            return ch::duration_cast<ch::seconds>(ch::steady_clock::now().time_since_epoch()).count();
+        }
+
+        uint64_t hashOf(const Key& key) const
+        {//murmur3 finalizer, std::hash of integers is identity
+            uint64_t h = m_hasher(key);
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 33;
+            return h;
+        }
+
+        Shard& shardOf(uint64_t h) const { return *m_shards[(h >> 32) & m_shardMask]; }
+
+        //returns visible node, the caller should be in EpochManager::Guard or hold the shard lock
+        static Node* findNode(const Table& t, const Key& key, uint64_t h)
+        {
+            for(size_t i = h & t.mask, n = 0; n <= t.mask; i = (i + 1) & t.mask, ++n)
+            {
+                Node* p = t.slots[i].load(std::memory_order_acquire);
+                if(!p) break;
+                if(p == removed() || p->hash != h || !(p->key == key)) continue;
+                if(p->ttl != ch::seconds(0) && p->expired(nowSec())) return nullptr;
+                p->touch();
+                return p;
+            }
+            return nullptr;
+        }
+
+        //under the shard lock, returns the slot index of the key including expired node
+        static size_t findIndex(const Table& t, const Key& key, uint64_t h)
+        {
+            for(size_t i = h & t.mask, n = 0; n <= t.mask; i = (i + 1) & t.mask, ++n)
+            {
+                Node* p = t.slots[i].load(std::memory_order_relaxed);
+                if(!p) break;
+                if(p != removed() && p->hash == h && p->key == key) return i;
+            }
+            return npos;
+        }
+
+        //under the shard lock, the table has free slots
+        static size_t freeIndex(const Table& t, uint64_t h)
+        {
+            size_t i = h & t.mask;
+            for(;; i = (i + 1) & t.mask)
+            {
+                Node* p = t.slots[i].load(std::memory_order_relaxed);
+                if(!p || p == removed()) return i;
+            }
+        }
+
+        template<typename T>
+        static void retire(Shard& s, T* ptr)
+        {
+            s.retired.push_back(Retired{EpochManager::instance().epoch(), ptr,
+                                        [](void* p) { delete static_cast<T*>(p); }});
+        }
+
+        static void reclaim(Shard& s, bool force = false)
+        {
+            if(s.retired.empty() || (!force && s.retired.size() < RECLAIM_THRESHOLD)) return;
+            uint64_t e = EpochManager::instance().tryAdvance();
+            auto it = std::partition(s.retired.begin(), s.retired.end(),
+                                     [e](const Retired& r) { return e < r.epoch + 2; });
+            std::for_each(it, s.retired.end(), [](const Retired& r) { r.deleter(r.ptr); });
+            s.retired.erase(it, s.retired.end());
+        }
+
+        //under the shard lock, drops removed and expired slots, grows if more than half is live
+        static void rehash(Shard& s)
+        {
+            Table* t = s.table.load(std::memory_order_relaxed);
+            const int64_t now_sec = nowSec();
+            size_t live = 0;
+            for(size_t i = 0; i < t->capacity(); ++i)
+            {
+                Node* p = t->slots[i].load(std::memory_order_relaxed);
+                if(p && p != removed() && !p->expired(now_sec)) ++live;
+            }
+            size_t capacity = t->capacity();
+            while(capacity < 2 * (live + 1)) capacity *= 2;
+
+            Table* nt = new Table(capacity);
+            for(size_t i = 0; i < t->capacity(); ++i)
+            {
+                Node* p = t->slots[i].load(std::memory_order_relaxed);
+                if(!p || p == removed()) continue;
+                if(p->expired(now_sec))
+                {
+                    s.wheel.cancel(p);
+                    s.expired.fetch_add(1, std::memory_order_relaxed);
+                    retire(s, p);
+                    continue;
+                }
+                nt->slots[freeIndex(*nt, p->hash)].store(p, std::memory_order_relaxed);
+            }
+            s.table.store(nt, std::memory_order_release);
+            s.used = live;
+            s.live.store(live, std::memory_order_relaxed);
+            retire(s, t);
+        }
+
+        //under the shard lock, unlinks the node and retires it
+        static void unpublish(Shard& s, Table& t, size_t idx)
+        {
+            Node* old = t.slots[idx].load(std::memory_order_relaxed);
+            t.slots[idx].store(removed(), std::memory_order_release);
+            s.live.fetch_sub(1, std::memory_order_relaxed);
+            s.wheel.cancel(old);
+            retire(s, old);
+        }
+
+        //under the shard lock, returns true if new entry is added
+        static bool publish(Shard& s, Node* node)
+        {
+            if(node->ttl != ch::seconds(0)) s.wheel.schedule(node, node->expires.load(std::memory_order_relaxed));
+            Table* t = s.table.load(std::memory_order_relaxed);
+            size_t idx = findIndex(*t, node->key, node->hash);
+            if(idx != npos)
+            {
+                Node* old = t->slots[idx].load(std::memory_order_relaxed);
+                t->slots[idx].store(node, std::memory_order_release);
+                s.wheel.cancel(old);
+                retire(s, old);
+                return false;
+            }
+            if(4 * (s.used + 1) > 3 * t->capacity())
+            {
+                rehash(s);
+                t = s.table.load(std::memory_order_relaxed);
+            }
+            idx = freeIndex(*t, node->hash);
+            if(!t->slots[idx].load(std::memory_order_relaxed)) ++s.used;
+            t->slots[idx].store(node, std::memory_order_release);
+            s.live.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+    public:
+        ConcurrentMap(unsigned num_shards = 64, const Hash& h = Hash())
+            : m_hasher(h)
+        {
+            size_t count = 1;
+            while(count < num_shards) count <<= 1;
+            m_shards.resize(count);
+            for(auto& s : m_shards)
+            {
+                s = std::make_unique<Shard>();
+                s->table.store(new Table(INITIAL_CAPACITY), std::memory_order_relaxed);
+            }
+            m_shardMask = count - 1;
+        }
+
+        ~ConcurrentMap()
+        {
+            for(auto& s : m_shards)
+            {
+                Table* t = s->table.load();
+                for(size_t i = 0; i < t->capacity(); ++i)
+                {
+                    Node* p = t->slots[i].load();
+                    if(p && p != removed()) delete p;
+                }
+                delete t;
+                for(const Retired& r : s->retired) r.deleter(r.ptr);
+            }
+        }
+
+        ConcurrentMap(const ConcurrentMap& other) = delete;
+        ConcurrentMap& operator=(const ConcurrentMap& other) = delete;
+
+        Value valueFor(Key const& key, Value const& default_value = Value()) const
+        {
+            const uint64_t h = hashOf(key);
+            EpochManager::Guard guard;
+            const Node* p = findNode(*shardOf(h).table.load(std::memory_order_acquire), key, h);
+            return p ? p->value : default_value;
+        }
+
+        void addOrUpdate(const Key& key, const Value& value, ch::seconds ttl = ch::seconds(0))
+        {
+            const uint64_t h = hashOf(key);
+            Node* node = new Node(key, value, h, ttl);
+            Shard& s = shardOf(h);
+            std::lock_guard<std::mutex> lk(s.mutex);
+            publish(s, node);
+            reclaim(s);
+        }
+
+        void remove(const Key& key)
+        {
+            const uint64_t h = hashOf(key);
+            Shard& s = shardOf(h);
+            std::lock_guard<std::mutex> lk(s.mutex);
+            Table* t = s.table.load(std::memory_order_relaxed);
+            size_t idx = findIndex(*t, key, h);
+            if(idx == npos) return;
+            unpublish(s, *t, idx);
+            reclaim(s);
+        }
+
+        //approximate number of entries, including expired ones that are not cleaned up yet
+        size_t size() const
+        {
+            size_t res = 0;
+            for(auto& s : m_shards) res += s->live.load(std::memory_order_relaxed);
+            return res;
+        }
+
+        //number of entries removed on expiry
+        uint64_t expiredCount() const
+        {
+            uint64_t res = 0;
+            for(auto& s : m_shards) res += s->expired.load(std::memory_order_relaxed);
+            return res;
+        }
+
+        bool hasKey(Key const& key) const
+        {
+            const uint64_t h = hashOf(key);
+            EpochManager::Guard guard;
+            return findNode(*shardOf(h).table.load(std::memory_order_acquire), key, h) != nullptr;
+        }
+
+        //f is called with the value in place without locks, the value must not be kept after the call
+        template<typename F>
+        bool visit(Key const& key, F f) const
+        {
+            const uint64_t h = hashOf(key);
+            EpochManager::Guard guard;
+            const Node* p = findNode(*shardOf(h).table.load(std::memory_order_acquire), key, h);
+            if(!p) return false;
+            f(static_cast<const Value&>(p->value));
+            return true;
+        }
+
+        //as apply, but f is applied to a default value with the ttl when there is no entry;
+        //the entry is added only if f returns true
+        bool applyOrAdd(Key const& key, std::function<bool(Value&)> f, ch::seconds ttl = ch::seconds(0))
+        {
+            const uint64_t h = hashOf(key);
+            Shard& s = shardOf(h);
+            std::lock_guard<std::mutex> lk(s.mutex);
+            const Node* p = findNode(*s.table.load(std::memory_order_relaxed), key, h);
+            Value value = p ? p->value : Value();
+            if(!f(value)) return false;
+            publish(s, new Node(key, std::move(value), h, p ? p->ttl : ttl));
+            reclaim(s);
+            return true;
+        }
+
+        //f is applied to a copy of the value under the shard lock, the copy replaces the value if f returns true
+        bool apply(Key const& key, std::function<bool(Value&)> f)
+        {
+            const uint64_t h = hashOf(key);
+            Shard& s = shardOf(h);
+            std::lock_guard<std::mutex> lk(s.mutex);
+            const Node* p = findNode(*s.table.load(std::memory_order_relaxed), key, h);
+            if(!p) return false;
+            Value value = p->value;
+            if(!f(value)) return false;
+            publish(s, new Node(key, std::move(value), h, p->ttl));
+            reclaim(s);
+            return true;
+        }
+
+        //removes the entries expired up to now, the cost is proportional to their number
+        void cleanup()
+        {
+            const int64_t now_sec = nowSec();
+            for(auto& ps : m_shards)
+            {
+                Shard& s = *ps;
+                std::lock_guard<std::mutex> lk(s.mutex);
+                s.wheel.advance(now_sec, [&s, now_sec](TimingWheelHook* h)
+                {
+                    Node* p = static_cast<Node*>(h);
+                    const int64_t expires = p->expires.load(std::memory_order_relaxed);
+                    if(now_sec < expires)
+                    {//accessed since it was scheduled
+                        s.wheel.schedule(p, expires);
+                        return;
+                    }
+                    Table* t = s.table.load(std::memory_order_relaxed);
+                    size_t idx = findIndex(*t, p->key, p->hash);
+                    assert(idx != npos && t->slots[idx].load(std::memory_order_relaxed) == p);
+                    unpublish(s, *t, idx);
+                    s.expired.fetch_add(1, std::memory_order_relaxed);
+                });
+                reclaim(s, true);
+            }
+        }
+    };
+}
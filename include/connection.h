@@ -26,7 +26,7 @@ mg_mgr* getMgr(mg_connection* nc);
 template<typename C, typename F = details::default_F<C>>
 void static_ev_handler(mg_connection *nc, int ev, void *ev_data)
 {
-    static bool entered = false;
+    static thread_local bool entered = false;
     assert(!entered); //recursive calls are dangerous
     entered = true;
     C* This = static_cast<C*>(getUserData(nc));
@@ -48,25 +48,71 @@ public:
     void send(TaskManager& manager, BaseTaskPtr bt);
     Status getStatus() const { return m_status; }
     const std::string& getError() const { return m_error; }
+    //accounts the request duration and the result to the metrics of its url path
+    void observeLatency();
+    //the key of the request in the upstream cache, empty if the reply is not cached
+    void setCacheKey(std::string key) { m_cacheKey = std::move(key); }
+    const std::string& getCacheKey() const { return m_cacheKey; }
 
     void ev_handler(mg_connection* upstream, int ev, void *ev_data);
 private:
+    //the request to one backend; the second one is the hedged request or the request failed over to another backend
+    struct Attempt
+    {
+        mg_connection *upstream = nullptr;
+        //the index of the cryptonode backend in the balancer, -1 if the url is not the one of the backends
+        int backend = -1;
+        std::string url;
+        //mg_time of the request timeout
+        double deadline = 0;
+        //the connection served requests before
+        bool reused = false;
+        //something is received over the connection
+        bool received = false;
+        std::chrono::steady_clock::time_point started;
+    };
+
     void setError(Status status, const std::string& error = std::string())
     {
         m_status = status;
         m_error = error;
     }
-
-    mg_connection *m_upstream = nullptr;
+    void startAttempt(TaskManager& manager, Attempt& attempt, int backend);
+    //sends the request over a connection of the upstream pool, fresh skips the idle connections
+    void connect(TaskManager& manager, Attempt& attempt, bool fresh);
+    //accounts the result of the attempt to its backend, its connection is released or closed already
+    void endAttempt(TaskManager& manager, Attempt& attempt, bool ok);
+    //the other attempt is not needed any more
+    void cancel(TaskManager& manager, Attempt& attempt);
+    void hedge(TaskManager& manager);
+    //the request fails unless the other attempt is in progress, or the request can be sent to another backend
+    void onFailed(TaskManager& manager, Attempt& attempt, const std::string& error, bool retriable);
+    Attempt& other(Attempt& attempt) { return (&attempt == &m_attempts[0])? m_attempts[1] : m_attempts[0]; }
+
+    Attempt m_attempts[2];
+    std::string m_headers;
+    std::string m_cacheKey;
+    //the request can be sent twice
+    bool m_idempotent = false;
+    bool m_hedged = false;
+    bool m_failedOver = false;
+    std::chrono::steady_clock::duration m_hedgeDelay = std::chrono::steady_clock::duration::zero();
+    //seconds, upstream-request-timeout or the deadline of the request of a thread
+    double m_timeout = 0;
     BaseTaskPtr m_bt;
     Status m_status = Status::None;
     std::string m_error;
+    std::chrono::steady_clock::time_point m_started;
+    Histogram* m_latency = nullptr;
+    Counter* m_errors = nullptr;
 };
 
 class Looper final : public TaskManager
 {
 public:
     Looper(const ConfigOpts& copts);
+    //secondary looper, shares the global context and the thread pool with the primary one
+    Looper(const ConfigOpts& copts, Looper& primary);
     virtual ~Looper();
 
     void serve();
@@ -101,7 +147,7 @@ public:
 
     void addRouter(Router& r) { m_root.addRouter(r); }
     bool enableRouting() { return m_root.arm(); }
-    bool matchRoute(const std::string& target, int method, Router::JobParams& params) { return m_root.match(target, method, params); }
+    bool matchRoute(boost::string_view target, int method, Router::JobParams& params) { return m_root.match(target, method, params); }
 
     std::string dbgDumpRouters() const { return m_root.dbgDumpRouters(); }
     void dbgDumpR3Tree(int level = 0) const { return m_root.dbgDumpR3Tree(level); }
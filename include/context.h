@@ -14,12 +14,27 @@
 #include <vector>
 #include <chrono>
 
-#include "graft_utility.hpp"
+#include "concurrent_map.hpp"
+#include "context_local.h"
+#include "context_slot.h"
+#include "rcu_cell.h"
 #include "graft_constants.h"
 
 namespace graft
 {
-using GlobalContextMap = graft::TSHashtable<std::string, boost::any>;
+struct ServerState;
+
+//////////////
+/// \brief The GlobalContextMap class
+/// Values of the global context, and the snapshot of the server state available through Context::state().
+/// ServerState is defined in rta/serverstate.h.
+///
+class GlobalContextMap : public graft::ConcurrentMap<std::string, ContextSlot>
+{
+public:
+    //replaced as a whole, on start and on reload
+    RcuCell<ServerState> serverState;
+};
 
 class Context
 {
@@ -27,13 +42,13 @@ public:
     class Local
     {
     private:
-        using ContextMap = std::map<std::string, boost::any>;
+        using ContextMap = LocalContextMap;
         ContextMap m_map;
 
         class Proxy
         {
         public:
-            Proxy(ContextMap& map, const std::string& key)
+            Proxy(ContextMap& map, const LocalKey& key)
                 : m_map(map), m_key(key) { }
 
             template<typename T>
@@ -42,28 +57,21 @@ public:
                 static_assert(std::is_nothrow_move_constructible<T>::value,
                               "not move constructible");
 
-                boost::any tmp(std::forward<T>(v));
-                auto it = m_map.find(m_key);
-                if(it == m_map.end())
-                {
-                    m_map.emplace(m_key, std::move(tmp));
-                }
-                else
-                {
-                    it->second = std::move(tmp);
-                }
+                m_map.set(m_key, std::forward<T>(v));
                 return *this;
             }
 
             template<typename T>
             operator T& () const
             {
-                return boost::any_cast<T&>(m_map[m_key]);
+                T* p = m_map.get<T>(m_key);
+                if(!p) throw boost::bad_any_cast();
+                return *p;
             }
 
         private:
             ContextMap& m_map;
-            const std::string& m_key;
+            const LocalKey m_key;
         };
 
     public:
@@ -73,31 +81,33 @@ public:
         Local(Local&&) = delete;
 
         template<typename T>
-        T const& operator[](const std::string& key) const
+        T const& operator[](const LocalKey& key) const
         {
-            auto it = m_map.find(key);
-            return boost::any_cast<T&>(it->second);
+            const T* p = m_map.get<T>(key);
+            if(!p) throw boost::bad_any_cast();
+            return *p;
         }
 
         template<typename T>
-        T operator[](const std::string& key) const
+        T operator[](const LocalKey& key) const
         {
-            auto it = m_map.find(key);
-            return boost::any_cast<T>(it->second);
+            const T* p = m_map.get<T>(key);
+            if(!p) throw boost::bad_any_cast();
+            return *p;
         }
 
-        Proxy operator[](const std::string& key)
+        Proxy operator[](const LocalKey& key)
         {
             return Proxy(m_map, key);
         }
 
-        bool hasKey(const std::string& key)
+        bool hasKey(const LocalKey& key)
         {
-            return (m_map.find(key) != m_map.end());
+            return m_map.hasKey(key);
         }
-        void remove(const std::string& key)
+        void remove(const LocalKey& key)
         {
-            m_map.erase(key);
+            m_map.remove(key);
         }
         void setError(const char* str, Status status = Status::InternalError)
         {
@@ -144,16 +154,14 @@ public:
             {
                 static_assert(std::is_nothrow_move_constructible<T>::value,
                               "not move constructible");
-                boost::any tmp(std::forward<T>(v));
-                m_map.addOrUpdate(m_key, std::move(tmp));
+                m_map.addOrUpdate(m_key, ContextSlot(std::forward<T>(v)));
                 return *this;
             }
 
             template<typename T>
             operator T () const
             {
-                return boost::any_cast<T>(
-                            m_map.valueFor(m_key, boost::any()));
+                return m_map.valueFor(m_key).template get<T>();
             }
 
         private:
@@ -170,8 +178,7 @@ public:
         template<typename T>
         T operator[](const std::string& key) const
         {
-            return boost::any_cast<T>(
-                        m_map.valueFor(key, boost::any()));
+            return m_map.valueFor(key).template get<T>();
         }
 
         Proxy operator[](const std::string& key)
@@ -189,26 +196,44 @@ public:
         {
             static_assert(std::is_nothrow_move_constructible<T>::value,
                           "not move constructible");
-            boost::any tmp(std::forward<T>(val));
-            m_map.addOrUpdate(key, std::move(tmp), ttl);
+            m_map.addOrUpdate(key, ContextSlot(std::forward<T>(val)), ttl);
+        }
+
+        //stores the value shared with the caller, it must not be changed after that
+        template<typename T>
+        void setShared(const std::string& key, std::shared_ptr<const T> val, std::chrono::seconds ttl = std::chrono::seconds(0))
+        {
+            m_map.addOrUpdate(key, ContextSlot::fromShared(std::move(val)), ttl);
         }
 
         template<typename T>
         T get(const std::string& key, T defval)
         {
-            return boost::any_cast<T>(
-                m_map.valueFor(
-                    key, boost::any(std::forward<T>(defval))
-                )
-            );
+            T res(std::move(defval));
+            m_map.visit(key, [&res](const ContextSlot& slot) { res = slot.get<T>(); });
+            return res;
         }
 
+        //shares the value without a copy, nullptr if there is no key
+        template<typename T>
+        std::shared_ptr<const T> getShared(const std::string& key) const
+        {
+            const ContextSlot slot = m_map.valueFor(key);
+            return slot.empty()? nullptr : slot.share<T>();
+        }
+
+        //copy-on-write update: f changes a copy of the value, the copy replaces the value under the lock of the key
+        //if f returns true; the holders of the shared value keep the old one
         template<typename T>
         bool apply(const std::string& key, std::function<bool(T&)> f)
         {
-            return m_map.apply(key, [f](boost::any& a)
-            { return f(boost::any_cast<T&>(a)); }
-            );
+            return m_map.apply(key, [f](ContextSlot& slot)
+            {
+                T value = slot.get<T>();
+                bool res = f(value);
+                slot = ContextSlot(std::move(value));
+                return res;
+            });
         }
 
         void remove(const std::string& key)
@@ -231,6 +256,7 @@ public:
     using uuid_t = boost::uuids::uuid;
     Context(GlobalContextMap& map)
         : global(map)
+        , m_serverState(map.serverState)
         , m_uuid(boost::uuids::nil_generator()())
         , m_nextUuid(boost::uuids::nil_generator()())
     {
@@ -243,7 +269,40 @@ public:
     void setNextTaskId(uuid_t uuid) { m_nextUuid = uuid; }
     uuid_t getNextTaskId() const { return m_nextUuid; }
 
+    //////////////
+    /// \brief The State class
+    /// The current snapshot of the server state, pinned with EpochManager::Guard while the view lives.
+    /// It is taken on the stack of the thread that uses it and is not stored or passed to another thread;
+    /// the snapshot does not change under the view. A handler that blocks keeps what it needs from the
+    /// snapshot or takes Context::stateSnapshot() instead, a pinned reader holds back the reclamation.
+    ///
+    class State
+    {
+    public:
+        State(const State& other) : m_state(other.m_state) { }
+        State& operator = (const State&) = delete;
+
+        const ServerState* operator -> () const { return m_state; }
+        const ServerState& operator * () const { return *m_state; }
+        const ServerState* get() const { return m_state; }
+        //false if the state is not published
+        explicit operator bool () const { return m_state != nullptr; }
+    private:
+        friend class Context;
+        explicit State(const RcuCell<ServerState>& cell) : m_state(cell.get()) { }
+
+        EpochManager::Guard m_guard; //initialized before m_state
+        const ServerState* m_state;
+    };
+
+    //the current snapshot of the server state without locks and reference counting;
+    //a handler takes it once and uses it for the whole call
+    State state() const { return State(m_serverState); }
+    //a holder of the current snapshot, nullptr if it is not published
+    std::shared_ptr<const ServerState> stateSnapshot() const { return m_serverState.load(); }
+
 private:
+    const RcuCell<ServerState>& m_serverState;
     mutable uuid_t m_uuid;
     uuid_t m_nextUuid;
 };
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <boost/any.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace graft
+{
+
+//////////////
+/// \brief The LocalKey class
+/// Key of the local context. A key is copied when a value is stored under it, unless it is tagged with
+/// LocalKey::literal; a tagged key is a string literal or __FUNCTION__ of static storage, it is referenced
+/// and never copied, GRAFT_FUNCTION_KEY is the tagged __FUNCTION__. A character buffer of another storage is
+/// never tagged. Keys compare by the address first, so the same tagged key matches without comparing characters.
+///
+class LocalKey
+{
+public:
+    enum Literal { literal };
+
+    template<size_t N>
+    LocalKey(Literal, const char (&str)[N]) : m_data(str), m_size(N - 1), m_static(true) { }
+    LocalKey(const char* str) : m_data(str), m_size(std::strlen(str)), m_static(false) { }
+    LocalKey(const std::string& str) : m_data(str.data()), m_size(str.size()), m_static(false) { }
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool isStatic() const { return m_static; }
+
+    bool equals(const char* data, size_t size) const
+    {
+        return m_data == data || (m_size == size && std::memcmp(m_data, data, size) == 0);
+    }
+private:
+    const char* m_data;
+    size_t m_size;
+    bool m_static;
+};
+
+//////////////
+/// \brief The LocalContextMap class
+/// Flat map of the local context, it replaces std::map<std::string, boost::any> there.
+/// The first INLINE_ENTRIES entries are kept in place, the others are allocated; entries never move, so the
+/// references to the values stay valid until the key is removed or overwritten. The lookup is a linear scan.
+/// A value up to INLINE_SIZE bytes is constructed in its entry (handler states, ids, sale data), a larger one
+/// is allocated. A cast to another type throws boost::bad_any_cast as before.
+///
+class LocalContextMap
+{
+public:
+    static constexpr size_t INLINE_ENTRIES = 8;
+    static constexpr size_t INLINE_SIZE = 48;
+
+    LocalContextMap() = default;
+    ~LocalContextMap() = default;
+    LocalContextMap(const LocalContextMap&) = delete;
+    LocalContextMap& operator = (const LocalContextMap&) = delete;
+
+    template<typename T>
+    void set(const LocalKey& key, T&& value)
+    {
+        using D = typename std::decay<T>::type;
+        Entry* e = find(key);
+        if(!e) e = insert(key);
+        e->reset();
+        e->template emplace<D>(std::forward<T>(value), is_inline<D>());
+    }
+
+    //nullptr if there is no key
+    template<typename T>
+    T* get(const LocalKey& key)
+    {
+        Entry* e = find(key);
+        if(!e) return nullptr;
+        if(e->type != tag<T>()) throw boost::bad_any_cast();
+        return static_cast<T*>(e->ptr);
+    }
+
+    template<typename T>
+    const T* get(const LocalKey& key) const
+    {
+        return const_cast<LocalContextMap*>(this)->get<T>(key);
+    }
+
+    bool hasKey(const LocalKey& key) const
+    {
+        return const_cast<LocalContextMap*>(this)->find(key) != nullptr;
+    }
+
+    void remove(const LocalKey& key)
+    {
+        Entry* e = find(key);
+        if(!e) return;
+        e->reset();
+        e->keyData = nullptr;
+        e->keySize = 0;
+        e->ownedKey.clear();
+        --m_size;
+    }
+
+    size_t size() const { return m_size; }
+private:
+    template<typename T>
+    using is_inline = std::integral_constant<bool,
+        sizeof(T) <= INLINE_SIZE && alignof(T) <= alignof(std::max_align_t)>;
+
+    //const T and T have the same tag, so that a value is read through a const reference
+    template<typename T>
+    static const void* tag()
+    {
+        return typeId<std::remove_cv_t<T>>();
+    }
+
+    template<typename T>
+    static const void* typeId()
+    {
+        static const char id = 0;
+        return &id;
+    }
+
+    struct Entry
+    {
+        Entry() = default;
+        Entry(const Entry&) = delete;
+        Entry& operator = (const Entry&) = delete;
+        ~Entry() { reset(); }
+
+        bool used() const { return keyData != nullptr; }
+
+        void reset()
+        {
+            if(destroy) destroy(ptr);
+            destroy = nullptr;
+            ptr = nullptr;
+            type = nullptr;
+        }
+
+        template<typename D, typename T>
+        void emplace(T&& value, std::true_type)
+        {
+            ptr = new(&storage) D(std::forward<T>(value));
+            destroy = [](void* p) { static_cast<D*>(p)->~D(); };
+            type = tag<D>();
+        }
+
+        template<typename D, typename T>
+        void emplace(T&& value, std::false_type)
+        {
+            ptr = new D(std::forward<T>(value));
+            destroy = [](void* p) { delete static_cast<D*>(p); };
+            type = tag<D>();
+        }
+
+        const char* keyData = nullptr;
+        size_t keySize = 0;
+        std::string ownedKey;
+        const void* type = nullptr;
+        void* ptr = nullptr;
+        void (*destroy)(void*) = nullptr;
+        typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type storage;
+    };
+
+    Entry* find(const LocalKey& key)
+    {
+        size_t left = m_size;
+        for(size_t i = 0; left && i < INLINE_ENTRIES; ++i)
+        {
+            Entry& e = m_inline[i];
+            if(!e.used()) continue;
+            if(key.equals(e.keyData, e.keySize)) return &e;
+            --left;
+        }
+        for(auto it = m_overflow.begin(); left && it != m_overflow.end(); ++it)
+        {
+            Entry& e = **it;
+            if(!e.used()) continue;
+            if(key.equals(e.keyData, e.keySize)) return &e;
+            --left;
+        }
+        return nullptr;
+    }
+
+    Entry* insert(const LocalKey& key)
+    {
+        Entry* e = nullptr;
+        for(size_t i = 0; !e && i < INLINE_ENTRIES; ++i)
+        {
+            if(!m_inline[i].used()) e = &m_inline[i];
+        }
+        for(auto it = m_overflow.begin(); !e && it != m_overflow.end(); ++it)
+        {
+            if(!(*it)->used()) e = it->get();
+        }
+        if(!e)
+        {
+            m_overflow.emplace_back(new Entry());
+            e = m_overflow.back().get();
+        }
+        if(key.isStatic())
+        {
+            e->keyData = key.data();
+        }
+        else
+        {
+            e->ownedKey.assign(key.data(), key.size());
+            e->keyData = e->ownedKey.data();
+        }
+        e->keySize = key.size();
+        ++m_size;
+        return e;
+    }
+
+    Entry m_inline[INLINE_ENTRIES];
+    std::vector<std::unique_ptr<Entry>> m_overflow;
+    size_t m_size = 0;
+};
+
+}//namespace graft
+
+//the key of the local context that is the name of the current function, it is not copied
+#define GRAFT_FUNCTION_KEY graft::LocalKey(graft::LocalKey::literal, __FUNCTION__)
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+namespace graft
+{
+
+//////////////
+/// \brief The ContextSlot class
+/// Type-erased immutable value of the global context, it replaces boost::any there.
+/// Small trivially copyable values (numbers, enums, flags) are kept in place, other values are
+/// held by std::shared_ptr<const T>, so a copy of a slot never copies the value and never allocates.
+/// The type is identified by the address of a per-type tag; a cast to another type throws std::bad_cast.
+///
+class ContextSlot
+{
+public:
+    static constexpr size_t INLINE_SIZE = 16;
+
+    template<typename T>
+    using is_inline = std::integral_constant<bool,
+        std::is_trivially_copyable<T>::value && sizeof(T) <= INLINE_SIZE && alignof(T) <= alignof(uint64_t)>;
+
+    ContextSlot() = default;
+
+    template<typename T, typename D = typename std::decay<T>::type,
+             typename = typename std::enable_if<!std::is_same<D, ContextSlot>::value>::type>
+    explicit ContextSlot(T&& value)
+    {
+        emplace<D>(std::forward<T>(value), is_inline<D>());
+    }
+
+    template<typename T>
+    static ContextSlot fromShared(std::shared_ptr<const T> value)
+    {
+        ContextSlot res;
+        if(value)
+        {
+            res.m_type = tag<T>();
+            res.m_shared = std::move(value);
+        }
+        return res;
+    }
+
+    bool empty() const { return m_type == nullptr; }
+
+    template<typename T>
+    bool is() const { return m_type == tag<typename std::decay<T>::type>(); }
+
+    //the reference is valid while the slot (or a copy of it) is alive
+    template<typename T>
+    const T& get() const
+    {
+        if(!is<T>()) throw std::bad_cast();
+        return ref<T>(is_inline<T>());
+    }
+
+    //shares the value without a copy; an inline value is copied to a new object
+    template<typename T>
+    std::shared_ptr<const T> share() const
+    {
+        if(!is<T>()) throw std::bad_cast();
+        return makeShared<T>(is_inline<T>());
+    }
+private:
+    template<typename T>
+    static const void* tag()
+    {
+        static const char id = 0;
+        return &id;
+    }
+
+    template<typename D, typename T>
+    void emplace(T&& value, std::true_type)
+    {
+        D tmp(std::forward<T>(value));
+        std::memcpy(&m_inline, &tmp, sizeof(D));
+        m_type = tag<D>();
+    }
+
+    template<typename D, typename T>
+    void emplace(T&& value, std::false_type)
+    {
+        m_shared = std::make_shared<const D>(std::forward<T>(value));
+        m_type = tag<D>();
+    }
+
+    template<typename T>
+    const T& ref(std::true_type) const { return *reinterpret_cast<const T*>(&m_inline); }
+
+    template<typename T>
+    const T& ref(std::false_type) const { return *static_cast<const T*>(m_shared.get()); }
+
+    template<typename T>
+    std::shared_ptr<const T> makeShared(std::true_type) const { return std::make_shared<const T>(ref<T>(std::true_type())); }
+
+    template<typename T>
+    std::shared_ptr<const T> makeShared(std::false_type) const { return std::static_pointer_cast<const T>(m_shared); }
+
+    const void* m_type = nullptr;
+    std::shared_ptr<const void> m_shared;
+    typename std::aligned_storage<INLINE_SIZE, alignof(uint64_t)>::type m_inline{};
+};
+
+}//namespace graft
@@ -19,4 +19,9 @@ namespace graft
 
 enum class Status : int { GRAFT_STATUS_LIST(EXP_TO_ENUM) };
 
+//Priority class of a route. When the thread pool is full, requests wait in the admission queue
+//and higher classes are served (and kept) first.
+enum class Priority : int { High, Normal, Low };
+constexpr int PRIORITY_COUNT = 3;
+
 }//namespace graft
@@ -136,8 +136,9 @@ namespace graft
             return false;
         }
 
-        void removeIf(func p)
+        size_t removeIf(func p)
         {
+            size_t removed = 0;
             node *current = &head;
             std::unique_lock<std::mutex> lk(head.m);
             while (node* const next = current->next.get())
@@ -148,6 +149,7 @@ namespace graft
                     std::unique_ptr<node> old_next = std::move(current->next);
                     current->next = std::move(next->next);
                     next_lk.unlock();
+                    ++removed;
                 }
                 else
                 {
@@ -156,10 +158,12 @@ namespace graft
                     lk = std::move(next_lk);
                 }
             }
+            return removed;
         }
 
-        void unsafe_cleanup()
+        size_t unsafe_cleanup()
         {
+            size_t removed = 0;
             ch::seconds now_sec = ch::time_point_cast<ch::seconds>(
                             ch::steady_clock::now()
                         ).time_since_epoch();
@@ -170,12 +174,14 @@ namespace graft
                 {
                     std::unique_ptr<node> old_next = std::move(current->next);
                     current->next = std::move(next->next);
+                    ++removed;
                 }
                 else
                 {
                     current = next;
                 }
             }
+            return removed;
         }
     };
 
@@ -210,18 +216,22 @@ namespace graft
                     default_value : found_entry->second;
             }
 
-            void addOrUpdate(Key const& key, Value const& value, ch::seconds ttl = ch::seconds(0))
+            //returns true if new entry is added
+            bool addOrUpdate(Key const& key, Value const& value, ch::seconds ttl = ch::seconds(0))
             {
                 BucketPtr const found_entry = findEntryFor(key);
                 if (found_entry == nullptr)
+                {
                     m_data.pushFront(BucketValue(key,value), ttl);
-                else
-                    found_entry->second = value;
+                    return true;
+                }
+                found_entry->second = value;
+                return false;
             }
 
-            void remove(Key const& key)
+            size_t remove(Key const& key)
             {
-                m_data.removeIf(
+                return m_data.removeIf(
                     [&](BucketValue const& item)
                     {return item.first == key;}
                 );
@@ -243,13 +253,14 @@ namespace graft
                 );
             }
 
-            void cleanup()
+            size_t cleanup()
             {
-                m_data.unsafe_cleanup();
+                return m_data.unsafe_cleanup();
             }
         };
 
         std::vector<std::unique_ptr<BucketType>> m_buckets;
+        std::atomic<size_t> m_size{0};
         Hash m_hasher;
         typename std::vector<std::unique_ptr<BucketType>>::iterator m_bit;
 
@@ -288,16 +299,19 @@ namespace graft
 
         void addOrUpdate(const Key& key, const Value& value, ch::seconds ttl = ch::seconds(0))
         {
-            getBucket(key).addOrUpdate(key, value, ttl);
+            if(getBucket(key).addOrUpdate(key, value, ttl)) ++m_size;
         }
 
         void remove(const Key& key)
         {
             BucketType& b = getBucket(key);
             boost::shared_lock<boost::shared_mutex> lock(b.blk);
-            b.remove(key);
+            m_size -= b.remove(key);
         }
 
+        //approximate number of entries
+        size_t size() const { return m_size.load(std::memory_order_relaxed); }
+
         bool hasKey(Key const& key) const
         {
             BucketType& b = getBucket(key);
@@ -316,7 +330,7 @@ namespace graft
         {
             BucketType& b = getNextBucket();
             boost::unique_lock<boost::shared_mutex> lock(b.blk);
-            b.cleanup();
+            m_size -= b.cleanup();
         }
     };
 }
@@ -6,12 +6,18 @@
 #include <string>
 #include <vector>
 #include <tuple>
+#include <memory>
+#include <cstdint>
+#include <ostream>
 #include <unordered_map>
 #include <boost/hana.hpp>
+#include <boost/utility/string_view.hpp>
 
 #include "reflective-rapidjson/reflector-boosthana.h"
 #include "reflective-rapidjson/serializable.h"
 #include "reflective-rapidjson/types.h"
+#include "json_sax.h"
+#include "binary_serializer.h"
 
 #include "graft_macros.h"
 
@@ -95,11 +101,11 @@ namespace graft
         {
             static std::string serialize(const T& t)
             {
-                return t.toJson().GetString();
+                return sax::toJson(t);
             }
             static void deserialize(const std::string& s, T& t)
             {
-                t = T::fromJson(s);
+                sax::fromJson(s, t);
             }
         };
 
@@ -108,11 +114,53 @@ namespace graft
         {
             static std::string serialize(const T& t)
             {
-                return utils::base64_encode(t.toJson().GetString());
+                return utils::base64_encode(sax::toJson(t));
             }
             static void deserialize(const std::string& s, T& t)
             {
-                t = T::fromJson(utils::base64_decode(s));
+                bin::fromAny(utils::base64_decode(s), t);
+            }
+        };
+
+        //the binary encoding, see binary_serializer.h; JSON is also accepted
+        template<typename T>
+        struct BIN
+        {
+            static std::string serialize(const T& t)
+            {
+                return bin::toBinary(t);
+            }
+            static void deserialize(const std::string& s, T& t)
+            {
+                bin::fromAny(s, t);
+            }
+        };
+
+        template<typename T>
+        struct BIN_B64
+        {
+            static std::string serialize(const T& t)
+            {
+                return utils::base64_encode(bin::toBinary(t));
+            }
+            static void deserialize(const std::string& s, T& t)
+            {
+                bin::fromAny(utils::base64_decode(s), t);
+            }
+        };
+
+        //the payloads of the supernodes, base64 encoded; they are read in both encodings and sent in JSON,
+        //a supernode does not know which encodings its peers read until the capability is negotiated
+        template<typename T>
+        struct RTA_B64
+        {
+            static std::string serialize(const T& t)
+            {
+                return JSON_B64<T>::serialize(t);
+            }
+            static void deserialize(const std::string& s, T& t)
+            {
+                bin::fromAny(utils::base64_decode(s), t);
             }
         };
 
@@ -120,6 +168,72 @@ namespace graft
 
     } //namespace serializer
 
+    //////////////
+    /// \brief The HttpBody class
+    /// Body of Input and Output. It is either owned, or shared with the other bodies, so the copies of a received
+    /// body (output.body = input.body, forwarding, retries) do not copy the bytes. It converts to const std::string&
+    /// in both cases, so it can be used wherever the body was std::string. A modification of a shared body
+    /// makes it owned, the other holders are not affected.
+    ///
+    class HttpBody
+    {
+    public:
+        HttpBody() = default;
+        HttpBody(const HttpBody& ) = default;
+        HttpBody(HttpBody&& ) = default;
+        HttpBody& operator = (const HttpBody& ) = default;
+        HttpBody& operator = (HttpBody&& ) = default;
+        ~HttpBody() = default;
+
+        HttpBody(std::string s) : m_own(std::move(s)) { }
+        HttpBody(const char* s) : m_own(s) { }
+        explicit HttpBody(std::shared_ptr<const std::string> shared) : m_shared(std::move(shared)) { }
+
+        HttpBody& operator = (std::string s) { m_shared.reset(); m_own = std::move(s); return *this; }
+        HttpBody& operator = (const char* s) { m_shared.reset(); m_own = s; return *this; }
+
+        template<typename It>
+        void assign(It first, It last) { m_shared.reset(); m_own.assign(first, last); }
+        void clear() { m_shared.reset(); m_own.clear(); }
+
+        const std::string& str() const { return m_shared? *m_shared : m_own; }
+        operator const std::string& () const { return str(); }
+        boost::string_view view() const { return boost::string_view(str()); }
+
+        const char* data() const { return str().data(); }
+        const char* c_str() const { return str().c_str(); }
+        size_t size() const { return str().size(); }
+        size_t length() const { return str().size(); }
+        bool empty() const { return str().empty(); }
+
+        bool isShared() const { return m_shared != nullptr; }
+        //makes the body shared, moving an owned value; the following copies do not copy the bytes
+        std::shared_ptr<const std::string> share()
+        {
+            if(!m_shared)
+            {
+                m_shared = std::make_shared<const std::string>(std::move(m_own));
+                m_own.clear();
+            }
+            return m_shared;
+        }
+    private:
+        std::string m_own;
+        std::shared_ptr<const std::string> m_shared;
+    };
+
+    inline bool operator == (const HttpBody& l, const HttpBody& r) { return l.str() == r.str(); }
+    inline bool operator == (const HttpBody& l, const std::string& r) { return l.str() == r; }
+    inline bool operator == (const std::string& l, const HttpBody& r) { return l == r.str(); }
+    inline bool operator == (const HttpBody& l, const char* r) { return l.str() == r; }
+    inline bool operator == (const char* l, const HttpBody& r) { return l == r.str(); }
+    inline bool operator != (const HttpBody& l, const HttpBody& r) { return !(l == r); }
+    inline bool operator != (const HttpBody& l, const std::string& r) { return !(l == r); }
+    inline bool operator != (const std::string& l, const HttpBody& r) { return !(l == r); }
+    inline bool operator != (const HttpBody& l, const char* r) { return !(l == r); }
+    inline bool operator != (const char* l, const HttpBody& r) { return !(l == r); }
+    inline std::ostream& operator << (std::ostream& os, const HttpBody& b) { return os << b.str(); }
+
     class InOutHttpBase
     {
     protected:
@@ -128,9 +242,6 @@ namespace graft
         InOutHttpBase(InOutHttpBase&& ) = default;
         InOutHttpBase& operator = (InOutHttpBase&& ) = default;
         ~InOutHttpBase() = default;
-
-        InOutHttpBase(const http_message& hm) { operator =(hm); }
-        InOutHttpBase& operator = (const http_message& hm);
     public:
         InOutHttpBase& operator = (const InOutHttpBase& ) = default;
     public:
@@ -138,7 +249,9 @@ namespace graft
         std::string combine_headers();
     public:
         //These fields are from mongoose http_message
-        std::string body;
+        //When Input is the result of a client request or upstream response, only body and resp_code are filled,
+        //the other fields are read with the views of InHttp (method_view(), uri_view(), header(), ...).
+        HttpBody body;
         std::string method;
         std::string uri;
         std::string proto;
@@ -149,7 +262,7 @@ namespace graft
         //headers is name-value pairs.
         //extra_headers looks like "Content-Type: text/plane\r\nHeaderName: HeaderValue\r\n..."
         //When they are part of Input, and the Input is the result of a client request or
-        //upstream response, extra_headers is empty and headers is filled accordingly.
+        //upstream response, both are empty; the received headers are read with InHttp::header() and header_views().
         //When they are part of Output, and it is requested to do upstream forward,
         //the framework will combine resulting headers as
         //extra_headers + "name0: value0\r\n" + "name1: value1\r\n" ...;
@@ -159,10 +272,10 @@ namespace graft
         //You can use combine_headers() to do this, like following
         //  output.extra_headers = output.combine_headers();
         //  output.headers.clear();
+        //When Output is the response to a client, non-empty extra_headers replaces the default
+        //"Content-Type: application/json\r\n".
         std::vector<std::pair<std::string, std::string>> headers;
         std::string extra_headers;
-    private:
-        void set_str_field(const http_message& hm, const mg_str& str_fld, std::string& fld);
     };
 
     class OutHttp final : public InOutHttpBase
@@ -192,7 +305,7 @@ namespace graft
             return std::make_pair(body.c_str(), body.length());
         }
 
-        std::string data() const
+        const std::string& data() const
         {
             return body;
         }
@@ -222,8 +335,32 @@ namespace graft
         InHttp& operator = (const InHttp&) = default;
         InHttp& operator = (InHttp&&) = default;
         ~InHttp() = default;
-        InHttp(const http_message& hm) : InOutHttpBase(hm)
-        { }
+        InHttp(const http_message& hm) { operator =(hm); }
+
+        /*!
+         * \brief operator = - takes the received message from mongoose. The receive buffer of mongoose is reused
+         * after the event, so the message is copied once: the head into a buffer the views point to and the body
+         * into a shared HttpBody. No string is made for the fields and the headers.
+         */
+        InHttp& operator = (const http_message& hm);
+
+        /*!
+         * \brief views of the received message; valid while the Input (or a copy of it) is alive.
+         * When the Input is not received, they refer to the corresponding string fields.
+         */
+        boost::string_view method_view() const { return view(m_method, method); }
+        boost::string_view uri_view() const { return view(m_uri, uri); }
+        boost::string_view proto_view() const { return view(m_proto, proto); }
+        boost::string_view query_string_view() const { return view(m_query_string, query_string); }
+        boost::string_view resp_status_msg_view() const { return view(m_resp_status_msg, resp_status_msg); }
+
+        using HeaderView = std::pair<boost::string_view, boost::string_view>;
+        std::vector<HeaderView> header_views() const;
+        /*!
+         * \brief header - value of the header, the name is case insensitive
+         * \return empty view if there is no such header
+         */
+        boost::string_view header(boost::string_view name) const;
 
         /*!
          * \brief get - parses object from JSON. Throws ParseError exception in case parse error
@@ -289,7 +426,7 @@ namespace graft
 
         void load(const char *buf, size_t size)
         {
-            InOutHttpBase::reset();
+            reset();
             body.assign(buf, buf + size);
         }
 
@@ -301,17 +438,43 @@ namespace graft
         void assign(const OutHttp& out)
         {
             static_cast<InOutHttpBase&>(*this) = static_cast<const InOutHttpBase&>(out);
+            clearHead();
         }
 
         void reset()
         {
             InOutHttpBase::reset();
+            clearHead();
         }
 
-        std::string data() const
+        const std::string& data() const
         {
             return body;
         }
+    private:
+        //offsets into m_head
+        struct Span
+        {
+            uint32_t off = 0;
+            uint32_t len = 0;
+        };
+
+        boost::string_view view(const Span& span, const std::string& fld) const
+        {
+            if(!m_head) return boost::string_view(fld);
+            return boost::string_view(m_head->data() + span.off, span.len);
+        }
+
+        void clearHead()
+        {
+            m_head.reset();
+            m_method = m_uri = m_proto = m_query_string = m_resp_status_msg = Span();
+            m_headers.clear();
+        }
+
+        std::shared_ptr<const std::string> m_head;
+        Span m_method, m_uri, m_proto, m_query_string, m_resp_status_msg;
+        std::vector<std::pair<Span, Span>> m_headers;
     };
 
     using Input = InHttp;
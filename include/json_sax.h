@@ -0,0 +1,387 @@
+#pragma once
+
+#include <boost/hana/at_key.hpp>
+#include <boost/hana/for_each.hpp>
+#include <boost/hana/keys.hpp>
+#include <boost/hana/length.hpp>
+#include <boost/hana/string.hpp>
+#include <boost/hana/concept/struct.hpp>
+
+#include <rapidjson/writer.h>
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+namespace graft { namespace serializer { namespace sax {
+
+struct Ops;
+
+//////////////
+/// \brief The Target struct
+/// The value the next JSON value is read into, and the operations on it.
+///
+struct Target
+{
+    void* ptr;
+    const Ops* ops;
+};
+
+//////////////
+/// \brief The Ops struct
+/// Type-erased operations of a target type, one static table per type.
+/// startObject and startArray return false if the target is not an object or an array, then the value is skipped;
+/// key returns the target of the member value, element appends an element and returns its target.
+///
+struct Ops
+{
+    void (*null)(void*);
+    void (*boolean)(void*, bool);
+    void (*int64)(void*, int64_t);
+    void (*uint64)(void*, uint64_t);
+    void (*number)(void*, double);
+    void (*string)(void*, const char*, size_t);
+    bool (*startObject)(void*);
+    Target (*key)(void*, const char*, size_t);
+    bool (*startArray)(void*);
+    Target (*element)(void*);
+};
+
+template<typename S>
+const Ops* opsOf()
+{
+    static const Ops ops{ &S::null, &S::boolean, &S::int64, &S::uint64, &S::number, &S::string,
+                          &S::startObject, &S::key, &S::startArray, &S::element };
+    return &ops;
+}
+
+inline Target skipTarget();
+
+//A value of another type is ignored, as JsonReflector::pull does.
+struct Ignore
+{
+    static void null(void*) { }
+    static void boolean(void*, bool) { }
+    static void int64(void*, int64_t) { }
+    static void uint64(void*, uint64_t) { }
+    static void number(void*, double) { }
+    static void string(void*, const char*, size_t) { }
+    static bool startObject(void*) { return false; }
+    static Target key(void*, const char*, size_t) { return skipTarget(); }
+    static bool startArray(void*) { return false; }
+    static Target element(void*) { return skipTarget(); }
+};
+
+//Unknown members and mismatched objects and arrays, with everything inside.
+struct Skip : Ignore
+{
+    static bool startObject(void*) { return true; }
+    static bool startArray(void*) { return true; }
+};
+
+inline Target skipTarget() { return Target{nullptr, opsOf<Skip>()}; }
+
+template<typename T, typename = void>
+struct Sink;
+
+template<typename T>
+Target target(T& t) { return Target{&t, opsOf<Sink<T>>()}; }
+
+template<typename T>
+struct Sink<T, typename std::enable_if<std::is_same<T, bool>::value>::type> : Ignore
+{
+    static void boolean(void* p, bool v) { *static_cast<T*>(p) = v; }
+};
+
+template<typename T>
+struct Sink<T, typename std::enable_if<!std::is_same<T, bool>::value && std::is_arithmetic<T>::value>::type> : Ignore
+{
+    static void int64(void* p, int64_t v) { *static_cast<T*>(p) = static_cast<T>(v); }
+    static void uint64(void* p, uint64_t v) { *static_cast<T*>(p) = static_cast<T>(v); }
+    static void number(void* p, double v) { *static_cast<T*>(p) = static_cast<T>(v); }
+};
+
+template<typename T>
+struct Sink<T, typename std::enable_if<std::is_enum<T>::value>::type> : Ignore
+{
+    static void int64(void* p, int64_t v) { *static_cast<T*>(p) = static_cast<T>(v); }
+    static void uint64(void* p, uint64_t v) { *static_cast<T*>(p) = static_cast<T>(v); }
+};
+
+template<>
+struct Sink<std::string> : Ignore
+{
+    static void string(void* p, const char* s, size_t len) { static_cast<std::string*>(p)->assign(s, len); }
+};
+
+//std::vector, std::list, std::deque
+template<typename T>
+struct Sink<T, decltype(void(std::declval<T&>().emplace_back()))> : Ignore
+{
+    static bool startArray(void* p)
+    {
+        static_cast<T*>(p)->clear();
+        return true;
+    }
+
+    static Target element(void* p)
+    {
+        T& t = *static_cast<T*>(p);
+        t.emplace_back();
+        return target(t.back());
+    }
+};
+
+template<typename T>
+struct Sink<std::map<std::string, T>> : Ignore
+{
+    static bool startObject(void*) { return true; }
+    static Target key(void* p, const char* name, size_t len)
+    {
+        return target((*static_cast<std::map<std::string, T>*>(p))[std::string(name, len)]);
+    }
+};
+
+template<typename T>
+struct Sink<std::unordered_map<std::string, T>> : Ignore
+{
+    static bool startObject(void*) { return true; }
+    static Target key(void* p, const char* name, size_t len)
+    {
+        return target((*static_cast<std::unordered_map<std::string, T>*>(p))[std::string(name, len)]);
+    }
+};
+
+//structures defined with GRAFT_DEFINE_IO_STRUCT
+template<typename T>
+struct Sink<T, typename std::enable_if<boost::hana::Struct<T>::value>::type> : Ignore
+{
+    static bool startObject(void*) { return true; }
+    static Target key(void* p, const char* name, size_t len)
+    {
+        T& t = *static_cast<T*>(p);
+        Target res = skipTarget();
+        bool found = false;
+        boost::hana::for_each(boost::hana::keys(t), [&](auto k)
+        {
+            if(found || decltype(boost::hana::length(k))::value != len) return;
+            if(std::memcmp(boost::hana::to<char const*>(k), name, len) != 0) return;
+            res = target(boost::hana::at_key(t, k));
+            found = true;
+        });
+        return res;
+    }
+};
+
+/*!
+ * \brief parse - reads JSON into the root target with the SAX reader of rapidjson, no DOM is built.
+ * The reader and its buffers are thread local and reused.
+ * Throws rapidjson::ParseResult on a parse error, as JsonReflector::fromJson does.
+ */
+void parse(const char* json, size_t size, Target root);
+
+/*!
+ * \brief fromJson - reads JSON into t, it is the replacement of JsonReflector::fromJson for the structures.
+ * Members missing in JSON keep the defaults, unknown members and values of another type are ignored.
+ */
+template<typename T>
+void fromJson(const char* json, size_t size, T& t)
+{
+    t = T();
+    parse(json, size, target(t));
+}
+
+template<typename T>
+void fromJson(const std::string& json, T& t)
+{
+    fromJson(json.data(), json.size(), t);
+}
+
+//////////////
+/// \brief The StringOutput struct
+/// Output stream of rapidjson::Writer that appends to std::string, so JSON is written to the body in place.
+///
+struct StringOutput
+{
+    typedef char Ch;
+    std::string* str = nullptr;
+
+    void Put(char c) { str->push_back(c); }
+    void Flush() { }
+};
+
+using Writer = rapidjson::Writer<StringOutput>;
+
+template<typename T, typename = void>
+struct Emit;
+
+template<typename W, typename T>
+void emit(W& w, const T& t) { Emit<T>::write(w, t); }
+
+//the binary writer needs the number of the members and the elements in advance, JSON does not
+inline void startObject(Writer& w, size_t) { w.StartObject(); }
+inline void endObject(Writer& w) { w.EndObject(); }
+inline void startArray(Writer& w, size_t) { w.StartArray(); }
+inline void endArray(Writer& w) { w.EndArray(); }
+
+template<typename T>
+struct Emit<T, typename std::enable_if<std::is_same<T, bool>::value>::type>
+{
+    template<typename W>
+    static void write(W& w, bool v) { w.Bool(v); }
+};
+
+template<typename T>
+struct Emit<T, typename std::enable_if<!std::is_same<T, bool>::value && std::is_integral<T>::value
+                                       && std::is_signed<T>::value>::type>
+{
+    template<typename W>
+    static void write(W& w, T v) { w.Int64(v); }
+};
+
+template<typename T>
+struct Emit<T, typename std::enable_if<!std::is_same<T, bool>::value && std::is_integral<T>::value
+                                       && std::is_unsigned<T>::value>::type>
+{
+    template<typename W>
+    static void write(W& w, T v) { w.Uint64(v); }
+};
+
+template<typename T>
+struct Emit<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    template<typename W>
+    static void write(W& w, T v) { w.Double(v); }
+};
+
+template<typename T>
+struct Emit<T, typename std::enable_if<std::is_enum<T>::value>::type>
+{
+    template<typename W>
+    static void write(W& w, T v) { emit(w, static_cast<typename std::underlying_type<T>::type>(v)); }
+};
+
+template<>
+struct Emit<std::string>
+{
+    template<typename W>
+    static void write(W& w, const std::string& v) { w.String(v.data(), static_cast<rapidjson::SizeType>(v.size())); }
+};
+
+template<>
+struct Emit<const char*>
+{
+    template<typename W>
+    static void write(W& w, const char* v) { w.String(v); }
+};
+
+//std::vector, std::list, std::deque
+template<typename T>
+struct Emit<T, decltype(void(std::declval<T&>().emplace_back()))>
+{
+    template<typename W>
+    static void write(W& w, const T& v)
+    {
+        startArray(w, v.size());
+        for(auto& item : v) emit(w, item);
+        endArray(w);
+    }
+};
+
+template<typename T>
+struct Emit<std::map<std::string, T>>
+{
+    template<typename W>
+    static void write(W& w, const std::map<std::string, T>& v)
+    {
+        startObject(w, v.size());
+        for(auto& item : v)
+        {
+            w.Key(item.first.data(), static_cast<rapidjson::SizeType>(item.first.size()));
+            emit(w, item.second);
+        }
+        endObject(w);
+    }
+};
+
+template<typename T>
+struct Emit<std::unordered_map<std::string, T>>
+{
+    template<typename W>
+    static void write(W& w, const std::unordered_map<std::string, T>& v)
+    {
+        startObject(w, v.size());
+        for(auto& item : v)
+        {
+            w.Key(item.first.data(), static_cast<rapidjson::SizeType>(item.first.size()));
+            emit(w, item.second);
+        }
+        endObject(w);
+    }
+};
+
+template<typename T>
+struct Emit<std::shared_ptr<T>>
+{
+    template<typename W>
+    static void write(W& w, const std::shared_ptr<T>& v) { if(v) emit(w, *v); else w.Null(); }
+};
+
+template<typename T>
+struct Emit<std::unique_ptr<T>>
+{
+    template<typename W>
+    static void write(W& w, const std::unique_ptr<T>& v) { if(v) emit(w, *v); else w.Null(); }
+};
+
+//structures defined with GRAFT_DEFINE_IO_STRUCT
+template<typename T>
+struct Emit<T, typename std::enable_if<boost::hana::Struct<T>::value>::type>
+{
+    template<typename W>
+    static void write(W& w, const T& t)
+    {
+        startObject(w, decltype(boost::hana::length(boost::hana::keys(t)))::value);
+        boost::hana::for_each(boost::hana::keys(t), [&w, &t](auto k)
+        {
+            w.Key(boost::hana::to<char const*>(k), static_cast<rapidjson::SizeType>(decltype(boost::hana::length(k))::value));
+            emit(w, boost::hana::at_key(t, k));
+        });
+        endObject(w);
+    }
+};
+
+//the writer of the thread, it keeps its level stack between the calls
+Writer& threadWriter(StringOutput& out);
+
+/*!
+ * \brief toJson - writes JSON of t to the end of str with rapidjson::Writer, no DOM is built and nothing is copied.
+ * The result is the same as of JsonReflector::toJson. str is reserved up to the size of the previous JSON of T
+ * made by the thread, so it usually does not grow while it is written.
+ */
+template<typename T>
+void toJson(const T& t, std::string& str)
+{
+    static thread_local size_t lastSize = 0;
+    str.reserve(str.size() + lastSize);
+    StringOutput out;
+    out.str = &str;
+    const size_t start = str.size();
+    emit(threadWriter(out), t);
+    lastSize = str.size() - start;
+}
+
+template<typename T>
+std::string toJson(const T& t)
+{
+    std::string res;
+    toJson(t, res);
+    return res;
+}
+
+} } } //namespace graft::serializer::sax
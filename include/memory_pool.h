@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+
+namespace graft
+{
+
+//////////////
+/// \brief The MemoryPool class
+/// Thread-safe pool of memory blocks. The blocks are grouped in size classes of BLOCK_ALIGN bytes
+/// up to MAX_BLOCK_SIZE; a freed block goes to the free list of its class and is reused by the next allocation
+/// of the same class. Larger blocks are served by the global operator new.
+/// A block can be allocated and deallocated by different threads (a job is created by a worker thread and
+/// destroyed by a looper, for example).
+///
+class MemoryPool
+{
+public:
+    static constexpr size_t BLOCK_ALIGN = 64;
+    static constexpr size_t MAX_BLOCK_SIZE = 4096;
+
+    explicit MemoryPool(size_t maxFreeBlocks = 1024) : m_maxFreeBlocks(maxFreeBlocks) { }
+    ~MemoryPool();
+
+    MemoryPool(const MemoryPool&) = delete;
+    MemoryPool& operator = (const MemoryPool&) = delete;
+
+    void* allocate(size_t size);
+    void deallocate(void* p, size_t size);
+
+    //number of allocations served from the free lists
+    uint64_t hits() const;
+    //number of allocations that required the global operator new
+    uint64_t misses() const;
+
+    //the pool of current looper thread, or the process-wide pool for all other threads
+    static MemoryPool& local();
+    static void setLocal(MemoryPool* pool);
+private:
+    static constexpr size_t CLASS_COUNT = MAX_BLOCK_SIZE / BLOCK_ALIGN;
+
+    struct Block
+    {
+        Block* next;
+    };
+
+    //the critical sections are a few instructions long, spinning is cheaper than a mutex
+    class SpinLock
+    {
+    public:
+        void lock() { while(m_flag.test_and_set(std::memory_order_acquire)) std::this_thread::yield(); }
+        void unlock() { m_flag.clear(std::memory_order_release); }
+    private:
+        std::atomic_flag m_flag = ATOMIC_FLAG_INIT;
+    };
+
+    //the counters are changed under the lock of the list
+    struct FreeList
+    {
+        mutable SpinLock lock;
+        Block* head = nullptr;
+        size_t count = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        char padding[64 - sizeof(void*) - 4*sizeof(uint64_t)]; //against false sharing of the neighbours
+    };
+
+    const size_t m_maxFreeBlocks;
+    FreeList m_free[CLASS_COUNT];
+    std::atomic<uint64_t> m_largeCount{0};
+};
+
+//////////////
+/// \brief The PoolAllocator class
+/// Stateful allocator over MemoryPool. With std::allocate_shared both the object and the control block
+/// are taken from the pool.
+/// Classes with private constructors should befriend it, like
+///   template<typename> friend class PoolAllocator;
+///
+template<typename T>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+
+    template<typename U>
+    struct rebind { using other = PoolAllocator<U>; };
+
+    explicit PoolAllocator(MemoryPool& pool) : m_pool(&pool) { }
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>& other) : m_pool(other.pool()) { }
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(m_pool->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        m_pool->deallocate(p, n * sizeof(T));
+    }
+
+    template<typename U, typename ...ARGS>
+    void construct(U* p, ARGS&&... args)
+    {
+        ::new(static_cast<void*>(p)) U(std::forward<ARGS>(args)...);
+    }
+
+    template<typename U>
+    void destroy(U* p)
+    {
+        p->~U();
+    }
+
+    MemoryPool* pool() const { return m_pool; }
+
+    template<typename U>
+    bool operator == (const PoolAllocator<U>& other) const { return m_pool == other.pool(); }
+    template<typename U>
+    bool operator != (const PoolAllocator<U>& other) const { return m_pool != other.pool(); }
+private:
+    MemoryPool* m_pool;
+};
+
+//////////////
+/// \brief The PoolDeleter class
+/// Deleter for std::unique_ptr of an object allocated in MemoryPool.
+///
+template<typename T>
+class PoolDeleter
+{
+public:
+    PoolDeleter() = default;
+    explicit PoolDeleter(MemoryPool& pool) : m_pool(&pool) { }
+
+    void operator ()(T* p) const
+    {
+        p->~T();
+        m_pool->deallocate(p, sizeof(T));
+    }
+private:
+    MemoryPool* m_pool = nullptr;
+};
+
+}//namespace graft
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace graft
+{
+
+namespace metrics_detail
+{
+    constexpr size_t SHARD_COUNT = 16;
+    constexpr size_t CACHE_LINE = 64;
+
+    //each thread takes its own shard in round-robin, the threads of the server (loopers and workers)
+    //are fewer than SHARD_COUNT usually, so the shards are not contended
+    inline size_t shardIndex()
+    {
+        static std::atomic<size_t> next{0};
+        thread_local size_t idx = next.fetch_add(1, std::memory_order_relaxed) % SHARD_COUNT;
+        return idx;
+    }
+}
+
+//////////////
+/// \brief The Counter class
+/// Monotonic counter, lock-free and sharded per thread. An increment is a relaxed atomic add
+/// to the cache line of the current thread; the value is summed over the shards on read.
+///
+class Counter
+{
+public:
+    Counter() = default;
+    Counter(const Counter&) = delete;
+    Counter& operator = (const Counter&) = delete;
+
+    void inc(uint64_t n = 1)
+    {
+        m_shards[metrics_detail::shardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const;
+private:
+    struct Shard
+    {
+        std::atomic<uint64_t> value{0};
+        char padding[metrics_detail::CACHE_LINE - sizeof(std::atomic<uint64_t>)]; //against false sharing
+    };
+    std::array<Shard, metrics_detail::SHARD_COUNT> m_shards;
+};
+
+//////////////
+/// \brief The Gauge class
+/// Current value of something, like a queue depth. It is expected to be set by a single thread
+/// (the owner of the measured object), so it is not sharded.
+///
+class Gauge
+{
+public:
+    Gauge() = default;
+    Gauge(const Gauge&) = delete;
+    Gauge& operator = (const Gauge&) = delete;
+
+    void set(int64_t v) { m_value.store(v, std::memory_order_relaxed); }
+    void add(int64_t v) { m_value.fetch_add(v, std::memory_order_relaxed); }
+    int64_t value() const { return m_value.load(std::memory_order_relaxed); }
+private:
+    std::atomic<int64_t> m_value{0};
+};
+
+//////////////
+/// \brief The Histogram class
+/// Latency histogram with fixed upper bounds in seconds. Each thread updates its own row of cells,
+/// a row is the bucket counters, the count and the sum in microseconds, padded to whole cache lines.
+///
+class Histogram
+{
+public:
+    using duration = std::chrono::steady_clock::duration;
+
+    explicit Histogram(const std::vector<double>& bounds);
+    Histogram(const Histogram&) = delete;
+    Histogram& operator = (const Histogram&) = delete;
+
+    void observe(duration d);
+
+    struct Snapshot
+    {
+        std::vector<uint64_t> buckets; //not cumulative, the last one is +Inf
+        uint64_t count = 0;
+        double sum = 0; //seconds
+    };
+
+    const std::vector<double>& bounds() const { return m_bounds; }
+    Snapshot snapshot() const;
+private:
+    std::vector<double> m_bounds;
+    std::vector<int64_t> m_boundsUs;
+    size_t m_rowSize;
+    std::unique_ptr<std::atomic<uint64_t>[]> m_cells;
+};
+
+//////////////
+/// \brief The Metrics class
+/// Process-wide registry of metric families. A series is identified by the family name and
+/// a label set like route="/health",code="200". Series are created on first use under the mutex
+/// and never destroyed, so the hot path should keep the returned reference.
+/// The number of series of a family is limited by MAX_SERIES, the excess goes to the series
+/// with label overflow="true".
+/// exposition() renders all series in Prometheus text format 0.0.4.
+///
+class Metrics
+{
+public:
+    static constexpr size_t MAX_SERIES = 256;
+
+    static Metrics& instance();
+
+    Counter& counter(const std::string& name, const std::string& help, const std::string& labels = std::string());
+    Gauge& gauge(const std::string& name, const std::string& help, const std::string& labels = std::string());
+    Histogram& histogram(const std::string& name, const std::string& help, const std::string& labels = std::string(),
+                         const std::vector<double>& bounds = latencyBounds());
+
+    std::string exposition() const;
+
+    //makes label set name0="value0",name1="value1" with escaped values
+    static std::string labels(std::initializer_list<std::pair<const char*, std::string>> pairs);
+    static const std::vector<double>& latencyBounds();
+
+    static constexpr const char* CONTENT_TYPE = "text/plain; version=0.0.4";
+private:
+    enum class Type { Counter, Gauge, Histogram };
+
+    struct Family
+    {
+        Type type;
+        std::string help;
+        std::map<std::string, std::unique_ptr<Counter>> counters;
+        std::map<std::string, std::unique_ptr<Gauge>> gauges;
+        std::map<std::string, std::unique_ptr<Histogram>> histograms;
+    };
+
+    Metrics() = default;
+
+    Family& family(const std::string& name, const std::string& help, Type type);
+
+    mutable std::mutex m_mutex;
+    std::map<std::string, Family> m_families;
+};
+
+}//namespace graft
@@ -20,4 +20,20 @@ mg_connection *mg_connect_http_x(
     MG_CB(mg_event_handler_t event_handler, void *user_data), const char *url,
     const char *extra_headers, const std::string& post_data);
 
+//Writes the next request to a connection made by mg_connect_http_x, that is kept alive by the server.
+//host is "host[:port]", target is the path with the query.
+void mg_send_http_request_x(mg_connection *nc, const std::string& host, const std::string& target,
+                            const char *extra_headers, const std::string& post_data);
+
+//Sends the head of the response and the body as mg_send_head and mg_send do. The send buffer is reserved once
+//for both of them, so the body is copied once and the head and the body go to the socket with one write.
+void mg_send_response_x(mg_connection *nc, int status_code, const char *extra_headers, const std::string& body);
+
+//Similar to mg_bind but sets SO_REUSEPORT on the listening socket, so that several managers
+//(each one polled by its own thread) can listen on the same TCP address.
+//The address is in "[tcp://][host:]port" form.
+mg_connection *mg_bind_reuseport_x(
+    mg_mgr *mgr, const char *address,
+    MG_CB(mg_event_handler_t event_handler, void *user_data));
+
 }
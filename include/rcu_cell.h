@@ -0,0 +1,83 @@
+#pragma once
+
+#include "concurrent_map.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace graft
+{
+    //////////////
+    /// \brief The RcuCell class
+    /// Holds the current immutable snapshot of T, read-copy-update style.
+    /// A reader takes the snapshot with an atomic load under EpochManager::Guard, it never locks;
+    /// get() hands out the snapshot itself for the time of the caller's guard, load() a holder of it.
+    /// A writer publishes the new snapshot as a whole with an atomic exchange and retires the holder
+    /// of the previous one; the holders of the previous snapshot keep it until they release it.
+    /// T may be incomplete where the cell is declared.
+    ///
+    template<typename T>
+    class RcuCell
+    {
+    public:
+        using Ptr = std::shared_ptr<const T>;
+
+        RcuCell() = default;
+        ~RcuCell()
+        {
+            delete m_current.load(std::memory_order_relaxed);
+            for(const Retired& r : m_retired) delete r.ptr;
+        }
+
+        RcuCell(const RcuCell&) = delete;
+        RcuCell& operator = (const RcuCell&) = delete;
+
+        //the caller holds EpochManager::Guard, the snapshot is valid until the guard is released;
+        //nullptr if nothing is published
+        const T* get() const
+        {
+            const Ptr* p = m_current.load(std::memory_order_acquire);
+            return p? p->get() : nullptr;
+        }
+
+        //nullptr if nothing is published
+        Ptr load() const
+        {
+            EpochManager::Guard guard;
+            const Ptr* p = m_current.load(std::memory_order_acquire);
+            return p? *p : Ptr();
+        }
+
+        void store(Ptr value)
+        {
+            const Ptr* p = new Ptr(std::move(value));
+            std::lock_guard<std::mutex> lk(m_mutex);
+            const Ptr* old = m_current.exchange(p, std::memory_order_acq_rel);
+            if(old) m_retired.push_back(Retired{EpochManager::instance().epoch(), old});
+            reclaim();
+        }
+    private:
+        struct Retired
+        {
+            uint64_t epoch;
+            const Ptr* ptr;
+        };
+
+        //under the lock
+        void reclaim()
+        {
+            uint64_t e = EpochManager::instance().tryAdvance();
+            auto it = std::partition(m_retired.begin(), m_retired.end(),
+                                     [e](const Retired& r) { return e < r.epoch + 2; });
+            std::for_each(it, m_retired.end(), [](const Retired& r) { delete r.ptr; });
+            m_retired.erase(it, m_retired.end());
+        }
+
+        std::atomic<const Ptr*> m_current{nullptr};
+        std::mutex m_mutex; //writers only
+        std::vector<Retired> m_retired;
+    };
+}
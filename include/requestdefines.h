@@ -49,14 +49,8 @@ static const std::string MESSAGE_RTA_CANT_BUILD_AUTH_SAMPLE("Can't build auth sa
 static const std::string MESSAGE_INVALID_TRANSACTION("Can't parse transaction");
 
 //Context Keys
-static const std::string CONTEXT_KEY_SALE_DETAILS(":saledetails");
-static const std::string CONTEXT_KEY_SALE(":sale");
-static const std::string CONTEXT_KEY_STATUS(":status");
-static const std::string CONTEXT_KEY_PAY(":pay");
-static const std::string CONTEXT_KEY_SUPERNODE("supernode");
-static const std::string CONTEXT_KEY_FULLSUPERNODELIST("fsl");
-// key to maintain auth responses from supernodes for given tx id
-static const std::string CONTEXT_KEY_AUTH_RESULT_BY_TXID(":tx_id_to_auth_resp");
+// key of the payment store, the records of sales and payments
+static const std::string CONTEXT_KEY_PAYMENTS("payments");
 // key to map tx_id -> payment_id
 static const std::string CONTEXT_KEY_PAYMENT_ID_BY_TXID(":tx_id_to_payment_id");
 // key to map tx_id -> tx
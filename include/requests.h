@@ -8,6 +8,8 @@ namespace graft {
 void registerRTARequests(graft::Router &router);
 void registerForwardRequests(graft::Router &router);
 void registerHealthcheckRequests(graft::Router &router);
+void registerMetricsRequests(graft::Router &router);
+void registerDebugRequests(graft::Router &router);
 
 }
 
@@ -4,6 +4,9 @@
 #include "router.h"
 #include "inout.h"
 
+#include <algorithm>
+#include <string>
+#include <vector>
 
 namespace graft {
 
@@ -12,6 +15,38 @@ GRAFT_DEFINE_IO_STRUCT(AuthorizeRtaTxRequest,
                        (std::string, payment_id) // TODO: this should be put to tx.extra and removed from here
                        );
 
+GRAFT_DEFINE_IO_STRUCT_INITED(SupernodeSignature,
+                              (std::string, address, std::string()),
+                              (std::string, result_signature, std::string()), // signarure for tx_id + result
+                              (std::string, tx_signature, std::string())      // signature for tx_id only
+                              );
+
+// votes of the auth sample for a tx
+struct RtaAuthResult
+{
+    // the tx the votes are for, a retried pay has a new tx and new votes
+    std::string txId;
+    std::vector<SupernodeSignature> approved;
+    std::vector<SupernodeSignature> rejected;
+    bool alreadyApproved(const std::string &address)
+    {
+        return contains(approved, address);
+    }
+
+    bool alreadyRejected(const std::string &address)
+    {
+        return contains(rejected, address);
+    }
+
+private:
+    bool contains(const std::vector<SupernodeSignature> &v, const std::string &address)
+    {
+        return std::find_if(v.begin(), v.end(), [&](const SupernodeSignature &item) {
+            return item.address == address;
+        }) != v.end();
+    }
+};
+
 void registerAuthorizeRtaTxRequests(graft::Router &router);
 
 }
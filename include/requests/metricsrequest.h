@@ -0,0 +1,12 @@
+#ifndef METRICSREQUEST_H
+#define METRICSREQUEST_H
+
+#include "router.h"
+
+namespace graft {
+
+void registerMetricsRequest(graft::Router &router);
+
+}
+
+#endif // METRICSREQUEST_H
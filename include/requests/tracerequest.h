@@ -0,0 +1,12 @@
+#ifndef TRACEREQUEST_H
+#define TRACEREQUEST_H
+
+#include "router.h"
+
+namespace graft {
+
+void registerTraceRequest(graft::Router &router);
+
+}
+
+#endif // TRACEREQUEST_H
@@ -1,6 +1,8 @@
 #ifndef REQUESTTOOLS_H
 #define REQUESTTOOLS_H
 
+#include "router.h"
+
 #include <string>
 
 namespace graft {
@@ -9,6 +11,16 @@ std::string generatePaymentID();
 
 uint64_t convertAmount(const std::string &amount);
 
+// value of a string field of a JSON text without parsing it, empty if there is no such field;
+// escapes are not processed, it is meant for ids
+std::string jsonStringField(const std::string &json, const std::string &field);
+
+// affinity key of a client request, the payment id field of the body
+Router::AffinityKey paymentIdAffinity(const std::string &field = "PaymentID");
+// affinity key of a multicast or broadcast request from cryptonode, the payment id field
+// of the base64 encoded payload in params.data, JSON or the binary encoding
+Router::AffinityKey multicastPaymentIdAffinity(const std::string &field);
+
 }
 
 #endif // REQUESTTOOLS_H
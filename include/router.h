@@ -12,6 +12,7 @@
 #include "r3.h"
 #include "inout.h"
 #include "context.h"
+#include "trace.h"
 
 namespace graft {
 
@@ -21,6 +22,8 @@ class RouterT
 public:
     using vars_t = std::multimap<std::string, std::string>;
     using Handler = std::function<Status (const vars_t&, const In&, Context&, Out& ) >;
+    //returns the key of related requests, such as a payment id, they are executed by the same worker; empty for none
+    using AffinityKey = std::function<std::string (const vars_t&, const In&)>;
 
     struct Handler3
     {
@@ -52,6 +55,13 @@ public:
         Input input;
         vars_t vars;
         Handler3 h3;
+        Priority priority = Priority::Normal;
+        //endpoint pattern of the matched route, for statistics
+        const std::string* endpoint = nullptr;
+        //trace histograms of the matched route
+        TraceRegistry::RouteStats* trace = nullptr;
+        //affinity key function of the matched route, nullptr if none
+        const AffinityKey* affinity = nullptr;
     };
 
     class Root
@@ -61,7 +71,7 @@ public:
         ~Root() { r3_tree_free(m_node); }
 
         bool arm();
-        bool match(const std::string& target, int method, JobParams& params);
+        bool match(boost::string_view target, int method, JobParams& params);
         void addRouter(RouterT& r) { m_routers.push_front(std::move(r)); }
 
         std::string dbgDumpRouters() const;
@@ -81,15 +91,17 @@ public:
 
     ~RouterT() = default;
 
-    void addRoute(const std::string& endpoint, int methods, const Handler3& ph3)
+    void addRoute(const std::string& endpoint, int methods, const Handler3& ph3, Priority priority = Priority::Normal,
+                  AffinityKey affinity = nullptr)
     {
-        Route r{m_endpointPrefix + endpoint, methods, ph3};
+        Route r{m_endpointPrefix + endpoint, methods, ph3, priority, std::move(affinity)};
         m_routes.push_front(r);
     }
 
-    void addRoute(const std::string& endpoint, int methods, const Handler3&& ph3)
+    void addRoute(const std::string& endpoint, int methods, const Handler3&& ph3, Priority priority = Priority::Normal,
+                  AffinityKey affinity = nullptr)
     {
-        m_routes.push_front({m_endpointPrefix + endpoint, methods, std::move(ph3)});
+        m_routes.push_front({m_endpointPrefix + endpoint, methods, std::move(ph3), priority, std::move(affinity)});
     }
 
 public:
@@ -101,6 +113,10 @@ private:
         std::string endpoint;
         int methods;
         Handler3 h3;
+        Priority priority;
+        AffinityKey affinity;
+        //resolved when the router is armed
+        TraceRegistry::RouteStats* trace = nullptr;
     };
 
     std::forward_list<Route> m_routes;
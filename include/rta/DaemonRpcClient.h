@@ -33,6 +33,9 @@
 #include <string>
 #include <vector>
 #include <chrono>
+#include <functional>
+#include <future>
+#include <mutex>
 #include <boost/optional.hpp>
 
 #include <net/http_client.h>
@@ -42,23 +45,56 @@
 
 namespace graft {
 
+/*!
+ * \brief The DaemonRpcClient class - client of the cryptonode RPC.
+ * The requests are sent by the upstream looper (see TaskManager::sendUpstreamAsync), so that many of them can be in
+ * flight over the pooled connections and each one has its own deadline. The callbacks are called on the looper
+ * thread and should not block. Without a running looper (tools, tests) the requests are made in place by the
+ * blocking http client.
+ */
 class DaemonRpcClient
 {
 public:
+    using HeightCallback = std::function<void (bool ok, uint64_t height)>;
+    using HashCallback = std::function<void (bool ok, const std::string &hash)>;
+
     DaemonRpcClient(const std::string &daemon_addr, const std::string &daemon_login, const std::string &daemon_pass);
     virtual ~DaemonRpcClient();
     bool get_tx_from_pool(const std::string &hash_str, cryptonote::transaction &out_tx);
     bool get_tx(const std::string &hash_str, cryptonote::transaction &out_tx, uint64_t &block_num, bool &mined);
+    // the calling thread waits for the reply; the calls of many workers are in flight at once
     bool get_height(uint64_t &height);
     bool get_block_hash(uint64_t height, std::string &hash);
 
+    /*!
+     * \brief get_height_async, get_block_hash_async - asynchronous calls.
+     * \param timeout - the deadline of the call, zero is the timeout of the client
+     * \return        - the future throws on failure
+     */
+    void get_height_async(HeightCallback callback, std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+    std::future<uint64_t> get_height_async(std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+    void get_block_hash_async(uint64_t height, HashCallback callback, std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+    std::future<std::string> get_block_hash_async(uint64_t height, std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+    //the default deadline of the calls
+    void set_timeout(std::chrono::milliseconds timeout) { m_rpc_timeout = timeout; }
+
 protected:
     bool init(const std::string &daemon_address, boost::optional<epee::net_utils::http::login> daemon_login);
 
 
 private:
+    template<typename Request, typename Response>
+    void invoke_async(const std::string &path, Request &req, std::function<void (bool ok, Response &res)> callback,
+                      std::chrono::milliseconds timeout);
+
+    std::string m_daemon_address;
+    //the looper does not do the digest authentication, the calls with the login are made by the blocking client
+    bool m_login = false;
+    //the blocking client is not thread safe
+    std::mutex m_http_mutex;
     epee::net_utils::http::http_simple_client m_http_client;
-    std::chrono::seconds m_rpc_timeout;
+    std::chrono::milliseconds m_rpc_timeout;
 
 };
 
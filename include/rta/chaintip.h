@@ -0,0 +1,97 @@
+#ifndef CHAINTIP_H
+#define CHAINTIP_H
+
+#include "rcu_cell.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace graft {
+
+class DaemonRpcClient;
+
+/*!
+ * \brief The ChainTip class - the cryptonode blockchain height and the hashes of the recent blocks.
+ *        poll() asks cryptonode once per interval and publishes the new snapshot as a whole, so the handlers read
+ *        the height and the hashes from memory without an RPC and never see the height without its hashes.
+ *        The subscribers are called after a new block is published.
+ */
+class ChainTip
+{
+public:
+    // hashes kept below the tip, it covers FullSupernodeList::AUTH_SAMPLE_HASH_HEIGHT of the recent sales
+    static const size_t DEFAULT_DEPTH = 64;
+    // the blocks below the previous tip checked again on each poll, also when the height is the same;
+    // a longer reorg refetches the whole ring
+    static const size_t REORG_CHECK_DEPTH = 1;
+
+    struct Snapshot
+    {
+        // the blockchain height, the hash of the top block is at height - 1
+        uint64_t height = 0;
+        // the height of hashes[0]
+        uint64_t first = 0;
+        std::vector<std::string> hashes;
+    };
+    using SnapshotPtr = std::shared_ptr<const Snapshot>;
+    using NewBlockCallback = std::function<void (const SnapshotPtr &tip)>;
+
+    explicit ChainTip(std::shared_ptr<DaemonRpcClient> daemon, size_t depth = DEFAULT_DEPTH);
+
+    ChainTip(const ChainTip&) = delete;
+    ChainTip& operator = (const ChainTip&) = delete;
+
+    /*!
+     * \brief poll - requests the height and the hashes of the new blocks and publishes them.
+     *               It waits for the replies, so it is called by a worker (periodic task), not in the IO thread.
+     * \return     - false if cryptonode failed, the previous snapshot is kept
+     */
+    bool poll();
+
+    /*!
+     * \brief snapshot - the last published snapshot, nullptr before the first successful poll
+     */
+    SnapshotPtr snapshot() const { return m_tip.load(); }
+    /*!
+     * \brief height - the last polled height, 0 before the first successful poll
+     */
+    uint64_t height() const;
+    /*!
+     * \brief getBlockHash - the hash of the block at height
+     * \return             - false if the block is not in the ring
+     */
+    bool getBlockHash(uint64_t height, std::string &hash) const;
+
+    /*!
+     * \brief subscribe - callback is called on the polling thread with each new snapshot, it should not block
+     * \return          - the id for unsubscribe
+     */
+    int subscribe(NewBlockCallback callback);
+    void unsubscribe(int id);
+
+    size_t depth() const { return m_depth; }
+
+private:
+    bool fetchHashes(uint64_t from, uint64_t to, std::vector<std::string> &hashes);
+
+    std::shared_ptr<DaemonRpcClient> m_daemon;
+    size_t m_depth;
+    RcuCell<Snapshot> m_tip;
+    // poll is not reentrant
+    std::mutex m_poll_mutex;
+    std::mutex m_subscribers_mutex;
+    std::map<int, NewBlockCallback> m_subscribers;
+    int m_next_id = 0;
+};
+
+using ChainTipPtr = std::shared_ptr<ChainTip>;
+
+} // namespace graft
+
+#endif // CHAINTIP_H
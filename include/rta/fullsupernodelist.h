@@ -3,6 +3,7 @@
 
 #include "rta/supernode.h"
 #include "rta/DaemonRpcClient.h"
+#include "rta/chaintip.h"
 
 #include <cryptonote_config.h>
 #include <string>
@@ -104,7 +105,7 @@ public:
     std::vector<std::string> items() const;
 
     /*!
-     * \brief getBlockHash - returns block hash for given height
+     * \brief getBlockHash - returns block hash for given height, from the chain tip if the block is there
      * \param height       - block height
      * \param hash         - output hash value
      * \return             - true on success
@@ -119,6 +120,12 @@ public:
      */
     std::future<void> refreshAsync();
 
+    /*!
+     * \brief setChainTip - the block hashes are served by the chain tip, the older ones are asked from cryptonode
+     * \param tip         - chain tip, nullptr to ask cryptonode
+     */
+    void setChainTip(ChainTipPtr tip);
+
     /*!
      * \brief refreshedItems - returns number of refreshed supernodes
      * \return
@@ -139,6 +146,7 @@ private:
     std::string m_daemon_address;
     bool m_testnet;
     DaemonRpcClient m_rpc_client;
+    ChainTipPtr m_chain_tip;
     mutable boost::shared_mutex m_access;
     std::unique_ptr<utils::ThreadPool> m_tp;
     std::atomic_size_t m_refresh_counter;
@@ -0,0 +1,81 @@
+#ifndef PAYMENTSTORE_H
+#define PAYMENTSTORE_H
+
+#include "requestdefines.h"
+#include "requests/saledetailsrequest.h"
+#include "requests/authorizertatxrequest.h"
+#include "concurrent_map.hpp"
+
+#include <boost/optional.hpp>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace graft {
+
+/*!
+ * \brief The PaymentRecord struct - everything the supernode keeps for a payment id
+ */
+struct PaymentRecord
+{
+    int status = static_cast<int>(RTAStatus::None);
+    boost::optional<SaleData> sale;
+    boost::optional<std::string> saleDetails;
+    boost::optional<PayData> pay;
+    // sale details response of a remote supernode
+    boost::optional<SaleDetailsResponse> saleDetailsResult;
+    std::string txId;
+    RtaAuthResult authResult;
+};
+
+/*!
+ * \brief The PaymentStore class - payment records keyed by payment id.
+ *        A record is found with a single lookup; reads are lock-free, an update is applied to the whole
+ *        record under the lock of its shard. Each record has the same ttl, it is prolonged on access.
+ */
+class PaymentStore
+{
+public:
+    explicit PaymentStore(std::chrono::seconds ttl = RTA_TX_TTL);
+
+    PaymentStore(const PaymentStore&) = delete;
+    PaymentStore& operator = (const PaymentStore&) = delete;
+
+    /*!
+     * \brief read - calls f with the record in place, f must not keep references to the record
+     * \return     - false if there is no record
+     */
+    bool read(const std::string &payment_id, const std::function<void(const PaymentRecord&)> &f) const;
+    /*!
+     * \brief status - status of the payment, RTAStatus::None if there is no record
+     */
+    int status(const std::string &payment_id) const;
+    bool has(const std::string &payment_id) const;
+    /*!
+     * \brief update - applies f to the record, the record is created if there is none;
+     *                  nothing is changed or created if f returns false
+     * \return       - the result of f
+     */
+    bool update(const std::string &payment_id, std::function<bool(PaymentRecord&)> f);
+    /*!
+     * \brief updateExisting - applies f to the record if it exists
+     * \return               - false if there is no record, otherwise the result of f
+     */
+    bool updateExisting(const std::string &payment_id, std::function<bool(PaymentRecord&)> f);
+    void remove(const std::string &payment_id);
+
+    size_t size() const;
+    // removes expired records
+    void cleanup();
+private:
+    std::chrono::seconds m_ttl;
+    ConcurrentMap<std::string, PaymentRecord> m_records;
+};
+
+using PaymentStorePtr = std::shared_ptr<PaymentStore>;
+
+}
+
+#endif // PAYMENTSTORE_H
@@ -0,0 +1,33 @@
+#ifndef SERVERSTATE_H
+#define SERVERSTATE_H
+
+#include "rta/supernode.h"
+#include "rta/fullsupernodelist.h"
+#include "rta/chaintip.h"
+
+#include <memory>
+#include <string>
+
+namespace graft {
+
+/*!
+ * \brief The ServerState struct - immutable snapshot of the supernode services and settings the handlers use.
+ *        It is published to GlobalContextMap::serverState as a whole and read with Context::state();
+ *        a reload publishes a new snapshot, the handlers in progress keep the one they have taken.
+ */
+struct ServerState
+{
+    SupernodePtr supernode;
+    FullSupernodeListPtr fsl;
+    ChainTipPtr chainTip;
+    bool testnet = false;
+    std::string data_dir;
+    std::string watchonly_wallets_path;
+    std::string cryptonode_rpc_address;
+};
+
+using ServerStatePtr = std::shared_ptr<const ServerState>;
+
+}
+
+#endif // SERVERSTATE_H
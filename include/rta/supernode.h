@@ -4,6 +4,7 @@
 #include <crypto/crypto.h>
 #include <cryptonote_config.h>
 #include <boost/scoped_ptr.hpp>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -18,6 +19,8 @@ namespace cryptonote {
 namespace graft {
 
 struct SupernodeAnnounce;
+class DaemonRpcClient;
+class ChainTip;
 
 /*!
  * \brief The Supernode class - Representing supernode instance
@@ -51,10 +54,16 @@ public:
     /*!
      * \brief setDaemonAddress - setup connection with the cryptonode daemon
      * \param address          - address in "hostname:port" form
-     * \return                 - true on success
+     * \return                 - true on success, false if the address is not valid and the previous one is kept
      */
     bool setDaemonAddress(const std::string &address);
 
+    /*!
+     * \brief setChainTip - daemonHeight is served by the chain tip once it is polled
+     * \param tip         - chain tip, nullptr to ask cryptonode
+     */
+    void setChainTip(std::shared_ptr<ChainTip> tip);
+
     /*!
      * \brief refresh         - get latest blocks from the daemon
      * \return                - true on success
@@ -80,7 +89,7 @@ public:
     std::string walletAddress() const;
 
     /*!
-     * \brief daemonHeight - returns cryptonode's blockchain height
+     * \brief daemonHeight - returns cryptonode's blockchain height, from the chain tip if it is set
      * \return
      */
     uint64_t daemonHeight() const;
@@ -224,6 +233,9 @@ private:
     using wallet2_ptr = boost::scoped_ptr<tools::wallet2>;
     // mutable tools::wallet2 m_wallet;
     mutable wallet2_ptr m_wallet;
+    // cryptonode RPC client, replaced by setDaemonAddress; none if the address was not valid, the wallet is asked then
+    std::shared_ptr<DaemonRpcClient> m_daemon;
+    std::shared_ptr<ChainTip> m_chain_tip;
     std::string    m_network_address;
     uint64_t       m_last_update_time;
 };
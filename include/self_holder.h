@@ -1,5 +1,7 @@
 #pragma once
 
+#include "memory_pool.h"
+
 #include <memory>
 
 namespace graft {
@@ -12,18 +14,20 @@ public:
 
     Ptr getSelf() { return m_self; }
 
+    //the object and its control block are allocated in the pool of current looper thread
     template<typename T=C, typename ...ARGS>
     static const Ptr Create(ARGS&&... args)
     {
-        return (new T(std::forward<ARGS>(args)...))->m_self;
+        std::shared_ptr<T> ptr = std::allocate_shared<T>(PoolAllocator<T>(MemoryPool::local()), std::forward<ARGS>(args)...);
+        ptr->m_self = ptr;
+        return ptr->m_self;
     }
 protected:
     void releaseItself() { m_self.reset(); }
 
-    SelfHolder() : m_self(static_cast<C*>(this)) { }
+    SelfHolder() = default;
 private:
     Ptr m_self;
 };
 
 }//namespace graft
-
@@ -18,7 +18,7 @@ private:
     void startSupernodePeriodicTasks();
     bool init(int argc, const char** argv);
     void serve();
-    void stop(bool force = false) { m_looper->stop(force); }
+    void stop(bool force = false);
     static void initSignals();
     void addGlobalCtxCleaner();
     void setHttpRouters(HttpConnectionManager& httpcm);
@@ -27,6 +27,8 @@ private:
 
     ConfigOpts m_configOpts;
     std::unique_ptr<graft::Looper> m_looper;
+    //secondary loopers in multi-looper mode (io-threads > 1)
+    std::vector<std::unique_ptr<graft::Looper>> m_ioLoopers;
     std::vector<std::unique_ptr<graft::ConnectionManager>> m_conManagers;
 };
 
@@ -6,6 +6,12 @@
 #include "context.h"
 #include "timer.h"
 #include "self_holder.h"
+#include "admission_queue.h"
+#include "trace.h"
+#include "metrics.h"
+#include "upstream_pool.h"
+#include "upstream_cache.h"
+#include "upstream_balancer.h"
 #include <misc_log_ex.h>
 #include "CMakeConfig.h"
 #include <future>
@@ -53,7 +59,8 @@ using GJ = GraftJob<BaseTaskPtr, TPResQueue, TaskManager>;
 ///
 class GJPtr final
 {
-    std::unique_ptr<GJ> m_ptr = nullptr;
+    //the job is allocated in the pool of its task manager
+    std::unique_ptr<GJ, PoolDeleter<GJ>> m_ptr = nullptr;
 public:
     GJPtr(GJPtr&& rhs)
     {
@@ -71,10 +78,8 @@ public:
     GJPtr& operator = (const GJPtr&) = delete;
     ~GJPtr() = default;
 
-    template<typename ...ARGS>
-    GJPtr(ARGS&&... args) : m_ptr( new GJ( std::forward<ARGS>(args)...) )
-    {
-    }
+    GJPtr(BaseTaskPtr bt, TPResQueue* rq, TaskManager* manager);
+    GJPtr(GJ&& gj);
 
     template<typename ...ARGS>
     void operator ()(ARGS... args)
@@ -109,6 +114,7 @@ struct ConfigOpts
     int timer_poll_interval_ms;
     // data directory - base directory where supernode stake wallet and other supernodes wallets are located
     std::string data_dir;
+    // interval of expiry of the global context entries, it is the precision of their ttl
     int lru_timeout_ms;
     // testnet flag
     bool testnet;
@@ -117,6 +123,32 @@ struct ConfigOpts
     // runtime parameters.
     // path to watch-only wallets (supernodes)
     std::string watchonly_wallets_path;
+    // number of loopers (IO threads), each one has its own listening socket and upstream connections
+    int io_threads = 1;
+    // admission queue, requests wait there when the thread pool is full; 0 means respond 503 at once
+    int admission_queue_len = 256;
+    // CoDel parameters of the admission queue
+    int admission_target_delay_ms = 50;
+    int admission_interval_ms = 500;
+    // max number of thread pool results processed per looper iteration, 0 means no limit
+    int result_drain_budget = 64;
+    // one of trace_sample_rate requests is kept for Chrome trace dump, 0 disables sampling
+    int trace_sample_rate = 0;
+    // keep-alive connections to the upstreams per looper and host, 0 means a connection per request
+    int upstream_keepalive_max_per_host = 8;
+    // seconds an upstream connection is kept idle
+    double upstream_keepalive_idle_timeout = 30;
+    // TTL in milliseconds of the cached upstream replies by url path or "path:method", see UpstreamCache
+    std::map<std::string, int> upstream_cache_ttl_ms;
+    // the cryptonode backends of the forwarded requests, cryptonode_rpc_address if empty
+    std::vector<std::string> cryptonode_rpc_backends;
+    // failures of a backend in a row that open its circuit, and milliseconds it stays open
+    int upstream_breaker_failures = 3;
+    int upstream_breaker_cooldown_ms = 5000;
+    // idempotent url paths or "path:method" sent to a second backend if there is no reply within the p95 latency
+    std::set<std::string> upstream_hedge_paths;
+    // milliseconds between the polls of the cryptonode height and recent block hashes, see ChainTip
+    int chain_tip_poll_interval_ms = 1000;
 };
 
 class BaseTask : public SelfHolder<BaseTask>
@@ -136,6 +168,9 @@ public:
     Output& getOutput() { return m_output; }
     const Router::Handler3& getHandler3() const { return m_params.h3; }
     Context& getCtx() { return m_ctx; }
+    TraceSpan& getSpan() { return m_span; }
+    //hash of the affinity key of the route, 0 if there is none; the worker jobs of the task are posted by it
+    size_t getAffinity() const { return m_affinity; }
 
     const char* getStrStatus();
     static const char* getStrStatus(Status s);
@@ -146,28 +181,43 @@ protected:
     Router::JobParams m_params;
     Output m_output;
     Context m_ctx;
+    TraceSpan m_span;
+    size_t m_affinity = 0;
 };
 
 class UpstreamTask : public BaseTask
 {
 public:
-    using PromiseItem = std::pair< std::promise<Input>, Output >;
+    //the reply, or an empty input and the error
+    using Callback = std::function<void (Input&& input, const std::string& err)>;
+
+    //the request of a thread to the upstream, sent by the looper
+    struct PromiseItem
+    {
+        //the promise is not used if the callback is set
+        std::promise<Input> promise;
+        Callback callback;
+        Output output;
+        //zero is upstream-request-timeout
+        std::chrono::milliseconds timeout{0};
+    };
 
     virtual void finalize() override;
     PromiseItem m_pi;
 private:
-    friend class SelfHolder<BaseTask>;
+    template<typename> friend class PoolAllocator;
     UpstreamTask(TaskManager& manager, PromiseItem&& pi)
         : BaseTask(manager, Router::JobParams({Input(), Router::vars_t(),
                 Router::Handler3(nullptr, nullptr, nullptr)}))
         , m_pi(std::move(pi))
     {
+        m_output = m_pi.output;
     }
 };
 
 class PeriodicTask : public BaseTask
 {
-    friend class SelfHolder<BaseTask>;
+    template<typename> friend class PoolAllocator;
     PeriodicTask(
             TaskManager& manager, const Router::Handler3& h3,
             std::chrono::milliseconds timeout_ms,
@@ -193,7 +243,7 @@ public:
 
 class ClientTask : public BaseTask
 {
-    friend class SelfHolder<BaseTask>;
+    template<typename> friend class PoolAllocator;
     ClientTask(ConnectionManager* connectionManager, mg_connection *client, Router::JobParams& prms);
 public:
     virtual void finalize() override;
@@ -207,9 +257,32 @@ class TaskManager
 public:
     TaskManager(const ConfigOpts& copts)
         : m_copts(copts)
+        , m_gcm(std::make_shared<GlobalContextMap>())
+        , m_primary(true)
+        , m_postponedOwners(std::make_shared<PostponedOwners>())
+        , m_upstreamPool(std::max(0, copts.upstream_keepalive_max_per_host), copts.upstream_keepalive_idle_timeout)
+        , m_upstreamCache(copts.upstream_cache_ttl_ms)
+        , m_upstreamBalancer(upstreamBackends(copts), copts.upstream_breaker_failures,
+                             std::chrono::milliseconds(copts.upstream_breaker_cooldown_ms), copts.upstream_hedge_paths)
     {
         // TODO: validate options, throw exception if any mandatory options missing
         initThreadPool(copts.workers_count, copts.worker_queue_len);
+        initMetrics();
+    }
+    //shares the global context and the thread pool with the primary manager
+    TaskManager(const ConfigOpts& copts, TaskManager& primary)
+        : m_copts(copts)
+        , m_gcm(primary.m_gcm)
+        , m_primary(false)
+        , m_id(++primary.m_secondaryCount)
+        , m_postponedOwners(primary.m_postponedOwners)
+        , m_upstreamPool(std::max(0, copts.upstream_keepalive_max_per_host), copts.upstream_keepalive_idle_timeout)
+        , m_upstreamCache(copts.upstream_cache_ttl_ms)
+        , m_upstreamBalancer(upstreamBackends(copts), copts.upstream_breaker_failures,
+                             std::chrono::milliseconds(copts.upstream_breaker_cooldown_ms), copts.upstream_hedge_paths)
+    {
+        initThreadPool(primary);
+        initMetrics();
     }
     virtual ~TaskManager() { }
 
@@ -220,8 +293,12 @@ public:
 
     ////getters
     virtual mg_mgr* getMgMgr()  = 0;
-    GlobalContextMap& getGcm() { return m_gcm; }
+    GlobalContextMap& getGcm() { return *m_gcm; }
+    MemoryPool& getPool() { return m_pool; }
+    UpstreamPool& getUpstreamPool() { return m_upstreamPool; }
+    UpstreamBalancer& getUpstreamBalancer() { return m_upstreamBalancer; }
     const ConfigOpts& getCopts() const { return m_copts; }
+    bool isPrimary() const { return m_primary; }
     TimerList<BaseTaskPtr>& getTimerList() { return m_timerList; }
 
     static TaskManager* from(mg_mgr* mgr);
@@ -235,13 +312,40 @@ public:
     void onUpstreamDone(UpstreamSender& uss);
 
     static void sendUpstreamBlocking(Output& output, Input& input, std::string& err);
+    /*!
+     * \brief sendUpstreamAsync - sends the request by the upstream looper and returns at once, so that a thread can have
+     * many requests in flight. It can be called from any thread; the callback is called on the looper thread, so it
+     * should not block. timeout is the deadline of the request, zero is upstream-request-timeout.
+     */
+    static void sendUpstreamAsync(const Output& output, UpstreamTask::Callback callback,
+                                  std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+    //the future is not waited in the IO thread, the reply would never come
+    static std::future<Input> sendUpstreamAsync(const Output& output,
+                                                std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+    //a looper is running to send the upstream requests of the threads
+    static bool hasUpstreamLooper() { return g_upstreamManager.load() != nullptr; }
+    //the current thread is the one of a looper, it should never wait for the upstream
+    static bool isIOThread() { return io_thread; }
 
     virtual void notifyJobReady() = 0;
 
     void cb_event(uint64_t cnt);
+
+    //number of job ready notifications sent and received, each one is a syscall
+    uint64_t getNotifyCount() const { return m_cntNotify.load(std::memory_order_relaxed); }
+    uint64_t getWakeupCount() const { return m_cntWakeup; }
+    uint64_t getJobCount() const { return m_cntJobDone; }
 protected:
+    //returns true if the notification should be sent, that is on the first job after the previous wakeup
+    bool onJobReady();
+    //returns true if the drain budget is exhausted and some results are left in the queue
+    bool hasReadyBacklog() const { return m_readyBacklog; }
+    void processReadyJobs();
+
     bool canStop();
     void executePostponedTasks();
+    //updates the gauges of this manager, called by the looper on each iteration
+    void publishMetrics();
     void setIOThread(bool current);
     void checkUpstreamBlockingIO();
 
@@ -250,14 +354,48 @@ private:
     void ExecutePreAction(BaseTaskPtr bt);
     void ExecutePostAction(BaseTaskPtr bt, GJ* gj = nullptr);  //gj equals nullptr if threadPool was skipped for some reasons
     void Execute(BaseTaskPtr bt);
+    void ExecuteAdmitted(BaseTaskPtr bt);
+    void admit(BaseTaskPtr bt);
+    void drainAdmissionQueue();
+    void respondBusy(BaseTaskPtr bt);
     void processResult(BaseTaskPtr bt);
     void respondAndDie(BaseTaskPtr bt, const std::string& s);
+    //continues the task with the reply of the upstream, or with the error
+    void onUpstreamReply(BaseTaskPtr bt, Status status, const std::string& error);
     void postponeTask(BaseTaskPtr bt);
+    //resumes the postponed task by its owner, returns false if no manager has the task
+    bool resumePostponedTask(const Context::uuid_t& uuid);
 
     void initThreadPool(int threadCount = std::thread::hardware_concurrency(), int workersQueueSize = 32);
+    void initThreadPool(TaskManager& primary);
+    void initResultQueue(size_t threadCount, size_t workersQueueSize);
+    void initMetrics();
+    //queues the request for the upstream looper, fails it if there is no looper or the queue is full
+    static void pushUpstreamRequest(UpstreamTask::PromiseItem&& pi);
+    static std::vector<std::string> upstreamBackends(const ConfigOpts& copts);
     bool tryProcessReadyJob();
 
-    GlobalContextMap m_gcm;
+    //the managers of the postponed tasks, shared by all of them; a callback may come to another looper
+    struct PostponedOwners
+    {
+        std::mutex mutex;
+        std::map<Context::uuid_t, TaskManager*> owners;
+    };
+
+    std::shared_ptr<GlobalContextMap> m_gcm;
+    bool m_primary;
+    //the label of the metrics, 0 is the primary manager
+    int m_id = 0;
+    int m_secondaryCount = 0;
+    std::shared_ptr<PostponedOwners> m_postponedOwners;
+    //tasks, jobs and upstream senders of this manager are allocated here, it should be destroyed last
+    MemoryPool m_pool;
+    //the connections of the looper to the upstreams
+    UpstreamPool m_upstreamPool;
+    //the cached replies of the upstreams and the requests in flight
+    UpstreamCache m_upstreamCache;
+    //the choice of the cryptonode backend, the circuit breakers and the hedging
+    UpstreamBalancer m_upstreamBalancer;
 
     uint64_t m_cntBaseTask = 0;
     uint64_t m_cntBaseTaskDone = 0;
@@ -265,13 +403,63 @@ private:
     uint64_t m_cntUpstreamSenderDone = 0;
     uint64_t m_cntJobSent = 0;
     uint64_t m_cntJobDone = 0;
+    uint64_t m_cntWakeup = 0;
+    std::atomic<uint64_t> m_cntNotify{0};
+
+    //set by the first ready job after the wakeup, cleared by the wakeup
+    std::atomic<bool> m_jobReadyNotified{false};
+    bool m_readyBacklog = false;
 
     uint64_t m_threadPoolInputSize = 0;
-    std::unique_ptr<ThreadPoolX> m_threadPool;
+    std::shared_ptr<ThreadPoolX> m_threadPool;
     std::unique_ptr<TPResQueue> m_resQueue;
+    std::unique_ptr<AdmissionQueue<BaseTaskPtr>> m_admissionQueue;
     TimerList<BaseTaskPtr> m_timerList;
 
+    //the series of this manager in the process-wide registry
+    struct ManagerMetrics
+    {
+        Counter* tasks;
+        Counter* jobs;
+        Counter* upstreamRequests;
+        Counter* shed;
+        Gauge* activeTasks;
+        Gauge* admissionQueue;
+        Gauge* poolJobs;
+        Gauge* poolCapacity;
+        Gauge* postponedTasks;
+        Gauge* upstreamInFlight;
+        Counter* upstreamConnects;
+        Counter* upstreamReuses;
+        Counter* upstreamEvictions;
+        Gauge* upstreamIdle;
+        uint64_t upstreamConnectsSeen;
+        uint64_t upstreamReusesSeen;
+        uint64_t upstreamEvictionsSeen;
+        Counter* upstreamCacheHits;
+        Counter* upstreamCacheMisses;
+        Counter* upstreamCoalesced;
+        Counter* upstreamSaved;
+        Gauge* upstreamCacheEntries;
+        uint64_t upstreamCacheHitsSeen;
+        uint64_t upstreamCacheMissesSeen;
+        uint64_t upstreamCoalescedSeen;
+        Counter* upstreamHedges;
+        Counter* upstreamFailovers;
+        Counter* upstreamCircuitOpens;
+        Gauge* upstreamOpenBackends;
+        uint64_t upstreamHedgesSeen;
+        uint64_t upstreamFailoversSeen;
+        uint64_t upstreamCircuitOpensSeen;
+        Gauge* globalContextSize; //primary only
+        Counter* globalContextExpired; //primary only
+        uint64_t globalContextExpiredSeen;
+    } m_metrics{};
+
     std::map<Context::uuid_t, BaseTaskPtr> m_postponedTasks;
+    //the postponed tasks of this manager resumed by the other managers
+    std::mutex m_resumeMutex;
+    std::vector<Context::uuid_t> m_resumeRequests;
     std::deque<BaseTaskPtr> m_readyToResume;
     std::priority_queue<std::pair<std::chrono::time_point<std::chrono::steady_clock>,Context::uuid_t>> m_expireTaskQueue;
 
@@ -280,7 +468,7 @@ private:
 
     std::unique_ptr<PromiseQueue> m_promiseQueue;
     static thread_local bool io_thread;
-    static TaskManager* g_upstreamManager;
+    static std::atomic<TaskManager*> g_upstreamManager;
 };
 
 }//namespace graft
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "thread_pool/thread_pool.hpp"
+#include "trace.h"
 
 namespace graft {
 
@@ -39,6 +40,7 @@ public:
     //main payload
     virtual void operator () ()
     {
+        m_bt->getSpan().mark(TraceStage::worker_start);
         {
             decltype(auto) vars_cref = m_bt->getVars();
             decltype(auto) input_ref = m_bt->getInput();
@@ -68,12 +70,14 @@ public:
                 throw;
             }
         }
+        m_bt->getSpan().mark(TraceStage::worker_finish);
         Watcher* save_m_watcher = m_watcher; //save m_watcher before move itself into resulting queue
         m_rq->push(std::move(*this)); //similar to "delete this;"
         save_m_watcher->notifyJobReady();
     }
 
     BT_ptr& getTask() { return m_bt; }
+    Watcher* getWatcher() { return m_watcher; }
 protected:
     BT_ptr m_bt;
 
@@ -23,8 +23,15 @@ using ThreadPool = ThreadPoolImpl<FixedFunction<void(), 128>,
  * It is highly scalable and fast.
  * It is header only.
  * It implements both work-stealing and work-distribution balancing
- * startegies.
+ * startegies. Jobs posted from outside of the pool are distributed among
+ * worker injection queues in round-robin, jobs posted from a worker thread go
+ * to its local deque. Idle workers steal jobs according to
+ * ThreadPoolOptions::StealMode.
  * It implements cooperative scheduling strategy for tasks.
+ * Idle workers are parked and woken up on post (see ThreadPoolOptions::IdleMode).
+ * A job posted with a non-zero affinity key goes to the injection queue of
+ * the worker the key maps to, so related jobs run on the same worker while
+ * idle workers can still steal them.
  */
 template <typename Task, template<typename> class Queue>
 class ThreadPoolImpl {
@@ -55,11 +62,13 @@ public:
      * @brief post Try post job to thread pool.
      * @param handler Handler to be called from thread pool worker. It has
      * to be callable as 'handler()'.
+     * @param affinity Jobs with the same non-zero key are posted to the same
+     * worker, 0 means any worker.
      * @return 'true' on success, false otherwise.
      * @note All exceptions thrown by handler will be suppressed.
      */
     template <typename Handler>
-    bool tryPost(Handler&& handler);
+    bool tryPost(Handler&& handler, size_t affinity = 0);
 
     /**
      * @brief post Post job to thread pool.
@@ -68,11 +77,28 @@ public:
      * @param to_any_queue If true, attempts to post into each worker queue
      * until success. Throws the exception otherwise. If false only one
      * attempt will be made.
+     * @param affinity Affinity key of the first attempt, see tryPost; the
+     * next attempts ignore it.
      * @throw std::overflow_error if worker's queue is full.
      * @note All exceptions thrown by handler will be suppressed.
      */
     template <typename Handler>
-    void post(Handler&& handler, bool to_any_queue = false);
+    void post(Handler&& handler, bool to_any_queue = false, size_t affinity = 0);
+
+    /**
+     * @brief The StealStats struct accumulates work stealing counters of all
+     * workers.
+     */
+    struct StealStats
+    {
+        uint64_t attempts = 0;
+        uint64_t successes = 0;
+    };
+
+    /**
+     * @brief getStealStats Return steal counters summed over all workers.
+     */
+    StealStats getStealStats() const;
 
     int dump_info()
     {
@@ -87,10 +113,18 @@ public:
     }
 
 private:
-    Worker<Task, Queue>& getWorker();
+    size_t getWorkerId();
+
+    /**
+     * @brief wakeup Wake up the worker a task has been posted to. If it is
+     * busy, wake up a worker that can steal from it instead.
+     * @param id Worker ID the task has been posted to.
+     */
+    void wakeup(size_t id);
 
     std::vector<std::unique_ptr<Worker<Task, Queue>>> m_workers;
     std::atomic<size_t> m_next_worker;
+    ThreadPoolOptions::StealMode m_steal_mode;
 };
 
 
@@ -101,17 +135,29 @@ inline ThreadPoolImpl<Task, Queue>::ThreadPoolImpl(
                                             const ThreadPoolOptions& options)
     : m_workers(options.threadCount())
     , m_next_worker(0)
+    , m_steal_mode(options.stealMode())
 {
     for(auto& worker_ptr : m_workers)
     {
-        worker_ptr.reset(new Worker<Task, Queue>(options.queueSize()));
+        worker_ptr.reset(new Worker<Task, Queue>(options));
     }
 
-    for(size_t i = 0; i < m_workers.size(); ++i)
+    const size_t count = m_workers.size();
+    for(size_t i = 0; i < count; ++i)
     {
-        Worker<Task, Queue>* steal_donor =
-                                m_workers[(i + 1) % m_workers.size()].get();
-        m_workers[i]->start(i, steal_donor);
+        std::vector<Worker<Task, Queue>*> victims;
+        if (m_steal_mode == ThreadPoolOptions::StealMode::Ring)
+        {
+            victims.push_back(m_workers[(i + 1) % count].get());
+        }
+        else
+        {
+            for(size_t j = 1; j < count; ++j)
+            {
+                victims.push_back(m_workers[(i + j) % count].get());
+            }
+        }
+        m_workers[i]->start(i, std::move(victims));
     }
 }
 
@@ -138,41 +184,98 @@ ThreadPoolImpl<Task, Queue>::operator=(ThreadPoolImpl<Task, Queue>&& rhs) noexce
     {
         m_workers = std::move(rhs.m_workers);
         m_next_worker = rhs.m_next_worker.load();
+        m_steal_mode = rhs.m_steal_mode;
     }
     return *this;
 }
 
 template <typename Task, template<typename> class Queue>
 template <typename Handler>
-inline bool ThreadPoolImpl<Task, Queue>::tryPost(Handler&& handler)
+inline bool ThreadPoolImpl<Task, Queue>::tryPost(Handler&& handler, size_t affinity)
 {
-    return getWorker().post(std::forward<Handler>(handler));
+    if (affinity != 0)
+    {
+        const size_t id = affinity % m_workers.size();
+        if (!m_workers[id]->post(std::forward<Handler>(handler)))
+            return false;
+        wakeup(id);
+        return true;
+    }
+
+    size_t id = getWorkerId();
+    Worker<Task, Queue>& worker = *m_workers[id];
+    if (m_steal_mode == ThreadPoolOptions::StealMode::Random && worker.isCurrent())
+    {
+        // the owner is running, let an idle sibling steal the job
+        if (!worker.postLocal(std::forward<Handler>(handler)))
+            return false;
+        wakeup((id + 1) % m_workers.size());
+        return true;
+    }
+
+    if (!worker.post(std::forward<Handler>(handler)))
+        return false;
+    wakeup(id);
+    return true;
 }
 
 template <typename Task, template<typename> class Queue>
 template <typename Handler>
-inline void ThreadPoolImpl<Task, Queue>::post(Handler&& handler, bool to_any_queue)
+inline void ThreadPoolImpl<Task, Queue>::post(Handler&& handler, bool to_any_queue, size_t affinity)
 {
     int try_count = (to_any_queue)? m_workers.size() : 1;
     for(int i = 0; i < try_count; ++i)
     {
-        bool ok = tryPost(std::forward<Handler>(handler));
+        bool ok = tryPost(std::forward<Handler>(handler), (i == 0)? affinity : 0);
         if(ok) return;
     }
     throw std::runtime_error("thread pool queue is full");
 }
 
 template <typename Task, template<typename> class Queue>
-inline Worker<Task, Queue>& ThreadPoolImpl<Task, Queue>::getWorker()
+inline size_t ThreadPoolImpl<Task, Queue>::getWorkerId()
 {
     auto id = Worker<Task, Queue>::getWorkerIdForCurrentThread();
 
-    if (id > m_workers.size())
+    if (id >= m_workers.size())
     {
         id = m_next_worker.fetch_add(1, std::memory_order_relaxed) %
              m_workers.size();
     }
 
-    return *m_workers[id];
+    return id;
+}
+
+template <typename Task, template<typename> class Queue>
+inline void ThreadPoolImpl<Task, Queue>::wakeup(size_t id)
+{
+    const size_t count = m_workers.size();
+    if (m_workers[id]->wake())
+        return;
+    if (m_steal_mode == ThreadPoolOptions::StealMode::Ring)
+    {
+        // the worker is busy, the previous one in the ring has it as steal donor
+        m_workers[(id + count - 1) % count]->wake();
+        return;
+    }
+    // the worker is busy, any parked one can steal
+    for (size_t i = 1; i < count; ++i)
+    {
+        if (m_workers[(id + i) % count]->wake())
+            return;
+    }
+}
+
+template <typename Task, template<typename> class Queue>
+inline typename ThreadPoolImpl<Task, Queue>::StealStats
+ThreadPoolImpl<Task, Queue>::getStealStats() const
+{
+    StealStats stats;
+    for (auto& worker_ptr : m_workers)
+    {
+        stats.attempts += worker_ptr->stealAttempts();
+        stats.successes += worker_ptr->stealSuccesses();
+    }
+    return stats;
 }
 }
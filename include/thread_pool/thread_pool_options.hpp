@@ -13,6 +13,28 @@ namespace tp
 class ThreadPoolOptions
 {
 public:
+    /**
+     * @brief The IdleMode enum defines what a worker does when there are no
+     * tasks neither in its own queue nor in the queue of the steal donor.
+     */
+    enum class IdleMode
+    {
+        Sleep, ///< poll queues with one millisecond delay
+        Park   ///< spin for a while, then block until a task is posted
+    };
+
+    /**
+     * @brief The StealMode enum defines which workers an idle worker steals
+     * tasks from.
+     */
+    enum class StealMode
+    {
+        Ring,  ///< from the next worker only
+        Random ///< from all other workers starting from a random one
+    };
+
+    static constexpr size_t defaultSpinCount = 64;
+
     /**
      * @brief ThreadPoolOptions Construct default options for thread pool.
      */
@@ -30,6 +52,25 @@ public:
      */
     void setQueueSize(size_t size);
 
+    /**
+     * @brief setIdleMode Set behaviour of idle workers.
+     * @param mode Idle mode.
+     */
+    void setIdleMode(IdleMode mode);
+
+    /**
+     * @brief setSpinCount Set number of polling attempts an idle worker makes
+     * before it parks. Used in IdleMode::Park only.
+     * @param count Number of attempts, each followed by the thread yield.
+     */
+    void setSpinCount(size_t count);
+
+    /**
+     * @brief setStealMode Set work stealing strategy.
+     * @param mode Steal mode.
+     */
+    void setStealMode(StealMode mode);
+
     /**
      * @brief threadCount Return thread count.
      */
@@ -40,9 +81,27 @@ public:
      */
     size_t queueSize() const;
 
+    /**
+     * @brief idleMode Return behaviour of idle workers.
+     */
+    IdleMode idleMode() const;
+
+    /**
+     * @brief spinCount Return number of polling attempts before parking.
+     */
+    size_t spinCount() const;
+
+    /**
+     * @brief stealMode Return work stealing strategy.
+     */
+    StealMode stealMode() const;
+
 private:
     size_t m_thread_count;
     size_t m_queue_size;
+    IdleMode m_idle_mode;
+    size_t m_spin_count;
+    StealMode m_steal_mode;
 };
 
 /// Implementation
@@ -50,6 +109,9 @@ private:
 inline ThreadPoolOptions::ThreadPoolOptions()
     : m_thread_count(std::max<size_t>(1u, std::thread::hardware_concurrency()))
     , m_queue_size(1024u)
+    , m_idle_mode(IdleMode::Park)
+    , m_spin_count(defaultSpinCount)
+    , m_steal_mode(StealMode::Random)
 {
 }
 
@@ -63,6 +125,21 @@ inline void ThreadPoolOptions::setQueueSize(size_t size)
     m_queue_size = std::max<size_t>(1u, size);
 }
 
+inline void ThreadPoolOptions::setIdleMode(IdleMode mode)
+{
+    m_idle_mode = mode;
+}
+
+inline void ThreadPoolOptions::setSpinCount(size_t count)
+{
+    m_spin_count = count;
+}
+
+inline void ThreadPoolOptions::setStealMode(StealMode mode)
+{
+    m_steal_mode = mode;
+}
+
 inline size_t ThreadPoolOptions::threadCount() const
 {
     return m_thread_count;
@@ -73,4 +150,19 @@ inline size_t ThreadPoolOptions::queueSize() const
     return m_queue_size;
 }
 
+inline ThreadPoolOptions::IdleMode ThreadPoolOptions::idleMode() const
+{
+    return m_idle_mode;
+}
+
+inline size_t ThreadPoolOptions::spinCount() const
+{
+    return m_spin_count;
+}
+
+inline ThreadPoolOptions::StealMode ThreadPoolOptions::stealMode() const
+{
+    return m_steal_mode;
+}
+
 }
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace tp
+{
+
+/**
+ * @brief The WorkStealingDeque class implements bounded Chase-Lev
+ * work-stealing deque.
+ * The owner thread pushes and pops items at the bottom end (LIFO), any other
+ * thread can steal items from the top end (FIFO).
+ * Items are stored in atomics, so T has to be trivially copyable
+ * (e.g. a pointer to the task).
+ * @see N.M. Le, A. Pop, A. Cohen, F. Zappa Nardelli "Correct and Efficient
+ * Work-Stealing for Weak Memory Models".
+ */
+template <typename T>
+class WorkStealingDeque
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "T has to be trivially copyable");
+public:
+    /**
+     * @brief WorkStealingDeque Constructor.
+     * @param size Power of 2 number - deque capacity.
+     * @throws std::invalid_argument if size is bad.
+     */
+    explicit WorkStealingDeque(size_t size);
+
+    /**
+     * @brief push Push item to the bottom. Owner thread only.
+     * @param item Item to be pushed.
+     * @return true on success, false if the deque is full.
+     */
+    bool push(T item);
+
+    /**
+     * @brief pop Pop item from the bottom. Owner thread only.
+     * @param item Place to store popped item.
+     * @return true on success.
+     */
+    bool pop(T& item);
+
+    /**
+     * @brief steal Steal item from the top. Any thread.
+     * @param item Place to store stolen item.
+     * @return true on success.
+     */
+    bool steal(T& item);
+
+    /**
+     * @brief size Return approximate number of items.
+     */
+    size_t size() const;
+
+    /**
+     * @brief capacity Return maximum number of items.
+     */
+    size_t capacity() const;
+
+private:
+    std::vector<std::atomic<T>> m_buffer;
+    const int64_t m_mask;
+
+    typedef char Cacheline[64];
+    Cacheline m_pad0;
+    std::atomic<int64_t> m_top;
+    Cacheline m_pad1;
+    std::atomic<int64_t> m_bottom;
+    Cacheline m_pad2;
+};
+
+
+/// Implementation
+
+template <typename T>
+inline WorkStealingDeque<T>::WorkStealingDeque(size_t size)
+    : m_buffer(size)
+    , m_mask(static_cast<int64_t>(size) - 1)
+    , m_top(0)
+    , m_bottom(0)
+{
+    bool size_is_power_of_2 = (size >= 2) && ((size & (size - 1)) == 0);
+    if(!size_is_power_of_2)
+    {
+        throw std::invalid_argument("buffer size should be a power of 2");
+    }
+}
+
+template <typename T>
+inline bool WorkStealingDeque<T>::push(T item)
+{
+    int64_t b = m_bottom.load(std::memory_order_relaxed);
+    int64_t t = m_top.load(std::memory_order_acquire);
+    if (b - t > m_mask)
+    {
+        return false;
+    }
+    m_buffer[b & m_mask].store(item, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+}
+
+template <typename T>
+inline bool WorkStealingDeque<T>::pop(T& item)
+{
+    int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+
+    if (t > b)
+    {
+        // empty
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    item = m_buffer[b & m_mask].load(std::memory_order_relaxed);
+    if (t == b)
+    {
+        // the last item, race against thieves
+        bool won = m_top.compare_exchange_strong(t, t + 1,
+                                                 std::memory_order_seq_cst,
+                                                 std::memory_order_relaxed);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+template <typename T>
+inline bool WorkStealingDeque<T>::steal(T& item)
+{
+    int64_t t = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = m_bottom.load(std::memory_order_acquire);
+
+    if (t >= b)
+    {
+        return false;
+    }
+
+    item = m_buffer[t & m_mask].load(std::memory_order_relaxed);
+    return m_top.compare_exchange_strong(t, t + 1,
+                                         std::memory_order_seq_cst,
+                                         std::memory_order_relaxed);
+}
+
+template <typename T>
+inline size_t WorkStealingDeque<T>::size() const
+{
+    int64_t b = m_bottom.load(std::memory_order_relaxed);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+    return (b > t)? static_cast<size_t>(b - t) : 0;
+}
+
+template <typename T>
+inline size_t WorkStealingDeque<T>::capacity() const
+{
+    return m_buffer.size();
+}
+
+}
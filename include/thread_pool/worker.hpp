@@ -1,16 +1,30 @@
 #pragma once
 
+#include <thread_pool/thread_pool_options.hpp>
+#include <thread_pool/work_stealing_deque.hpp>
+
 #include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 namespace tp
 {
 
 /**
- * @brief The Worker class owns task queue and executing thread.
- * In thread it tries to pop task from queue. If queue is empty then it tries
- * to steal task from the sibling worker. If steal was unsuccessful then spins
- * with one millisecond delay.
+ * @brief The Worker class owns task queues and executing thread.
+ * Tasks posted from outside of the pool go to the injection queue, tasks
+ * posted from the executing thread itself go to the local work-stealing deque.
+ * In thread it tries to pop task from the deque and then from the injection
+ * queue. If both are empty then it tries to steal task from the victims (the
+ * sibling worker in StealMode::Ring, all other workers in random order in
+ * StealMode::Random). If steal was unsuccessful then, depending on the idle
+ * mode, it either polls again after one millisecond delay (IdleMode::Sleep)
+ * or spins for a while and then parks until a task is posted and the worker
+ * is woken up (IdleMode::Park).
  */
 template <typename Task, template<typename> class Queue>
 class Worker
@@ -18,26 +32,20 @@ class Worker
 public:
     /**
      * @brief Worker Constructor.
-     * @param queue_size Length of undelaying task queue.
-     */
-    explicit Worker(size_t queue_size);
-
-    /**
-     * @brief Move ctor implementation.
+     * @param options Creation options, queue size, idle and steal modes are
+     * used.
      */
-    Worker(Worker&& rhs) noexcept;
+    explicit Worker(const ThreadPoolOptions& options);
 
-    /**
-     * @brief Move assignment implementaion.
-     */
-    Worker& operator=(Worker&& rhs) noexcept;
+    Worker(const Worker&) = delete;
+    Worker& operator=(const Worker&) = delete;
 
     /**
      * @brief start Create the executing thread and start tasks execution.
      * @param id Worker ID.
-     * @param steal_donor Sibling worker to steal task from it.
+     * @param victims Sibling workers to steal tasks from.
      */
-    void start(size_t id, Worker* steal_donor);
+    void start(size_t id, std::vector<Worker*> victims);
 
     /**
      * @brief stop Stop all worker's thread and stealing activity.
@@ -46,7 +54,7 @@ public:
     void stop();
 
     /**
-     * @brief post Post task to queue.
+     * @brief post Post task to injection queue.
      * @param handler Handler to be executed in executing thread.
      * @return true on success.
      */
@@ -54,12 +62,45 @@ public:
     bool post(Handler&& handler);
 
     /**
-     * @brief steal Steal one task from this worker queue.
+     * @brief postLocal Post task to the local deque. Can be called from the
+     * executing thread of this worker only. Falls back to the injection queue
+     * if the deque is full or the next task slot is still being taken.
+     * @param handler Handler to be executed in executing thread.
+     * @return true on success.
+     */
+    template <typename Handler>
+    bool postLocal(Handler&& handler);
+
+    /**
+     * @brief steal Steal one task from this worker, either from the top of
+     * the local deque or from the injection queue.
      * @param task Place for stealed task to be stored.
      * @return true on success.
      */
     bool steal(Task& task);
 
+    /**
+     * @brief wake Wake up the executing thread if it is parked.
+     * @return true if the thread was parked, false if it is busy or spinning.
+     */
+    bool wake();
+
+    /**
+     * @brief isCurrent Check if current thread is the executing thread of
+     * this worker.
+     */
+    bool isCurrent() const;
+
+    /**
+     * @brief stealAttempts Return number of steal attempts made by this worker.
+     */
+    uint64_t stealAttempts() const;
+
+    /**
+     * @brief stealSuccesses Return number of tasks stolen by this worker.
+     */
+    uint64_t stealSuccesses() const;
+
     /**
      * @brief getWorkerIdForCurrentThread Return worker ID associated with
      * current thread if exists.
@@ -71,13 +112,61 @@ private:
     /**
      * @brief threadFunc Executing thread function.
      * @param id Worker ID to be associated with this thread.
-     * @param steal_donor Sibling worker to steal task from it.
      */
-    void threadFunc(size_t id, Worker* steal_donor);
+    void threadFunc(size_t id);
+
+    /**
+     * @brief tryGetTask Pop own task or steal one from victims.
+     * @return true if a task has been stored into the handler.
+     */
+    bool tryGetTask(Task& handler);
+
+    /**
+     * @brief trySteal Try victims starting from a random one.
+     * @return true if a task has been stored into the handler.
+     */
+    bool trySteal(Task& handler);
+
+    /**
+     * @brief park Block the executing thread until a task appears either in
+     * own queues or in one of the victims, or the worker is stopped.
+     * @return true if a task has been stored into the handler.
+     */
+    bool park(Task& handler);
+
+    /**
+     * @brief The Slot struct keeps a task of the local deque, the deque holds
+     * pointers to the slots. The slots are allocated once and reused in turn,
+     * busy is cleared by the thread that has moved the task out.
+     */
+    struct Slot
+    {
+        Task task;
+        std::atomic<bool> busy{false};
+    };
+
+    /**
+     * @brief take Move the task out of the slot and free it.
+     */
+    static void take(Slot* slot, Task& task);
 
     Queue<Task> m_queue;
+    WorkStealingDeque<Slot*> m_deque;
+    std::unique_ptr<Slot[]> m_slots;
+    size_t m_next_slot;
+    std::vector<Worker*> m_victims;
     std::atomic<bool> m_running_flag;
     std::thread m_thread;
+
+    ThreadPoolOptions::IdleMode m_idle_mode;
+    size_t m_spin_count;
+    std::atomic<bool> m_parked;
+    std::mutex m_park_mutex;
+    std::condition_variable m_park_cond;
+
+    uint32_t m_rand_state;
+    std::atomic<uint64_t> m_steal_attempts;
+    std::atomic<uint64_t> m_steal_successes;
 };
 
 
@@ -90,44 +179,56 @@ namespace detail
         static thread_local size_t tss_id = -1u;
         return &tss_id;
     }
-}
 
-template <typename Task, template<typename> class Queue>
-inline Worker<Task, Queue>::Worker(size_t queue_size)
-    : m_queue(queue_size)
-    , m_running_flag(true)
-{
-}
+    inline const void** thread_worker()
+    {
+        static thread_local const void* tss_worker = nullptr;
+        return &tss_worker;
+    }
 
-template <typename Task, template<typename> class Queue>
-inline Worker<Task, Queue>::Worker(Worker&& rhs) noexcept
-{
-    *this = rhs;
+    inline size_t deque_size(size_t queue_size)
+    {
+        size_t bit = 2;
+        for(; bit < queue_size; bit <<= 1);
+        return bit;
+    }
 }
 
 template <typename Task, template<typename> class Queue>
-inline Worker<Task, Queue>& Worker<Task, Queue>::operator=(Worker&& rhs) noexcept
+inline Worker<Task, Queue>::Worker(const ThreadPoolOptions& options)
+    : m_queue(options.queueSize())
+    , m_deque(detail::deque_size(options.queueSize()))
+    , m_slots(new Slot[m_deque.capacity()])
+    , m_next_slot(0)
+    , m_running_flag(true)
+    , m_idle_mode(options.idleMode())
+    , m_spin_count(options.spinCount())
+    , m_parked(false)
+    , m_rand_state(1)
+    , m_steal_attempts(0)
+    , m_steal_successes(0)
 {
-    if (this != &rhs)
-    {
-        m_queue = std::move(rhs.m_queue);
-        m_running_flag = rhs.m_running_flag.load();
-        m_thread = std::move(rhs.m_thread);
-    }
-    return *this;
 }
 
 template <typename Task, template<typename> class Queue>
 inline void Worker<Task, Queue>::stop()
 {
     m_running_flag.store(false, std::memory_order_relaxed);
+    {
+        // the lock guarantees the parked thread is either waiting already
+        // or will see the cleared flag before it waits
+        std::lock_guard<std::mutex> lock(m_park_mutex);
+    }
+    m_park_cond.notify_all();
     m_thread.join();
 }
 
 template <typename Task, template<typename> class Queue>
-inline void Worker<Task, Queue>::start(size_t id, Worker* steal_donor)
+inline void Worker<Task, Queue>::start(size_t id, std::vector<Worker*> victims)
 {
-    m_thread = std::thread(&Worker<Task, Queue>::threadFunc, this, id, steal_donor);
+    m_victims = std::move(victims);
+    m_rand_state = static_cast<uint32_t>(id) * 2654435761u + 1;
+    m_thread = std::thread(&Worker<Task, Queue>::threadFunc, this, id);
 }
 
 template <typename Task, template<typename> class Queue>
@@ -136,6 +237,12 @@ inline size_t Worker<Task, Queue>::getWorkerIdForCurrentThread()
     return *detail::thread_id();
 }
 
+template <typename Task, template<typename> class Queue>
+inline bool Worker<Task, Queue>::isCurrent() const
+{
+    return *detail::thread_worker() == this;
+}
+
 template <typename Task, template<typename> class Queue>
 template <typename Handler>
 inline bool Worker<Task, Queue>::post(Handler&& handler)
@@ -143,23 +250,155 @@ inline bool Worker<Task, Queue>::post(Handler&& handler)
     return m_queue.push(std::forward<Handler>(handler));
 }
 
+template <typename Task, template<typename> class Queue>
+template <typename Handler>
+inline bool Worker<Task, Queue>::postLocal(Handler&& handler)
+{
+    // only the owner pushes, so the deque cannot become full after the check
+    if (m_deque.size() >= m_deque.capacity())
+        return m_queue.push(std::forward<Handler>(handler));
+    // a thief may still be moving the task out of the slot it has stolen
+    Slot* slot = &m_slots[m_next_slot & (m_deque.capacity() - 1)];
+    if (slot->busy.load(std::memory_order_acquire))
+        return m_queue.push(std::forward<Handler>(handler));
+    ++m_next_slot;
+    slot->task = std::forward<Handler>(handler);
+    slot->busy.store(true, std::memory_order_relaxed);
+    return m_deque.push(slot);
+}
+
+template <typename Task, template<typename> class Queue>
+inline void Worker<Task, Queue>::take(Slot* slot, Task& task)
+{
+    task = std::move(slot->task);
+    slot->busy.store(false, std::memory_order_release);
+}
+
 template <typename Task, template<typename> class Queue>
 inline bool Worker<Task, Queue>::steal(Task& task)
 {
+    Slot* stolen;
+    if (m_deque.steal(stolen))
+    {
+        take(stolen, task);
+        return true;
+    }
     return m_queue.pop(task);
 }
 
 template <typename Task, template<typename> class Queue>
-inline void Worker<Task, Queue>::threadFunc(size_t id, Worker* steal_donor)
+inline uint64_t Worker<Task, Queue>::stealAttempts() const
+{
+    return m_steal_attempts.load(std::memory_order_relaxed);
+}
+
+template <typename Task, template<typename> class Queue>
+inline uint64_t Worker<Task, Queue>::stealSuccesses() const
+{
+    return m_steal_successes.load(std::memory_order_relaxed);
+}
+
+template <typename Task, template<typename> class Queue>
+inline bool Worker<Task, Queue>::wake()
+{
+    // pairs with the fence in park(): either the poster sees the parked flag
+    // or the parked thread sees the pushed task
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!m_parked.load(std::memory_order_relaxed))
+        return false;
+    {
+        std::lock_guard<std::mutex> lock(m_park_mutex);
+    }
+    m_park_cond.notify_one();
+    return true;
+}
+
+template <typename Task, template<typename> class Queue>
+inline bool Worker<Task, Queue>::trySteal(Task& handler)
+{
+    const size_t count = m_victims.size();
+    if (count == 0)
+        return false;
+
+    // xorshift32, the state is touched by the executing thread only
+    m_rand_state ^= m_rand_state << 13;
+    m_rand_state ^= m_rand_state >> 17;
+    m_rand_state ^= m_rand_state << 5;
+
+    m_steal_attempts.fetch_add(1, std::memory_order_relaxed);
+    const size_t first = m_rand_state % count;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (m_victims[(first + i) % count]->steal(handler))
+        {
+            m_steal_successes.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename Task, template<typename> class Queue>
+inline bool Worker<Task, Queue>::tryGetTask(Task& handler)
+{
+    Slot* slot;
+    if (m_deque.pop(slot))
+    {
+        // the last posted task is popped, the next post takes its slot again
+        if (slot == &m_slots[(m_next_slot - 1) & (m_deque.capacity() - 1)])
+            --m_next_slot;
+        take(slot, handler);
+        return true;
+    }
+    return m_queue.pop(handler) || trySteal(handler);
+}
+
+template <typename Task, template<typename> class Queue>
+inline bool Worker<Task, Queue>::park(Task& handler)
+{
+    std::unique_lock<std::mutex> lock(m_park_mutex);
+    m_parked.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    bool ready = false;
+    while (m_running_flag.load(std::memory_order_relaxed))
+    {
+        ready = tryGetTask(handler);
+        if (ready)
+            break;
+        m_park_cond.wait(lock);
+    }
+
+    m_parked.store(false, std::memory_order_relaxed);
+    return ready;
+}
+
+template <typename Task, template<typename> class Queue>
+inline void Worker<Task, Queue>::threadFunc(size_t id)
 {
     *detail::thread_id() = id;
+    *detail::thread_worker() = this;
 
     Task handler;
+    size_t spins = 0;
 
     while (m_running_flag.load(std::memory_order_relaxed))
     {
-        if (m_queue.pop(handler) || steal_donor->steal(handler))
+        bool ready = tryGetTask(handler);
+        if (!ready && m_idle_mode == ThreadPoolOptions::IdleMode::Park)
+        {
+            if (spins < m_spin_count)
+            {
+                ++spins;
+                std::this_thread::yield();
+                continue;
+            }
+            ready = park(handler);
+        }
+
+        if (ready)
         {
+            spins = 0;
             try
             {
                 handler();
@@ -170,7 +409,7 @@ inline void Worker<Task, Queue>::threadFunc(size_t id, Worker* steal_donor)
                 throw;
             }
         }
-        else
+        else if (m_idle_mode == ThreadPoolOptions::IdleMode::Sleep)
         {
             std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
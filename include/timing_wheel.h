@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace graft
+{
+    //////////////
+    /// \brief The TimingWheelHook class
+    /// Intrusive link of an object scheduled in TimingWheel, the object derives from it.
+    ///
+    struct TimingWheelHook
+    {
+        TimingWheelHook* prev = nullptr;
+        TimingWheelHook* next = nullptr;
+        int64_t deadline = 0;
+
+        bool linked() const { return prev != nullptr; }
+    };
+
+    //////////////
+    /// \brief The TimingWheel class
+    /// Hierarchical timing wheel of LEVELS levels with 2^BITS slots each, the time is in abstract ticks.
+    /// Level L holds the hooks due in less than 2^(BITS*(L+1)) ticks; when the lower level wraps around,
+    /// the next slot of the upper level is cascaded down. Scheduling and cancelling are O(1), advancing
+    /// is O(1) amortized per tick and per hook. A hook due beyond the range waits at its end and is placed again.
+    /// The wheel is not thread-safe, and does not own the hooks.
+    ///
+    template<size_t LEVELS = 4, size_t BITS = 6>
+    class TimingWheel
+    {
+    public:
+        static constexpr size_t SLOTS = size_t(1) << BITS;
+
+        explicit TimingWheel(int64_t now) : m_now(now)
+        {
+            for(auto& level : m_slots)
+            {
+                for(TimingWheelHook& s : level)
+                {
+                    s.prev = s.next = &s;
+                }
+            }
+        }
+
+        TimingWheel(const TimingWheel&) = delete;
+        TimingWheel& operator = (const TimingWheel&) = delete;
+
+        //reschedules the hook if it is scheduled already
+        void schedule(TimingWheelHook* h, int64_t deadline)
+        {
+            if(h->linked())
+            {
+                unlink(h);
+                --m_size;
+            }
+            h->deadline = deadline;
+            link(h, m_now + 1);
+            ++m_size;
+        }
+
+        void cancel(TimingWheelHook* h)
+        {
+            if(!h->linked()) return;
+            unlink(h);
+            --m_size;
+        }
+
+        //calls f(hook) for each hook due up to now, the hook is unlinked before the call and can be rescheduled
+        template<typename F>
+        void advance(int64_t now, F f)
+        {
+            while(m_now < now)
+            {
+                if(m_size == 0)
+                {
+                    m_now = now;
+                    break;
+                }
+                const int64_t t = ++m_now;
+                //cascade the upper levels that wrap around at t, starting from the highest one
+                size_t top = 0;
+                while(top + 1 < LEVELS && (t & ((int64_t(1) << (BITS * (top + 1))) - 1)) == 0) ++top;
+                for(size_t level = top; 0 < level; --level)
+                {
+                    TimingWheelHook& slot = m_slots[level][(t >> (BITS * level)) & (SLOTS - 1)];
+                    while(slot.next != &slot)
+                    {
+                        TimingWheelHook* h = slot.next;
+                        unlink(h);
+                        link(h, t);
+                    }
+                }
+                TimingWheelHook& slot = m_slots[0][t & (SLOTS - 1)];
+                while(slot.next != &slot)
+                {
+                    TimingWheelHook* h = slot.next;
+                    unlink(h);
+                    if(t < h->deadline)
+                    {//clamped to the range of the wheel
+                        link(h, t + 1);
+                        continue;
+                    }
+                    --m_size;
+                    f(h);
+                }
+            }
+        }
+
+        int64_t now() const { return m_now; }
+        size_t size() const { return m_size; }
+    private:
+        //the hook is placed to the slot of its deadline, but not earlier than the tick
+        void link(TimingWheelHook* h, int64_t earliest)
+        {
+            const int64_t range = int64_t(1) << (BITS * LEVELS);
+            int64_t deadline = (h->deadline < earliest)? earliest : h->deadline;
+            if(range <= deadline - m_now) deadline = m_now + range - 1;
+            const int64_t delta = deadline - m_now;
+            size_t level = 0;
+            while(level + 1 < LEVELS && (int64_t(1) << (BITS * (level + 1))) <= delta) ++level;
+            TimingWheelHook& slot = m_slots[level][(deadline >> (BITS * level)) & (SLOTS - 1)];
+            h->prev = slot.prev;
+            h->next = &slot;
+            slot.prev->next = h;
+            slot.prev = h;
+        }
+
+        void unlink(TimingWheelHook* h)
+        {
+            h->prev->next = h->next;
+            h->next->prev = h->prev;
+            h->prev = h->next = nullptr;
+        }
+
+        int64_t m_now;
+        size_t m_size = 0;
+        TimingWheelHook m_slots[LEVELS][SLOTS];
+    };
+}
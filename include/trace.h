@@ -0,0 +1,140 @@
+#pragma once
+
+#include "graft_constants.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace graft
+{
+
+#define GRAFT_TRACE_STAGE_LIST(EXP) \
+    EXP(accept) \
+    EXP(pre_action) \
+    EXP(admitted) \
+    EXP(enqueue) \
+    EXP(worker_start) \
+    EXP(worker_finish) \
+    EXP(upstream_send) \
+    EXP(upstream_reply) \
+    EXP(postpone) \
+    EXP(resume) \
+    EXP(respond)
+
+//points of the task pipeline where a request is timestamped
+enum class TraceStage : uint8_t { GRAFT_TRACE_STAGE_LIST(EXP_TO_ENUM) Count };
+
+const char* traceStageName(TraceStage stage);
+
+//////////////
+/// \brief The TraceSpan class
+/// Fixed size record of the stages a task has passed. It is a part of BaseTask and does not allocate.
+/// The marks above MAX_MARKS are counted but not stored.
+///
+class TraceSpan
+{
+public:
+    using clock = std::chrono::steady_clock;
+    static constexpr size_t MAX_MARKS = 32;
+
+    struct Mark
+    {
+        uint32_t offset_us; //since the first mark
+        TraceStage stage;
+    };
+
+    void mark(TraceStage stage)
+    {
+        clock::time_point now = clock::now();
+        if(m_count == 0) m_start = now;
+        if(m_count < MAX_MARKS)
+        {
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - m_start).count();
+            m_marks[m_count] = Mark{static_cast<uint32_t>(us), stage};
+        }
+        ++m_count;
+    }
+
+    clock::time_point start() const { return m_start; }
+    size_t size() const { return std::min<size_t>(m_count, MAX_MARKS); }
+    size_t dropped() const { return m_count - size(); }
+    const Mark& operator [](size_t idx) const { return m_marks[idx]; }
+private:
+    clock::time_point m_start;
+    std::array<Mark, MAX_MARKS> m_marks;
+    uint32_t m_count = 0;
+};
+
+//////////////
+/// \brief The TraceRegistry class
+/// Process-wide collector of finished spans. For each route it keeps a latency histogram per stage,
+/// the value of a stage is the time from the previous mark to the mark of the stage.
+/// The histograms of a route are sharded per thread as the metrics are, so the loopers record without a lock;
+/// the route is resolved once, when the router is armed, and the shards are summed on read.
+/// One of sample_rate spans is also kept (up to MAX_SAMPLES last ones) to be dumped in Chrome trace format
+/// (chrome://tracing, Perfetto).
+///
+class TraceRegistry
+{
+public:
+    static constexpr size_t MAX_SAMPLES = 256;
+    //bucket i counts values in [2^(i-1), 2^i) microseconds, bucket 0 counts values below 1 us
+    static constexpr size_t BUCKET_COUNT = 32;
+
+    //the histograms of a route, created once and never destroyed
+    struct RouteStats;
+
+    static TraceRegistry& instance();
+
+    //0 disables sampling
+    void setSampleRate(unsigned int rate) { m_sampleRate = rate; }
+    unsigned int getSampleRate() const { return m_sampleRate; }
+
+    //finds or creates the histograms of the route under the lock, the result is kept by the caller
+    RouteStats& route(const std::string& route);
+
+    void record(RouteStats& route, const TraceSpan& span);
+    void record(const std::string& route, const TraceSpan& span) { record(this->route(route), span); }
+
+    //{"routes":[{"route":"/dapi/v2.0/pay","stages":[{"stage":"worker_finish","count":..,"p50_us":..,"p99_us":..,"max_us":..,"buckets":[..]},..]},..]}
+    std::string histogramsJson() const;
+    //{"traceEvents":[..]} of the sampled spans
+    std::string chromeTraceJson() const;
+    void clear();
+private:
+    struct Histogram
+    {
+        uint64_t count = 0;
+        uint64_t sum_us = 0;
+        uint64_t max_us = 0;
+        std::array<uint64_t, BUCKET_COUNT> buckets{};
+
+        uint64_t percentile(double p) const;
+    };
+
+    struct Sample
+    {
+        std::string route;
+        TraceSpan span;
+    };
+
+    TraceRegistry() = default;
+
+    std::atomic<unsigned int> m_sampleRate{0};
+    std::atomic<uint64_t> m_recorded{0};
+
+    //guards the routes map and the samples, not the histograms
+    mutable std::mutex m_mutex;
+    std::map<std::string, std::unique_ptr<RouteStats>> m_routes;
+    std::deque<Sample> m_samples;
+};
+
+}//namespace graft
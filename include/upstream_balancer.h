@@ -0,0 +1,106 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace graft
+{
+
+//////////////
+/// \brief The UpstreamBalancer class
+/// Chooses the cryptonode backend for a request. The backend with the lowest EWMA latency, scaled by its requests in
+/// flight, is chosen; a backend without recent samples is tried first, so that a recovered one is probed again.
+/// Each backend has a circuit breaker: after breakerFailures failures in a row it is not chosen for breakerCooldown,
+/// then one probe request is let through, and its success closes the circuit. When all circuits are open the request
+/// goes to the backend whose circuit reopens first.
+/// The requests to hedgePaths ("/getheight" or "/json_rpc:get_info"), which must be idempotent, are also sent to a
+/// second backend when the first one has not answered within the p95 of the recent latencies.
+/// It is used by the looper thread only.
+///
+class UpstreamBalancer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    //the latency weight of a new sample
+    static constexpr double EWMA_ALPHA = 0.2;
+    //a backend without samples for this long is probed again
+    static constexpr std::chrono::seconds PROBE_INTERVAL{10};
+    //the latencies the p95 is taken over, and the samples required for hedging
+    static constexpr size_t LATENCY_WINDOW = 128;
+    static constexpr size_t MIN_HEDGE_SAMPLES = 16;
+    static constexpr std::chrono::milliseconds MIN_HEDGE_DELAY{2};
+
+    UpstreamBalancer(const std::vector<std::string>& addresses, int breakerFailures,
+                     std::chrono::milliseconds breakerCooldown, const std::set<std::string>& hedgePaths);
+    ~UpstreamBalancer() = default;
+
+    UpstreamBalancer(const UpstreamBalancer&) = delete;
+    UpstreamBalancer& operator = (const UpstreamBalancer&) = delete;
+
+    size_t size() const { return m_backends.size(); }
+    const std::string& address(int backend) const { return m_backends[backend].address; }
+
+    /*!
+     * \brief pick - chooses the backend for the next request.
+     * \param exclude - the backend that is not chosen, the one of the first request for the hedged or failed over one
+     * \return -1 if there is no backend except exclude
+     */
+    int pick(int exclude = -1);
+    //a request is sent to the backend
+    void onStart(int backend);
+    //the request to the backend is answered, or failed
+    void onResult(int backend, bool ok, Clock::duration latency);
+    //the hedged request lost to the other backend and is dropped, it is neither a failure nor a latency sample
+    void onCancelled(int backend);
+
+    //the request is one of hedgePaths, so it can be sent twice
+    bool idempotent(const std::string& path, const std::string& body) const;
+    //the delay of the hedged request, zero if there are not enough samples or backends to hedge
+    Clock::duration hedgeDelay();
+
+    //the hedged requests sent
+    uint64_t hedgeCount() const { return m_hedges; }
+    void onHedge() { ++m_hedges; }
+    //the requests sent to another backend after a failure
+    uint64_t failoverCount() const { return m_failovers; }
+    void onFailover() { ++m_failovers; }
+    //the circuits opened
+    uint64_t openCount() const { return m_opens; }
+    size_t openBackends() const;
+private:
+    struct Backend
+    {
+        std::string address;
+        //seconds, valid if samples is not zero
+        double ewma = 0;
+        uint64_t samples = 0;
+        Clock::time_point lastSample;
+        int inFlight = 0;
+        int failures = 0;
+        bool open = false;
+        bool probing = false;
+        Clock::time_point openUntil;
+    };
+
+    bool available(const Backend& b, Clock::time_point now) const;
+
+    std::vector<Backend> m_backends;
+    int m_breakerFailures;
+    Clock::duration m_breakerCooldown;
+    std::set<std::string> m_hedgePaths;
+    //the ring of the recent latencies of all backends
+    std::vector<Clock::duration> m_latencies;
+    size_t m_latencyPos = 0;
+    size_t m_sinceP95 = 0;
+    Clock::duration m_p95 = Clock::duration::zero();
+    uint64_t m_hedges = 0;
+    uint64_t m_failovers = 0;
+    uint64_t m_opens = 0;
+};
+
+}//namespace graft
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "inout.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace graft
+{
+
+class BaseTask;
+
+//"http://host:port/json_rpc?a=b" -> "/json_rpc"
+std::string urlPath(const std::string& url);
+//the value of the first "method" member of a JSON-RPC request, empty if there is none
+std::string jsonRpcMethod(const std::string& body);
+
+//////////////
+/// \brief The UpstreamCache class
+/// Replies of the upstream to the idempotent reads, keyed by the url and the request body, and the requests in flight.
+/// The TTL is configured per url path ("/getheight") or per path and JSON-RPC method ("/json_rpc:get_info"),
+/// the requests to other paths are not cached. A request identical to one in flight waits for its reply instead of
+/// going to the upstream (single flight), so N concurrent requests make one upstream call.
+/// Only 200 replies are kept; a failed request fails its waiters too.
+/// It is used by the looper thread only.
+///
+class UpstreamCache
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    using TaskPtr = std::shared_ptr<BaseTask>;
+
+    enum class Lookup
+    {
+        Bypass, //not cached, send it
+        Hit,    //the reply is cached
+        Joined, //the task waits for the request in flight
+        Miss,   //send it and complete the key
+    };
+
+    static constexpr size_t MAX_ENTRIES = 4096;
+
+    //ttls_ms maps the path or "path:method" to the TTL in milliseconds, 0 disables caching of the path
+    explicit UpstreamCache(const std::map<std::string, int>& ttls_ms);
+    ~UpstreamCache() = default;
+
+    UpstreamCache(const UpstreamCache&) = delete;
+    UpstreamCache& operator = (const UpstreamCache&) = delete;
+
+    /*!
+     * \brief lookup - finds the reply for the request or the identical request in flight.
+     * On Hit, reply points to the cached reply; it is valid until the next call.
+     * On Joined, bt is kept until the key is completed.
+     * On Miss, key is set, the caller sends the request and completes the key with the result.
+     */
+    Lookup lookup(const std::string& url, const std::string& body, const TaskPtr& bt,
+                  const Input*& reply, std::string& key);
+
+    /*!
+     * \brief complete - ends the request in flight, reply is nullptr on failure.
+     * \return the tasks waiting for the reply
+     */
+    std::vector<TaskPtr> complete(const std::string& key, const Input* reply);
+
+    bool enabled() const { return !m_ttls.empty(); }
+
+    //the requests answered from the cache
+    uint64_t hitCount() const { return m_hits; }
+    //the requests sent to the upstream that can be cached
+    uint64_t missCount() const { return m_misses; }
+    //the requests that waited for an identical one in flight
+    uint64_t coalescedCount() const { return m_coalesced; }
+    size_t size() const { return m_entries.size(); }
+private:
+    struct Entry
+    {
+        Input reply;
+        Clock::time_point expires;
+        bool pending = true;
+        std::vector<TaskPtr> waiters;
+    };
+
+    Clock::duration ttl(const std::string& path, const std::string& body) const;
+    void sweep(Clock::time_point now);
+
+    std::unordered_map<std::string, Clock::duration> m_ttls;
+    //the key is the url and the body, so that equal hashes of different bodies never share a reply
+    std::unordered_map<std::string, Entry> m_entries;
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+    uint64_t m_coalesced = 0;
+};
+
+}//namespace graft
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct mg_mgr;
+struct mg_connection;
+
+namespace graft
+{
+
+//////////////
+/// \brief The UpstreamPool class
+/// Persistent HTTP/1.1 connections of a looper to the upstreams (the cryptonode mostly), keyed by the scheme and
+/// host:port. A connection is borrowed for a request and given back when the reply is complete; then it waits
+/// for the next request up to the idle timeout. A connection is evicted when the peer closes it, sends
+/// something while idle, answers with Connection: close, or fails a request.
+/// Up to maxPerHost connections to a host are kept, the requests beyond it are sent over one-time connections.
+/// It is used by the looper thread only.
+///
+class UpstreamPool
+{
+public:
+    using Handler = void (*)(mg_connection* nc, int ev, void* ev_data);
+
+    //maxPerHost equal to 0 disables the pool, idleTimeout is in seconds
+    UpstreamPool(size_t maxPerHost, double idleTimeout);
+    ~UpstreamPool() = default;
+
+    UpstreamPool(const UpstreamPool&) = delete;
+    UpstreamPool& operator = (const UpstreamPool&) = delete;
+
+    /*!
+     * \brief send - writes the request to an idle connection to the host of url, or to a new one. The handler and
+     * user_data are set to the connection. reused is set if the connection served requests before, so it may be
+     * closed by the peer already; fresh disables the reuse.
+     * \return nullptr if the connection cannot be made
+     */
+    mg_connection* send(mg_mgr* mgr, const std::string& url, const char* extra_headers, const std::string& body,
+                        Handler handler, void* user_data, bool fresh, bool& reused);
+
+    //the reply is received; the connection is kept if reusable and it is a pooled one, otherwise it is closed
+    void release(mg_connection* nc, bool reusable);
+    //MG_EV_CLOSE of a borrowed connection
+    void closed(mg_connection* nc);
+
+    //the connections made, including one-time ones
+    uint64_t connectCount() const { return m_connects; }
+    //the requests sent over idle connections
+    uint64_t reuseCount() const { return m_reuses; }
+    //the connections evicted as unhealthy, excluding the idle timeouts and the closes by the peer
+    uint64_t evictCount() const { return m_evictions; }
+    size_t idleCount() const { return m_idle; }
+private:
+    struct Host
+    {
+        std::vector<mg_connection*> idle;
+        size_t total = 0;
+    };
+
+    struct Entry
+    {
+        Host* host;
+        bool idle;
+    };
+
+    static void idleHandler(mg_connection* nc, int ev, void* ev_data);
+    void onIdleEvent(mg_connection* nc, int ev);
+    void forget(mg_connection* nc);
+    void evict(mg_connection* nc);
+
+    size_t m_maxPerHost;
+    double m_idleTimeout;
+    std::unordered_map<std::string, Host> m_hosts;
+    std::unordered_map<mg_connection*, Entry> m_entries;
+    size_t m_idle = 0;
+    uint64_t m_connects = 0;
+    uint64_t m_reuses = 0;
+    uint64_t m_evictions = 0;
+};
+
+}//namespace graft
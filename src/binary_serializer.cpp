@@ -0,0 +1,253 @@
+#include "binary_serializer.h"
+
+namespace graft { namespace serializer { namespace bin {
+
+namespace
+{
+
+//hex of less digits is not worth the ext header
+constexpr size_t MIN_HEX_SIZE = 16;
+constexpr int MAX_DEPTH = 64;
+
+const char hexDigits[] = "0123456789abcdef";
+
+int hexValue(char c)
+{
+    if('0' <= c && c <= '9') return c - '0';
+    if('a' <= c && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+bool isHex(const char* s, size_t len)
+{
+    if(len < MIN_HEX_SIZE || len % 2) return false;
+    for(size_t i = 0; i < len; ++i)
+    {
+        if(hexValue(s[i]) < 0) return false;
+    }
+    return true;
+}
+
+class Reader
+{
+public:
+    Reader(const char* data, size_t size) : m_begin(data), m_cur(data), m_end(data + size) { }
+
+    void header()
+    {
+        if(byte() != static_cast<unsigned char>(MAGIC)) fail("no magic byte");
+        if(byte() != static_cast<unsigned char>(VERSION)) fail("unsupported version");
+    }
+
+    void value(sax::Target t, int depth)
+    {
+        if(MAX_DEPTH < depth) fail("too deep");
+        unsigned char c = byte();
+        if(c <= 0x7f) return t.ops->uint64(t.ptr, c);
+        if(0xe0 <= c) return t.ops->int64(t.ptr, static_cast<int8_t>(c));
+        if((c & 0xf0) == 0x80) return object(t, c & 0x0f, depth);
+        if((c & 0xf0) == 0x90) return array(t, c & 0x0f, depth);
+        if((c & 0xe0) == 0xa0) return string(t, c & 0x1f);
+        switch(c)
+        {
+        case 0xc0: return t.ops->null(t.ptr);
+        case 0xc2: return t.ops->boolean(t.ptr, false);
+        case 0xc3: return t.ops->boolean(t.ptr, true);
+        case 0xc7: return ext(t, be(1));
+        case 0xc8: return ext(t, be(2));
+        case 0xc9: return ext(t, be(4));
+        case 0xcb:
+        {
+            uint64_t bits = be(8);
+            double v;
+            std::memcpy(&v, &bits, sizeof(v));
+            return t.ops->number(t.ptr, v);
+        }
+        case 0xcc: return t.ops->uint64(t.ptr, be(1));
+        case 0xcd: return t.ops->uint64(t.ptr, be(2));
+        case 0xce: return t.ops->uint64(t.ptr, be(4));
+        case 0xcf: return t.ops->uint64(t.ptr, be(8));
+        case 0xd0: return t.ops->int64(t.ptr, static_cast<int8_t>(be(1)));
+        case 0xd1: return t.ops->int64(t.ptr, static_cast<int16_t>(be(2)));
+        case 0xd2: return t.ops->int64(t.ptr, static_cast<int32_t>(be(4)));
+        case 0xd3: return t.ops->int64(t.ptr, static_cast<int64_t>(be(8)));
+        case 0xd9: return string(t, be(1));
+        case 0xda: return string(t, be(2));
+        case 0xdb: return string(t, be(4));
+        case 0xdc: return array(t, be(2), depth);
+        case 0xdd: return array(t, be(4), depth);
+        case 0xde: return object(t, be(2), depth);
+        case 0xdf: return object(t, be(4), depth);
+        default: fail("unsupported type");
+        }
+    }
+
+    void finish()
+    {
+        if(m_cur != m_end) fail("trailing bytes");
+    }
+private:
+    [[noreturn]] void fail(const char* what)
+    {
+        throw BinaryParseError(what, m_cur - m_begin);
+    }
+
+    const char* take(size_t n)
+    {
+        if(static_cast<size_t>(m_end - m_cur) < n) fail("unexpected end");
+        const char* res = m_cur;
+        m_cur += n;
+        return res;
+    }
+
+    unsigned char byte() { return static_cast<unsigned char>(*take(1)); }
+
+    uint64_t be(int bytes)
+    {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(take(bytes));
+        uint64_t v = 0;
+        for(int i = 0; i < bytes; ++i) v = (v << 8) | p[i];
+        return v;
+    }
+
+    //the count is checked against the rest of the input, every value takes a byte at least
+    void checkCount(uint64_t count)
+    {
+        if(static_cast<uint64_t>(m_end - m_cur) < count) fail("unexpected end");
+    }
+
+    void string(sax::Target t, uint64_t len)
+    {
+        const char* s = take(len);
+        t.ops->string(t.ptr, s, len);
+    }
+
+    void ext(sax::Target t, uint64_t len)
+    {
+        if(static_cast<int8_t>(byte()) != HEX_EXT) fail("unsupported ext type");
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(take(len));
+        std::string& hex = hexBuffer();
+        hex.resize(2 * len);
+        for(size_t i = 0; i < len; ++i)
+        {
+            hex[2 * i] = hexDigits[p[i] >> 4];
+            hex[2 * i + 1] = hexDigits[p[i] & 0x0f];
+        }
+        t.ops->string(t.ptr, hex.data(), hex.size());
+    }
+
+    void array(sax::Target t, uint64_t count, int depth)
+    {
+        checkCount(count);
+        if(!t.ops->startArray(t.ptr)) t = sax::skipTarget();
+        for(uint64_t i = 0; i < count; ++i)
+        {
+            value(t.ops->element(t.ptr), depth + 1);
+        }
+    }
+
+    void object(sax::Target t, uint64_t count, int depth)
+    {
+        checkCount(count);
+        if(!t.ops->startObject(t.ptr)) t = sax::skipTarget();
+        for(uint64_t i = 0; i < count; ++i)
+        {
+            unsigned char c = byte();
+            uint64_t len;
+            if((c & 0xe0) == 0xa0) len = c & 0x1f;
+            else if(c == 0xd9) len = be(1);
+            else if(c == 0xda) len = be(2);
+            else if(c == 0xdb) len = be(4);
+            else fail("key is not a string");
+            const char* name = take(len);
+            value(t.ops->key(t.ptr, name, len), depth + 1);
+        }
+    }
+
+    //the values are copied by the sinks, so the buffer of the thread is reused
+    static std::string& hexBuffer()
+    {
+        static thread_local std::string buf;
+        return buf;
+    }
+
+    const char* m_begin;
+    const char* m_cur;
+    const char* m_end;
+};
+
+} //namespace
+
+void Writer::putBE(uint64_t v, int bytes)
+{
+    for(int i = bytes - 1; 0 <= i; --i) put(static_cast<unsigned char>(v >> (8 * i)));
+}
+
+void Writer::header(size_t count, unsigned char fix, unsigned char b16, unsigned char b32)
+{
+    if(count < 16) put(fix | static_cast<unsigned char>(count));
+    else if(count <= 0xffff) { put(b16); putBE(count, 2); }
+    else { put(b32); putBE(count, 4); }
+}
+
+void Writer::Uint64(uint64_t v)
+{
+    if(v <= 0x7f) put(static_cast<unsigned char>(v));
+    else if(v <= 0xff) { put(0xcc); putBE(v, 1); }
+    else if(v <= 0xffff) { put(0xcd); putBE(v, 2); }
+    else if(v <= 0xffffffff) { put(0xce); putBE(v, 4); }
+    else { put(0xcf); putBE(v, 8); }
+}
+
+void Writer::Int64(int64_t v)
+{
+    if(0 <= v) return Uint64(static_cast<uint64_t>(v));
+    if(-32 <= v) put(static_cast<unsigned char>(v));
+    else if(INT8_MIN <= v) { put(0xd0); putBE(static_cast<uint64_t>(v), 1); }
+    else if(INT16_MIN <= v) { put(0xd1); putBE(static_cast<uint64_t>(v), 2); }
+    else if(INT32_MIN <= v) { put(0xd2); putBE(static_cast<uint64_t>(v), 4); }
+    else { put(0xd3); putBE(static_cast<uint64_t>(v), 8); }
+}
+
+void Writer::Double(double v)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    put(0xcb);
+    putBE(bits, 8);
+}
+
+void Writer::raw(const char* s, size_t len)
+{
+    if(len < 32) put(0xa0 | static_cast<unsigned char>(len));
+    else if(len <= 0xff) { put(0xd9); putBE(len, 1); }
+    else if(len <= 0xffff) { put(0xda); putBE(len, 2); }
+    else { put(0xdb); putBE(len, 4); }
+    m_str.append(s, len);
+}
+
+void Writer::String(const char* s, size_t len)
+{
+    if(!isHex(s, len)) return raw(s, len);
+    size_t n = len / 2;
+    if(n <= 0xff) { put(0xc7); putBE(n, 1); }
+    else if(n <= 0xffff) { put(0xc8); putBE(n, 2); }
+    else { put(0xc9); putBE(n, 4); }
+    put(static_cast<unsigned char>(HEX_EXT));
+    size_t pos = m_str.size();
+    m_str.resize(pos + n);
+    for(size_t i = 0; i < n; ++i)
+    {
+        m_str[pos + i] = static_cast<char>(hexValue(s[2 * i]) << 4 | hexValue(s[2 * i + 1]));
+    }
+}
+
+void parse(const char* data, size_t size, sax::Target root)
+{
+    Reader reader(data, size);
+    reader.header();
+    reader.value(root, 0);
+    reader.finish();
+}
+
+} } } //namespace graft::serializer::bin
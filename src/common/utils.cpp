@@ -1,19 +1,470 @@
-#include "utils/utils.h"
-#include <locale>            // epee::string_coding uses std::locale but misses include
-#include <string_coding.h>
+#include "common/utils.h"
 
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GRAFT_CODECS_X86 1
+#include <immintrin.h>
+#endif
 
 namespace graft {
 namespace utils {
 
+namespace {
+
+const char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+const char hexChars[] = "0123456789abcdef";
+
+struct Tables
+{
+    int8_t base64[256];
+    int8_t hex[256];
+
+    Tables()
+    {
+        std::memset(base64, -1, sizeof(base64));
+        for (int i = 0; i < 64; ++i)
+            base64[static_cast<unsigned char>(base64Chars[i])] = static_cast<int8_t>(i);
+        std::memset(hex, -1, sizeof(hex));
+        for (int i = 0; i < 16; ++i)
+        {
+            hex[static_cast<unsigned char>(hexChars[i])] = static_cast<int8_t>(i);
+            hex[static_cast<unsigned char>(std::toupper(hexChars[i]))] = static_cast<int8_t>(i);
+        }
+    }
+};
+
+const Tables tables;
+
+/*!
+ * The implementations process the blocks they can and return the number of the processed input bytes, the rest is
+ * done by the scalar code. Encoders write 4/3 and 2 output bytes per input byte exactly, decoders of base64 may
+ * write up to 4 bytes beyond the decoded ones, the output is reserved for it.
+ */
+struct Codec
+{
+    const char *name;
+    size_t (*base64Encode)(const unsigned char *in, size_t size, char *out);
+    size_t (*base64Decode)(const char *in, size_t size, unsigned char *out);
+    size_t (*hexEncode)(const unsigned char *in, size_t size, char *out);
+    size_t (*hexDecode)(const char *in, size_t size, unsigned char *out);
+};
+
+size_t none(const unsigned char *, size_t, char *) { return 0; }
+size_t noneDecode(const char *, size_t, unsigned char *) { return 0; }
+
+const Codec scalarCodec{"scalar", &none, &noneDecode, &none, &noneDecode};
+
+#ifdef GRAFT_CODECS_X86
+
+//The base64 algorithms are of W. Mula and D. Lemire, "Faster Base64 Encoding and Decoding Using AVX2 Instructions".
+
+__attribute__((target("ssse3")))
+inline __m128i base64EncodeBlock(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    const __m128i indices = _mm_or_si128(t1, t3);
+
+    __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+    const __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    result = _mm_shuffle_epi8(shift, result);
+    return _mm_add_epi8(result, indices);
+}
+
+//false if a character is not base64
+__attribute__((target("ssse3")))
+inline bool base64DecodeBlock(__m128i in, __m128i &out)
+{
+    const __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0f));
+    const __m128i loNibbles = _mm_and_si128(in, _mm_set1_epi8(0x0f));
+    const __m128i lo = _mm_shuffle_epi8(_mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                                      0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a), loNibbles);
+    const __m128i hi = _mm_shuffle_epi8(_mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                                      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10), hiNibbles);
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0)
+        return false;
+    const __m128i eq2F = _mm_cmpeq_epi8(in, _mm_set1_epi8(0x2f));
+    const __m128i roll = _mm_shuffle_epi8(_mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0),
+                                          _mm_add_epi8(eq2F, hiNibbles));
+    const __m128i values = _mm_add_epi8(in, roll);
+    const __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    out = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    out = _mm_shuffle_epi8(out, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    return true;
+}
+
+//16 bytes to 32 characters, as the interleaved high and low nibbles
+__attribute__((target("ssse3")))
+inline void hexEncodeBlock(__m128i in, __m128i &first, __m128i &second)
+{
+    const __m128i digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+                                         '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(in, 4), mask));
+    const __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(in, mask));
+    first = _mm_unpacklo_epi8(hi, lo);
+    second = _mm_unpackhi_epi8(hi, lo);
+}
+
+//16 characters to the values of the pairs in the 16 bit lanes, false if a character is not hex
+__attribute__((target("ssse3")))
+inline bool hexDecodeBlock(__m128i in, __m128i &out)
+{
+    const __m128i digit = _mm_sub_epi8(in, _mm_set1_epi8('0'));
+    const __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    const __m128i alpha = _mm_sub_epi8(_mm_or_si128(in, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    const __m128i isAlpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+    if (_mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha)) != 0xffff)
+        return false;
+    const __m128i values = _mm_or_si128(_mm_and_si128(isDigit, digit),
+                                        _mm_and_si128(isAlpha, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+    out = _mm_maddubs_epi16(values, _mm_set1_epi16(0x0110));
+    return true;
+}
+
+__attribute__((target("ssse3")))
+size_t base64EncodeSsse3(const unsigned char *in, size_t size, char *out)
+{
+    size_t done = 0;
+    //16 bytes are read, 12 are used
+    for (; done + 16 <= size; done += 12, out += 16)
+    {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + done));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), base64EncodeBlock(block));
+    }
+    return done;
+}
+
+__attribute__((target("ssse3")))
+size_t base64DecodeSsse3(const char *in, size_t size, unsigned char *out)
+{
+    size_t done = 0;
+    for (; done + 16 <= size; done += 16, out += 12)
+    {
+        __m128i res;
+        if (!base64DecodeBlock(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + done)), res))
+            break;
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), res);
+    }
+    return done;
+}
+
+__attribute__((target("ssse3")))
+size_t hexEncodeSsse3(const unsigned char *in, size_t size, char *out)
+{
+    size_t done = 0;
+    for (; done + 16 <= size; done += 16, out += 32)
+    {
+        __m128i first, second;
+        hexEncodeBlock(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + done)), first, second);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), first);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16), second);
+    }
+    return done;
+}
+
+__attribute__((target("ssse3")))
+size_t hexDecodeSsse3(const char *in, size_t size, unsigned char *out)
+{
+    size_t done = 0;
+    for (; done + 32 <= size; done += 32, out += 16)
+    {
+        __m128i first, second;
+        if (!hexDecodeBlock(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + done)), first)
+                || !hexDecodeBlock(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + done + 16)), second))
+            break;
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_packus_epi16(first, second));
+    }
+    return done;
+}
+
+//the AVX2 versions process two blocks of the SSSE3 ones in the 128 bit lanes
+
+__attribute__((target("avx2")))
+size_t base64EncodeAvx2(const unsigned char *in, size_t size, char *out)
+{
+    size_t done = 0;
+    //the lanes read 16 bytes at done and done + 12, 24 are used
+    for (; done + 28 <= size; done += 24, out += 32)
+    {
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + done));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + done + 12));
+        __m256i block = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+        block = _mm256_shuffle_epi8(block, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                                           10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        const __m256i t0 = _mm256_and_si256(block, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(block, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(t1, t3);
+
+        __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        const __m256i shift = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                               '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                               'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                               '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+        result = _mm256_add_epi8(_mm256_shuffle_epi8(shift, result), indices);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), result);
+    }
+    return done;
+}
+
+__attribute__((target("avx2")))
+size_t base64DecodeAvx2(const char *in, size_t size, unsigned char *out)
+{
+    size_t done = 0;
+    for (; done + 32 <= size; done += 32, out += 24)
+    {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + done));
+        const __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(block, 4), _mm256_set1_epi8(0x0f));
+        const __m256i loNibbles = _mm256_and_si256(block, _mm256_set1_epi8(0x0f));
+        const __m256i lo = _mm256_shuffle_epi8(_mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                                                0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+                                                                0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                                                0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a),
+                                               loNibbles);
+        const __m256i hi = _mm256_shuffle_epi8(_mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                                                0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                                                0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                                                0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10),
+                                               hiNibbles);
+        if (!_mm256_testz_si256(lo, hi))
+            break;
+        const __m256i eq2F = _mm256_cmpeq_epi8(block, _mm256_set1_epi8(0x2f));
+        const __m256i roll = _mm256_shuffle_epi8(_mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                                  0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0),
+                                                 _mm256_add_epi8(eq2F, hiNibbles));
+        const __m256i values = _mm256_add_epi8(block, roll);
+        const __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        __m256i res = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        res = _mm256_shuffle_epi8(res, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        //12 bytes of each lane, the second store overwrites the padding of the first one
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm256_castsi256_si128(res));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 12), _mm256_extracti128_si256(res, 1));
+    }
+    return done;
+}
+
+__attribute__((target("avx2")))
+size_t hexEncodeAvx2(const unsigned char *in, size_t size, char *out)
+{
+    const __m256i digits = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+                                            '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t done = 0;
+    for (; done + 32 <= size; done += 32, out += 64)
+    {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + done));
+        const __m256i hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(block, 4), mask));
+        const __m256i lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(block, mask));
+        //the unpacks are within the lanes: bytes 0-7 and 16-23, 8-15 and 24-31
+        const __m256i first = _mm256_unpacklo_epi8(hi, lo);
+        const __m256i second = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 32), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+    return done;
+}
+
+__attribute__((target("avx2")))
+size_t hexDecodeAvx2(const char *in, size_t size, unsigned char *out)
+{
+    size_t done = 0;
+    for (; done + 64 <= size; done += 64, out += 32)
+    {
+        __m256i pairs[2];
+        bool valid = true;
+        for (int i = 0; i < 2; ++i)
+        {
+            const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + done + 32 * i));
+            const __m256i digit = _mm256_sub_epi8(block, _mm256_set1_epi8('0'));
+            const __m256i isDigit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+            const __m256i alpha = _mm256_sub_epi8(_mm256_or_si256(block, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+            const __m256i isAlpha = _mm256_cmpeq_epi8(_mm256_min_epu8(alpha, _mm256_set1_epi8(5)), alpha);
+            valid = valid && _mm256_movemask_epi8(_mm256_or_si256(isDigit, isAlpha)) == -1;
+            const __m256i values = _mm256_or_si256(_mm256_and_si256(isDigit, digit),
+                                                   _mm256_and_si256(isAlpha, _mm256_add_epi8(alpha, _mm256_set1_epi8(10))));
+            pairs[i] = _mm256_maddubs_epi16(values, _mm256_set1_epi16(0x0110));
+        }
+        if (!valid)
+            break;
+        //the pack is within the lanes, the quadwords are put in order
+        const __m256i res = _mm256_permute4x64_epi64(_mm256_packus_epi16(pairs[0], pairs[1]), 0xd8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), res);
+    }
+    return done;
+}
+
+const Codec ssse3Codec{"ssse3", &base64EncodeSsse3, &base64DecodeSsse3, &hexEncodeSsse3, &hexDecodeSsse3};
+const Codec avx2Codec{"avx2", &base64EncodeAvx2, &base64DecodeAvx2, &hexEncodeAvx2, &hexDecodeAvx2};
+
+#endif // GRAFT_CODECS_X86
+
+const Codec *bestCodec()
+{
+#ifdef GRAFT_CODECS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return &avx2Codec;
+    if (__builtin_cpu_supports("ssse3"))
+        return &ssse3Codec;
+#endif
+    return &scalarCodec;
+}
+
+std::atomic<const Codec *> &codec()
+{
+    static std::atomic<const Codec *> res{bestCodec()};
+    return res;
+}
+
+const Codec &currentCodec()
+{
+    return *codec().load(std::memory_order_relaxed);
+}
+
+} // namespace
+
+std::string base64_decode(const char *encoded_data, size_t size)
+{
+    //as epee, the characters up to the first '=' or another one that is not base64 are decoded
+    std::string res;
+    res.resize(size / 4 * 3 + 16);
+    unsigned char *out = reinterpret_cast<unsigned char *>(&res[0]);
+    size_t in = currentCodec().base64Decode(encoded_data, size, out);
+    out += in / 4 * 3;
+
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(encoded_data);
+    uint32_t acc = 0;
+    int count = 0;
+    for (; in < size; ++in)
+    {
+        const int8_t v = tables.base64[p[in]];
+        if (v < 0)
+            break;
+        acc = acc << 6 | static_cast<uint32_t>(v);
+        if (++count == 4)
+        {
+            *out++ = static_cast<unsigned char>(acc >> 16);
+            *out++ = static_cast<unsigned char>(acc >> 8);
+            *out++ = static_cast<unsigned char>(acc);
+            acc = 0;
+            count = 0;
+        }
+    }
+    //the partial group, two characters give a byte, three give two
+    if (count == 2)
+    {
+        *out++ = static_cast<unsigned char>(acc >> 4);
+    }
+    else if (count == 3)
+    {
+        *out++ = static_cast<unsigned char>(acc >> 10);
+        *out++ = static_cast<unsigned char>(acc >> 2);
+    }
+    res.resize(out - reinterpret_cast<unsigned char *>(&res[0]));
+    return res;
+}
+
 std::string base64_decode(const std::string &encoded_data)
 {
-    return epee::string_encoding::base64_decode(encoded_data);
+    return base64_decode(encoded_data.data(), encoded_data.size());
+}
+
+std::string base64_encode(const char *data, size_t size)
+{
+    std::string res;
+    res.resize((size + 2) / 3 * 4);
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+    char *out = &res[0];
+    size_t i = currentCodec().base64Encode(p, size, out);
+    out += i / 3 * 4;
+
+    for (; i + 3 <= size; i += 3)
+    {
+        const uint32_t v = uint32_t(p[i]) << 16 | uint32_t(p[i + 1]) << 8 | p[i + 2];
+        *out++ = base64Chars[v >> 18];
+        *out++ = base64Chars[(v >> 12) & 0x3f];
+        *out++ = base64Chars[(v >> 6) & 0x3f];
+        *out++ = base64Chars[v & 0x3f];
+    }
+    if (i < size)
+    {
+        const uint32_t v = uint32_t(p[i]) << 16 | (i + 1 < size ? uint32_t(p[i + 1]) << 8 : 0);
+        *out++ = base64Chars[v >> 18];
+        *out++ = base64Chars[(v >> 12) & 0x3f];
+        *out++ = i + 1 < size ? base64Chars[(v >> 6) & 0x3f] : '=';
+        *out++ = '=';
+    }
+    return res;
 }
 
 std::string base64_encode(const std::string &data)
 {
-    return epee::string_encoding::base64_encode(data);
+    return base64_encode(data.data(), data.size());
+}
+
+std::string to_hex(const void *data, size_t size)
+{
+    std::string res;
+    res.resize(2 * size);
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    char *out = &res[0];
+    for (size_t i = currentCodec().hexEncode(p, size, out); i < size; ++i)
+    {
+        out[2 * i] = hexChars[p[i] >> 4];
+        out[2 * i + 1] = hexChars[p[i] & 0x0f];
+    }
+    return res;
+}
+
+bool from_hex(const char *hex, size_t size, void *out)
+{
+    if (size % 2)
+        return false;
+    unsigned char *o = static_cast<unsigned char *>(out);
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(hex);
+    for (size_t i = currentCodec().hexDecode(hex, size, o); i < size; i += 2)
+    {
+        const int8_t hi = tables.hex[p[i]];
+        const int8_t lo = tables.hex[p[i + 1]];
+        if (hi < 0 || lo < 0)
+            return false;
+        o[i / 2] = static_cast<unsigned char>(hi << 4 | lo);
+    }
+    return true;
+}
+
+bool from_hex(const std::string &hex, std::string &out)
+{
+    if (hex.size() % 2)
+        return false;
+    out.resize(hex.size() / 2);
+    return from_hex(hex.data(), hex.size(), &out[0]);
+}
+
+const char *codec_implementation()
+{
+    return currentCodec().name;
+}
+
+void force_scalar_codecs(bool scalar)
+{
+    codec().store(scalar ? &scalarCodec : bestCodec(), std::memory_order_relaxed);
 }
 
 }
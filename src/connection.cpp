@@ -25,31 +25,178 @@ void static_empty_ev_handler(mg_connection *nc, int ev, void *ev_data)
 
 constexpr std::pair<const char *, int> ConnectionManager::m_methods[];
 
+namespace
+{
+
+//the series are cached per looper thread, so that the registry is not locked on each request
+struct UpstreamSeries
+{
+    Histogram* latency;
+    Counter* errors;
+};
+
+UpstreamSeries upstreamSeries(const std::string& path)
+{
+    thread_local std::map<std::string, UpstreamSeries> cache;
+    auto it = cache.find(path);
+    if(it != cache.end()) return it->second;
+    Metrics& metrics = Metrics::instance();
+    const std::string labels = Metrics::labels({{"path", path}});
+    UpstreamSeries series{
+        &metrics.histogram("graft_upstream_request_duration_seconds", "Duration of requests to the cryptonode.", labels),
+        &metrics.counter("graft_upstream_errors_total", "Failed requests to the cryptonode.", labels)
+    };
+    if(cache.size() < Metrics::MAX_SERIES) cache.emplace(path, series);
+    return series;
+}
+
+Counter& responseCounter(const std::string& route, int code)
+{
+    thread_local std::map<std::pair<std::string, int>, Counter*> cache;
+    auto key = std::make_pair(route, code);
+    auto it = cache.find(key);
+    if(it != cache.end()) return *it->second;
+    Counter& counter = Metrics::instance().counter("graft_http_responses_total", "Responses by route and status code.",
+                                                   Metrics::labels({{"route", route}, {"code", std::to_string(code)}}));
+    if(cache.size() < Metrics::MAX_SERIES) cache.emplace(key, &counter);
+    return counter;
+}
+
+}//namespace
+
 void UpstreamSender::send(TaskManager &manager, BaseTaskPtr bt)
 {
     m_bt = bt;
+    bt->getSpan().mark(TraceStage::upstream_send);
 
     const ConfigOpts& opts = manager.getCopts();
-    std::string default_uri = opts.cryptonode_rpc_address.c_str();
+    UpstreamBalancer& balancer = manager.getUpstreamBalancer();
     Output& output = bt->getOutput();
-    std::string url = output.makeUri(default_uri);
-    std::string extra_headers = output.combine_headers();
-    if(extra_headers.empty())
+    //the requests to the default uri go to the cryptonode backends
+    int backend = (output.uri.empty() && output.host.empty() && output.port.empty())? balancer.pick() : -1;
+    std::string path = urlPath(output.makeUri(opts.cryptonode_rpc_address));
+    UpstreamSeries series = upstreamSeries(path);
+    m_latency = series.latency;
+    m_errors = series.errors;
+    m_started = std::chrono::steady_clock::now();
+    m_headers = output.combine_headers();
+    if(m_headers.empty())
+    {
+        m_headers = "Content-Type: application/json\r\n";
+    }
+    m_timeout = opts.upstream_request_timeout;
+    UpstreamTask* ust = dynamic_cast<UpstreamTask*>(bt.get());
+    if(ust && ust->m_pi.timeout.count() != 0) m_timeout = std::chrono::duration<double>(ust->m_pi.timeout).count();
+    if(0 <= backend)
     {
-        extra_headers = "Content-Type: application/json\r\n";
+        m_idempotent = balancer.idempotent(path, output.body);
+        if(m_idempotent) m_hedgeDelay = balancer.hedgeDelay();
     }
-    std::string& body = output.body;
-    m_upstream = mg::mg_connect_http_x(manager.getMgMgr(), static_ev_handler<UpstreamSender>, url.c_str(),
-                             extra_headers.c_str(),
-                             body); //body.empty() means GET
-    assert(m_upstream);
-    m_upstream->user_data = this;
-    mg_set_timer(m_upstream, mg_time() + opts.upstream_request_timeout);
+    startAttempt(manager, m_attempts[0], backend);
 }
 
+void UpstreamSender::startAttempt(TaskManager& manager, Attempt& attempt, int backend)
+{
+    UpstreamBalancer& balancer = manager.getUpstreamBalancer();
+    attempt.backend = backend;
+    attempt.url = m_bt->getOutput().makeUri((0 <= backend)? balancer.address(backend) : manager.getCopts().cryptonode_rpc_address);
+    attempt.deadline = mg_time() + m_timeout;
+    attempt.started = std::chrono::steady_clock::now();
+    if(0 <= backend) balancer.onStart(backend);
+    connect(manager, attempt, false);
+}
+
+void UpstreamSender::connect(TaskManager& manager, Attempt& attempt, bool fresh)
+{
+    const std::string& body = m_bt->getOutput().body;
+    attempt.received = false;
+    attempt.upstream = manager.getUpstreamPool().send(manager.getMgMgr(), attempt.url, m_headers.c_str(), body, //body.empty() means GET
+                                                      static_ev_handler<UpstreamSender>, this, fresh, attempt.reused);
+    assert(attempt.upstream);
+    //the timer of the first request fires earlier to send the hedged one
+    double timer = attempt.deadline;
+    if(&attempt == &m_attempts[0] && !m_hedged && m_hedgeDelay != std::chrono::steady_clock::duration::zero())
+    {
+        timer = std::min(timer, mg_time() + std::chrono::duration<double>(m_hedgeDelay).count());
+    }
+    mg_set_timer(attempt.upstream, timer);
+}
+
+void UpstreamSender::endAttempt(TaskManager& manager, Attempt& attempt, bool ok)
+{
+    attempt.upstream = nullptr;
+    if(attempt.backend < 0) return;
+    manager.getUpstreamBalancer().onResult(attempt.backend, ok, std::chrono::steady_clock::now() - attempt.started);
+}
+
+void UpstreamSender::cancel(TaskManager& manager, Attempt& attempt)
+{
+    if(!attempt.upstream) return;
+    mg_set_timer(attempt.upstream, 0);
+    manager.getUpstreamPool().release(attempt.upstream, false);
+    attempt.upstream = nullptr;
+    //the backend is slower than the other one, not broken, and its latency is not known
+    if(0 <= attempt.backend) manager.getUpstreamBalancer().onCancelled(attempt.backend);
+}
+
+void UpstreamSender::hedge(TaskManager& manager)
+{
+    if(m_hedged || m_attempts[1].upstream) return;
+    m_hedged = true;
+    UpstreamBalancer& balancer = manager.getUpstreamBalancer();
+    int backend = balancer.pick(m_attempts[0].backend);
+    if(backend < 0) return;
+    balancer.onHedge();
+    startAttempt(manager, m_attempts[1], backend);
+}
+
+void UpstreamSender::onFailed(TaskManager& manager, Attempt& attempt, const std::string& error, bool retriable)
+{
+    setError(Status::Error, error);
+    if(other(attempt).upstream) return;
+    if(retriable && !m_failedOver && 0 <= attempt.backend)
+    {
+        UpstreamBalancer& balancer = manager.getUpstreamBalancer();
+        int backend = balancer.pick(attempt.backend);
+        if(0 <= backend)
+        {
+            //the one more request is not hedged
+            m_failedOver = m_hedged = true;
+            balancer.onFailover();
+            startAttempt(manager, attempt, backend);
+            return;
+        }
+    }
+    manager.onUpstreamDone(*this);
+    releaseItself();
+}
+
+void UpstreamSender::observeLatency()
+{
+    if(!m_latency) return;
+    m_latency->observe(std::chrono::steady_clock::now() - m_started);
+    if(Status::Ok != m_status) m_errors->inc();
+}
+
+namespace
+{
+
+//the server keeps the connection unless it says otherwise, HTTP/1.0 closes it by default
+bool keepsAlive(http_message* hm)
+{
+    mg_str* connection = mg_get_http_header(hm, "Connection");
+    if(connection) return mg_vcasecmp(connection, "close") != 0;
+    return mg_vcasecmp(&hm->proto, "HTTP/1.0") != 0;
+}
+
+} //namespace
+
 void UpstreamSender::ev_handler(mg_connection *upstream, int ev, void *ev_data)
 {
-    assert(upstream == this->m_upstream);
+    Attempt& attempt = (upstream == m_attempts[0].upstream)? m_attempts[0] : m_attempts[1];
+    assert(upstream == attempt.upstream);
+    TaskManager* manager = TaskManager::from(upstream->mgr);
+    UpstreamPool& pool = manager->getUpstreamPool();
     switch (ev)
     {
     case MG_EV_CONNECT:
@@ -59,43 +206,56 @@ void UpstreamSender::ev_handler(mg_connection *upstream, int ev, void *ev_data)
         {
             std::ostringstream ss;
             ss << "cryptonode connect failed: " << strerror(err);
-            setError(Status::Error, ss.str().c_str());
-            TaskManager::from(upstream->mgr)->onUpstreamDone(*this);
-            upstream->handler = static_empty_ev_handler;
-            m_upstream = nullptr;
-            releaseItself();
+            mg_set_timer(upstream, 0);
+            pool.release(upstream, false);
+            endAttempt(*manager, attempt, false);
+            //nothing is sent, another backend can take it
+            onFailed(*manager, attempt, ss.str(), true);
         }
     } break;
+    case MG_EV_RECV:
+    {
+        attempt.received = true;
+    } break;
     case MG_EV_HTTP_REPLY:
     {
         mg_set_timer(upstream, 0);
         http_message* hm = static_cast<http_message*>(ev_data);
         m_bt->getInput() = *hm;
         setError(Status::Ok);
-        upstream->flags |= MG_F_CLOSE_IMMEDIATELY;
-        TaskManager::from(upstream->mgr)->onUpstreamDone(*this);
-        upstream->handler = static_empty_ev_handler;
-        m_upstream = nullptr;
+        cancel(*manager, other(attempt));
+        endAttempt(*manager, attempt, true);
+        manager->onUpstreamDone(*this);
+        pool.release(upstream, keepsAlive(hm));
         releaseItself();
     } break;
     case MG_EV_CLOSE:
     {
         mg_set_timer(upstream, 0);
-        setError(Status::Error, "cryptonode connection unexpectedly closed");
-        TaskManager::from(upstream->mgr)->onUpstreamDone(*this);
-        upstream->handler = static_empty_ev_handler;
-        m_upstream = nullptr;
-        releaseItself();
+        pool.closed(upstream);
+        attempt.upstream = nullptr;
+        //the idle connection may have been closed by the server before the request reached it, or after the
+        //request is processed; so only the request that can be sent twice goes once more on a new connection
+        if(attempt.reused && !attempt.received && (m_idempotent || m_bt->getOutput().body.empty()))
+        {
+            connect(*manager, attempt, true);
+            break;
+        }
+        endAttempt(*manager, attempt, false);
+        onFailed(*manager, attempt, "cryptonode connection unexpectedly closed", m_idempotent);
     } break;
     case MG_EV_TIMER:
     {
+        if(mg_time() < attempt.deadline)
+        {//no reply within the hedge delay
+            mg_set_timer(upstream, attempt.deadline);
+            hedge(*manager);
+            break;
+        }
         mg_set_timer(upstream, 0);
-        setError(Status::Error, "cryptonode request timout");
-        upstream->flags |= MG_F_CLOSE_IMMEDIATELY;
-        TaskManager::from(upstream->mgr)->onUpstreamDone(*this);
-        upstream->handler = static_empty_ev_handler;
-        m_upstream = nullptr;
-        releaseItself();
+        pool.release(upstream, false);
+        endAttempt(*manager, attempt, false);
+        onFailed(*manager, attempt, "cryptonode request timout", false);
     } break;
     default:
         break;
@@ -109,6 +269,13 @@ Looper::Looper(const ConfigOpts& copts)
     mg_mgr_init(m_mgr.get(), this, cb_event);
 }
 
+Looper::Looper(const ConfigOpts& copts, Looper& primary)
+    : TaskManager(copts, primary)
+    , m_mgr(std::make_unique<mg_mgr>())
+{
+    mg_mgr_init(m_mgr.get(), this, cb_event);
+}
+
 
 Looper::~Looper()
 {
@@ -122,10 +289,13 @@ void Looper::serve()
     m_ready = true;
     for (;;)
     {
-        mg_mgr_poll(m_mgr.get(), m_copts.timer_poll_interval_ms);
+        //do not wait in poll while results are left after the drain budget
+        mg_mgr_poll(m_mgr.get(), hasReadyBacklog()? 0 : m_copts.timer_poll_interval_ms);
+        if(hasReadyBacklog()) processReadyJobs();
         getTimerList().eval();
         checkUpstreamBlockingIO();
         executePostponedTasks();
+        publishMetrics();
         if( stopped() && (m_forceStop || canStop()) ) break;
     }
 
@@ -143,7 +313,7 @@ void Looper::stop(bool force)
 
 void Looper::notifyJobReady()
 {
-    mg_notify(m_mgr.get());
+    if(onJobReady()) mg_notify(m_mgr.get());
 }
 
 void Looper::cb_event(mg_mgr *mgr, uint64_t cnt)
@@ -189,7 +359,10 @@ void HttpConnectionManager::bind(Looper& looper)
 
     const ConfigOpts& opts = looper.getCopts();
 
-    mg_connection *nc_http = mg_bind(mgr, opts.http_address.c_str(), ev_handler_http);
+    //each looper has its own listening socket, the kernel balances connections between them
+    mg_connection *nc_http = (opts.io_threads > 1)?
+                mg::mg_bind_reuseport_x(mgr, opts.http_address.c_str(), ev_handler_http)
+              : mg_bind(mgr, opts.http_address.c_str(), ev_handler_http);
     if(!nc_http) throw std::runtime_error("Cannot bind to " + opts.http_address);
     nc_http->user_data = this;
     mg_set_protocol_http_websocket(nc_http);
@@ -198,6 +371,8 @@ void HttpConnectionManager::bind(Looper& looper)
 void CoapConnectionManager::bind(Looper& looper)
 {
     assert(!looper.ready());
+    //UDP requests are served by the primary looper only
+    if(!looper.isPrimary()) return;
     mg_mgr* mgr = looper.getMgMgr();
 
     const ConfigOpts& opts = looper.getCopts();
@@ -250,21 +425,19 @@ void HttpConnectionManager::ev_handler_http(mg_connection *client, int ev, void
         mg_set_timer(client, 0);
 
         struct http_message *hm = (struct http_message *) ev_data;
-        std::string uri(hm->uri.p, hm->uri.len);
+        boost::string_view uri(hm->uri.p, hm->uri.len);
 
         int method = translateMethod(hm->method.p, hm->method.len);
         if (method < 0) return;
 
-        std::string s_method(hm->method.p, hm->method.len);
-        LOG_PRINT_CLN(1,client,"New HTTP client. uri:" << std::string(hm->uri.p, hm->uri.len) << " method:" << s_method);
+        LOG_PRINT_CLN(1,client,"New HTTP client. uri:" << uri << " method:" << boost::string_view(hm->method.p, hm->method.len));
 
         HttpConnectionManager* httpcm = HttpConnectionManager::from_accepted(client);
         Router::JobParams prms;
         if (httpcm->matchRoute(uri, method, prms))
         {
-            mg_str& body = hm->body;
-            prms.input.load(body.p, body.len);
-            LOG_PRINT_CLN(2,client,"Matching Route found; body = " << std::string(body.p, body.len));
+            prms.input = *hm;
+            LOG_PRINT_CLN(2,client,"Matching Route found; body = " << prms.input.body);
             BaseTask* bt = BaseTask::Create<ClientTask>(httpcm, client, prms).get();
             assert(dynamic_cast<ClientTask*>(bt));
             ClientTask* ptr = static_cast<ClientTask*>(bt);
@@ -372,12 +545,28 @@ void ConnectionManager::respond(ClientTask* ct, const std::string& s)
     default: assert(false); break;
     }
 
+    const std::string* endpoint = ct->getParams().endpoint;
+    responseCounter(endpoint? *endpoint : std::string(), code).inc();
+
     auto& ctx = ct->getCtx();
     auto& client = ct->m_client;
     if(Status::Ok == ctx.local.getLastStatus())
     {
-        mg_send_head(client, code, s.size(), "Content-Type: application/json\r\nConnection: close");
-        mg_send(client, s.c_str(), s.size());
+        const std::string& extra_headers = ct->getOutput().extra_headers;
+        if(extra_headers.empty())
+        {
+            mg::mg_send_response_x(client, code, "Content-Type: application/json\r\nConnection: close", s);
+        }
+        else
+        {//the handler has set its own Content-Type
+            std::string headers = extra_headers + "Connection: close";
+            mg::mg_send_response_x(client, code, headers.c_str(), s);
+        }
+    }
+    else if(Status::Busy == ctx.local.getLastStatus())
+    {//Retry-After header is prepared by TaskManager
+        std::string headers = ct->getOutput().combine_headers() + "Content-Type: text/plain\r\nConnection: close";
+        mg::mg_send_response_x(client, code, headers.c_str(), s);
     }
     else
     {
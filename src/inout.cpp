@@ -5,44 +5,103 @@ namespace graft
 {
 std::unordered_map<std::string, std::string> OutHttp::uri_substitutions;
 
-void InOutHttpBase::set_str_field(const http_message& hm, const mg_str& str_fld, std::string& fld)
+namespace
 {
-    if(str_fld.len == 0)
+
+//the received message, the body is shared by HttpBody with the aliasing constructor
+struct Message
+{
+    std::string head;
+    std::string body;
+};
+
+} //namespace
+
+InHttp& InHttp::operator = (const http_message& hm)
+{
+    reset();
+    resp_code = hm.resp_code;
+
+    const char* head_end = hm.message.p + hm.message.len;
+    if(hm.body.len != 0)
     {
-        fld.clear();
+        assert(hm.message.p <= hm.body.p && hm.body.p + hm.body.len <= hm.message.p + hm.message.len);
+        head_end = hm.body.p;
     }
-    else
+    auto msg = std::make_shared<Message>();
+    msg->head.assign(hm.message.p, head_end);
+    msg->body.assign(hm.body.p, hm.body.len);
+
+    auto span = [&hm, &msg](const mg_str& fld)->Span
     {
-        int off = str_fld.p - hm.message.p;
-        assert(0<str_fld.len && 0<=off && off+str_fld.len<=hm.message.len);
-        fld = std::string(str_fld.p, str_fld.len);
-    }
-}
+        Span res;
+        if(fld.len == 0) return res;
+        size_t off = fld.p - hm.message.p;
+        assert(0<=fld.p - hm.message.p && off + fld.len <= msg->head.size());
+        res.off = static_cast<uint32_t>(off);
+        res.len = static_cast<uint32_t>(fld.len);
+        return res;
+    };
 
-InOutHttpBase& InOutHttpBase::operator = (const http_message& hm)
-{
-    //fill corresponding fields from hm
-    set_str_field(hm, hm.body, body);
-    set_str_field(hm, hm.method, method);
-    set_str_field(hm, hm.uri, uri);
-    set_str_field(hm, hm.proto, proto);
-    resp_code = hm.resp_code;
-    set_str_field(hm, hm.resp_status_msg, resp_status_msg);
-    set_str_field(hm, hm.query_string, query_string);
-    //fill headers from hm
+    m_method = span(hm.method);
+    m_uri = span(hm.uri);
+    m_proto = span(hm.proto);
+    m_query_string = span(hm.query_string);
+    m_resp_status_msg = span(hm.resp_status_msg);
     for(int i = 0; i < MG_MAX_HTTP_HEADERS; ++i)
     {
         const mg_str& h_n = hm.header_names[i];
         const mg_str& h_v = hm.header_values[i];
         assert((h_n.p == nullptr) == (h_n.len == 0));
-        assert((h_v.p == nullptr) == (h_v.len == 0));
         assert(h_n.p != nullptr ||  h_v.p == nullptr);
         if(h_n.p == nullptr) break;
-        headers.push_back({std::string(h_n.p, h_n.len), std::string(h_v.p, h_v.len)});
+        m_headers.emplace_back(span(h_n), span(h_v));
     }
+
+    m_head = std::shared_ptr<const std::string>(msg, &msg->head);
+    body = HttpBody(std::shared_ptr<const std::string>(msg, &msg->body));
     return *this;
 }
 
+std::vector<InHttp::HeaderView> InHttp::header_views() const
+{
+    std::vector<HeaderView> res;
+    if(!m_head)
+    {
+        for(auto& pair : headers) res.emplace_back(pair.first, pair.second);
+        return res;
+    }
+    res.reserve(m_headers.size());
+    for(auto& pair : m_headers)
+    {
+        res.emplace_back(boost::string_view(m_head->data() + pair.first.off, pair.first.len),
+                         boost::string_view(m_head->data() + pair.second.off, pair.second.len));
+    }
+    return res;
+}
+
+boost::string_view InHttp::header(boost::string_view name) const
+{
+    auto equal = [name](boost::string_view n)
+    {
+        return n.size() == name.size() && mg_ncasecmp(n.data(), name.data(), n.size()) == 0;
+    };
+    if(!m_head)
+    {
+        for(auto& pair : headers)
+        {
+            if(equal(pair.first)) return pair.second;
+        }
+        return boost::string_view();
+    }
+    for(auto& pair : m_headers)
+    {
+        boost::string_view n(m_head->data() + pair.first.off, pair.first.len);
+        if(equal(n)) return boost::string_view(m_head->data() + pair.second.off, pair.second.len);
+    }
+    return boost::string_view();
+}
+
 std::string InOutHttpBase::combine_headers()
 {
     std::string s = extra_headers;
@@ -0,0 +1,108 @@
+#include "json_sax.h"
+
+#include <rapidjson/reader.h>
+#include <rapidjson/memorystream.h>
+#include <rapidjson/encodedstream.h>
+
+#include <vector>
+
+namespace graft { namespace serializer { namespace sax {
+
+namespace
+{
+
+class Handler
+{
+public:
+    void reset(Target root)
+    {
+        m_levels.clear();
+        m_next = root;
+    }
+
+    bool Null() { Target t = next(); t.ops->null(t.ptr); return true; }
+    bool Bool(bool v) { Target t = next(); t.ops->boolean(t.ptr, v); return true; }
+    bool Int(int v) { return Int64(v); }
+    bool Uint(unsigned v) { return Uint64(v); }
+    bool Int64(int64_t v) { Target t = next(); t.ops->int64(t.ptr, v); return true; }
+    bool Uint64(uint64_t v) { Target t = next(); t.ops->uint64(t.ptr, v); return true; }
+    bool Double(double v) { Target t = next(); t.ops->number(t.ptr, v); return true; }
+    bool RawNumber(const char*, rapidjson::SizeType, bool) { return true; } //kParseNumbersAsStringsFlag is not used
+    bool String(const char* s, rapidjson::SizeType len, bool) { Target t = next(); t.ops->string(t.ptr, s, len); return true; }
+
+    bool StartObject()
+    {
+        Target t = next();
+        if(!t.ops->startObject(t.ptr)) t = skipTarget();
+        m_levels.push_back(Level{t, false});
+        return true;
+    }
+
+    bool Key(const char* s, rapidjson::SizeType len, bool)
+    {
+        const Target& t = m_levels.back().target;
+        m_next = t.ops->key(t.ptr, s, len);
+        return true;
+    }
+
+    bool EndObject(rapidjson::SizeType) { m_levels.pop_back(); return true; }
+
+    bool StartArray()
+    {
+        Target t = next();
+        if(!t.ops->startArray(t.ptr)) t = skipTarget();
+        m_levels.push_back(Level{t, true});
+        return true;
+    }
+
+    bool EndArray(rapidjson::SizeType) { m_levels.pop_back(); return true; }
+private:
+    //the target of the value that starts: the next element in an array, the member set by Key or the root
+    Target next()
+    {
+        if(!m_levels.empty() && m_levels.back().array)
+        {
+            const Target& t = m_levels.back().target;
+            return t.ops->element(t.ptr);
+        }
+        return m_next;
+    }
+
+    struct Level
+    {
+        Target target;
+        bool array;
+    };
+
+    std::vector<Level> m_levels;
+    Target m_next;
+};
+
+struct Parser
+{
+    rapidjson::Reader reader;
+    Handler handler;
+};
+
+} //namespace
+
+void parse(const char* json, size_t size, Target root)
+{
+    //the targets do not parse, so the parser of the thread is never reentered
+    static thread_local Parser parser;
+    parser.handler.reset(root);
+    rapidjson::MemoryStream ms(json, size);
+    rapidjson::EncodedInputStream<rapidjson::UTF8<>, rapidjson::MemoryStream> is(ms);
+    rapidjson::ParseResult res = parser.reader.Parse<rapidjson::kParseDefaultFlags>(is, parser.handler);
+    if(res.IsError()) throw res;
+}
+
+Writer& threadWriter(StringOutput& out)
+{
+    static thread_local StringOutput s_out;
+    static thread_local Writer writer(s_out);
+    writer.Reset(out);
+    return writer;
+}
+
+} } } //namespace graft::serializer::sax
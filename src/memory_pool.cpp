@@ -0,0 +1,111 @@
+#include "memory_pool.h"
+
+namespace graft
+{
+
+constexpr size_t MemoryPool::BLOCK_ALIGN;
+constexpr size_t MemoryPool::MAX_BLOCK_SIZE;
+constexpr size_t MemoryPool::CLASS_COUNT;
+
+namespace
+{
+    thread_local MemoryPool* tls_pool = nullptr;
+}
+
+MemoryPool::~MemoryPool()
+{
+    for(FreeList& fl : m_free)
+    {
+        while(fl.head)
+        {
+            Block* b = fl.head;
+            fl.head = b->next;
+            ::operator delete(b);
+        }
+    }
+}
+
+void* MemoryPool::allocate(size_t size)
+{
+    if(size == 0 || MAX_BLOCK_SIZE < size)
+    {
+        m_largeCount.fetch_add(1, std::memory_order_relaxed);
+        return ::operator new(size);
+    }
+    size_t idx = (size - 1) / BLOCK_ALIGN;
+    FreeList& fl = m_free[idx];
+    {
+        std::lock_guard<SpinLock> lk(fl.lock);
+        Block* b = fl.head;
+        if(b)
+        {
+            fl.head = b->next;
+            --fl.count;
+            ++fl.hits;
+            return b;
+        }
+        ++fl.misses;
+    }
+    //allocate the whole class size so that the block can be reused by any request of the class
+    return ::operator new((idx + 1) * BLOCK_ALIGN);
+}
+
+void MemoryPool::deallocate(void* p, size_t size)
+{
+    if(!p) return;
+    if(size == 0 || MAX_BLOCK_SIZE < size)
+    {
+        ::operator delete(p);
+        return;
+    }
+    FreeList& fl = m_free[(size - 1) / BLOCK_ALIGN];
+    {
+        std::lock_guard<SpinLock> lk(fl.lock);
+        if(fl.count < m_maxFreeBlocks)
+        {
+            Block* b = static_cast<Block*>(p);
+            b->next = fl.head;
+            fl.head = b;
+            ++fl.count;
+            return;
+        }
+    }
+    ::operator delete(p);
+}
+
+uint64_t MemoryPool::hits() const
+{
+    uint64_t res = 0;
+    for(const FreeList& fl : m_free)
+    {
+        std::lock_guard<SpinLock> lk(fl.lock);
+        res += fl.hits;
+    }
+    return res;
+}
+
+uint64_t MemoryPool::misses() const
+{
+    uint64_t res = m_largeCount.load(std::memory_order_relaxed);
+    for(const FreeList& fl : m_free)
+    {
+        std::lock_guard<SpinLock> lk(fl.lock);
+        res += fl.misses;
+    }
+    return res;
+}
+
+MemoryPool& MemoryPool::local()
+{
+    if(tls_pool) return *tls_pool;
+    //never destroyed, blocks can be returned by static objects on exit
+    static MemoryPool* global = new MemoryPool();
+    return *global;
+}
+
+void MemoryPool::setLocal(MemoryPool* pool)
+{
+    tls_pool = pool;
+}
+
+}//namespace graft
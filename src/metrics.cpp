@@ -0,0 +1,213 @@
+#include "metrics.h"
+
+#include <sstream>
+#include <stdexcept>
+
+namespace graft
+{
+
+constexpr size_t Metrics::MAX_SERIES;
+constexpr const char* Metrics::CONTENT_TYPE;
+
+uint64_t Counter::value() const
+{
+    uint64_t res = 0;
+    for(const Shard& shard : m_shards)
+    {
+        res += shard.value.load(std::memory_order_relaxed);
+    }
+    return res;
+}
+
+Histogram::Histogram(const std::vector<double>& bounds)
+    : m_bounds(bounds)
+{
+    for(double b : m_bounds)
+    {
+        m_boundsUs.push_back(static_cast<int64_t>(b * 1000000));
+    }
+    //buckets, +Inf bucket, sum; rounded up to whole cache lines
+    const size_t cellsPerLine = metrics_detail::CACHE_LINE / sizeof(std::atomic<uint64_t>);
+    m_rowSize = (m_bounds.size() + 2 + cellsPerLine - 1) / cellsPerLine * cellsPerLine;
+    const size_t size = m_rowSize * metrics_detail::SHARD_COUNT;
+    m_cells.reset(new std::atomic<uint64_t>[size]);
+    for(size_t i = 0; i < size; ++i)
+    {
+        m_cells[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::observe(duration d)
+{
+    int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    if(us < 0) us = 0;
+    size_t idx = 0;
+    for(; idx < m_boundsUs.size() && m_boundsUs[idx] < us; ++idx);
+    std::atomic<uint64_t>* row = &m_cells[metrics_detail::shardIndex() * m_rowSize];
+    row[idx].fetch_add(1, std::memory_order_relaxed);
+    row[m_bounds.size() + 1].fetch_add(us, std::memory_order_relaxed);
+}
+
+Histogram::Snapshot Histogram::snapshot() const
+{
+    Snapshot res;
+    res.buckets.resize(m_bounds.size() + 1, 0);
+    uint64_t sum_us = 0;
+    for(size_t shard = 0; shard < metrics_detail::SHARD_COUNT; ++shard)
+    {
+        const std::atomic<uint64_t>* row = &m_cells[shard * m_rowSize];
+        for(size_t i = 0; i < res.buckets.size(); ++i)
+        {
+            uint64_t v = row[i].load(std::memory_order_relaxed);
+            res.buckets[i] += v;
+            res.count += v;
+        }
+        sum_us += row[m_bounds.size() + 1].load(std::memory_order_relaxed);
+    }
+    res.sum = sum_us / 1000000.0;
+    return res;
+}
+
+Metrics& Metrics::instance()
+{
+    //never destroyed, the metrics can be updated by static objects on exit
+    static Metrics* metrics = new Metrics();
+    return *metrics;
+}
+
+const std::vector<double>& Metrics::latencyBounds()
+{
+    static const std::vector<double> bounds = {
+        0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+    };
+    return bounds;
+}
+
+std::string Metrics::labels(std::initializer_list<std::pair<const char*, std::string>> pairs)
+{
+    std::string res;
+    for(auto& pair : pairs)
+    {
+        if(!res.empty()) res += ',';
+        res += pair.first;
+        res += "=\"";
+        for(char c : pair.second)
+        {
+            switch(c)
+            {
+            case '\\': res += "\\\\"; break;
+            case '"': res += "\\\""; break;
+            case '\n': res += "\\n"; break;
+            default: res += c; break;
+            }
+        }
+        res += '"';
+    }
+    return res;
+}
+
+Metrics::Family& Metrics::family(const std::string& name, const std::string& help, Type type)
+{
+    auto it = m_families.find(name);
+    if(it == m_families.end())
+    {
+        Family& f = m_families[name];
+        f.type = type;
+        f.help = help;
+        return f;
+    }
+    if(it->second.type != type) throw std::logic_error("metric " + name + " is registered with another type");
+    return it->second;
+}
+
+namespace
+{
+
+template<typename T, typename F>
+T& findOrCreate(std::map<std::string, std::unique_ptr<T>>& map, const std::string& labels, F make)
+{
+    auto it = map.find(labels);
+    if(it != map.end()) return *it->second;
+    const std::string& key = (map.size() < Metrics::MAX_SERIES)? labels : "overflow=\"true\"";
+    std::unique_ptr<T>& ptr = map[key];
+    if(!ptr) ptr = make();
+    return *ptr;
+}
+
+void writeSeries(std::ostringstream& ss, const std::string& name, const std::string& labels)
+{
+    ss << name;
+    if(!labels.empty()) ss << '{' << labels << '}';
+    ss << ' ';
+}
+
+}//namespace
+
+Counter& Metrics::counter(const std::string& name, const std::string& help, const std::string& labels)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    Family& f = family(name, help, Type::Counter);
+    return findOrCreate(f.counters, labels, []{ return std::make_unique<Counter>(); });
+}
+
+Gauge& Metrics::gauge(const std::string& name, const std::string& help, const std::string& labels)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    Family& f = family(name, help, Type::Gauge);
+    return findOrCreate(f.gauges, labels, []{ return std::make_unique<Gauge>(); });
+}
+
+Histogram& Metrics::histogram(const std::string& name, const std::string& help, const std::string& labels,
+                              const std::vector<double>& bounds)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    Family& f = family(name, help, Type::Histogram);
+    return findOrCreate(f.histograms, labels, [&bounds]{ return std::make_unique<Histogram>(bounds); });
+}
+
+std::string Metrics::exposition() const
+{
+    static const char* typeNames[] = { "counter", "gauge", "histogram" };
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+    std::ostringstream ss;
+    for(auto& pair : m_families)
+    {
+        const std::string& name = pair.first;
+        const Family& f = pair.second;
+        ss << "# HELP " << name << ' ' << f.help << '\n';
+        ss << "# TYPE " << name << ' ' << typeNames[static_cast<int>(f.type)] << '\n';
+        for(auto& it : f.counters)
+        {
+            writeSeries(ss, name, it.first);
+            ss << it.second->value() << '\n';
+        }
+        for(auto& it : f.gauges)
+        {
+            writeSeries(ss, name, it.first);
+            ss << it.second->value() << '\n';
+        }
+        for(auto& it : f.histograms)
+        {
+            const Histogram& h = *it.second;
+            Histogram::Snapshot snap = h.snapshot();
+            const std::string sep = it.first.empty()? "" : ",";
+            uint64_t acc = 0;
+            for(size_t i = 0; i < snap.buckets.size(); ++i)
+            {
+                acc += snap.buckets[i];
+                ss << name << "_bucket{" << it.first << sep << "le=\"";
+                if(i < h.bounds().size()) ss << h.bounds()[i];
+                else ss << "+Inf";
+                ss << "\"} " << acc << '\n';
+            }
+            writeSeries(ss, name + "_sum", it.first);
+            ss << snap.sum << '\n';
+            writeSeries(ss, name + "_count", it.first);
+            ss << snap.count << '\n';
+        }
+    }
+    return ss.str();
+}
+
+}//namespace graft
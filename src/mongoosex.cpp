@@ -1,5 +1,7 @@
 #include "mongoosex.h"
 
+#include <netdb.h>
+
 extern "C" {
 
 mg_connection *mg_connect_http_base(
@@ -13,6 +15,18 @@ mg_connection *mg_connect_http_base(
 namespace mg
 {
 
+namespace
+{
+
+//makes the send buffer large enough to append size bytes without reallocation
+void reserve_send_x(mg_connection *nc, size_t size)
+{
+    size_t required = nc->send_mbuf.len + size;
+    if (nc->send_mbuf.size < required) mbuf_resize(&nc->send_mbuf, required);
+}
+
+} //namespace
+
 mg_connection *mg_connect_http_opt_x(
     mg_mgr *mgr, MG_CB(mg_event_handler_t ev_handler, void *user_data),
     mg_connect_opts opts, const char *url, const char *extra_headers,
@@ -39,6 +53,9 @@ mg_connection *mg_connect_http_opt_x(
     if (path.len == 0) path = mg_mk_str("/");
     if (host.len == 0) host = mg_mk_str("");
 
+    //the request line, the headers and the body are appended to the reserved send buffer
+    reserve_send_x(nc, 64 + path.len + host.len + auth.len + strlen(extra_headers) + post_data.size());
+
     mg_printf(nc, "%s %.*s HTTP/1.1\r\nHost: %.*s\r\nContent-Length: %" SIZE_T_FMT
               "\r\n%.*s%s\r\n",
               (post_data.empty() ? "GET" : "POST"), (int) path.len, path.p,
@@ -51,6 +68,19 @@ mg_connection *mg_connect_http_opt_x(
     return nc;
 }
 
+void mg_send_http_request_x(mg_connection *nc, const std::string& host, const std::string& target,
+                            const char *extra_headers, const std::string& post_data)
+{
+    if (extra_headers == NULL) extra_headers = "";
+    reserve_send_x(nc, 64 + target.size() + host.size() + strlen(extra_headers) + post_data.size());
+
+    mg_printf(nc, "%s %.*s HTTP/1.1\r\nHost: %.*s\r\nContent-Length: %" SIZE_T_FMT "\r\n%s\r\n",
+              (post_data.empty() ? "GET" : "POST"), (int) target.size(), target.data(),
+              (int) host.size(), host.data(), post_data.size(), extra_headers);
+
+    mg_send(nc, post_data.c_str(), post_data.size());
+}
+
 mg_connection *mg_connect_http_x(
     mg_mgr *mgr, MG_CB(mg_event_handler_t ev_handler, void *user_data),
     const char *url, const char *extra_headers, const std::string& post_data)
@@ -62,4 +92,60 @@ mg_connection *mg_connect_http_x(
                                  post_data);
 }
 
+void mg_send_response_x(mg_connection *nc, int status_code, const char *extra_headers, const std::string& body)
+{
+    //the status line with the longest status message and Content-Length are less than 128 bytes
+    reserve_send_x(nc, 128 + (extra_headers? strlen(extra_headers) : 0) + body.size());
+    mg_send_head(nc, status_code, body.size(), extra_headers);
+    mg_send(nc, body.data(), body.size());
+}
+
+mg_connection *mg_bind_reuseport_x(
+    mg_mgr *mgr, const char *address,
+    MG_CB(mg_event_handler_t ev_handler, void *user_data))
+{
+    std::string addr(address);
+    const std::string tcp_prefix = "tcp://";
+    if (addr.compare(0, tcp_prefix.size(), tcp_prefix) == 0) addr.erase(0, tcp_prefix.size());
+
+    std::string host, port = addr;
+    std::string::size_type pos = addr.rfind(':');
+    if (pos != std::string::npos)
+    {
+        host = addr.substr(0, pos);
+        port = addr.substr(pos + 1);
+    }
+
+    addrinfo hints, *res = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(host.empty()? nullptr : host.c_str(), port.c_str(), &hints, &res) != 0 || !res) return NULL;
+
+    sock_t sock = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    bool ok = sock != INVALID_SOCKET
+            && setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (void *) &on, sizeof(on)) == 0
+            && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (void *) &on, sizeof(on)) == 0
+            && bind(sock, res->ai_addr, res->ai_addrlen) == 0
+            && listen(sock, SOMAXCONN) == 0;
+    freeaddrinfo(res);
+    if (!ok)
+    {
+        if (sock != INVALID_SOCKET) closesocket(sock);
+        return NULL;
+    }
+
+    //mg_add_sock makes the socket non-blocking, the listening flag makes the manager accept on it
+    mg_connection *nc = mg_add_sock(mgr, sock, MG_CB(ev_handler, user_data));
+    if (nc == NULL)
+    {
+        closesocket(sock);
+        return NULL;
+    }
+    nc->flags |= MG_F_LISTENING;
+    return nc;
+}
+
 } //namespace mg
@@ -2,10 +2,11 @@
 #include "jsonrpc.h"
 #include "context.h"
 #include "rta/supernode.h"
+#include "rta/paymentstore.h"
 #include "requests/broadcast.h"
 #include "requests/salestatusrequest.h"
 
-#include <string_tools.h> // epee
+#include "common/utils.h"
 #include <misc_log_ex.h>
 
 namespace graft {
@@ -129,9 +130,8 @@ Status errorCustomError(const std::string &message, int code, Output &output)
 
 void cleanPaySaleData(const std::string &payment_id, Context &ctx)
 {
-    ctx.global.remove(payment_id + CONTEXT_KEY_PAY);
-    ctx.global.remove(payment_id + CONTEXT_KEY_SALE);
-    ctx.global.remove(payment_id + CONTEXT_KEY_STATUS);
+    PaymentStorePtr payments = ctx.global.get(CONTEXT_KEY_PAYMENTS, PaymentStorePtr());
+    payments->remove(payment_id);
 }
 
 void buildBroadcastSaleStatusOutput(const std::string &payment_id, int status, const SupernodePtr &supernode, Output &output)
@@ -145,10 +145,10 @@ void buildBroadcastSaleStatusOutput(const std::string &payment_id, int status, c
     std::string msg = payment_id + ":" + to_string(ussb.Status);
     crypto::signature sign;
     supernode->signMessage(msg, sign);
-    ussb.signature = epee::string_tools::pod_to_hex(sign);
+    ussb.signature = utils::pod_to_hex(sign);
 
     Output innerOut;
-    innerOut.loadT<serializer::JSON_B64>(ussb);
+    innerOut.loadT<serializer::RTA_B64>(ussb);
 
     // send payload
     BroadcastRequestJsonRpc cryptonode_req;
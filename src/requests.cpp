@@ -10,6 +10,8 @@
 #include "rejectpayrequest.h"
 #include "forwardrequest.h"
 #include "healthcheckrequest.h"
+#include "tracerequest.h"
+#include "metricsrequest.h"
 
 #include "sendrawtxrequest.h"
 #include "authorizertatxrequest.h"
@@ -42,4 +44,14 @@ void registerHealthcheckRequests(Router &router)
     graft::registerHealthcheckRequest(router);
 }
 
+void registerMetricsRequests(Router &router)
+{
+    graft::registerMetricsRequest(router);
+}
+
+void registerDebugRequests(Router &router)
+{
+    graft::registerTraceRequest(router);
+}
+
 }
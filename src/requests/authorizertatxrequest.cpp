@@ -28,11 +28,14 @@
 
 #include "authorizertatxrequest.h"
 #include "requestdefines.h"
+#include "requesttools.h"
 #include "jsonrpc.h"
 #include "sendrawtxrequest.h"
 #include "requests/multicast.h"
 #include "requests/broadcast.h"
 #include "rta/supernode.h"
+#include "rta/serverstate.h"
+#include "rta/paymentstore.h"
 #include <misc_log_ex.h>
 #include <exception>
 
@@ -51,12 +54,6 @@ namespace graft {
 
 
 
-GRAFT_DEFINE_IO_STRUCT_INITED(SupernodeSignature,
-                              (std::string, address, std::string()),
-                              (std::string, result_signature, std::string()), // signarure for tx_id + result
-                              (std::string, tx_signature, std::string())      // signature for tx_id only
-                              );
-
 GRAFT_DEFINE_IO_STRUCT_INITED(AuthorizeRtaTxRequestResponse,
                         (int, Result, STATUS_OK)
                        );
@@ -89,29 +86,6 @@ enum class RtaAuthResponseHandlerState : int {
     StatusBroadcastReply
 };
 
-struct RtaAuthResult
-{
-    std::vector<SupernodeSignature> approved;
-    std::vector<SupernodeSignature> rejected;
-    bool alreadyApproved(const std::string &address)
-    {
-        return contains(approved, address);
-    }
-
-    bool alreadyRejected(const std::string &address)
-    {
-        return contains(rejected, address);
-    }
-
-private:
-    bool contains(const std::vector<SupernodeSignature> &v, const std::string &address)
-    {
-        return std::find_if(v.begin(), v.end(), [&](const SupernodeSignature &item) {
-            return item.address == address;
-        }) != v.end();
-    }
-};
-
 // TODO: this function duplicates PendingTransaction::putRtaSignatures
 void putRtaSignaturesToTx(cryptonote::transaction &tx, const std::vector<SupernodeSignature> &signatures, bool testnet)
 {
@@ -122,7 +96,7 @@ void putRtaSignaturesToTx(cryptonote::transaction &tx, const std::vector<Superno
             LOG_ERROR("error parsing address from string: " << sign.address);
             continue;
         }
-        epee::string_tools::hex_to_pod(sign.tx_signature, bin_sign.signature);
+        utils::hex_to_pod(sign.tx_signature, bin_sign.signature);
         bin_signs.push_back(bin_sign);
     }
     tx.put_rta_signatures(bin_signs);
@@ -139,11 +113,11 @@ bool signAuthResponse(AuthorizeRtaTxResponse &arg, const SupernodePtr &supernode
 {
     crypto::signature sign;
     supernode->signMessage(arg.tx_id + ":" + to_string(arg.result), sign);
-    arg.signature.result_signature = epee::string_tools::pod_to_hex(sign);
+    arg.signature.result_signature = utils::pod_to_hex(sign);
     crypto::hash tx_id;
-    epee::string_tools::hex_to_pod(arg.tx_id, tx_id);
+    utils::hex_to_pod(arg.tx_id, tx_id);
     supernode->signHash(tx_id, sign);
-    arg.signature.tx_signature = epee::string_tools::pod_to_hex(sign);
+    arg.signature.tx_signature = utils::pod_to_hex(sign);
     arg.signature.address = supernode->walletAddress();
 }
 
@@ -158,17 +132,17 @@ bool validateAuthResponse(const AuthorizeRtaTxResponse &arg, const SupernodePtr
     crypto::signature sign_result;
     crypto::signature sign_tx_id;
     crypto::hash tx_id;
-    if (!epee::string_tools::hex_to_pod(arg.signature.result_signature, sign_result)) {
+    if (!utils::hex_to_pod(arg.signature.result_signature, sign_result)) {
         LOG_ERROR("Error parsing signature: " << arg.signature.result_signature);
         return false;
     }
 
-    if (!epee::string_tools::hex_to_pod(arg.signature.tx_signature, sign_tx_id)) {
+    if (!utils::hex_to_pod(arg.signature.tx_signature, sign_tx_id)) {
         LOG_ERROR("Error parsing signature: " << arg.signature.result_signature);
         return false;
     }
 
-    if (!epee::string_tools::hex_to_pod(arg.tx_id, tx_id)) {
+    if (!utils::hex_to_pod(arg.tx_id, tx_id)) {
         LOG_ERROR("Error parsing tx_id: " << arg.tx_id);
         return false;
     }
@@ -199,14 +173,15 @@ Status handleTxAuthRequest(const Router::vars_t& vars, const graft::Input& input
         return errorCustomError(string("failed to parse request: ")  + input.data(), ERROR_INVALID_REQUEST, output);
     }
 
-    SupernodePtr supernode = ctx.global.get(CONTEXT_KEY_SUPERNODE, SupernodePtr());
+    Context::State state = ctx.state();
+    const SupernodePtr& supernode = state->supernode;
 
 
     AuthorizeRtaTxRequest authReq;
     Input innerInput;
     innerInput.load(req.params.data);
 
-    if (!innerInput.getT<serializer::JSON_B64>(authReq)) {
+    if (!innerInput.getT<serializer::RTA_B64>(authReq)) {
         return errorInvalidParams(output);
     }
 
@@ -215,7 +190,7 @@ Status handleTxAuthRequest(const Router::vars_t& vars, const graft::Input& input
     crypto::hash tx_hash, tx_prefix_hash;
     cryptonote::blobdata tx_blob;
 
-    if (!epee::string_tools::parse_hexstr_to_binbuff(authReq.tx_hex, tx_blob)) {
+    if (!utils::from_hex(authReq.tx_hex, tx_blob)) {
         LOG_ERROR("Failed to parse hex tx: " << authReq.tx_hex);
         return errorInvalidTransaction(authReq.tx_hex, output);
     }
@@ -225,7 +200,7 @@ Status handleTxAuthRequest(const Router::vars_t& vars, const graft::Input& input
         return errorInvalidTransaction(authReq.tx_hex, output);
     }
 
-    string tx_id_str = epee::string_tools::pod_to_hex(tx_hash);
+    string tx_id_str = utils::pod_to_hex(tx_hash);
     MDEBUG("incoming auth req with tx: " << tx_id_str);
     // check if we already processed this tx
 
@@ -258,9 +233,19 @@ Status handleTxAuthRequest(const Router::vars_t& vars, const graft::Input& input
     ctx.global.set(authResponse.tx_id + CONTEXT_KEY_TX_BY_TXID, tx, RTA_TX_TTL);
     // TODO: remove it when payment id will be in tx.extra
     ctx.global.set(authResponse.tx_id + CONTEXT_KEY_PAYMENT_ID_BY_TXID, authReq.payment_id, RTA_TX_TTL);
+    // the votes for the previous tx of the payment are not counted any more
+    PaymentStorePtr payments = ctx.global.get(CONTEXT_KEY_PAYMENTS, PaymentStorePtr());
+    payments->update(authReq.payment_id, [&tx_id_str](PaymentRecord &record) {
+        if (record.txId == tx_id_str) {
+            return false;
+        }
+        record.txId = tx_id_str;
+        record.authResult = RtaAuthResult();
+        return true;
+    });
 
     Output innerOut;
-    innerOut.loadT<serializer::JSON_B64>(authResponse);
+    innerOut.loadT<serializer::RTA_B64>(authResponse);
     authResponseMulticast.params.data = innerOut.data();
     output.load(authResponseMulticast);
     output.path = "/json_rpc/rta";
@@ -326,12 +311,13 @@ Status handleRtaAuthResponseMulticast(const Router::vars_t& vars, const graft::I
 
         innerIn.load(req.params.data);
 
-        if (!innerIn.getT<serializer::JSON_B64>(rtaAuthResp)) {
+        if (!innerIn.getT<serializer::RTA_B64>(rtaAuthResp)) {
             LOG_ERROR("error deserialize rta auth response");
             return errorInvalidParams(output);
         }
 
-        SupernodePtr supernode = ctx.global.get(CONTEXT_KEY_SUPERNODE, SupernodePtr());
+        Context::State state = ctx.state();
+        const SupernodePtr& supernode = state->supernode;
 
         RTAAuthResult result = static_cast<RTAAuthResult>(rtaAuthResp.result);
         // sanity check
@@ -365,34 +351,52 @@ Status handleRtaAuthResponseMulticast(const Router::vars_t& vars, const graft::I
         }
         MDEBUG("rta_result signature validated");
 
-        // stop handling it if we already processed response
-
+        // stop handling it if we already processed response, the check and the vote are under one lock
+        PaymentStorePtr payments = ctx.global.get(CONTEXT_KEY_PAYMENTS, PaymentStorePtr());
         RtaAuthResult authResult;
-        string ctx_tx_to_auth_resp = rtaAuthResp.tx_id + CONTEXT_KEY_AUTH_RESULT_BY_TXID;
-        if (ctx.global.hasKey(ctx_tx_to_auth_resp)) {
-            authResult = ctx.global.get(ctx_tx_to_auth_resp, authResult);
+        bool otherTx = false;
+        bool accepted = payments->update(payment_id, [&](PaymentRecord &record) {
+            // the votes are counted for the current tx of the payment only
+            if (!record.txId.empty() && record.txId != rtaAuthResp.tx_id) {
+                otherTx = true;
+                return false;
+            }
+            if (record.authResult.txId != rtaAuthResp.tx_id) {
+                record.authResult = RtaAuthResult();
+                record.authResult.txId = rtaAuthResp.tx_id;
+            }
+            if (record.authResult.alreadyApproved(rtaAuthResp.signature.address)
+                    || record.authResult.alreadyRejected(rtaAuthResp.signature.address)) {
+                return false;
+            }
+            if (result == RTAAuthResult::Approved) {
+                record.authResult.approved.push_back(rtaAuthResp.signature);
+            } else {
+                record.authResult.rejected.push_back(rtaAuthResp.signature);
+            }
+            record.txId = rtaAuthResp.tx_id;
+            authResult = record.authResult;
+            return true;
+        });
+
+        if (otherTx) {
+            LOG_ERROR("rta auth response for tx " << rtaAuthResp.tx_id << " which is not the current tx of payment " << payment_id);
+            return errorCustomError(string("not the current tx of the payment: ") + rtaAuthResp.tx_id,
+                                    ERROR_INVALID_PARAMS, output);
         }
-
-        if (authResult.alreadyApproved(rtaAuthResp.signature.address)
-                || authResult.alreadyRejected(rtaAuthResp.signature.address)) {
+        if (!accepted) {
             return errorCustomError(string("supernode: ") + rtaAuthResp.signature.address + " already processed",
                                     ERROR_ADDRESS_INVALID, output);
         }
 
-        if (result == RTAAuthResult::Approved) {
-            authResult.approved.push_back(rtaAuthResp.signature);
-        } else {
-            authResult.rejected.push_back(rtaAuthResp.signature);
-        }
-
         MDEBUG("rta result accepted from " << rtaAuthResp.signature.address);
-        // store result in context
-        ctx.global.set(ctx_tx_to_auth_resp, authResult, RTA_TX_TTL);
         MDEBUG("approved votes: " << authResult.approved.size()
                << ", rejected votes: " << authResult.rejected.size());
 
         MDEBUG(__FUNCTION__ << " end");
-        if (!ctx.global.hasKey(rtaAuthResp.tx_id + CONTEXT_KEY_TX_BY_TXID)) {
+        std::shared_ptr<const cryptonote::transaction> stored_tx =
+                ctx.global.getShared<cryptonote::transaction>(rtaAuthResp.tx_id + CONTEXT_KEY_TX_BY_TXID);
+        if (!stored_tx) {
             string msg = string("rta auth response processed but no tx found for tx id: ") + rtaAuthResp.tx_id;
             LOG_ERROR(msg);
             return errorCustomError(msg, ERROR_INTERNAL_ERROR, output);
@@ -402,7 +406,10 @@ Status handleRtaAuthResponseMulticast(const Router::vars_t& vars, const graft::I
             MDEBUG("tx " << rtaAuthResp.tx_id << " rejected by auth sample, updating status");
             // tx rejected by auth sample, broadcast status;
             ctx.global[__FUNCTION__] = RtaAuthResponseHandlerState::StatusBroadcastReply;
-            ctx.global.set(payment_id + CONTEXT_KEY_STATUS, static_cast<int> (RTAStatus::Fail), RTA_TX_TTL);
+            payments->update(payment_id, [](PaymentRecord &record) {
+                record.status = static_cast<int>(RTAStatus::Fail);
+                return true;
+            });
             buildBroadcastSaleStatusOutput(payment_id, static_cast<int> (RTAStatus::Fail), supernode, output);
             return Status::Forward;
         } else if (authResult.approved.size() >= RTA_VOTES_TO_APPROVE) {
@@ -410,7 +417,8 @@ Status handleRtaAuthResponseMulticast(const Router::vars_t& vars, const graft::I
             SendRawTxRequest req;
             // store tx_id in local context so we can use it when broadcasting status
             ctx.local[CONTEXT_TX_ID] = rtaAuthResp.tx_id;
-            cryptonote::transaction tx = ctx.global.get(rtaAuthResp.tx_id + CONTEXT_KEY_TX_BY_TXID, cryptonote::transaction());
+            // the stored tx is shared, the signatures are put to a copy
+            cryptonote::transaction tx = *stored_tx;
             putRtaSignaturesToTx(tx, authResult.approved, supernode->testnet());
             createSendRawTxRequest(tx, req);
             {
@@ -420,7 +428,7 @@ Status handleRtaAuthResponseMulticast(const Router::vars_t& vars, const graft::I
                 buf += "\n";
                 for (const auto & rta_sign:  tx.rta_signatures) {
                     buf += string("      address: ") + cryptonote::get_account_address_as_str(true, rta_sign.address) + "\n";
-                    buf += string("      signature: ") + epee::string_tools::pod_to_hex(rta_sign.signature) + "\n";
+                    buf += string("      signature: ") + utils::pod_to_hex(rta_sign.signature) + "\n";
                 }
                 MDEBUG(buf);
             }
@@ -428,7 +436,7 @@ Status handleRtaAuthResponseMulticast(const Router::vars_t& vars, const graft::I
             // call cryptonode
             output.load(req);
             output.path = "/sendrawtransaction";
-            ctx.local[__FUNCTION__] = RtaAuthResponseHandlerState::TransactionPushReply;
+            ctx.local[GRAFT_FUNCTION_KEY] = RtaAuthResponseHandlerState::TransactionPushReply;
 
             return Status::Forward;
         } else {
@@ -472,7 +480,8 @@ Status handleCryptonodeTxPushResponse(const Router::vars_t& vars, const graft::I
         LOG_ERROR("Internal error, payment id not found for tx id: " << tx_id);
     }
 
-    RTAStatus status = static_cast<RTAStatus>(ctx.global.get(payment_id + CONTEXT_KEY_STATUS, int(RTAStatus::None)));
+    PaymentStorePtr payments = ctx.global.get(CONTEXT_KEY_PAYMENTS, PaymentStorePtr());
+    RTAStatus status = static_cast<RTAStatus>(payments->status(payment_id));
     if (status == RTAStatus::None) {
         LOG_ERROR("can't find status for payment_id: " << payment_id);
         return errorInvalidParams(output);
@@ -503,11 +512,12 @@ Status handleCryptonodeTxPushResponse(const Router::vars_t& vars, const graft::I
         status = RTAStatus::Success;
     }
 
-    SupernodePtr supernode = ctx.global.get(CONTEXT_KEY_SUPERNODE, SupernodePtr());
+    Context::State state = ctx.state();
+    const SupernodePtr& supernode = state->supernode;
 
     MDEBUG(__FUNCTION__ << " broadcasting status for payment id: " << payment_id << ", status : " << int(status));
     buildBroadcastSaleStatusOutput(payment_id, int(status), supernode, output);
-    ctx.local[__FUNCTION__] = RtaAuthResponseHandlerState::StatusBroadcastReply;
+    ctx.local[GRAFT_FUNCTION_KEY] = RtaAuthResponseHandlerState::StatusBroadcastReply;
     MDEBUG(__FUNCTION__ << " end");
     return Status::Forward;
 }
@@ -546,13 +556,13 @@ Status authorizeRtaTxRequestHandler(const Router::vars_t& vars, const graft::Inp
                                  graft::Context& ctx, graft::Output& output) noexcept
 {
     try {
-        RtaAuthRequestHandlerState state = ctx.local.hasKey(__FUNCTION__) ? ctx.local[__FUNCTION__] : RtaAuthRequestHandlerState::ClientRequest;
+        RtaAuthRequestHandlerState state = ctx.local.hasKey(GRAFT_FUNCTION_KEY) ? ctx.local[GRAFT_FUNCTION_KEY] : RtaAuthRequestHandlerState::ClientRequest;
 
         MDEBUG(__FUNCTION__ << " state: " << (int) state);
         switch (state) {
         case RtaAuthRequestHandlerState::ClientRequest:
             MDEBUG("called by client, payload: " << input.data());
-            ctx.local[__FUNCTION__] = RtaAuthRequestHandlerState::CryptonodeReply;
+            ctx.local[GRAFT_FUNCTION_KEY] = RtaAuthRequestHandlerState::CryptonodeReply;
             return handleTxAuthRequest(vars, input, ctx, output);
         case RtaAuthRequestHandlerState::CryptonodeReply:
             MDEBUG("cyptonode reply, payload: " << input.data());
@@ -583,18 +593,18 @@ Status authorizeRtaTxResponseHandler(const Router::vars_t& vars, const graft::In
 {
 
     try {
-        RtaAuthResponseHandlerState state = ctx.local.hasKey(__FUNCTION__) ? ctx.local[__FUNCTION__] : RtaAuthResponseHandlerState::RtaAuthReply;
+        RtaAuthResponseHandlerState state = ctx.local.hasKey(GRAFT_FUNCTION_KEY) ? ctx.local[GRAFT_FUNCTION_KEY] : RtaAuthResponseHandlerState::RtaAuthReply;
         MDEBUG(__FUNCTION__ << " state: " << int(state) << ", status: "<< (int) ctx.local.getLastStatus() << ", task id: " << boost::uuids::to_string(ctx.getId()));
         MDEBUG("auth_resp: input: " << input.data());
 
         switch (state) {
         // actually not a reply, just incoming multicast. same as "called by client" and client is cryptonode here
         case RtaAuthResponseHandlerState::RtaAuthReply:
-            ctx.local[__FUNCTION__] = RtaAuthResponseHandlerState::TransactionPushReply;
+            ctx.local[GRAFT_FUNCTION_KEY] = RtaAuthResponseHandlerState::TransactionPushReply;
             return handleRtaAuthResponseMulticast(vars, input, ctx, output);
 
         case RtaAuthResponseHandlerState::TransactionPushReply:
-            ctx.local[__FUNCTION__] = RtaAuthResponseHandlerState::StatusBroadcastReply;
+            ctx.local[GRAFT_FUNCTION_KEY] = RtaAuthResponseHandlerState::StatusBroadcastReply;
             return handleCryptonodeTxPushResponse(vars, input, ctx, output);
 
         case RtaAuthResponseHandlerState::StatusBroadcastReply:
@@ -618,9 +628,10 @@ void registerAuthorizeRtaTxRequests(graft::Router &router)
 {
     Router::Handler3 request_handler(nullptr, authorizeRtaTxRequestHandler, nullptr);
     Router::Handler3 response_handler(nullptr, authorizeRtaTxResponseHandler, nullptr);
-    router.addRoute(PATH_REQUEST, METHOD_POST, request_handler);
+    router.addRoute(PATH_REQUEST, METHOD_POST, request_handler, Priority::High,
+                    multicastPaymentIdAffinity("payment_id"));
     LOG_PRINT_L1("route " << PATH_REQUEST << " registered");
-    router.addRoute(PATH_RESPONSE, METHOD_POST, response_handler);
+    router.addRoute(PATH_RESPONSE, METHOD_POST, response_handler, Priority::High);
     LOG_PRINT_L1("route " << PATH_RESPONSE << " registered");
 
 }
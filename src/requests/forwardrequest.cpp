@@ -34,8 +34,9 @@ void registerForwardRequest(Router &router)
     };
 
     //METHOD_GET is required here because some GET requests from the wallet has body
+    //wallet proxy traffic yields to RTA requests under load
     router.addRoute("/{forward:gethashes.bin|json_rpc|getblocks.bin|gettransactions|sendrawtransaction|getheight|get_transaction_pool_hashes.bin|get_outs.bin}",
-                               METHOD_POST|METHOD_GET, graft::Router::Handler3(forward,nullptr,nullptr));
+                               METHOD_POST|METHOD_GET, graft::Router::Handler3(forward,nullptr,nullptr), graft::Priority::Low);
 }
 
 }
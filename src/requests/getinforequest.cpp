@@ -56,7 +56,7 @@ Status getInfoHandler(const Router::vars_t& vars, const graft::Input& input,
     //     2.3 HTTP body (normally JSON RPC but could be some arbitrary JSON which is not valid JSON RPC)
     //  3. return Forward, which tells framework to forward request to cryptonode
     LOG_PRINT_L2(__FUNCTION__);
-    if (!ctx.local.hasKey(__FUNCTION__)) {
+    if (!ctx.local.hasKey(GRAFT_FUNCTION_KEY)) {
         LOG_PRINT_L2("call from client, forwarding to cryptonode...");
         JsonRpcRequestHeader req;
         req.method = "get_info";
@@ -64,7 +64,7 @@ Status getInfoHandler(const Router::vars_t& vars, const graft::Input& input,
         output.path = "/json_rpc";
         // alternatively, it could NOT be done like this:
         // output.uri = ctx.global.getConfig()->cryptonode_rpc_address + "/json_rpc";
-        ctx.local[__FUNCTION__] = true;
+        ctx.local[GRAFT_FUNCTION_KEY] = true;
         return Status::Forward;
     } else {
     // 2. response from cryptonode
@@ -83,7 +83,7 @@ Status getInfoHandler(const Router::vars_t& vars, const graft::Input& input,
         LOG_PRINT_L2("status: " << (int)status);
         LOG_PRINT_L2("error: " << error);
         LOG_PRINT_L2("input.http code: " << input.resp_code);
-        LOG_PRINT_L2("input.http status msg: " << input.resp_status_msg);
+        LOG_PRINT_L2("input.http status msg: " << input.resp_status_msg_view());
 
         GetInfoResponseJsonRpc resp;
         bool parsed = input.get<GetInfoResponseJsonRpc>(resp);
@@ -0,0 +1,24 @@
+#include "metricsrequest.h"
+#include "metrics.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "supernode.metricsrequest"
+
+namespace graft {
+
+Status metricsHandler(const Router::vars_t& vars, const graft::Input& input,
+                      graft::Context& ctx, graft::Output& output)
+{
+    output.body = Metrics::instance().exposition();
+    output.extra_headers = std::string("Content-Type: ") + Metrics::CONTENT_TYPE + "\r\n";
+    return Status::Ok;
+}
+
+void registerMetricsRequest(Router &router)
+{
+    // Prometheus text exposition
+    Router::Handler3 h3(nullptr, metricsHandler, nullptr);
+    router.addRoute("/metrics", METHOD_GET, h3, Priority::High);
+}
+
+}
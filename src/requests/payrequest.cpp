@@ -7,6 +7,8 @@
 #include "requests/authorizertatxrequest.h"
 #include "rta/supernode.h"
 #include "rta/fullsupernodelist.h"
+#include "rta/serverstate.h"
+#include "rta/paymentstore.h"
 #include "inout.h"
 #include "jsonrpc.h"
 
@@ -38,14 +40,16 @@ Status handleClientPayRequest(const Router::vars_t& vars, const graft::Input& in
     }
     const PayRequest &in = req.params;
 
-    SupernodePtr supernode = ctx.global.get(CONTEXT_KEY_SUPERNODE, SupernodePtr());
-    FullSupernodeListPtr fsl = ctx.global.get(CONTEXT_KEY_FULLSUPERNODELIST, FullSupernodeListPtr());
+    Context::State state = ctx.state();
+    const SupernodePtr& supernode = state->supernode;
+    const FullSupernodeListPtr& fsl = state->fsl;
+    PaymentStorePtr payments = ctx.global.get(CONTEXT_KEY_PAYMENTS, PaymentStorePtr());
     // we don't really need to check address here, as we supposed to receive transaction
     if (!supernode->validateAddress(in.Address, supernode->testnet())) {
         return errorInvalidAddress(output);
     }
 
-    int current_status = ctx.global.get(in.PaymentID + CONTEXT_KEY_STATUS, static_cast<int>(RTAStatus::None));
+    int current_status = payments->status(in.PaymentID);
     if (errorFinishedPayment(current_status, output)) {
         return Status::Error;
     }
@@ -60,7 +64,7 @@ Status handleClientPayRequest(const Router::vars_t& vars, const graft::Input& in
     crypto::hash tx_hash, tx_prefix_hash;
     cryptonote::blobdata tx_blob;
 
-    if (!epee::string_tools::parse_hexstr_to_binbuff(tx_hex, tx_blob)) {
+    if (!utils::from_hex(tx_hex, tx_blob)) {
         return errorInvalidTransaction(tx_hex, output);
     }
     if (!cryptonote::parse_and_validate_tx_from_blob(tx_blob, tx, tx_hash, tx_prefix_hash)) {
@@ -71,10 +75,10 @@ Status handleClientPayRequest(const Router::vars_t& vars, const graft::Input& in
     if (!fsl->buildAuthSample(in.BlockNumber, authSample) || authSample.size() != FullSupernodeList::AUTH_SAMPLE_SIZE) {
         return errorBuildAuthSample(output);
     }
-    LOG_PRINT_L0(__FUNCTION__ << " incoming pay, tx: " << epee::string_tools::pod_to_hex(tx_hash) << ", payment_id: " << in.PaymentID);
+    const string tx_id = utils::pod_to_hex(tx_hash);
+    LOG_PRINT_L0(__FUNCTION__ << " incoming pay, tx: " << tx_id << ", payment_id: " << in.PaymentID);
     // map tx_id -> payment id
-    ctx.global.set(epee::string_tools::pod_to_hex(tx_hash) + CONTEXT_KEY_PAYMENT_ID_BY_TXID,
-                   in.PaymentID, RTA_TX_TTL);
+    ctx.global.set(tx_id + CONTEXT_KEY_PAYMENT_ID_BY_TXID, in.PaymentID, RTA_TX_TTL);
 
     // send multicast to /cryptonode/authorize_rta_tx_request
     MulticastRequestJsonRpc cryptonode_req;
@@ -88,7 +92,7 @@ Status handleClientPayRequest(const Router::vars_t& vars, const graft::Input& in
     authTxReq.tx_hex = tx_hex;
     authTxReq.payment_id = in.PaymentID;
 
-    innerOut.loadT<serializer::JSON_B64>(authTxReq);
+    innerOut.loadT<serializer::RTA_B64>(authTxReq);
     cryptonode_req.method = "multicast";
     cryptonode_req.params.callback_uri =  "/cryptonode/authorize_rta_tx_request";
     cryptonode_req.params.data = innerOut.data();
@@ -97,8 +101,15 @@ Status handleClientPayRequest(const Router::vars_t& vars, const graft::Input& in
     ctx.local["payment_id"] = in.PaymentID;
     // TODO: what is the purpose of PayData?
     PayData data(in.Address, in.BlockNumber, in.Amount);
-    ctx.global[in.PaymentID + CONTEXT_KEY_PAY] = data;
-    ctx.global[in.PaymentID + CONTEXT_KEY_STATUS] = static_cast<int>(RTAStatus::InProgress);
+    payments->update(in.PaymentID, [&](PaymentRecord &record) {
+        record.pay = data;
+        if (record.txId != tx_id) {
+            record.authResult = RtaAuthResult();
+        }
+        record.txId = tx_id;
+        record.status = static_cast<int>(RTAStatus::InProgress);
+        return true;
+    });
 
     output.load(cryptonode_req);
     output.path = "/json_rpc/rta";
@@ -114,12 +125,18 @@ Status handleTxAuthReply(const Router::vars_t& vars, const graft::Input& input,
     // check cryptonode reply
     MulticastResponseFromCryptonodeJsonRpc resp;
     std::string payment_id = ctx.local["payment_id"];
+    PaymentStorePtr payments = ctx.global.get(CONTEXT_KEY_PAYMENTS, PaymentStorePtr());
 
     JsonRpcErrorResponse error;
     if (!input.get(resp) || resp.error.code != 0 || resp.result.status != STATUS_OK) {
 
-        ctx.global.remove(payment_id + CONTEXT_KEY_PAY);
-        ctx.global.remove(payment_id + CONTEXT_KEY_STATUS);
+        payments->updateExisting(payment_id, [](PaymentRecord &record) {
+            record.pay = boost::none;
+            record.txId.clear();
+            record.authResult = RtaAuthResult();
+            record.status = static_cast<int>(RTAStatus::None);
+            return true;
+        });
 
         error.error.code = ERROR_INTERNAL_ERROR;
         error.error.message = "Error multicasting request";
@@ -128,9 +145,11 @@ Status handleTxAuthReply(const Router::vars_t& vars, const graft::Input& input,
         return Status::Error;
     }
 
-    SupernodePtr supernode = ctx.global.get(CONTEXT_KEY_SUPERNODE, SupernodePtr());
+    Context::State state = ctx.state();
+    const SupernodePtr& supernode = state->supernode;
 
-    int status = ctx.global.get(payment_id + CONTEXT_KEY_STATUS, static_cast<int>((RTAStatus::InProgress)));
+    int status = static_cast<int>(RTAStatus::InProgress);
+    payments->read(payment_id, [&status](const PaymentRecord &record) { status = record.status; });
     buildBroadcastSaleStatusOutput(payment_id, status, supernode, output);
 
 
@@ -176,14 +195,14 @@ Status handleStatusBroadcastReply(const Router::vars_t& vars, const graft::Input
 Status payClientHandler(const Router::vars_t& vars, const graft::Input& input,
                         graft::Context& ctx, graft::Output& output)
 {
-    PayHandlerState state = ctx.local.hasKey(__FUNCTION__) ? ctx.local[__FUNCTION__] : PayHandlerState::ClientRequest;
+    PayHandlerState state = ctx.local.hasKey(GRAFT_FUNCTION_KEY) ? ctx.local[GRAFT_FUNCTION_KEY] : PayHandlerState::ClientRequest;
 
     // state machine to perform two calls to cryptonode and return result to the client
     switch (state) {
     // client requested "/pay"
     case PayHandlerState::ClientRequest:
         LOG_PRINT_L0("called by client, payload: " << input.data());
-        ctx.local[__FUNCTION__] = PayHandlerState::TxAuthReply;
+        ctx.local[GRAFT_FUNCTION_KEY] = PayHandlerState::TxAuthReply;
         // call cryptonode's "/rta/multicast" to send sale data to auth sample
         // "handleClientPayRequest" returns Forward;
         return handleClientPayRequest(vars, input, ctx, output);
@@ -192,7 +211,7 @@ Status payClientHandler(const Router::vars_t& vars, const graft::Input& input,
         // "sale status" with broadcast to cryptonode
         LOG_PRINT_L0("authorize_rta_tx_request multicast response from cryptonode: " << input.data());
         LOG_PRINT_L0("status: " << (int)ctx.local.getLastStatus());
-        ctx.local[__FUNCTION__] = PayHandlerState::StatusReply;
+        ctx.local[GRAFT_FUNCTION_KEY] = PayHandlerState::StatusReply;
         // handleSameMulticast returns Forward, call performed according traffic capture but after that moment
         // this handler never called again, but it supposed to be "broadcast" reply from cryptonode
         return handleTxAuthReply(vars, input, ctx, output);
@@ -211,7 +230,7 @@ Status payClientHandler(const Router::vars_t& vars, const graft::Input& input,
 void registerPayRequest(Router &router)
 {
     Router::Handler3 clientHandler(nullptr, payClientHandler, nullptr);
-    router.addRoute("/pay", METHOD_POST, clientHandler);
+    router.addRoute("/pay", METHOD_POST, clientHandler, Priority::Normal, paymentIdAffinity());
 }
 
 }
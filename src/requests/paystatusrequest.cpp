@@ -1,6 +1,7 @@
 #include "paystatusrequest.h"
 #include "requestdefines.h"
 #include "jsonrpc.h"
+#include "rta/paymentstore.h"
 
 
 #undef MONERO_DEFAULT_LOG_CATEGORY
@@ -24,7 +25,8 @@ Status payStatusHandler(const Router::vars_t& vars, const graft::Input& input,
     }
 
     const PayStatusRequest &in = req.params;
-    int current_status = ctx.global.get(in.PaymentID + CONTEXT_KEY_STATUS, static_cast<int>(RTAStatus::None));
+    PaymentStorePtr payments = ctx.global.get(CONTEXT_KEY_PAYMENTS, PaymentStorePtr());
+    int current_status = payments->status(in.PaymentID);
     if (in.PaymentID.empty() || current_status == 0)
     {
         return errorInvalidPaymentID(output);
@@ -1,5 +1,7 @@
 #include "rejectpayrequest.h"
 #include "requestdefines.h"
+#include "requesttools.h"
+#include "rta/paymentstore.h"
 
 #undef MONERO_DEFAULT_LOG_CATEGORY
 #define MONERO_DEFAULT_LOG_CATEGORY "supernode.rejectpayrequest"
@@ -10,12 +12,18 @@ Status rejectPayHandler(const Router::vars_t& vars, const graft::Input& input,
                         graft::Context& ctx, graft::Output& output)
 {
     RejectPayRequest in = input.get<RejectPayRequest>();
-    int current_status = ctx.global.get(in.PaymentID + CONTEXT_KEY_STATUS, static_cast<int>(RTAStatus::None));
-    if (in.PaymentID.empty() || current_status == 0)
+    PaymentStorePtr payments = ctx.global.get(CONTEXT_KEY_PAYMENTS, PaymentStorePtr());
+    bool rejected = !in.PaymentID.empty() && payments->updateExisting(in.PaymentID, [](PaymentRecord &record) {
+        if (record.status == static_cast<int>(RTAStatus::None)) {
+            return false;
+        }
+        record.status = static_cast<int>(RTAStatus::RejectedByWallet);
+        return true;
+    });
+    if (!rejected)
     {
         return errorInvalidPaymentID(output);
     }
-    ctx.global[in.PaymentID + CONTEXT_KEY_STATUS] = static_cast<int>(RTAStatus::RejectedByWallet);
     // TODO: Reject Pay: Add broadcast and another business logic
     RejectPayResponse out;
     out.Result = STATUS_OK;
@@ -26,7 +34,7 @@ Status rejectPayHandler(const Router::vars_t& vars, const graft::Input& input,
 void registerRejectPayRequest(Router &router)
 {
     Router::Handler3 h3(nullptr, rejectPayHandler, nullptr);
-    router.addRoute("/reject_pay", METHOD_POST, h3);
+    router.addRoute("/reject_pay", METHOD_POST, h3, Priority::Normal, paymentIdAffinity());
 }
 
 }
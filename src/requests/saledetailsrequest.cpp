@@ -1,9 +1,12 @@
 #include "saledetailsrequest.h"
 #include "requestdefines.h"
+#include "requesttools.h"
 #include "jsonrpc.h"
 #include "router.h"
 #include "rta/fullsupernodelist.h"
 #include "rta/supernode.h"
+#include "rta/serverstate.h"
+#include "rta/paymentstore.h"
 #include "requests/unicast.h"
 #include "common/utils.h"
 
@@ -23,24 +26,28 @@ GRAFT_DEFINE_JSON_RPC_RESPONSE_RESULT(SaleDetailsResponseJsonRpc, SaleDetailsRes
 
 
 // helper function. prepares sale details response for given request
-bool prepareSaleDetailsResponse(const SaleDetailsRequest &req, graft::Context &ctx, SaleDetailsResponse &resp, JsonRpcError &error,
+bool prepareSaleDetailsResponse(const SaleDetailsRequest &req, const PaymentStore &payments, SaleDetailsResponse &resp, JsonRpcError &error,
                                 const std::vector<SupernodePtr> &authSample)
 {
-    // generate auth sample
-    SaleDetailsResponseJsonRpc out;
-
+    bool have_sale = false;
+    uint64_t amount = 0;
+    payments.read(req.PaymentID, [&](const PaymentRecord &record) {
+        if (!record.sale) {
+            return;
+        }
+        have_sale = true;
+        amount = record.sale->Amount;
+        resp.Details = record.saleDetails.value_or(std::string());
+    });
 
-    if (!ctx.global.hasKey(req.PaymentID + CONTEXT_KEY_SALE)) {
+    if (!have_sale) {
         error.code = ERROR_PAYMENT_ID_INVALID;
         error.message = string("sale data missing for payment: ") + req.PaymentID;
         LOG_ERROR(__FUNCTION__ << " " << error.message);
         return false;
     }
 
-    resp.Details = ctx.global.get(req.PaymentID + CONTEXT_KEY_SALE_DETAILS, std::string());
-    SaleData sale_data = ctx.global.get(req.PaymentID + CONTEXT_KEY_SALE, SaleData());
-
-    uint64_t total_fee = static_cast<uint64_t>(std::round(sale_data.Amount * AUTHSAMPLE_FEE_PERCENTAGE / 100.0));
+    uint64_t total_fee = static_cast<uint64_t>(std::round(amount * AUTHSAMPLE_FEE_PERCENTAGE / 100.0));
 
     for (const auto &member : authSample) {
         SupernodeFee snf;
@@ -76,29 +83,34 @@ Status handleClientRequest(const Router::vars_t& vars, const graft::Input& input
         return errorInvalidPaymentID(output);
     }
 
-    int current_status = ctx.global.get(in.PaymentID + CONTEXT_KEY_STATUS, static_cast<int>(RTAStatus::None));
+    PaymentStorePtr payments = ctx.global.get(CONTEXT_KEY_PAYMENTS, PaymentStorePtr());
+    int current_status = static_cast<int>(RTAStatus::None);
+    boost::optional<SaleDetailsResponse> cached_result;
+    // we have sale details locally, easy way
+    bool have_data_locally = false;
+    payments->read(in.PaymentID, [&](const PaymentRecord &record) {
+        current_status = record.status;
+        cached_result = record.saleDetailsResult;
+        have_data_locally = bool(record.saleDetails);
+    });
 
     if (errorFinishedPayment(current_status, output))
     {
         return Status::Error;
     }
 
-    if (ctx.global.hasKey(in.PaymentID + CONTEXT_SALE_DETAILS_RESULT)) {
-        SaleDetailsResponse sdr = ctx.global.get(in.PaymentID + CONTEXT_SALE_DETAILS_RESULT, SaleDetailsResponse());
-        output.load(sdr);
+    if (cached_result) {
+        output.load(*cached_result);
         return Status::Ok;
     }
 
     vector<SupernodePtr> authSample;
-    FullSupernodeListPtr fsl = ctx.global.get(CONTEXT_KEY_FULLSUPERNODELIST, FullSupernodeListPtr());
+    Context::State state = ctx.state();
 
-    if (!fsl->buildAuthSample(in.BlockNumber, authSample)) {
+    if (!state->fsl->buildAuthSample(in.BlockNumber, authSample)) {
         return  errorBuildAuthSample(output);
     }
 
-    // we have sale details locally, easy way
-    bool have_data_locally = ctx.global.hasKey(in.PaymentID + CONTEXT_KEY_SALE_DETAILS);
-
     // TODO: testing remote flow
     // have_data_locally = false;
 
@@ -106,7 +118,7 @@ Status handleClientRequest(const Router::vars_t& vars, const graft::Input& input
         LOG_PRINT_L0("we have sale details locally for payment id: " << in.PaymentID);
         SaleDetailsResponse resp;
         SaleDetailsResponseJsonRpc out;
-        if (!prepareSaleDetailsResponse(in, ctx, resp, error, authSample)) {
+        if (!prepareSaleDetailsResponse(in, *payments, resp, error, authSample)) {
             JsonRpcErrorResponse er;
             er.error = error;
             output.load(error);
@@ -123,10 +135,9 @@ Status handleClientRequest(const Router::vars_t& vars, const graft::Input& input
         ctx.local["payment_id"] = in.PaymentID;
         Output innerOut;
         in.callback_uri = "/cryptonode/callback/sale_details/" + boost::uuids::to_string(ctx.getId());
-        innerOut.loadT<serializer::JSON_B64>(in);
+        innerOut.loadT<serializer::RTA_B64>(in);
         UnicastRequestJsonRpc unicastReq;
-        SupernodePtr supernode = ctx.global.get(CONTEXT_KEY_SUPERNODE, SupernodePtr());
-        unicastReq.params.sender_address = supernode->walletAddress();
+        unicastReq.params.sender_address = state->supernode->walletAddress();
         size_t maxIndex = authSample.size() - 1;
         size_t randomIndex = utils::random_number<size_t>(0, maxIndex);
         unicastReq.params.receiver_address = authSample.at(randomIndex)->walletAddress();
@@ -176,7 +187,8 @@ Status handleSaleDetailsResponse(const Router::vars_t& vars, const graft::Input&
     }
 
     UnicastRequest unicastReq = in.params;
-    SupernodePtr supernode = ctx.global.get(CONTEXT_KEY_SUPERNODE, SupernodePtr());
+    Context::State state = ctx.state();
+    const SupernodePtr& supernode = state->supernode;
 
     if (unicastReq.receiver_address != supernode->walletAddress()) {
         string msg =  string("wrong receiver address: " + unicastReq.receiver_address + ", expected address: " + supernode->walletAddress());
@@ -189,7 +201,7 @@ Status handleSaleDetailsResponse(const Router::vars_t& vars, const graft::Input&
 
     SaleDetailsResponse sdr;
 
-    if (!innerIn.getT<serializer::JSON_B64>(sdr)) {
+    if (!innerIn.getT<serializer::RTA_B64>(sdr)) {
         LOG_ERROR("error deserialize rta auth response");
         return errorInvalidParams(output);
     }
@@ -197,7 +209,11 @@ Status handleSaleDetailsResponse(const Router::vars_t& vars, const graft::Input&
     string payment_id = ctx.local["payment_id"];
 
     // cache response;
-    ctx.global.set(payment_id + CONTEXT_SALE_DETAILS_RESULT, sdr, RTA_TX_TTL);
+    PaymentStorePtr payments = ctx.global.get(CONTEXT_KEY_PAYMENTS, PaymentStorePtr());
+    payments->update(payment_id, [&sdr](PaymentRecord &record) {
+        record.saleDetailsResult = sdr;
+        return true;
+    });
 
     // remove callback reply
     ctx.global.remove(task_id + CONTEXT_SALE_DETAILS_RESULT);
@@ -238,7 +254,8 @@ Status handleSaleDetailsUnicastRequest(const Router::vars_t& vars, const graft::
     }
 
     UnicastRequest unicastReq = in.params;
-    SupernodePtr supernode = ctx.global.get(CONTEXT_KEY_SUPERNODE, SupernodePtr());
+    Context::State state = ctx.state();
+    const SupernodePtr& supernode = state->supernode;
 
     if (unicastReq.receiver_address != supernode->walletAddress()) {
         string msg =  string("wrong receiver address: " + supernode->walletAddress());
@@ -252,30 +269,35 @@ Status handleSaleDetailsUnicastRequest(const Router::vars_t& vars, const graft::
 
     SaleDetailsRequest sdr;
 
-    if (!innerIn.getT<serializer::JSON_B64>(sdr)) {
+    if (!innerIn.getT<serializer::RTA_B64>(sdr)) {
         LOG_ERROR("error deserialize rta auth response");
         return sendOkResponseToCryptonode(output); // cryptonode doesn't care about any errors, it's job is only deliver request
     }
 
     vector<SupernodePtr> authSample;
-    FullSupernodeListPtr fsl = ctx.global.get(CONTEXT_KEY_FULLSUPERNODELIST, FullSupernodeListPtr());
 
-    if (!fsl->buildAuthSample(sdr.BlockNumber, authSample)) {
+    if (!state->fsl->buildAuthSample(sdr.BlockNumber, authSample)) {
         return sendOkResponseToCryptonode(output); // cryptonode doesn't care about any errors, it's job is only deliver request
     }
 
-    if (ctx.global.hasKey(sdr.PaymentID + CONTEXT_KEY_SALE_DETAILS)) {
+    PaymentStorePtr payments = ctx.global.get(CONTEXT_KEY_PAYMENTS, PaymentStorePtr());
+    bool have_details = false;
+    payments->read(sdr.PaymentID, [&have_details](const PaymentRecord &record) {
+        have_details = bool(record.saleDetails);
+    });
+
+    if (have_details) {
         LOG_PRINT_L0("we have sale details for payment id: " << sdr.PaymentID);
         SaleDetailsResponse resp;
 
         JsonRpcError error;
-        if (!prepareSaleDetailsResponse(sdr, ctx, resp, error, authSample)) {
+        if (!prepareSaleDetailsResponse(sdr, *payments, resp, error, authSample)) {
             LOG_ERROR("Error preparing sale details response");
             return sendOkResponseToCryptonode(output); // cryptonode doesn't care about any errors, it's job is only deliver request
         } else {
             UnicastRequestJsonRpc callbackReq;
             Output innerOut;
-            innerOut.loadT<serializer::JSON_B64>(resp);
+            innerOut.loadT<serializer::RTA_B64>(resp);
 
             callbackReq.params.data = innerOut.data();
             callbackReq.params.callback_uri = sdr.callback_uri;
@@ -313,14 +335,14 @@ Status saleDetailsClientHandler(const Router::vars_t& vars, const graft::Input&
         CallbackFromAuthSample, // response from remote supernode (random auth sample member)
     };
 
-    ClientHandlerState state = ctx.local.hasKey(__FUNCTION__) ? ctx.local[__FUNCTION__] : ClientHandlerState::ClientRequest;
+    ClientHandlerState state = ctx.local.hasKey(GRAFT_FUNCTION_KEY) ? ctx.local[GRAFT_FUNCTION_KEY] : ClientHandlerState::ClientRequest;
     LOG_PRINT_L0(__FUNCTION__ << " state: " << int(state) << ", task_id: " << boost::uuids::to_string(ctx.getId()));
     switch (state) {
     case ClientHandlerState::ClientRequest:
-        ctx.local[__FUNCTION__] = ClientHandlerState::UnicastAcknowledge;
+        ctx.local[GRAFT_FUNCTION_KEY] = ClientHandlerState::UnicastAcknowledge;
         return handleClientRequest(vars, input, ctx, output);
     case ClientHandlerState::UnicastAcknowledge:
-        ctx.local[__FUNCTION__] = ClientHandlerState::CallbackFromAuthSample;
+        ctx.local[GRAFT_FUNCTION_KEY] = ClientHandlerState::CallbackFromAuthSample;
         return handleUnicastAcknowledge(vars, input, ctx, output);
     case ClientHandlerState::CallbackFromAuthSample:
         return handleSaleDetailsResponse(vars, input, ctx, output);
@@ -359,19 +381,19 @@ Status saleDetailsUnicastHandler(const Router::vars_t& vars, const graft::Input&
         CallbackAcknowledge,  // cryptonode accepted callbacks,
     };
 
-    State state = ctx.local.hasKey(__FUNCTION__) ? ctx.local[__FUNCTION__] : State::ClientRequest;
+    State state = ctx.local.hasKey(GRAFT_FUNCTION_KEY) ? ctx.local[GRAFT_FUNCTION_KEY] : State::ClientRequest;
 
     LOG_PRINT_L0(__FUNCTION__ << " state: " << int(state));
 
     switch (state) {
     case State::ClientRequest:
-        ctx.local[__FUNCTION__] = State::CallbackToClient;
+        ctx.local[GRAFT_FUNCTION_KEY] = State::CallbackToClient;
         return handleSaleDetailsUnicastRequest(vars, input, ctx, output); // send Unicast callback
     case State::CallbackToClient:
-        ctx.local[__FUNCTION__] = State::CallbackAcknowledge;
+        ctx.local[GRAFT_FUNCTION_KEY] = State::CallbackAcknowledge;
         return sendOkResponseToCryptonode(output);                       //  cryptonode accepted uncast callback,
     case State::CallbackAcknowledge:
-        ctx.local[__FUNCTION__] = State::CallbackAcknowledge;
+        ctx.local[GRAFT_FUNCTION_KEY] = State::CallbackAcknowledge;
         return sendOkResponseToCryptonode(output);                       // send ok as reply to initial request
     }
 }
@@ -381,17 +403,17 @@ void registerSaleDetailsRequest(Router &router)
 {
     // client requests
     Router::Handler3 clientHandler(nullptr, saleDetailsClientHandler, nullptr);
-    router.addRoute("/sale_details", METHOD_POST, clientHandler);
+    router.addRoute("/sale_details", METHOD_POST, clientHandler, Priority::Normal, paymentIdAffinity());
 
     // unicast callbacks from remote supernode (responses)
     Router::Handler3 callbackHandler(nullptr, saleDetailsCallbackHandler, nullptr);
     router.addRoute("/cryptonode/callback/sale_details/{id:[0-9a-fA-F-]+}",
-                    METHOD_POST, callbackHandler);
+                    METHOD_POST, callbackHandler, Priority::High);
 
     // unicast requests from remote supernode (requests)
     Router::Handler3 unicastRequestHandler(nullptr, saleDetailsUnicastHandler, nullptr);
     router.addRoute("/cryptonode/sale_details/",
-                    METHOD_POST, unicastRequestHandler);
+                    METHOD_POST, unicastRequestHandler, Priority::High);
 }
 
 }
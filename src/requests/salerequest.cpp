@@ -3,6 +3,8 @@
 #include "requesttools.h"
 #include "rta/supernode.h"
 #include "rta/fullsupernodelist.h"
+#include "rta/serverstate.h"
+#include "rta/paymentstore.h"
 #include "requests/multicast.h"
 #include "requests/broadcast.h"
 #include "requests/salestatusrequest.h"
@@ -20,8 +22,6 @@ BOOST_HANA_ADAPT_STRUCT(graft::SaleData,
 
 namespace graft {
 
-static const std::chrono::seconds SALE_TTL = std::chrono::seconds(60);
-
 // message to be multicasted to auth sample
 GRAFT_DEFINE_IO_STRUCT(SaleDataMulticast,
                        (SaleData, sale_data),
@@ -58,8 +58,8 @@ Status handleClientSaleRequest(const Router::vars_t& vars, const graft::Input& i
         return errorInvalidAmount(output);
     }
 
-    bool testnet = ctx.global["testnet"];
-    if (!Supernode::validateAddress(in.Address, testnet))
+    Context::State state = ctx.state();
+    if (!Supernode::validateAddress(in.Address, state->testnet))
     {
         return errorInvalidAddress(output);
     }
@@ -71,8 +71,9 @@ Status handleClientSaleRequest(const Router::vars_t& vars, const graft::Input& i
     }
 
 
-    SupernodePtr supernode = ctx.global.get(CONTEXT_KEY_SUPERNODE, SupernodePtr());
-    FullSupernodeListPtr fsl = ctx.global.get(CONTEXT_KEY_FULLSUPERNODELIST, FullSupernodeListPtr());
+    const SupernodePtr& supernode = state->supernode;
+    const FullSupernodeListPtr& fsl = state->fsl;
+    PaymentStorePtr payments = ctx.global.get(CONTEXT_KEY_PAYMENTS, PaymentStorePtr());
 
     // reply to caller (POS)
     SaleData data(in.Address, supernode->daemonHeight(), in.Amount);
@@ -80,10 +81,6 @@ Status handleClientSaleRequest(const Router::vars_t& vars, const graft::Input& i
     // what needs to be multicasted to auth sample ?
     // 1. payment_id
     // 2. SaleData
-    if (!in.SaleDetails.empty())
-    {
-        ctx.global.set(payment_id + CONTEXT_KEY_SALE_DETAILS, in.SaleDetails, SALE_TTL);
-    }
 
     // generate auth sample
     std::vector<SupernodePtr> authSample;
@@ -94,8 +91,14 @@ Status handleClientSaleRequest(const Router::vars_t& vars, const graft::Input& i
     // here we need to perform two actions:
     // 1. multicast sale over auth sample
     // 2. broadcast sale status
-    ctx.global.set(payment_id + CONTEXT_KEY_SALE, data, SALE_TTL);
-    ctx.global.set(payment_id + CONTEXT_KEY_STATUS, static_cast<int>(RTAStatus::Waiting), SALE_TTL);
+    payments->update(payment_id, [&](PaymentRecord &record) {
+        record.sale = data;
+        if (!in.SaleDetails.empty()) {
+            record.saleDetails = in.SaleDetails;
+        }
+        record.status = static_cast<int>(RTAStatus::Waiting);
+        return true;
+    });
 
     // store SaleData, payment_id and status in local context, so when we got reply from cryptonode, we just pass it to client
     ctx.local["sale_data"]  = data;
@@ -109,7 +112,7 @@ Status handleClientSaleRequest(const Router::vars_t& vars, const graft::Input& i
     sdm.status = static_cast<int>(RTAStatus::Waiting);
     sdm.details = in.SaleDetails;
     Output innerOut;
-    innerOut.loadT<serializer::JSON_B64>(sdm);
+    innerOut.loadT<serializer::RTA_B64>(sdm);
 
     MulticastRequestJsonRpc cryptonode_req;
 
@@ -140,10 +143,13 @@ Status handleSaleMulticastReply(const Router::vars_t& vars, const graft::Input&
         return errorCustomError("Error multicasting request", ERROR_INTERNAL_ERROR, output);
     }
 
-    SupernodePtr supernode = ctx.global.get(CONTEXT_KEY_SUPERNODE, SupernodePtr());
+    Context::State state = ctx.state();
+    const SupernodePtr& supernode = state->supernode;
+    PaymentStorePtr payments = ctx.global.get(CONTEXT_KEY_PAYMENTS, PaymentStorePtr());
 
     string payment_id = ctx.local["payment_id"];
-    int status = ctx.global.get(payment_id + CONTEXT_KEY_STATUS, static_cast<int>((RTAStatus::Waiting)));
+    int status = static_cast<int>(RTAStatus::Waiting);
+    payments->read(payment_id, [&status](const PaymentRecord &record) { status = record.status; });
 
     buildBroadcastSaleStatusOutput(payment_id, status, supernode, output);
 
@@ -186,14 +192,14 @@ Status saleClientHandler(const Router::vars_t& vars, const graft::Input& input,
                          graft::Context& ctx, graft::Output& output)
 {
 
-    SaleHandlerState state = ctx.local.hasKey(__FUNCTION__) ? ctx.local[__FUNCTION__] : SaleHandlerState::ClientRequest;
+    SaleHandlerState state = ctx.local.hasKey(GRAFT_FUNCTION_KEY) ? ctx.local[GRAFT_FUNCTION_KEY] : SaleHandlerState::ClientRequest;
 
     // state machine to perform two calls to cryptonode and return result to the client
     switch (state) {
     // client requested "/sale"
     case SaleHandlerState::ClientRequest:
         LOG_PRINT_L0("called by client, payload: " << input.data());
-        ctx.local[__FUNCTION__] = SaleHandlerState::SaleMulticastReply;
+        ctx.local[GRAFT_FUNCTION_KEY] = SaleHandlerState::SaleMulticastReply;
         // call cryptonode's "/rta/multicast" to send sale data to auth sample
         // "handleClientSaleRequest" returns Forward;
         return handleClientSaleRequest(vars, input, ctx, output);
@@ -202,7 +208,7 @@ Status saleClientHandler(const Router::vars_t& vars, const graft::Input& input,
         // "sale status" with broadcast to cryptonode
         LOG_PRINT_L0("SaleMulticast response from cryptonode: " << input.data());
         LOG_PRINT_L0("status: " << (int)ctx.local.getLastStatus());
-        ctx.local[__FUNCTION__] = SaleHandlerState::SaleStatusReply;
+        ctx.local[GRAFT_FUNCTION_KEY] = SaleHandlerState::SaleStatusReply;
         // handleSameMulticast returns Forward, call performed according traffic capture but after that moment
         // this handler never called again, but it supposed to be "broadcast" reply from cryptonode
         return handleSaleMulticastReply(vars, input, ctx, output);
@@ -244,17 +250,23 @@ Status saleCryptonodeHandler(const Router::vars_t& vars, const graft::Input& inp
     innerInput.load(req.params.data);
 
     LOG_PRINT_L0("input loaded");
-    if (!innerInput.getT<serializer::JSON_B64>(sdm)) {
+    if (!innerInput.getT<serializer::RTA_B64>(sdm)) {
         return errorInvalidParams(output);
     }
     const std::string &payment_id = sdm.paymentId;
     LOG_PRINT_L0("sale details received from multicast: " << sdm.paymentId);
     // TODO: should be signed by sender??
-    if (!ctx.global.hasKey(payment_id + CONTEXT_KEY_SALE)) {
-        ctx.global[payment_id + CONTEXT_KEY_SALE] = sdm.sale_data;
-        ctx.global[payment_id + CONTEXT_KEY_STATUS] = sdm.status;
-        ctx.global[payment_id + CONTEXT_KEY_SALE_DETAILS] = sdm.details;
-    } else {
+    PaymentStorePtr payments = ctx.global.get(CONTEXT_KEY_PAYMENTS, PaymentStorePtr());
+    bool added = payments->update(payment_id, [&sdm](PaymentRecord &record) {
+        if (record.sale) {
+            return false;
+        }
+        record.sale = sdm.sale_data;
+        record.status = sdm.status;
+        record.saleDetails = sdm.details;
+        return true;
+    });
+    if (!added) {
         LOG_PRINT_L0("payment " << payment_id << " already known");
     }
 
@@ -269,9 +281,9 @@ Status saleCryptonodeHandler(const Router::vars_t& vars, const graft::Input& inp
 void registerSaleRequest(graft::Router &router)
 {
     Router::Handler3 h1(nullptr, saleClientHandler, nullptr);
-    router.addRoute("/sale", METHOD_POST, h1);
+    router.addRoute("/sale", METHOD_POST, h1, Priority::Normal, paymentIdAffinity());
     Router::Handler3 h2(nullptr, saleCryptonodeHandler, nullptr);
-    router.addRoute("/cryptonode/sale", METHOD_POST, h2);
+    router.addRoute("/cryptonode/sale", METHOD_POST, h2, Priority::High, multicastPaymentIdAffinity("paymentId"));
 }
 
 }
@@ -1,6 +1,8 @@
 #include "salestatusrequest.h"
 #include "requestdefines.h"
 #include "requests/broadcast.h"
+#include "rta/paymentstore.h"
+#include "rta/serverstate.h"
 #include <misc_log_ex.h>
 
 
@@ -28,7 +30,8 @@ Status saleStatusHandler(const Router::vars_t& vars, const graft::Input& input,
     }
 
     const SaleStatusRequest &in = req.params;
-    int current_status = ctx.global.get(in.PaymentID + CONTEXT_KEY_STATUS, static_cast<int>(RTAStatus::None));
+    PaymentStorePtr payments = ctx.global.get(CONTEXT_KEY_PAYMENTS, PaymentStorePtr());
+    int current_status = payments->status(in.PaymentID);
     if (in.PaymentID.empty() || current_status == 0)
     {
         return errorInvalidPaymentID(output);
@@ -59,11 +62,12 @@ Status updateSaleStatusHandler(const Router::vars_t& vars, const graft::Input& i
     innerInput.load(req.params.data);
 
     LOG_PRINT_L0("input loaded");
-    if (!innerInput.getT<serializer::JSON_B64>(ussb)) {
+    if (!innerInput.getT<serializer::RTA_B64>(ussb)) {
         return errorInvalidParams(output);
     }
 
-    SupernodePtr supernode = ctx.global.get(CONTEXT_KEY_SUPERNODE, SupernodePtr());
+    Context::State state = ctx.state();
+    const SupernodePtr& supernode = state->supernode;
 
 
     LOG_PRINT_L0("sale status update received from broadcast: " << ussb.PaymentID);
@@ -78,9 +82,17 @@ Status updateSaleStatusHandler(const Router::vars_t& vars, const graft::Input& i
         return Status::Error;
     } else {
         // TODO: complete state chart for status transitions
-        RTAStatus currentStatus = static_cast<RTAStatus>(ctx.global.get(ussb.PaymentID + CONTEXT_KEY_STATUS, int(RTAStatus::None)));
-        if (!isFiniteRtaStatus(currentStatus)) {
-            ctx.global.set(ussb.PaymentID + CONTEXT_KEY_STATUS, ussb.Status, RTA_TX_TTL);
+        PaymentStorePtr payments = ctx.global.get(CONTEXT_KEY_PAYMENTS, PaymentStorePtr());
+        RTAStatus currentStatus = RTAStatus::None;
+        bool updated = payments->update(ussb.PaymentID, [&](PaymentRecord &record) {
+            currentStatus = static_cast<RTAStatus>(record.status);
+            if (isFiniteRtaStatus(currentStatus)) {
+                return false;
+            }
+            record.status = ussb.Status;
+            return true;
+        });
+        if (updated) {
             LOG_PRINT_L0("sale status updated for payment id: " << ussb.PaymentID << " to: " << ussb.Status);
         } else {
             MWARNING("Current status already in finite state: " << int(currentStatus)
@@ -102,7 +114,7 @@ void registerSaleStatusRequest(graft::Router &router)
     Router::Handler3 h1(saleStatusHandler, nullptr, nullptr);
     router.addRoute("/sale_status", METHOD_POST, h1);
     Router::Handler3 h2(updateSaleStatusHandler, nullptr, nullptr);
-    router.addRoute("/cryptonode/update_sale_status", METHOD_POST, h2);
+    router.addRoute("/cryptonode/update_sale_status", METHOD_POST, h2, Priority::High);
 }
 
 string signSaleStatusUpdate(const string &payment_id, int status, const SupernodePtr &supernode)
@@ -110,7 +122,7 @@ string signSaleStatusUpdate(const string &payment_id, int status, const Supernod
     std::string msg = payment_id + ":" + to_string(status);
     crypto::signature sign;
     supernode->signMessage(msg, sign);
-    return epee::string_tools::pod_to_hex(sign);
+    return utils::pod_to_hex(sign);
 }
 
 
@@ -118,7 +130,7 @@ bool checkSaleStatusUpdateSignature(const string &payment_id, int status, const
                                     const SupernodePtr &supernode)
 {
     crypto::signature sign;
-    if (!epee::string_tools::hex_to_pod(signature, sign)) {
+    if (!utils::hex_to_pod(signature, sign)) {
         LOG_ERROR("Error parsing signature: " << signature);
         return false;
     }
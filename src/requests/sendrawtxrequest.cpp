@@ -40,13 +40,13 @@ Status sendRawTxHandler(const Router::vars_t& vars, const graft::Input& input,
                                  graft::Context& ctx, graft::Output& output)
 {
     // call from client
-    if (!ctx.local.hasKey(__FUNCTION__)) {
+    if (!ctx.local.hasKey(GRAFT_FUNCTION_KEY)) {
         LOG_PRINT_L2("call from client, forwarding to cryptonode...");
 
         // just forward input to cryptonode
         SendRawTxRequest req = input.get<SendRawTxRequest>();
         output.load(req);
-        ctx.local[__FUNCTION__] = true;
+        ctx.local[GRAFT_FUNCTION_KEY] = true;
         return Status::Forward;
     } else {
     // response from cryptonode
@@ -84,14 +84,14 @@ bool createSendRawTxRequest(const tools::wallet2::pending_tx &ptx, SendRawTxRequ
 //    request.tx_info.fee = ptx.fee;
 //    request.tx_info.dest_address = cryptonote::get_account_address_as_str(true, ptx.dests[0].addr);
 //    request.tx_info.id = epee::string_tools::pod_to_hex(cryptonote::get_transaction_hash(ptx.tx));
-    request.tx_as_hex = epee::string_tools::buff_to_hex_nodelimer(cryptonote::tx_to_blob(ptx.tx));
+    request.tx_as_hex = utils::to_hex(cryptonote::tx_to_blob(ptx.tx));
 
     return true;
 }
 
 bool createSendRawTxRequest(const cryptonote::transaction &tx, SendRawTxRequest &request)
 {
-    request.tx_as_hex = epee::string_tools::buff_to_hex_nodelimer(cryptonote::tx_to_blob(tx));
+    request.tx_as_hex = utils::to_hex(cryptonote::tx_to_blob(tx));
     return true;
 }
 
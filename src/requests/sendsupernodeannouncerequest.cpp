@@ -31,6 +31,7 @@
 #include "sendrawtxrequest.h"
 #include "rta/fullsupernodelist.h"
 #include "rta/supernode.h"
+#include "rta/serverstate.h"
 
 #include <misc_log_ex.h>
 #include <boost/shared_ptr.hpp>
@@ -63,8 +64,9 @@ Status sendSupernodeAnnounceHandler(const Router::vars_t& vars, const graft::Inp
     LOG_PRINT_L1(PATH << " called with payload: " << input.data());
     // TODO: implement DOS protection, ignore too frequent requests
 
-    boost::shared_ptr<FullSupernodeList> fsl = ctx.global.get("fsl", boost::shared_ptr<FullSupernodeList>());
-    SupernodePtr supernode = ctx.global.get("supernode", SupernodePtr());
+    Context::State state = ctx.state();
+    FullSupernodeListPtr fsl = state? state->fsl : FullSupernodeListPtr();
+    SupernodePtr supernode = state? state->supernode : SupernodePtr();
 
     JsonRpcError error;
     error.code = 0;
@@ -104,13 +106,13 @@ Status sendSupernodeAnnounceHandler(const Router::vars_t& vars, const graft::Inp
             // this can't be executed here as it takes too much time, we need to respond "ok" and run
             // this task asynchronously
 
-            std::string watchonly_wallets_path = ctx.global["watchonly_wallets_path"];
+            const std::string& watchonly_wallets_path = state->watchonly_wallets_path;
             assert(!watchonly_wallets_path.empty());
             boost::filesystem::path p(watchonly_wallets_path);
             p /= announce.address;
             std::string wallet_path = p.string();
-            std::string cryptonode_rpc_address = ctx.global["cryptonode_rpc_address"];
-            bool testnet = ctx.global["testnet"];
+            std::string cryptonode_rpc_address = state->cryptonode_rpc_address;
+            bool testnet = state->testnet;
             MINFO("creating wallet in: " << p.string());
 
             auto worker = [announce, wallet_path, cryptonode_rpc_address, testnet, fsl]() {
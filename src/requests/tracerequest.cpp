@@ -0,0 +1,33 @@
+#include "tracerequest.h"
+#include "trace.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "supernode.tracerequest"
+
+namespace graft {
+
+Status traceHistogramsHandler(const Router::vars_t& vars, const graft::Input& input,
+                              graft::Context& ctx, graft::Output& output)
+{
+    output.body = TraceRegistry::instance().histogramsJson();
+    return Status::Ok;
+}
+
+Status traceChromeHandler(const Router::vars_t& vars, const graft::Input& input,
+                          graft::Context& ctx, graft::Output& output)
+{
+    output.body = TraceRegistry::instance().chromeTraceJson();
+    return Status::Ok;
+}
+
+void registerTraceRequest(Router &router)
+{
+    // per route, per stage latency histograms
+    Router::Handler3 histograms(nullptr, traceHistogramsHandler, nullptr);
+    router.addRoute("/debug/trace", METHOD_GET, histograms);
+    // sampled requests, open in chrome://tracing
+    Router::Handler3 chrome(nullptr, traceChromeHandler, nullptr);
+    router.addRoute("/debug/trace/chrome", METHOD_GET, chrome);
+}
+
+}
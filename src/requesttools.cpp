@@ -1,4 +1,5 @@
 #include "requesttools.h"
+#include "common/utils.h"
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
 #include <boost/uuid/uuid.hpp>
@@ -21,4 +22,129 @@ uint64_t convertAmount(const std::string &amount)
     return value;
 }
 
+namespace {
+
+// bounds of the value of a string field, the value is not copied
+bool jsonStringFieldBounds(const std::string &json, const std::string &field, size_t &begin, size_t &end)
+{
+    const std::string name = '"' + field + '"';
+    size_t pos = json.find(name);
+    if (pos == std::string::npos)
+        return false;
+    pos = json.find_first_not_of(" \t\r\n", pos + name.size());
+    if (pos == std::string::npos || json[pos] != ':')
+        return false;
+    pos = json.find_first_not_of(" \t\r\n", pos + 1);
+    if (pos == std::string::npos || json[pos] != '"')
+        return false;
+    end = json.find('"', pos + 1);
+    if (end == std::string::npos)
+        return false;
+    begin = pos + 1;
+    return true;
+}
+
+// the length of a MessagePack string or ext that starts at pos
+bool binaryLength(const std::string &data, size_t &pos, int bytes, size_t &len)
+{
+    if (data.size() < pos + bytes)
+        return false;
+    len = 0;
+    for (int i = 0; i < bytes; ++i)
+        len = len << 8 | static_cast<unsigned char>(data[pos + i]);
+    pos += bytes;
+    return true;
+}
+
+// value of a string field of a payload in the binary encoding without parsing it, see binary_serializer.h;
+// the key is written as a string, the value is either a string or a hex string written as HEX_EXT
+std::string binaryStringField(const std::string &data, const std::string &field)
+{
+    std::string key;
+    serializer::bin::Writer(key).Key(field.data(), field.size());
+    size_t pos = data.find(key);
+    if (pos == std::string::npos || data.size() <= pos + key.size())
+        return std::string();
+    pos += key.size();
+    const unsigned char c = data[pos++];
+    size_t len = 0;
+    bool hex = false;
+    if ((c & 0xe0) == 0xa0) {
+        len = c & 0x1f;
+    } else if (0xd9 <= c && c <= 0xdb) {
+        if (!binaryLength(data, pos, 1 << (c - 0xd9), len))
+            return std::string();
+    } else if (0xc7 <= c && c <= 0xc9) {
+        if (!binaryLength(data, pos, 1 << (c - 0xc7), len) || data.size() <= pos
+                || data[pos++] != serializer::bin::HEX_EXT)
+            return std::string();
+        hex = true;
+    } else {
+        return std::string();
+    }
+    if (data.size() - pos < len)
+        return std::string();
+    if (!hex)
+        return data.substr(pos, len);
+    static const char digits[] = "0123456789abcdef";
+    std::string res(2 * len, '0');
+    for (size_t i = 0; i < len; ++i) {
+        const unsigned char b = data[pos + i];
+        res[2 * i] = digits[b >> 4];
+        res[2 * i + 1] = digits[b & 0xf];
+    }
+    return res;
+}
+
+// the field of a decoded multicast payload in either encoding
+std::string payloadStringField(const std::string &payload, bool binary, const std::string &field)
+{
+    return binary ? binaryStringField(payload, field) : jsonStringField(payload, field);
+}
+
+// base64 characters decoded at each end of a multicast payload for its affinity key, 258 bytes
+const size_t AFFINITY_WINDOW = 344;
+
+}
+
+std::string jsonStringField(const std::string &json, const std::string &field)
+{
+    size_t begin, end;
+    if (!jsonStringFieldBounds(json, field, begin, end))
+        return std::string();
+    return json.substr(begin, end - begin);
+}
+
+Router::AffinityKey paymentIdAffinity(const std::string &field)
+{
+    return [field](const Router::vars_t&, const Input &input)
+    {
+        return jsonStringField(input.data(), field);
+    };
+}
+
+Router::AffinityKey multicastPaymentIdAffinity(const std::string &field)
+{
+    // the key is taken on the IO thread, so only the head and the tail of the payload are decoded, that is where
+    // the payment id is (the sale multicast has it first, the auth request has it after the tx)
+    return [field](const Router::vars_t&, const Input &input)
+    {
+        const std::string &json = input.data();
+        size_t begin, end;
+        if (!jsonStringFieldBounds(json, "data", begin, end) || begin == end)
+            return std::string();
+        const size_t size = end - begin;
+        const std::string head = utils::base64_decode(json.data() + begin,
+                                                      size <= 2 * AFFINITY_WINDOW ? size : AFFINITY_WINDOW);
+        // the encoding is told by the first byte of the payload
+        const bool binary = serializer::bin::isBinary(head);
+        std::string key = payloadStringField(head, binary, field);
+        if (!key.empty() || size <= 2 * AFFINITY_WINDOW)
+            return key;
+        // the tail starts at a quad boundary
+        const size_t tail = (size - AFFINITY_WINDOW) / 4 * 4;
+        return payloadStringField(utils::base64_decode(json.data() + begin + tail, size - tail), binary, field);
+    };
+}
+
 }
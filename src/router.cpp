@@ -12,6 +12,7 @@ bool RouterT<In,Out>::Root::arm()
             std::for_each(ro.m_routes.begin(), ro.m_routes.end(),
                 [this](Route& r)
                 {
+                    r.trace = &TraceRegistry::instance().route(r.endpoint);
                     r3_tree_insert_route(m_node, r.methods, r.endpoint.c_str(), &r);
                 }
             );
@@ -27,11 +28,11 @@ bool RouterT<In,Out>::Root::arm()
 }
 
 template<typename In, typename Out>
-bool RouterT<In,Out>::Root::match(const std::string& target, int method, JobParams& params)
+bool RouterT<In,Out>::Root::match(boost::string_view target, int method, JobParams& params)
 {
     bool ret = false;
 
-    match_entry *entry = match_entry_create(target.c_str());
+    match_entry *entry = match_entry_createl(target.data(), target.size());
     entry->request_method = method;
 
     R3Route *m = r3_tree_match_route(m_node, entry);
@@ -43,7 +44,12 @@ bool RouterT<In,Out>::Root::match(const std::string& target, int method, JobPara
                 std::move(std::string(entry->vars.tokens.entries[i].base, entry->vars.tokens.entries[i].len))
             ));
 
-        params.h3 = static_cast<Route*>(m->data)->h3;
+        Route* route = static_cast<Route*>(m->data);
+        params.h3 = route->h3;
+        params.priority = route->priority;
+        params.endpoint = &route->endpoint;
+        params.trace = route->trace;
+        params.affinity = route->affinity? &route->affinity : nullptr;
         ret = true;
     }
     match_entry_free(entry);
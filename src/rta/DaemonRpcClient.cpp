@@ -28,8 +28,11 @@
 //
 
 #include "DaemonRpcClient.h"
+#include "common/utils.h"
+#include "task.h"
 #include <rpc/core_rpc_server_commands_defs.h>
 #include <storages/http_abstract_invoke.h>
+#include <storages/portable_storage_template_helper.h>
 #include <cryptonote_basic/cryptonote_format_utils.h>
 
 #include <exception>
@@ -39,16 +42,14 @@ using namespace std;
 namespace graft {
 
 DaemonRpcClient::DaemonRpcClient(const std::string &daemon_addr, const std::string &daemon_login, const std::string &daemon_pass)
-    :  m_rpc_timeout(std::chrono::seconds(30))
+    : m_daemon_address(daemon_addr)
+    , m_rpc_timeout(std::chrono::seconds(30))
 {
-
-    boost::shared_mutex mutex;
-    boost::shared_lock<boost::shared_mutex> readerLock(mutex);
-
     bool result = false;
     boost::optional<epee::net_utils::http::login> login{};
     if (!daemon_login.empty() && !daemon_pass.empty()) {
         login.emplace(daemon_login, daemon_pass);
+        m_login = true;
     }
     result = init(daemon_addr, login);
     if (!result) {
@@ -64,7 +65,7 @@ DaemonRpcClient::~DaemonRpcClient()
 bool DaemonRpcClient::get_tx_from_pool(const string &hash_str, cryptonote::transaction &out_tx)
 {
     crypto::hash hash;
-    if (!epee::string_tools::hex_to_pod(hash_str, hash)) {
+    if (!utils::hex_to_pod(hash_str, hash)) {
         LOG_ERROR("error parsing input hash");
         return false;
     }
@@ -73,7 +74,9 @@ bool DaemonRpcClient::get_tx_from_pool(const string &hash_str, cryptonote::trans
     cryptonote::COMMAND_RPC_GET_TRANSACTION_POOL_HASHES::request req;
     cryptonote::COMMAND_RPC_GET_TRANSACTION_POOL_HASHES::response res;
 
+    std::unique_lock<std::mutex> lock(m_http_mutex);
     bool r = epee::net_utils::invoke_http_json("/get_transaction_pool_hashes.bin", req, res, m_http_client, m_rpc_timeout);
+    lock.unlock();
     if (!r) {
         LOG_ERROR("/get_transaction_pool_hashes.bin error");
         return r;
@@ -102,7 +105,9 @@ bool DaemonRpcClient::get_tx(const string &hash_str, cryptonote::transaction &ou
     req_tx.txs_hashes.push_back(hash_str);
 
     req_tx.decode_as_json = false;
+    std::unique_lock<std::mutex> lock(m_http_mutex);
     bool r = epee::net_utils::invoke_http_json("/gettransactions", req_tx, res_tx, m_http_client, m_rpc_timeout);
+    lock.unlock();
     if (!r && res_tx.status != CORE_RPC_STATUS_OK) {
         LOG_ERROR("/getransactions error");
         return false;
@@ -121,7 +126,7 @@ bool DaemonRpcClient::get_tx(const string &hash_str, cryptonote::transaction &ou
 
     cryptonote::blobdata bd;
     crypto::hash tx_hash, tx_prefix_hash;
-    if (!epee::string_tools::parse_hexstr_to_binbuff(res_tx.txs[0].as_hex, bd)) {
+    if (!utils::from_hex(res_tx.txs[0].as_hex, bd)) {
         LOG_ERROR("failed to parse tx from hex");
         return false;
     }
@@ -141,10 +146,21 @@ bool DaemonRpcClient::get_tx(const string &hash_str, cryptonote::transaction &ou
 
 bool DaemonRpcClient::get_height(uint64_t &height)
 {
-    // get full tx
+    if (!m_login && TaskManager::hasUpstreamLooper() && !TaskManager::isIOThread()) {
+        try {
+            height = get_height_async().get();
+            return true;
+        } catch (const std::exception &e) {
+            LOG_ERROR("/getheight error: " << e.what());
+            return false;
+        }
+    }
+
     cryptonote::COMMAND_RPC_GET_HEIGHT::request req;
     cryptonote::COMMAND_RPC_GET_HEIGHT::response res =  boost::value_initialized<cryptonote::COMMAND_RPC_GET_HEIGHT::response>();
+    std::unique_lock<std::mutex> lock(m_http_mutex);
     bool r = epee::net_utils::invoke_http_json("/getheight", req, res, m_http_client, m_rpc_timeout);
+    lock.unlock();
     if (!r && res.status != CORE_RPC_STATUS_OK) {
         LOG_ERROR("/getheight error");
         return false;
@@ -156,13 +172,25 @@ bool DaemonRpcClient::get_height(uint64_t &height)
 
 bool DaemonRpcClient::get_block_hash(uint64_t height, string &hash)
 {
+    if (!m_login && TaskManager::hasUpstreamLooper() && !TaskManager::isIOThread()) {
+        try {
+            hash = get_block_hash_async(height).get();
+            return true;
+        } catch (const std::exception &e) {
+            LOG_ERROR("/on_getblockhash error: " << e.what());
+            return false;
+        }
+    }
+
     epee::json_rpc::request<cryptonote::COMMAND_RPC_GETBLOCKHASH::request> req_t = AUTO_VAL_INIT(req_t);
     epee::json_rpc::response<cryptonote::COMMAND_RPC_GETBLOCKHASH::response, std::string> resp_t = AUTO_VAL_INIT(resp_t);
     req_t.jsonrpc = "2.0";
     req_t.id = epee::serialization::storage_entry(0);
     req_t.method = "on_getblockhash";
     req_t.params.push_back(height);
+    std::unique_lock<std::mutex> lock(m_http_mutex);
     bool ok = epee::net_utils::invoke_http_json("/json_rpc", req_t, resp_t, m_http_client, m_rpc_timeout);
+    lock.unlock();
     if (!ok) {
         LOG_ERROR("/on_getblockhash error");
         return false;
@@ -172,6 +200,87 @@ bool DaemonRpcClient::get_block_hash(uint64_t height, string &hash)
     return true;
 }
 
+template<typename Request, typename Response>
+void DaemonRpcClient::invoke_async(const string &path, Request &req, std::function<void (bool ok, Response &res)> callback,
+                                   std::chrono::milliseconds timeout)
+{
+    if (m_login || !TaskManager::hasUpstreamLooper()) {
+        Response res = AUTO_VAL_INIT(res);
+        std::unique_lock<std::mutex> lock(m_http_mutex);
+        bool ok = epee::net_utils::invoke_http_json(path, req, res, m_http_client,
+                                                    (timeout.count() != 0)? timeout : m_rpc_timeout);
+        lock.unlock();
+        callback(ok, res);
+        return;
+    }
+
+    Output output;
+    output.uri = m_daemon_address;
+    output.path = path;
+    std::string body;
+    epee::serialization::store_t_to_json(req, body);
+    output.body = std::move(body);
+    TaskManager::sendUpstreamAsync(output, [path, callback](Input &&input, const std::string &err)
+    {
+        Response res = AUTO_VAL_INIT(res);
+        bool ok = err.empty() && input.resp_code == 200 && epee::serialization::load_t_from_json(res, input.body);
+        if (!ok) {
+            LOG_ERROR(path << " error: " << (err.empty()? "bad response" : err));
+        }
+        callback(ok, res);
+    }, (timeout.count() != 0)? timeout : m_rpc_timeout);
+}
+
+void DaemonRpcClient::get_height_async(HeightCallback callback, std::chrono::milliseconds timeout)
+{
+    using Response = cryptonote::COMMAND_RPC_GET_HEIGHT::response;
+    cryptonote::COMMAND_RPC_GET_HEIGHT::request req;
+    invoke_async<cryptonote::COMMAND_RPC_GET_HEIGHT::request, Response>("/getheight", req,
+        [callback](bool ok, Response &res)
+        {
+            ok = ok && res.status == CORE_RPC_STATUS_OK;
+            callback(ok, ok? res.height : 0);
+        }, timeout);
+}
+
+std::future<uint64_t> DaemonRpcClient::get_height_async(std::chrono::milliseconds timeout)
+{
+    auto promise = std::make_shared<std::promise<uint64_t>>();
+    get_height_async([promise](bool ok, uint64_t height)
+    {
+        if (ok) promise->set_value(height);
+        else promise->set_exception(std::make_exception_ptr(std::runtime_error("getheight failed")));
+    }, timeout);
+    return promise->get_future();
+}
+
+void DaemonRpcClient::get_block_hash_async(uint64_t height, HashCallback callback, std::chrono::milliseconds timeout)
+{
+    using Request = epee::json_rpc::request<cryptonote::COMMAND_RPC_GETBLOCKHASH::request>;
+    using Response = epee::json_rpc::response<cryptonote::COMMAND_RPC_GETBLOCKHASH::response, std::string>;
+    Request req_t = AUTO_VAL_INIT(req_t);
+    req_t.jsonrpc = "2.0";
+    req_t.id = epee::serialization::storage_entry(0);
+    req_t.method = "on_getblockhash";
+    req_t.params.push_back(height);
+    invoke_async<Request, Response>("/json_rpc", req_t, [callback](bool ok, Response &res)
+    {
+        ok = ok && !res.result.empty();
+        callback(ok, res.result);
+    }, timeout);
+}
+
+std::future<std::string> DaemonRpcClient::get_block_hash_async(uint64_t height, std::chrono::milliseconds timeout)
+{
+    auto promise = std::make_shared<std::promise<std::string>>();
+    get_block_hash_async(height, [promise](bool ok, const std::string &hash)
+    {
+        if (ok) promise->set_value(hash);
+        else promise->set_exception(std::make_exception_ptr(std::runtime_error("on_getblockhash failed")));
+    }, timeout);
+    return promise->get_future();
+}
+
 bool DaemonRpcClient::init(const string &daemon_address, boost::optional<epee::net_utils::http::login> daemon_login)
 {
     return m_http_client.set_server(daemon_address, daemon_login);
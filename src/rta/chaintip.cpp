@@ -0,0 +1,159 @@
+#include "chaintip.h"
+#include "DaemonRpcClient.h"
+
+#include <misc_log_ex.h>
+
+#include <algorithm>
+#include <future>
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "supernode.chaintip"
+
+using namespace std;
+
+namespace graft {
+
+const size_t ChainTip::DEFAULT_DEPTH;
+const size_t ChainTip::REORG_CHECK_DEPTH;
+
+ChainTip::ChainTip(std::shared_ptr<DaemonRpcClient> daemon, size_t depth)
+    : m_daemon(std::move(daemon))
+    , m_depth(std::max<size_t>(1, depth))
+{
+}
+
+bool ChainTip::fetchHashes(uint64_t from, uint64_t to, vector<string> &hashes)
+{
+    // all the requests are in flight at once
+    vector<future<string>> futures;
+    futures.reserve(to - from);
+    for (uint64_t h = from; h < to; ++h) {
+        futures.push_back(m_daemon->get_block_hash_async(h));
+    }
+    hashes.clear();
+    hashes.reserve(futures.size());
+    bool ok = true;
+    for (auto &f : futures) {
+        try {
+            hashes.push_back(f.get());
+        } catch (const std::exception &) {
+            // the rest are waited for anyway
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+bool ChainTip::poll()
+{
+    std::lock_guard<std::mutex> lock(m_poll_mutex);
+
+    uint64_t height = 0;
+    if (!m_daemon->get_height(height) || height == 0) {
+        LOG_ERROR("can't get cryptonode height");
+        return false;
+    }
+    SnapshotPtr prev = m_tip.load();
+
+    auto tip = std::make_shared<Snapshot>();
+    tip->height = height;
+    tip->first = (m_depth < height)? height - m_depth : 0;
+
+    // the hashes of the previous snapshot are reused up to the checked blocks below its tip
+    uint64_t reuse_from = tip->first, reuse_to = tip->first;
+    if (prev) {
+        uint64_t top = std::min(prev->height, height);
+        uint64_t from = std::max(tip->first, prev->first);
+        uint64_t to = (REORG_CHECK_DEPTH < top)? top - REORG_CHECK_DEPTH : 0;
+        if (from < to) {
+            reuse_from = from;
+            reuse_to = to;
+        }
+    }
+
+    vector<string> fresh;
+    if (!fetchHashes(reuse_to, height, fresh)) {
+        LOG_ERROR("can't get block hashes from " << reuse_to << " to " << height);
+        return false;
+    }
+
+    // a checked block that changed means a reorg, the reused hashes are not valid either
+    bool reorg = false;
+    if (prev) {
+        for (uint64_t h = reuse_to; h < std::min(prev->height, height) && !reorg; ++h) {
+            reorg = prev->first <= h && prev->hashes[h - prev->first] != fresh[h - reuse_to];
+        }
+    }
+
+    // the same height and the same checked blocks, the snapshot is not changed
+    if (prev && prev->height == height && !reorg) {
+        return true;
+    }
+
+    tip->hashes.reserve(height - tip->first);
+    if (reorg) {
+        LOG_PRINT_L0("chain reorganization below height " << std::min(prev->height, height));
+        if (!fetchHashes(tip->first, reuse_to, tip->hashes)) {
+            LOG_ERROR("can't get block hashes from " << tip->first << " to " << reuse_to);
+            return false;
+        }
+    } else {
+        // after the height went down the ring may start above first, it is filled up by the next blocks;
+        // nothing is reused if it went down below the previous ring
+        tip->first = reuse_from;
+        if (prev && reuse_from < reuse_to) {
+            auto it = prev->hashes.begin() + (reuse_from - prev->first);
+            tip->hashes.insert(tip->hashes.end(), it, it + (reuse_to - reuse_from));
+        }
+    }
+    tip->hashes.insert(tip->hashes.end(), fresh.begin(), fresh.end());
+
+    SnapshotPtr published = tip;
+    m_tip.store(published);
+    LOG_PRINT_L1("chain tip: " << height << " " << tip->hashes.back());
+
+    vector<NewBlockCallback> subscribers;
+    {
+        std::lock_guard<std::mutex> lk(m_subscribers_mutex);
+        subscribers.reserve(m_subscribers.size());
+        for (auto &item : m_subscribers) {
+            subscribers.push_back(item.second);
+        }
+    }
+    for (auto &callback : subscribers) {
+        callback(published);
+    }
+    return true;
+}
+
+uint64_t ChainTip::height() const
+{
+    SnapshotPtr tip = m_tip.load();
+    return tip? tip->height : 0;
+}
+
+bool ChainTip::getBlockHash(uint64_t height, string &hash) const
+{
+    SnapshotPtr tip = m_tip.load();
+    if (!tip || height < tip->first || tip->first + tip->hashes.size() <= height) {
+        return false;
+    }
+    hash = tip->hashes[height - tip->first];
+    return true;
+}
+
+int ChainTip::subscribe(NewBlockCallback callback)
+{
+    std::lock_guard<std::mutex> lk(m_subscribers_mutex);
+    int id = m_next_id++;
+    m_subscribers.emplace(id, std::move(callback));
+    return id;
+}
+
+void ChainTip::unsubscribe(int id)
+{
+    std::lock_guard<std::mutex> lk(m_subscribers_mutex);
+    m_subscribers.erase(id);
+}
+
+} // namespace graft
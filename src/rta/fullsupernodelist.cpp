@@ -1,4 +1,5 @@
 #include "fullsupernodelist.h"
+#include "common/utils.h"
 
 #include <wallet/api/wallet_manager.h>
 #include <cryptonote_basic/cryptonote_basic_impl.h>
@@ -23,7 +24,7 @@ using namespace std;
 namespace {
     uint256_t hash_to_int256(const crypto::hash &hash)
     {
-        cryptonote::blobdata str_val = std::string("0x") + epee::string_tools::pod_to_hex(hash);
+        cryptonote::blobdata str_val = std::string("0x") + graft::utils::pod_to_hex(hash);
         return uint256_t(str_val);
     }
     // this is WalletManager::findWallets immplenentation. only removed check for cache file.
@@ -236,7 +237,7 @@ bool FullSupernodeList::buildAuthSample(uint64_t height, vector<SupernodePtr> &o
         return false;
     }
 
-    epee::string_tools::hex_to_pod(block_hash_str, block_hash);
+    utils::hex_to_pod(block_hash_str, block_hash);
     vector<SupernodePtr> tier_supernodes;
 
     auto out_it = back_inserter(out);
@@ -284,10 +285,19 @@ vector<string> FullSupernodeList::items() const
 
 bool FullSupernodeList::getBlockHash(uint64_t height, string &hash)
 {
+    ChainTipPtr tip = std::atomic_load(&m_chain_tip);
+    if (tip && tip->getBlockHash(height, hash)) {
+        return true;
+    }
     bool result = m_rpc_client.get_block_hash(height, hash);
     return result;
 }
 
+void FullSupernodeList::setChainTip(ChainTipPtr tip)
+{
+    std::atomic_store(&m_chain_tip, std::move(tip));
+}
+
 std::future<void> FullSupernodeList::refreshAsync()
 {
     m_refresh_counter = 0;
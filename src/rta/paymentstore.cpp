@@ -0,0 +1,52 @@
+#include "rta/paymentstore.h"
+
+namespace graft {
+
+PaymentStore::PaymentStore(std::chrono::seconds ttl)
+    : m_ttl(ttl)
+{
+}
+
+bool PaymentStore::read(const std::string &payment_id, const std::function<void(const PaymentRecord&)> &f) const
+{
+    return m_records.visit(payment_id, f);
+}
+
+int PaymentStore::status(const std::string &payment_id) const
+{
+    int res = static_cast<int>(RTAStatus::None);
+    m_records.visit(payment_id, [&res](const PaymentRecord &record) { res = record.status; });
+    return res;
+}
+
+bool PaymentStore::has(const std::string &payment_id) const
+{
+    return m_records.hasKey(payment_id);
+}
+
+bool PaymentStore::update(const std::string &payment_id, std::function<bool(PaymentRecord&)> f)
+{
+    return m_records.applyOrAdd(payment_id, std::move(f), m_ttl);
+}
+
+bool PaymentStore::updateExisting(const std::string &payment_id, std::function<bool(PaymentRecord&)> f)
+{
+    return m_records.apply(payment_id, std::move(f));
+}
+
+void PaymentStore::remove(const std::string &payment_id)
+{
+    m_records.remove(payment_id);
+}
+
+size_t PaymentStore::size() const
+{
+    return m_records.size();
+}
+
+void PaymentStore::cleanup()
+{
+    m_records.cleanup();
+}
+
+}
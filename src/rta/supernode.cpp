@@ -1,5 +1,7 @@
 #include "supernode.h"
 #include "fullsupernodelist.h"
+#include "DaemonRpcClient.h"
+#include "chaintip.h"
 #include "requests/sendsupernodeannouncerequest.h"
 
 
@@ -17,9 +19,25 @@ using namespace std;
 
 namespace graft {
 
+namespace {
+
+// nullptr if the address is not valid, the wallet is asked then
+std::shared_ptr<DaemonRpcClient> makeDaemonClient(const string &address)
+{
+    try {
+        return std::make_shared<DaemonRpcClient>(address, "", "");
+    } catch (const std::exception &e) {
+        LOG_ERROR("can't create cryptonode RPC client: " << e.what());
+        return nullptr;
+    }
+}
+
+}
+
 Supernode::Supernode(const string &wallet_path, const string &wallet_password, const string &daemon_address, bool testnet,
                      const string &seed_language)
     : m_wallet{new tools::wallet2(testnet)}
+    , m_daemon{makeDaemonClient(daemon_address)}
     , m_last_update_time {0}
 {
     bool keys_file_exists;
@@ -64,6 +82,15 @@ string Supernode::walletAddress() const
 uint64_t Supernode::daemonHeight() const
 {
     uint64_t result = 0;
+    std::shared_ptr<ChainTip> tip = std::atomic_load(&m_chain_tip);
+    if (tip && (result = tip->height()) != 0) {
+        return result;
+    }
+    std::shared_ptr<DaemonRpcClient> daemon = std::atomic_load(&m_daemon);
+    if (daemon) {
+        daemon->get_height(result);
+        return result;
+    }
     std::string err;
     result = m_wallet->get_daemon_blockchain_height(err);
     if (!result) {
@@ -166,12 +193,12 @@ bool Supernode::updateFromAnnounce(const SupernodeAnnounce &announce)
         crypto::key_image ki;
         crypto::signature s;
 
-        if (!epee::string_tools::hex_to_pod(skis.key_image, ki)) {
+        if (!utils::hex_to_pod(skis.key_image, ki)) {
             LOG_ERROR("failed to parse key image: " << skis.key_image);
             return false;
         }
 
-        if (!epee::string_tools::hex_to_pod(skis.signature, s)) {
+        if (!utils::hex_to_pod(skis.signature, s)) {
             LOG_ERROR("failed to parse key signature: " << skis.signature);
             return false;
         }
@@ -202,7 +229,7 @@ Supernode *Supernode::createFromAnnounce(const string &path, const SupernodeAnno
     Supernode * result = nullptr;
 
     crypto::secret_key viewkey;
-    if (!epee::string_tools::hex_to_pod(announce.secret_viewkey, viewkey)) {
+    if (!utils::hex_to_pod(announce.secret_viewkey, viewkey)) {
         LOG_ERROR("Failed to parse secret viewkey from string: " << announce.secret_viewkey);
         return nullptr;
     }
@@ -230,7 +257,7 @@ Supernode *Supernode::createFromAnnounce(const string &path, const SupernodeAnno
 bool Supernode::prepareAnnounce(SupernodeAnnounce &announce)
 {
     announce.timestamp = time(nullptr);
-    announce.secret_viewkey = epee::string_tools::pod_to_hex(this->exportViewkey());
+    announce.secret_viewkey = utils::pod_to_hex(this->exportViewkey());
     announce.height = m_wallet->get_blockchain_current_height();
 
     vector<Supernode::SignedKeyImage> signed_key_images;
@@ -241,8 +268,8 @@ bool Supernode::prepareAnnounce(SupernodeAnnounce &announce)
 
     for (const SignedKeyImage &ski : signed_key_images) {
         SignedKeyImageStr skis;
-        skis.key_image = epee::string_tools::pod_to_hex(ski.first);
-        skis.signature = epee::string_tools::pod_to_hex(ski.second);
+        skis.key_image = utils::pod_to_hex(ski.first);
+        skis.signature = utils::pod_to_hex(ski.second);
         announce.signed_key_images.push_back(skis);
     }
 
@@ -300,9 +327,19 @@ bool Supernode::verifyHash(const crypto::hash &hash, const string &address, cons
 
 bool Supernode::setDaemonAddress(const string &address)
 {
+    std::shared_ptr<DaemonRpcClient> daemon = makeDaemonClient(address);
+    if (!daemon) {
+        return false;
+    }
+    std::atomic_store(&m_daemon, daemon);
     return m_wallet->init(address);
 }
 
+void Supernode::setChainTip(std::shared_ptr<ChainTip> tip)
+{
+    std::atomic_store(&m_chain_tip, std::move(tip));
+}
+
 bool Supernode::refresh()
 {
     try {
@@ -322,7 +359,7 @@ bool Supernode::testnet() const
 void Supernode::getScoreHash(const crypto::hash &block_hash, crypto::hash &result) const
 {
     cryptonote::blobdata data = m_wallet->get_account().get_public_address_str(testnet());
-    data += epee::string_tools::pod_to_hex(block_hash);
+    data += utils::pod_to_hex(block_hash);
     crypto::cn_fast_hash(data.c_str(), data.size(), result);
 }
 
@@ -2,11 +2,16 @@
 #include "backtrace.h"
 #include <boost/program_options.hpp>
 #include <boost/property_tree/ini_parser.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <thread>
+#include <sstream>
 #include "requests.h"
 #include "requestdefines.h"
 #include "requests/sendsupernodeannouncerequest.h"
 #include "rta/supernode.h"
 #include "rta/fullsupernodelist.h"
+#include "rta/paymentstore.h"
+#include "rta/serverstate.h"
 
 #undef MONERO_DEFAULT_LOG_CATEGORY
 #define MONERO_DEFAULT_LOG_CATEGORY "supernode.server"
@@ -70,6 +75,14 @@ void GraftServer::setHttpRouters(HttpConnectionManager& httpcm)
     Router health_router;
     graft::registerHealthcheckRequests(health_router);
     httpcm.addRouter(health_router);
+
+    Router metrics_router;
+    graft::registerMetricsRequests(metrics_router);
+    httpcm.addRouter(metrics_router);
+
+    Router debug_router;
+    graft::registerDebugRequests(debug_router);
+    httpcm.addRouter(debug_router);
 }
 
 void GraftServer::setCoapRouters(CoapConnectionManager& coapcm)
@@ -95,6 +108,7 @@ void GraftServer::initGlobalContext()
     graft::Context ctx(m_looper->getGcm());
     const ConfigOpts& copts = m_looper->getCopts();
 //  copts is empty here
+    ctx.global[CONTEXT_KEY_PAYMENTS] = std::make_shared<graft::PaymentStore>();
 
 //    ctx.global["testnet"] = copts.testnet;
 //    ctx.global["watchonly_wallets_path"] = copts.watchonly_wallets_path;
@@ -107,8 +121,13 @@ bool GraftServer::init(int argc, const char** argv)
     if(!res) return false;
 
     assert(!m_looper);
+    TraceRegistry::instance().setSampleRate(std::max(0, m_configOpts.trace_sample_rate));
     m_looper = std::make_unique<Looper>(m_configOpts);
     assert(m_looper);
+    for(int i = 1; i < m_configOpts.io_threads; ++i)
+    {
+        m_ioLoopers.emplace_back(std::make_unique<Looper>(m_configOpts, *m_looper));
+    }
 
     intiConnectionManagers();
 
@@ -124,6 +143,10 @@ bool GraftServer::init(int argc, const char** argv)
         cm->enableRouting();
         checkRoutes(*cm);
         cm->bind(*m_looper);
+        for(auto& looper : m_ioLoopers)
+        {
+            cm->bind(*looper);
+        }
     }
 
     initGlobalContext();
@@ -133,9 +156,31 @@ bool GraftServer::init(int argc, const char** argv)
 
 void GraftServer::serve()
 {
-    LOG_PRINT_L0("Starting server on: [http] " << m_configOpts.http_address << ", [coap] " << m_configOpts.coap_address);
+    LOG_PRINT_L0("Starting server on: [http] " << m_configOpts.http_address << ", [coap] " << m_configOpts.coap_address
+                 << " with " << 1 + m_ioLoopers.size() << " IO thread(s)");
+
+    std::vector<std::thread> threads;
+    for(auto& looper : m_ioLoopers)
+    {
+        Looper* ptr = looper.get();
+        threads.emplace_back([ptr]{ ptr->serve(); });
+    }
 
     m_looper->serve();
+
+    for(auto& th : threads)
+    {
+        th.join();
+    }
+}
+
+void GraftServer::stop(bool force)
+{
+    m_looper->stop(force);
+    for(auto& looper : m_ioLoopers)
+    {
+        looper->stop(force);
+    }
 }
 
 bool GraftServer::run(int argc, const char** argv)
@@ -229,6 +274,20 @@ void init_log(const boost::property_tree::ptree& config, const po::variables_map
     mlog_set_log_level(log_level);
 }
 
+//"a, b,c" -> {"a", "b", "c"}
+std::vector<std::string> splitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::istringstream ss(list);
+    std::string item;
+    while(std::getline(ss, item, ','))
+    {
+        boost::algorithm::trim(item);
+        if(!item.empty()) items.push_back(std::move(item));
+    }
+    return items;
+}
+
 } //namespace details
 
 void usage(const boost::program_options::options_description& desc)
@@ -286,12 +345,25 @@ bool GraftServer::initConfigOption(int argc, const char** argv)
     //  address <IP>:<PORT>
     //  workers-count <integer>
     //  worker-queue-len <integer>
+    //  io-threads <integer> # number of network event loops
+    //  admission-queue-len <integer> # requests waiting for the thread pool, 0 - respond 503 at once
+    //  admission-target-delay-ms <integer> # CoDel target queue delay
+    //  admission-interval-ms <integer> # CoDel interval
+    //  result-drain-budget <integer> # thread pool results processed per loop iteration, 0 - no limit
+    //  trace-sample-rate <integer> # one of N requests is kept for /debug/trace/chrome, 0 - disabled
     //  stake-wallet <string> # stake wallet filename (no path)
+    //  upstream-breaker-failures <integer> # failures of a cryptonode backend in a row that open its circuit
+    //  upstream-breaker-cooldown-ms <integer> # time the circuit stays open
+    //  upstream-hedge-paths <path[:method],...> # idempotent requests sent to a second backend after the p95 latency
     // [cryptonode]
     //  rpc-address <IP>:<PORT>
+    //  rpc-backends <IP>:<PORT>,... # the backends of the forwarded requests, rpc-address if absent
+    //  chain-tip-poll-interval-ms <integer> # interval of the polls of the height and recent block hashes
     //  p2p-address <IP>:<PORT> #maybe
     // [upstream]
     //  uri_name=uri_value #pairs for uri substitution
+    // [upstream-cache]
+    //  path[:method]=ttl_ms #cached replies of the cryptonode
     //
     // data directory structure
     //        .
@@ -321,6 +393,18 @@ bool GraftServer::initConfigOption(int argc, const char** argv)
     m_configOpts.upstream_request_timeout = server_conf.get<double>("upstream-request-timeout");
     m_configOpts.data_dir = server_conf.get<string>("data-dir", string());
     m_configOpts.lru_timeout_ms = server_conf.get<int>("lru-timeout-ms");
+    m_configOpts.io_threads = std::max(1, server_conf.get<int>("io-threads", 1));
+    m_configOpts.admission_queue_len = server_conf.get<int>("admission-queue-len", m_configOpts.admission_queue_len);
+    m_configOpts.admission_target_delay_ms = server_conf.get<int>("admission-target-delay-ms", m_configOpts.admission_target_delay_ms);
+    m_configOpts.admission_interval_ms = server_conf.get<int>("admission-interval-ms", m_configOpts.admission_interval_ms);
+    m_configOpts.result_drain_budget = server_conf.get<int>("result-drain-budget", m_configOpts.result_drain_budget);
+    m_configOpts.trace_sample_rate = server_conf.get<int>("trace-sample-rate", m_configOpts.trace_sample_rate);
+    m_configOpts.upstream_keepalive_max_per_host = server_conf.get<int>("upstream-keepalive-max-per-host", m_configOpts.upstream_keepalive_max_per_host);
+    m_configOpts.upstream_keepalive_idle_timeout = server_conf.get<double>("upstream-keepalive-idle-timeout", m_configOpts.upstream_keepalive_idle_timeout);
+    m_configOpts.upstream_breaker_failures = server_conf.get<int>("upstream-breaker-failures", m_configOpts.upstream_breaker_failures);
+    m_configOpts.upstream_breaker_cooldown_ms = server_conf.get<int>("upstream-breaker-cooldown-ms", m_configOpts.upstream_breaker_cooldown_ms);
+    std::vector<std::string> hedge_paths = details::splitList(server_conf.get<string>("upstream-hedge-paths", string()));
+    m_configOpts.upstream_hedge_paths = std::set<std::string>(hedge_paths.begin(), hedge_paths.end());
     m_configOpts.testnet = server_conf.get<bool>("testnet", false);
     m_configOpts.stake_wallet_name = server_conf.get<string>("stake-wallet-name", "stake-wallet");
     m_configOpts.stake_wallet_refresh_interval_ms = server_conf.get<size_t>("stake-wallet-refresh-interval-ms",
@@ -335,6 +419,8 @@ bool GraftServer::initConfigOption(int argc, const char** argv)
     const boost::property_tree::ptree& cryptonode_conf = config.get_child("cryptonode");
 
     m_configOpts.cryptonode_rpc_address = cryptonode_conf.get<string>("rpc-address");
+    m_configOpts.cryptonode_rpc_backends = details::splitList(cryptonode_conf.get<string>("rpc-backends", string()));
+    m_configOpts.chain_tip_poll_interval_ms = cryptonode_conf.get<int>("chain-tip-poll-interval-ms", m_configOpts.chain_tip_poll_interval_ms);
     const boost::property_tree::ptree& uri_subst_conf = config.get_child("upstream");
     graft::OutHttp::uri_substitutions.clear();
     std::for_each(uri_subst_conf.begin(), uri_subst_conf.end(),[&uri_subst_conf](auto it)
@@ -344,6 +430,17 @@ bool GraftServer::initConfigOption(int argc, const char** argv)
         graft::OutHttp::uri_substitutions.insert({std::move(name), std::move(val)});
     });
 
+    //the section is optional, the replies of the upstreams are not cached without it
+    m_configOpts.upstream_cache_ttl_ms.clear();
+    auto cache_conf = config.get_child_optional("upstream-cache");
+    if(cache_conf)
+    {
+        for(auto& item : *cache_conf)
+        {
+            m_configOpts.upstream_cache_ttl_ms[item.first] = item.second.get_value<int>();
+        }
+    }
+
     return true;
 }
 
@@ -398,14 +495,23 @@ void GraftServer::prepareDataDirAndSupernodes()
     // add our supernode as well, it wont be added from announce;
     fsl->add(supernode);
 
-    //put fsl into global context
+    // the height and the recent block hashes are served from memory, polled by startSupernodePeriodicTasks
+    graft::ChainTipPtr chainTip = std::make_shared<graft::ChainTip>(
+                std::make_shared<graft::DaemonRpcClient>(m_configOpts.cryptonode_rpc_address, "", ""));
+    supernode->setChainTip(chainTip);
+    fsl->setChainTip(chainTip);
+
+    //publish the server state, the loopers share the global context
     assert(m_looper);
-    graft::Context ctx(m_looper->getGcm());
-    ctx.global["supernode"] = supernode;
-    ctx.global[CONTEXT_KEY_FULLSUPERNODELIST] = fsl;
-    ctx.global["testnet"] = m_configOpts.testnet;
-    ctx.global["watchonly_wallets_path"] = m_configOpts.watchonly_wallets_path;
-    ctx.global["cryptonode_rpc_address"] = m_configOpts.cryptonode_rpc_address;
+    auto state = std::make_shared<graft::ServerState>();
+    state->supernode = supernode;
+    state->fsl = fsl;
+    state->chainTip = chainTip;
+    state->testnet = m_configOpts.testnet;
+    state->data_dir = m_configOpts.data_dir;
+    state->watchonly_wallets_path = m_configOpts.watchonly_wallets_path;
+    state->cryptonode_rpc_address = m_configOpts.cryptonode_rpc_address;
+    m_looper->getGcm().serverState.store(std::move(state));
 }
 
 void GraftServer::intiConnectionManagers()
@@ -424,6 +530,8 @@ void GraftServer::addGlobalCtxCleaner()
     auto cleaner = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
     {
         graft::Context::GlobalFriend::cleanup(ctx.global);
+        graft::PaymentStorePtr payments = ctx.global.get(CONTEXT_KEY_PAYMENTS, graft::PaymentStorePtr());
+        if(payments) payments->cleanup();
         return graft::Status::Ok;
     };
     m_looper->addPeriodicTask(
@@ -452,11 +560,11 @@ void GraftServer::startSupernodePeriodicTasks()
                 LOG_PRINT_L1("output: " << output.data());
                 LOG_PRINT_L1("last status: " << (int)ctx.local.getLastStatus());
 
-                supernode = ctx.global.get(CONTEXT_KEY_SUPERNODE, graft::SupernodePtr(nullptr));
-
+                // the refresh blocks, the snapshot is not pinned for it
+                if (graft::Context::State state = ctx.state()) supernode = state->supernode;
 
                 if (!supernode.get()) {
-                    LOG_ERROR("supernode is not set in global context");
+                    LOG_ERROR("supernode is not set in server state");
                     return graft::Status::Error;
                 }
 
@@ -493,8 +601,25 @@ void GraftServer::startSupernodePeriodicTasks()
         return Status::Ok;
     };
 
+    // poll the chain tip every interval_ms
+    auto chainTipWorker = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx,
+            graft::Output& output)->graft::Status
+    {
+        graft::ChainTipPtr chainTip;
+        if (graft::Context::State state = ctx.state()) chainTip = state->chainTip;
+        if (chainTip) {
+            chainTip->poll();
+        }
+        return graft::Status::Ok;
+    };
+
     size_t initial_interval_ms = 1000;
     assert(m_looper);
+    m_looper->addPeriodicTask(
+                graft::Router::Handler3(nullptr, chainTipWorker, nullptr),
+                std::chrono::milliseconds(m_configOpts.chain_tip_poll_interval_ms),
+                std::chrono::milliseconds(initial_interval_ms)
+                );
     m_looper->addPeriodicTask(
                 graft::Router::Handler3(nullptr, supernodeRefreshWorker, nullptr),
                 std::chrono::milliseconds(m_configOpts.stake_wallet_refresh_interval_ms),
@@ -8,22 +8,30 @@
 namespace graft {
 
 thread_local bool TaskManager::io_thread = false;
-TaskManager* TaskManager::g_upstreamManager{nullptr};
+std::atomic<TaskManager*> TaskManager::g_upstreamManager{nullptr};
+
+GJPtr::GJPtr(BaseTaskPtr bt, TPResQueue* rq, TaskManager* manager)
+    : m_ptr(nullptr, PoolDeleter<GJ>(manager->getPool()))
+{
+    void* p = manager->getPool().allocate(sizeof(GJ));
+    m_ptr.reset(new(p) GJ(bt, rq, manager));
+}
+
+GJPtr::GJPtr(GJ&& gj)
+    : m_ptr(nullptr, PoolDeleter<GJ>(gj.getWatcher()->getPool()))
+{
+    void* p = gj.getWatcher()->getPool().allocate(sizeof(GJ));
+    m_ptr.reset(new(p) GJ(std::move(gj)));
+}
 
 //pay attension, input is output and vice versa
 void TaskManager::sendUpstreamBlocking(Output& output, Input& input, std::string& err)
 {
     if(io_thread) throw std::logic_error("the function sendUpstreamBlocking should not be called in IO thread");
-    assert(g_upstreamManager);
-    std::promise<Input> promise;
-    std::future<Input> future = promise.get_future();
-    std::pair< std::promise<Input>, Output> pair = std::make_pair( std::move(promise), output);
-    g_upstreamManager->m_promiseQueue->push( std::move(pair) );
-    g_upstreamManager->notifyJobReady();
     err.clear();
     try
     {
-        input = future.get();
+        input = sendUpstreamAsync(output).get();
     }
     catch(std::exception& ex)
     {
@@ -31,6 +39,47 @@ void TaskManager::sendUpstreamBlocking(Output& output, Input& input, std::string
     }
 }
 
+std::future<Input> TaskManager::sendUpstreamAsync(const Output& output, std::chrono::milliseconds timeout)
+{
+    UpstreamTask::PromiseItem pi;
+    pi.output = output;
+    pi.timeout = timeout;
+    std::future<Input> future = pi.promise.get_future();
+    pushUpstreamRequest(std::move(pi));
+    return future;
+}
+
+void TaskManager::sendUpstreamAsync(const Output& output, UpstreamTask::Callback callback, std::chrono::milliseconds timeout)
+{
+    assert(callback);
+    UpstreamTask::PromiseItem pi;
+    pi.output = output;
+    pi.callback = std::move(callback);
+    pi.timeout = timeout;
+    pushUpstreamRequest(std::move(pi));
+}
+
+void TaskManager::pushUpstreamRequest(PromiseItem&& pi)
+{
+    TaskManager* manager = g_upstreamManager.load();
+    const char* err = (!manager)? "there is no looper to send the upstream request" : nullptr;
+    //a thread waits for the looper to take the queued requests, the looper itself cannot wait
+    while(!err && !manager->m_promiseQueue->push(std::move(pi)))
+    {
+        if(io_thread) err = "the upstream request queue is full";
+        manager->notifyJobReady();
+        std::this_thread::yield();
+    }
+    if(!err)
+    {
+        manager->notifyJobReady();
+        return;
+    }
+    //the item is not moved on failure
+    if(pi.callback) pi.callback(Input(), err);
+    else pi.promise.set_exception(std::make_exception_ptr(std::runtime_error(err)));
+}
+
 void TaskManager::checkUpstreamBlockingIO()
 {
     while(true)
@@ -46,8 +95,30 @@ void TaskManager::checkUpstreamBlockingIO()
 
 void TaskManager::sendUpstream(BaseTaskPtr bt)
 {
+    std::string key;
+    if(m_upstreamCache.enabled())
+    {
+        const Output& output = bt->getOutput();
+        const Input* reply = nullptr;
+        switch(m_upstreamCache.lookup(output.makeUri(m_copts.cryptonode_rpc_address), output.body, bt, reply, key))
+        {
+        case UpstreamCache::Lookup::Hit:
+            bt->getSpan().mark(TraceStage::upstream_send);
+            bt->getInput() = *reply;
+            onUpstreamReply(bt, Status::Ok, std::string());
+            return;
+        case UpstreamCache::Lookup::Joined:
+            //the task is continued with the reply of the identical request in flight
+            bt->getSpan().mark(TraceStage::upstream_send);
+            return;
+        default:
+            break;
+        }
+    }
     ++m_cntUpstreamSender;
+    m_metrics.upstreamRequests->inc();
     UpstreamSender::Ptr uss = UpstreamSender::Create();
+    uss->setCacheKey(std::move(key));
     uss->send(*this, bt);
 }
 
@@ -63,6 +134,10 @@ void TaskManager::respondAndDie(BaseTaskPtr bt, const std::string& s)
     if(ct)
     {
         ct->m_connectionManager->respond(ct, s);
+        TraceSpan& span = bt->getSpan();
+        span.mark(TraceStage::respond);
+        TraceRegistry::RouteStats* trace = bt->getParams().trace;
+        if(trace) TraceRegistry::instance().record(*trace, span);
     }
     else
     {
@@ -72,7 +147,11 @@ void TaskManager::respondAndDie(BaseTaskPtr bt, const std::string& s)
     Context::uuid_t uuid = bt->getCtx().getId();
     auto it = m_postponedTasks.find(uuid);
     if (it != m_postponedTasks.end())
+    {
         m_postponedTasks.erase(it);
+        std::lock_guard<std::mutex> lk(m_postponedOwners->mutex);
+        m_postponedOwners->owners.erase(uuid);
+    }
 
     bt->finalize();
 }
@@ -85,12 +164,61 @@ void TaskManager::schedule(PeriodicTask* pt)
 void TaskManager::Execute(BaseTaskPtr bt)
 {
     assert(m_cntJobDone <= m_cntJobSent);
-    if(m_cntJobSent - m_cntJobDone == m_threadPoolInputSize)
-    {//check overflow
-        bt->getCtx().local.setError("Service Unavailable", Status::Busy);
-        respondAndDie(bt,"Thread pool overflow");
+    if(m_cntJobSent - m_cntJobDone >= m_threadPoolInputSize || !m_admissionQueue->empty())
+    {//check overflow, keep the order of the waiting tasks
+        admit(bt);
+        drainAdmissionQueue();
         return;
     }
+    ExecuteAdmitted(bt);
+}
+
+void TaskManager::admit(BaseTaskPtr bt)
+{
+    std::vector<BaseTaskPtr> shed;
+    bool res = m_admissionQueue->push(bt->getParams().priority, bt, shed);
+    for(auto& it : shed)
+    {
+        respondBusy(it);
+    }
+    if(!res)
+    {
+        respondBusy(bt);
+    }
+}
+
+void TaskManager::drainAdmissionQueue()
+{
+    std::vector<BaseTaskPtr> shed;
+    while(m_cntJobSent - m_cntJobDone < m_threadPoolInputSize)
+    {
+        BaseTaskPtr bt;
+        bool res = m_admissionQueue->pop(bt, shed);
+        for(auto& it : shed)
+        {
+            respondBusy(it);
+        }
+        shed.clear();
+        if(!res) break;
+        if(!bt->getSelf()) continue; //a client has closed connection while waiting
+        bt->getSpan().mark(TraceStage::admitted);
+        ExecuteAdmitted(bt);
+    }
+}
+
+void TaskManager::respondBusy(BaseTaskPtr bt)
+{
+    if(!bt->getSelf()) return;
+    Output& output = bt->getOutput();
+    output.reset();
+    output.headers.emplace_back("Retry-After", std::to_string(m_admissionQueue->retryAfter()));
+    m_metrics.shed->inc();
+    bt->getCtx().local.setError("Service Unavailable", Status::Busy);
+    respondAndDie(bt,"Thread pool overflow");
+}
+
+void TaskManager::ExecuteAdmitted(BaseTaskPtr bt)
+{
     assert(m_cntJobSent - m_cntJobDone < m_threadPoolInputSize);
 
     auto& params = bt->getParams();
@@ -104,9 +232,12 @@ void TaskManager::Execute(BaseTaskPtr bt)
     if(params.h3.worker_action)
     {
         ++m_cntJobSent;
+        m_metrics.jobs->inc();
+        bt->getSpan().mark(TraceStage::enqueue);
         m_threadPool->post(
                     GJPtr( bt, m_resQueue.get(), this ),
-                    true
+                    true,
+                    bt->getAffinity()
                     );
     }
     else
@@ -130,6 +261,7 @@ bool TaskManager::tryProcessReadyJob()
     bool res = m_resQueue->pop(gj);
     if(!res) return res;
     ++m_cntJobDone;
+    m_admissionQueue->onDone();
     BaseTaskPtr bt = gj->getTask();
     ExecutePostAction(bt, &*gj);
     processResult(bt);
@@ -140,6 +272,7 @@ void TaskManager::ExecutePreAction(BaseTaskPtr bt)
 {
     auto& params = bt->getParams();
     if(!params.h3.pre_action) return;
+    bt->getSpan().mark(TraceStage::pre_action);
     auto& ctx = bt->getCtx();
     auto& output = bt->getOutput();
 
@@ -212,6 +345,11 @@ void TaskManager::postponeTask(BaseTaskPtr bt)
     assert(!uuid.is_nil());
     assert(m_postponedTasks.find(uuid) == m_postponedTasks.end());
     m_postponedTasks[uuid] = bt;
+    {
+        std::lock_guard<std::mutex> lk(m_postponedOwners->mutex);
+        m_postponedOwners->owners[uuid] = this;
+    }
+    bt->getSpan().mark(TraceStage::postpone);
     std::chrono::duration<double> timeout(m_copts.http_connection_timeout);
     std::chrono::steady_clock::time_point tpoint = std::chrono::steady_clock::now()
             + std::chrono::duration_cast<std::chrono::steady_clock::duration>( timeout );
@@ -221,11 +359,51 @@ void TaskManager::postponeTask(BaseTaskPtr bt)
                                 );
 }
 
+bool TaskManager::resumePostponedTask(const Context::uuid_t& uuid)
+{
+    TaskManager* owner = nullptr;
+    {
+        std::lock_guard<std::mutex> lk(m_postponedOwners->mutex);
+        auto it = m_postponedOwners->owners.find(uuid);
+        if(it == m_postponedOwners->owners.end()) return false;
+        owner = it->second;
+        m_postponedOwners->owners.erase(it);
+    }
+    if(owner == this)
+    {
+        auto it = m_postponedTasks.find(uuid);
+        assert(it != m_postponedTasks.end());
+        m_readyToResume.push_back(it->second);
+        m_postponedTasks.erase(it);
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lk(owner->m_resumeMutex);
+        owner->m_resumeRequests.push_back(uuid);
+    }
+    owner->notifyJobReady();
+    return true;
+}
+
 void TaskManager::executePostponedTasks()
 {
+    std::vector<Context::uuid_t> resumed;
+    {
+        std::lock_guard<std::mutex> lk(m_resumeMutex);
+        resumed.swap(m_resumeRequests);
+    }
+    for(auto& uuid : resumed)
+    {//the task may have expired meanwhile
+        auto it = m_postponedTasks.find(uuid);
+        if(it == m_postponedTasks.end()) continue;
+        m_readyToResume.push_back(it->second);
+        m_postponedTasks.erase(it);
+    }
+
     while(!m_readyToResume.empty())
     {
         BaseTaskPtr& bt = m_readyToResume.front();
+        bt->getSpan().mark(TraceStage::resume);
         Execute(bt);
         m_readyToResume.pop_front();
     }
@@ -263,12 +441,12 @@ void TaskManager::processResult(BaseTaskPtr bt)
     case Status::Ok:
     {
         Context::uuid_t nextUuid = bt->getCtx().getNextTaskId();
-        if(!nextUuid.is_nil())
-        {
-            auto it = m_postponedTasks.find(nextUuid);
-            assert(it != m_postponedTasks.end());
-            m_readyToResume.push_back(it->second);
-            m_postponedTasks.erase(it);
+        if(!nextUuid.is_nil() && !resumePostponedTask(nextUuid))
+        {//the task has expired or there was none
+            std::string msg = "Postponed task not found";
+            bt->setError(msg.c_str(), Status::Error);
+            respondAndDie(bt, msg);
+            break;
         }
         respondAndDie(bt, bt->getOutput().data());
     } break;
@@ -317,6 +495,7 @@ TaskManager *TaskManager::from(mg_mgr *mgr)
 void TaskManager::onNewClient(BaseTaskPtr bt)
 {
     ++m_cntBaseTask;
+    m_metrics.tasks->inc();
     Execute(bt);
 }
 
@@ -333,7 +512,29 @@ void TaskManager::initThreadPool(int threadCount, int workersQueueSize)
     tp::ThreadPoolOptions th_op;
     th_op.setThreadCount(threadCount);
     th_op.setQueueSize(workersQueueSize);
-    graft::ThreadPoolX thread_pool(th_op);
+
+    m_threadPool = std::make_shared<ThreadPoolX>(th_op);
+    initResultQueue(th_op.threadCount(), th_op.queueSize());
+
+    LOG_PRINT_L1("Thread pool created with " << threadCount
+                 << " workers with " << workersQueueSize
+                 << " queue size each.");
+}
+
+void TaskManager::initThreadPool(TaskManager& primary)
+{
+    m_threadPool = primary.m_threadPool;
+    const ConfigOpts& copts = primary.m_copts;
+    size_t threadCount = (copts.workers_count <= 0)? std::thread::hardware_concurrency() : copts.workers_count;
+    size_t workersQueueSize = (copts.worker_queue_len <= 0)? 32 : copts.worker_queue_len;
+    initResultQueue(threadCount, workersQueueSize);
+}
+
+void TaskManager::initResultQueue(size_t threadCount, size_t workersQueueSize)
+{
+    tp::ThreadPoolOptions th_op;
+    th_op.setThreadCount(threadCount);
+    th_op.setQueueSize(workersQueueSize);
 
     size_t resQueueSize;
     {//nearest ceiling power of 2
@@ -343,35 +544,145 @@ void TaskManager::initThreadPool(int threadCount, int workersQueueSize)
         resQueueSize = bit;
     }
 
-    const size_t maxinputSize = th_op.threadCount()*th_op.queueSize();
-    graft::TPResQueue resQueue(resQueueSize);
+    //the pool is shared by all loopers, each one can occupy its share of the pool input only,
+    //so that posting never fails
+    const size_t loopers = std::max(1, m_copts.io_threads);
+    const size_t maxinputSize = std::max<size_t>(1, th_op.threadCount()*th_op.queueSize() / loopers);
 
-    m_threadPool = std::make_unique<ThreadPoolX>(std::move(thread_pool));
-    m_resQueue = std::make_unique<TPResQueue>(std::move(resQueue));
+    m_resQueue = std::make_unique<TPResQueue>(resQueueSize);
     m_threadPoolInputSize = maxinputSize;
-    m_promiseQueue = std::make_unique<PromiseQueue>(threadCount);
+    m_promiseQueue = std::make_unique<PromiseQueue>(std::max<size_t>(2, resQueueSize));
+    m_admissionQueue = std::make_unique<AdmissionQueue<BaseTaskPtr>>(
+                std::max(0, m_copts.admission_queue_len),
+                std::chrono::milliseconds(m_copts.admission_target_delay_ms),
+                std::chrono::milliseconds(m_copts.admission_interval_ms));
+
+    LOG_PRINT_L1("The output queue size is " << resQueueSize
+                 << ", up to " << maxinputSize << " jobs can be in the thread pool at once.");
+}
 
-    LOG_PRINT_L1("Thread pool created with " << threadCount
-                 << " workers with " << workersQueueSize
-                 << " queue size each. The output queue size is " << resQueueSize);
+std::vector<std::string> TaskManager::upstreamBackends(const ConfigOpts& copts)
+{
+    if(!copts.cryptonode_rpc_backends.empty()) return copts.cryptonode_rpc_backends;
+    return std::vector<std::string>{copts.cryptonode_rpc_address};
+}
+
+void TaskManager::initMetrics()
+{
+    Metrics& metrics = Metrics::instance();
+    const std::string labels = Metrics::labels({{"looper", std::to_string(m_id)}});
+    m_metrics.tasks = &metrics.counter("graft_client_requests_total", "Client requests accepted.", labels);
+    m_metrics.jobs = &metrics.counter("graft_thread_pool_jobs_total", "Jobs posted to the thread pool.", labels);
+    m_metrics.upstreamRequests = &metrics.counter("graft_upstream_requests_total", "Requests sent to the cryptonode.", labels);
+    m_metrics.shed = &metrics.counter("graft_admission_shed_total", "Requests answered 503 by the admission queue.", labels);
+    m_metrics.activeTasks = &metrics.gauge("graft_client_requests_active", "Client requests in progress.", labels);
+    m_metrics.admissionQueue = &metrics.gauge("graft_admission_queue_depth", "Requests waiting in the admission queue.", labels);
+    m_metrics.poolJobs = &metrics.gauge("graft_thread_pool_jobs", "Jobs of the looper in the thread pool.", labels);
+    m_metrics.poolCapacity = &metrics.gauge("graft_thread_pool_capacity", "Max jobs of the looper in the thread pool.", labels);
+    m_metrics.postponedTasks = &metrics.gauge("graft_postponed_tasks", "Postponed requests waiting to be resumed.", labels);
+    m_metrics.upstreamInFlight = &metrics.gauge("graft_upstream_requests_active", "Requests to the cryptonode in progress.", labels);
+    m_metrics.upstreamConnects = &metrics.counter("graft_upstream_connects_total", "Connections made to the upstreams.", labels);
+    m_metrics.upstreamReuses = &metrics.counter("graft_upstream_connection_reuses_total", "Requests sent over kept-alive upstream connections.", labels);
+    m_metrics.upstreamEvictions = &metrics.counter("graft_upstream_connection_evictions_total", "Upstream connections closed as unhealthy.", labels);
+    m_metrics.upstreamIdle = &metrics.gauge("graft_upstream_connections_idle", "Idle kept-alive upstream connections.", labels);
+    m_metrics.upstreamCacheHits = &metrics.counter("graft_upstream_cache_hits_total", "Upstream requests answered from the cache.", labels);
+    m_metrics.upstreamCacheMisses = &metrics.counter("graft_upstream_cache_misses_total", "Cacheable upstream requests sent to the upstream.", labels);
+    m_metrics.upstreamCoalesced = &metrics.counter("graft_upstream_coalesced_total", "Upstream requests that waited for an identical one in flight.", labels);
+    m_metrics.upstreamSaved = &metrics.counter("graft_upstream_requests_saved_total", "Upstream requests not sent owing to the cache and the coalescing.", labels);
+    m_metrics.upstreamCacheEntries = &metrics.gauge("graft_upstream_cache_entries", "Cached upstream replies and requests in flight.", labels);
+    m_metrics.upstreamHedges = &metrics.counter("graft_upstream_hedged_total", "Requests sent to a second cryptonode backend after the p95 latency.", labels);
+    m_metrics.upstreamFailovers = &metrics.counter("graft_upstream_failovers_total", "Requests sent to another cryptonode backend after a failure.", labels);
+    m_metrics.upstreamCircuitOpens = &metrics.counter("graft_upstream_circuit_opens_total", "Circuits of cryptonode backends opened.", labels);
+    m_metrics.upstreamOpenBackends = &metrics.gauge("graft_upstream_backends_open", "Cryptonode backends with the open circuit.", labels);
+    //the global context is shared by all loopers
+    m_metrics.globalContextSize = (m_primary)?
+                &metrics.gauge("graft_global_context_entries", "Entries of the global context.") : nullptr;
+    m_metrics.globalContextExpired = (m_primary)?
+                &metrics.counter("graft_global_context_expired_total", "Entries of the global context removed on expiry.") : nullptr;
+    m_metrics.poolCapacity->set(m_threadPoolInputSize);
+}
+
+void TaskManager::publishMetrics()
+{
+    m_metrics.activeTasks->set(m_cntBaseTask - m_cntBaseTaskDone);
+    m_metrics.admissionQueue->set(m_admissionQueue->size());
+    m_metrics.poolJobs->set(m_cntJobSent - m_cntJobDone);
+    m_metrics.postponedTasks->set(m_postponedTasks.size());
+    m_metrics.upstreamInFlight->set(m_cntUpstreamSender - m_cntUpstreamSenderDone);
+    m_metrics.upstreamConnects->inc(m_upstreamPool.connectCount() - m_metrics.upstreamConnectsSeen);
+    m_metrics.upstreamConnectsSeen = m_upstreamPool.connectCount();
+    m_metrics.upstreamReuses->inc(m_upstreamPool.reuseCount() - m_metrics.upstreamReusesSeen);
+    m_metrics.upstreamReusesSeen = m_upstreamPool.reuseCount();
+    m_metrics.upstreamEvictions->inc(m_upstreamPool.evictCount() - m_metrics.upstreamEvictionsSeen);
+    m_metrics.upstreamEvictionsSeen = m_upstreamPool.evictCount();
+    m_metrics.upstreamIdle->set(m_upstreamPool.idleCount());
+    uint64_t hits = m_upstreamCache.hitCount() - m_metrics.upstreamCacheHitsSeen;
+    uint64_t coalesced = m_upstreamCache.coalescedCount() - m_metrics.upstreamCoalescedSeen;
+    m_metrics.upstreamCacheHits->inc(hits);
+    m_metrics.upstreamCoalesced->inc(coalesced);
+    m_metrics.upstreamSaved->inc(hits + coalesced);
+    m_metrics.upstreamCacheMisses->inc(m_upstreamCache.missCount() - m_metrics.upstreamCacheMissesSeen);
+    m_metrics.upstreamCacheHitsSeen = m_upstreamCache.hitCount();
+    m_metrics.upstreamCoalescedSeen = m_upstreamCache.coalescedCount();
+    m_metrics.upstreamCacheMissesSeen = m_upstreamCache.missCount();
+    m_metrics.upstreamCacheEntries->set(m_upstreamCache.size());
+    m_metrics.upstreamHedges->inc(m_upstreamBalancer.hedgeCount() - m_metrics.upstreamHedgesSeen);
+    m_metrics.upstreamHedgesSeen = m_upstreamBalancer.hedgeCount();
+    m_metrics.upstreamFailovers->inc(m_upstreamBalancer.failoverCount() - m_metrics.upstreamFailoversSeen);
+    m_metrics.upstreamFailoversSeen = m_upstreamBalancer.failoverCount();
+    m_metrics.upstreamCircuitOpens->inc(m_upstreamBalancer.openCount() - m_metrics.upstreamCircuitOpensSeen);
+    m_metrics.upstreamCircuitOpensSeen = m_upstreamBalancer.openCount();
+    m_metrics.upstreamOpenBackends->set(m_upstreamBalancer.openBackends());
+    if(m_metrics.globalContextSize) m_metrics.globalContextSize->set(m_gcm->size());
+    if(m_metrics.globalContextExpired)
+    {
+        uint64_t expired = m_gcm->expiredCount();
+        m_metrics.globalContextExpired->inc(expired - m_metrics.globalContextExpiredSeen);
+        m_metrics.globalContextExpiredSeen = expired;
+    }
 }
 
 void TaskManager::setIOThread(bool current)
 {
+    //in multi-looper mode the primary looper serves blocking upstream requests
     if(current)
     {
         io_thread = true;
-        assert(!g_upstreamManager);
-        g_upstreamManager = this;
+        MemoryPool::setLocal(&m_pool);
+        if(m_primary)
+        {
+            TaskManager* expected = nullptr;
+            bool res = g_upstreamManager.compare_exchange_strong(expected, this);
+            assert(res);
+        }
     }
     else
     {
-        g_upstreamManager = nullptr;
+        TaskManager* expected = this;
+        g_upstreamManager.compare_exchange_strong(expected, nullptr);
+        MemoryPool::setLocal(nullptr);
         io_thread = false;
+        LOG_PRINT_L1("Memory pool hits " << m_pool.hits() << ", misses " << m_pool.misses());
+        LOG_PRINT_L1("Jobs done " << m_cntJobDone << ", job ready notifications " << getNotifyCount()
+                     << ", wakeups " << m_cntWakeup);
     }
 }
 
+bool TaskManager::onJobReady()
+{
+    //only the transition from the empty queue is signaled, the other jobs are picked up by the same wakeup
+    if(m_jobReadyNotified.exchange(true, std::memory_order_seq_cst)) return false;
+    m_cntNotify.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
 void TaskManager::cb_event(uint64_t cnt)
+{
+    ++m_cntWakeup;
+    processReadyJobs();
+}
+
+void TaskManager::processReadyJobs()
 {
     //When multiple threads write to the output queue of the thread pool.
     //It is possible that a hole appears when a thread has not completed to set
@@ -379,55 +690,84 @@ void TaskManager::cb_event(uint64_t cnt)
     //Thus, it is better to process as many cells as we can without waiting when
     //the cell will be filled, instead of basing on the counter.
     //We cannot lose any cell because a notification follows the hole completion.
+    //The number of processed cells is limited by the budget, so that IO and timers are not starved,
+    //the looper continues without waiting in poll until the backlog is processed.
 
-    while(true)
+    //The notification flag stays set while the looper drains the queue. It is cleared when the queue
+    //seems empty, then the queue is checked once more, so a job pushed before the flag was cleared
+    //is not lost and a job pushed after that sends a new notification.
+
+    const int budget = m_copts.result_drain_budget;
+    m_readyBacklog = true;
+    for(int i = 0; budget <= 0 || i < budget; ++i)
     {
-        bool res = tryProcessReadyJob();
-        if(!res) break;
+        if(tryProcessReadyJob()) continue;
+        m_jobReadyNotified.exchange(false, std::memory_order_seq_cst);
+        if(tryProcessReadyJob()) continue;
+        m_readyBacklog = false;
+        break;
     }
+    drainAdmissionQueue();
 }
 
 void TaskManager::onUpstreamDone(UpstreamSender& uss)
 {
+    uss.observeLatency();
     BaseTaskPtr bt = uss.getTask();
     UpstreamTask* ust = dynamic_cast<UpstreamTask*>(bt.get());
     if(ust)
     {
-        try
+        UpstreamTask::PromiseItem& pi = ust->m_pi;
+        if(pi.callback)
+        {
+            bool ok = Status::Ok == uss.getStatus();
+            pi.callback(ok? std::move(bt->getInput()) : Input(), ok? std::string() : uss.getError());
+        }
+        else if(Status::Ok != uss.getStatus())
         {
-            if(Status::Ok != uss.getStatus())
-            {
-                throw std::runtime_error(uss.getError().c_str());
-            }
-            ust->m_pi.first.set_value(bt->getInput());
+            pi.promise.set_exception(std::make_exception_ptr(std::runtime_error(uss.getError())));
         }
-        catch(std::exception&)
+        else
         {
-            ust->m_pi.first.set_exception(std::current_exception());
+            pi.promise.set_value(std::move(bt->getInput()));
         }
+        ust->finalize();
         return;
     }
-    if(Status::Ok != uss.getStatus())
+    if(!uss.getCacheKey().empty())
+    {//the waiters are continued first, the handlers of the task may change its input
+        bool ok = Status::Ok == uss.getStatus();
+        std::vector<BaseTaskPtr> waiters = m_upstreamCache.complete(uss.getCacheKey(), ok? &bt->getInput() : nullptr);
+        for(auto& waiter : waiters)
+        {
+            if(ok) waiter->getInput() = bt->getInput();
+            onUpstreamReply(waiter, uss.getStatus(), uss.getError());
+        }
+    }
+    onUpstreamReply(bt, uss.getStatus(), uss.getError());
+    ++m_cntUpstreamSenderDone;
+    //uss will be destroyed on exit
+}
+
+void TaskManager::onUpstreamReply(BaseTaskPtr bt, Status status, const std::string& error)
+{
+    bt->getSpan().mark(TraceStage::upstream_reply);
+    if(Status::Ok != status)
     {
-        bt->setError(uss.getError().c_str(), uss.getStatus());
-        LOG_PRINT_RQS_BT(2,bt, "CryptoNode done with error: " << uss.getError().c_str());
+        bt->setError(error.c_str(), status);
+        LOG_PRINT_RQS_BT(2,bt, "CryptoNode done with error: " << error.c_str());
         processResult(bt);
-        ++m_cntUpstreamSenderDone;
         return;
     }
     //here you can send a job to the thread pool or send response to client
-    //uss will be destroyed on exit, save its result
     {//now always create a job and put it to the thread pool after CryptoNode
         LOG_PRINT_RQS_BT(2,bt, "CryptoNode answered : '" << bt->getInput().body << "'");
         if(!bt->getSelf())
         {//it is possible that a client has closed connection already
-            ++m_cntUpstreamSenderDone;
             return;
         }
         Execute(bt);
     }
-    ++m_cntUpstreamSenderDone;
-    //uss will be destroyed on exit
 }
 
 BaseTask::BaseTask(TaskManager& manager, const Router::JobParams& params)
@@ -435,6 +775,11 @@ BaseTask::BaseTask(TaskManager& manager, const Router::JobParams& params)
     , m_params(params)
     , m_ctx(manager.getGcm())
 {
+    if(params.affinity)
+    {
+        const std::string key = (*params.affinity)(params.vars, params.input);
+        if(!key.empty()) m_affinity = std::max<size_t>(1, std::hash<std::string>()(key));
+    }
 }
 
 const char* BaseTask::getStrStatus(Status s)
@@ -477,6 +822,7 @@ ClientTask::ClientTask(ConnectionManager* connectionManager, mg_connection *clie
     , m_connectionManager(connectionManager)
     , m_client(client)
 {
+    m_span.mark(TraceStage::accept);
 }
 
 void ClientTask::finalize()
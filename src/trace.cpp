@@ -0,0 +1,218 @@
+#include "trace.h"
+#include "metrics.h"
+
+#include <sstream>
+
+namespace graft
+{
+
+constexpr size_t TraceSpan::MAX_MARKS;
+constexpr size_t TraceRegistry::MAX_SAMPLES;
+constexpr size_t TraceRegistry::BUCKET_COUNT;
+
+const char* traceStageName(TraceStage stage)
+{
+    static const char* names[] = { GRAFT_TRACE_STAGE_LIST(EXP_TO_STR) "total" };
+    return names[static_cast<int>(stage)];
+}
+
+TraceRegistry& TraceRegistry::instance()
+{
+    static TraceRegistry registry;
+    return registry;
+}
+
+namespace
+{
+
+//the last stage of the histograms is the total time of the request
+constexpr size_t STAGE_COUNT = static_cast<size_t>(TraceStage::Count) + 1;
+//the cells of a stage in the row of a thread: the buckets, the sum and the max
+constexpr size_t SUM_CELL = TraceRegistry::BUCKET_COUNT;
+constexpr size_t MAX_CELL = TraceRegistry::BUCKET_COUNT + 1;
+constexpr size_t STAGE_CELLS = TraceRegistry::BUCKET_COUNT + 2;
+
+}
+
+struct TraceRegistry::RouteStats
+{
+    explicit RouteStats(const std::string& name)
+        : name(name)
+    {
+        //rounded up to whole cache lines
+        const size_t cellsPerLine = metrics_detail::CACHE_LINE / sizeof(std::atomic<uint64_t>);
+        rowSize = (STAGE_COUNT * STAGE_CELLS + cellsPerLine - 1) / cellsPerLine * cellsPerLine;
+        cells.reset(new std::atomic<uint64_t>[rowSize * metrics_detail::SHARD_COUNT]);
+        clear();
+    }
+
+    void add(size_t stage, uint64_t us)
+    {
+        std::atomic<uint64_t>* c = &cells[metrics_detail::shardIndex() * rowSize + stage * STAGE_CELLS];
+        size_t idx = 0;
+        for(uint64_t v = us; v && idx < BUCKET_COUNT - 1; v >>= 1, ++idx);
+        c[idx].fetch_add(1, std::memory_order_relaxed);
+        c[SUM_CELL].fetch_add(us, std::memory_order_relaxed);
+        //the shard is shared only when there are more threads than shards
+        uint64_t max = c[MAX_CELL].load(std::memory_order_relaxed);
+        while(max < us && !c[MAX_CELL].compare_exchange_weak(max, us, std::memory_order_relaxed));
+    }
+
+    Histogram merge(size_t stage) const
+    {
+        Histogram res;
+        for(size_t shard = 0; shard < metrics_detail::SHARD_COUNT; ++shard)
+        {
+            const std::atomic<uint64_t>* c = &cells[shard * rowSize + stage * STAGE_CELLS];
+            for(size_t i = 0; i < BUCKET_COUNT; ++i)
+            {
+                uint64_t v = c[i].load(std::memory_order_relaxed);
+                res.buckets[i] += v;
+                res.count += v;
+            }
+            res.sum_us += c[SUM_CELL].load(std::memory_order_relaxed);
+            res.max_us = std::max(res.max_us, c[MAX_CELL].load(std::memory_order_relaxed));
+        }
+        return res;
+    }
+
+    void clear()
+    {
+        for(size_t i = 0; i < rowSize * metrics_detail::SHARD_COUNT; ++i)
+        {
+            cells[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    const std::string name;
+    size_t rowSize;
+    std::unique_ptr<std::atomic<uint64_t>[]> cells;
+};
+
+uint64_t TraceRegistry::Histogram::percentile(double p) const
+{
+    //the upper bound of the bucket where the percentile falls
+    uint64_t rank = static_cast<uint64_t>(p * count);
+    uint64_t acc = 0;
+    for(size_t i = 0; i < BUCKET_COUNT; ++i)
+    {
+        acc += buckets[i];
+        if(rank < acc) return std::min<uint64_t>(max_us, (uint64_t(1) << i));
+    }
+    return max_us;
+}
+
+TraceRegistry::RouteStats& TraceRegistry::route(const std::string& route)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    std::unique_ptr<RouteStats>& stats = m_routes[route];
+    if(!stats) stats.reset(new RouteStats(route));
+    return *stats;
+}
+
+void TraceRegistry::record(RouteStats& route, const TraceSpan& span)
+{
+    if(span.size() == 0) return;
+    for(size_t i = 1; i < span.size(); ++i)
+    {
+        route.add(static_cast<size_t>(span[i].stage), span[i].offset_us - span[i-1].offset_us);
+    }
+    route.add(STAGE_COUNT - 1, span[span.size()-1].offset_us);
+
+    unsigned int rate = m_sampleRate.load(std::memory_order_relaxed);
+    if(!rate || m_recorded.fetch_add(1, std::memory_order_relaxed) % rate != 0) return;
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if(MAX_SAMPLES <= m_samples.size()) m_samples.pop_front();
+    m_samples.push_back(Sample{route.name, span});
+}
+
+std::string TraceRegistry::histogramsJson() const
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    std::ostringstream ss;
+    ss << "{\"routes\":[";
+    bool first_route = true;
+    for(auto& pair : m_routes)
+    {
+        std::array<Histogram, STAGE_COUNT> stages;
+        for(size_t s = 0; s < STAGE_COUNT; ++s)
+        {
+            stages[s] = pair.second->merge(s);
+        }
+        //the routes registered by the router are listed once they are requested
+        if(stages[STAGE_COUNT - 1].count == 0) continue;
+        if(!first_route) ss << ',';
+        first_route = false;
+        ss << "{\"route\":\"" << pair.first << "\",\"stages\":[";
+        bool first_stage = true;
+        for(size_t s = 0; s < STAGE_COUNT; ++s)
+        {
+            const Histogram& h = stages[s];
+            if(h.count == 0) continue;
+            if(!first_stage) ss << ',';
+            first_stage = false;
+            ss << "{\"stage\":\"" << traceStageName(static_cast<TraceStage>(s)) << "\""
+               << ",\"count\":" << h.count
+               << ",\"mean_us\":" << h.sum_us / h.count
+               << ",\"p50_us\":" << h.percentile(0.5)
+               << ",\"p99_us\":" << h.percentile(0.99)
+               << ",\"max_us\":" << h.max_us
+               << ",\"buckets\":[";
+            size_t last = BUCKET_COUNT;
+            for(; 0 < last && h.buckets[last-1] == 0; --last);
+            for(size_t i = 0; i < last; ++i)
+            {
+                if(i) ss << ',';
+                ss << h.buckets[i];
+            }
+            ss << "]}";
+        }
+        ss << "]}";
+    }
+    ss << "]}";
+    return ss.str();
+}
+
+std::string TraceRegistry::chromeTraceJson() const
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    std::ostringstream ss;
+    ss << "{\"traceEvents\":[";
+    if(!m_samples.empty())
+    {
+        //timestamps are relative to the oldest sample, each request is shown in its own row
+        TraceSpan::clock::time_point base = m_samples.front().span.start();
+        bool first = true;
+        int tid = 0;
+        for(const Sample& sample : m_samples)
+        {
+            ++tid;
+            const TraceSpan& span = sample.span;
+            auto start_us = std::chrono::duration_cast<std::chrono::microseconds>(span.start() - base).count();
+            for(size_t i = 1; i < span.size(); ++i)
+            {
+                if(!first) ss << ',';
+                first = false;
+                ss << "{\"name\":\"" << traceStageName(span[i].stage) << "\",\"cat\":\"" << sample.route << "\""
+                   << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+                   << ",\"ts\":" << start_us + span[i-1].offset_us
+                   << ",\"dur\":" << span[i].offset_us - span[i-1].offset_us << "}";
+            }
+        }
+    }
+    ss << "]}";
+    return ss.str();
+}
+
+void TraceRegistry::clear()
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    //the routes are kept, the router refers to them
+    for(auto& pair : m_routes)
+    {
+        pair.second->clear();
+    }
+    m_samples.clear();
+}
+
+}//namespace graft
@@ -0,0 +1,138 @@
+#include "upstream_balancer.h"
+#include "upstream_cache.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace graft
+{
+
+constexpr double UpstreamBalancer::EWMA_ALPHA;
+constexpr std::chrono::seconds UpstreamBalancer::PROBE_INTERVAL;
+constexpr size_t UpstreamBalancer::LATENCY_WINDOW;
+constexpr size_t UpstreamBalancer::MIN_HEDGE_SAMPLES;
+constexpr std::chrono::milliseconds UpstreamBalancer::MIN_HEDGE_DELAY;
+
+UpstreamBalancer::UpstreamBalancer(const std::vector<std::string>& addresses, int breakerFailures,
+                                   std::chrono::milliseconds breakerCooldown, const std::set<std::string>& hedgePaths)
+    : m_breakerFailures(std::max(1, breakerFailures))
+    , m_breakerCooldown(breakerCooldown)
+    , m_hedgePaths(hedgePaths)
+{
+    m_backends.reserve(addresses.size());
+    for(auto& address : addresses)
+    {
+        Backend b;
+        b.address = address;
+        m_backends.push_back(std::move(b));
+    }
+    m_latencies.reserve(LATENCY_WINDOW);
+}
+
+bool UpstreamBalancer::available(const Backend& b, Clock::time_point now) const
+{
+    //the open circuit lets one probe through after the cooldown
+    return !b.open || (b.openUntil <= now && !b.probing);
+}
+
+int UpstreamBalancer::pick(int exclude)
+{
+    Clock::time_point now = Clock::now();
+    int best = -1;
+    double bestScore = 0;
+    for(int i = 0; i < static_cast<int>(m_backends.size()); ++i)
+    {
+        const Backend& b = m_backends[i];
+        if(i == exclude || !available(b, now)) continue;
+        //an unknown latency is the lowest one, so that new and recovered backends get a request
+        bool stale = b.samples == 0 || PROBE_INTERVAL <= now - b.lastSample;
+        double score = stale? 0 : b.ewma * (b.inFlight + 1);
+        if(best < 0 || score < bestScore)
+        {
+            best = i;
+            bestScore = score;
+        }
+    }
+    if(0 <= best || 0 <= exclude) return best;
+
+    //all circuits are open
+    for(int i = 0; i < static_cast<int>(m_backends.size()); ++i)
+    {
+        if(best < 0 || m_backends[i].openUntil < m_backends[best].openUntil) best = i;
+    }
+    return best;
+}
+
+void UpstreamBalancer::onStart(int backend)
+{
+    Backend& b = m_backends[backend];
+    ++b.inFlight;
+    if(b.open && b.openUntil <= Clock::now()) b.probing = true;
+}
+
+void UpstreamBalancer::onResult(int backend, bool ok, Clock::duration latency)
+{
+    Backend& b = m_backends[backend];
+    assert(0 < b.inFlight);
+    --b.inFlight;
+    b.probing = false;
+    if(!ok)
+    {
+        if(++b.failures < m_breakerFailures && !b.open) return;
+        if(!b.open) ++m_opens;
+        b.open = true;
+        b.openUntil = Clock::now() + m_breakerCooldown;
+        return;
+    }
+    b.failures = 0;
+    b.open = false;
+
+    double seconds = std::chrono::duration<double>(latency).count();
+    b.ewma = (b.samples == 0)? seconds : b.ewma + EWMA_ALPHA * (seconds - b.ewma);
+    ++b.samples;
+    b.lastSample = Clock::now();
+
+    if(m_latencies.size() < LATENCY_WINDOW) m_latencies.push_back(latency);
+    else m_latencies[m_latencyPos] = latency;
+    m_latencyPos = (m_latencyPos + 1) % LATENCY_WINDOW;
+    ++m_sinceP95;
+}
+
+void UpstreamBalancer::onCancelled(int backend)
+{
+    Backend& b = m_backends[backend];
+    assert(0 < b.inFlight);
+    --b.inFlight;
+    //the probe did not finish, the next request probes again
+    b.probing = false;
+}
+
+bool UpstreamBalancer::idempotent(const std::string& path, const std::string& body) const
+{
+    if(m_hedgePaths.empty()) return false;
+    if(m_hedgePaths.find(path) != m_hedgePaths.end()) return true;
+    std::string method = jsonRpcMethod(body);
+    return !method.empty() && m_hedgePaths.find(path + ':' + method) != m_hedgePaths.end();
+}
+
+UpstreamBalancer::Clock::duration UpstreamBalancer::hedgeDelay()
+{
+    if(m_backends.size() < 2 || m_latencies.size() < MIN_HEDGE_SAMPLES) return Clock::duration::zero();
+    //the p95 is taken again after a sixteenth of the window is replaced
+    if(m_p95 == Clock::duration::zero() || LATENCY_WINDOW / 16 <= m_sinceP95)
+    {
+        std::vector<Clock::duration> latencies = m_latencies;
+        auto nth = latencies.begin() + (latencies.size() * 95) / 100;
+        std::nth_element(latencies.begin(), nth, latencies.end());
+        m_p95 = *nth;
+        m_sinceP95 = 0;
+    }
+    return std::max<Clock::duration>(m_p95, MIN_HEDGE_DELAY);
+}
+
+size_t UpstreamBalancer::openBackends() const
+{
+    return std::count_if(m_backends.begin(), m_backends.end(), [](const Backend& b){ return b.open; });
+}
+
+}//namespace graft
@@ -0,0 +1,128 @@
+#include "upstream_cache.h"
+
+#include <cassert>
+
+namespace graft
+{
+
+std::string urlPath(const std::string& url)
+{
+    size_t start = url.find("://");
+    start = url.find('/', (start == std::string::npos)? 0 : start + 3);
+    if(start == std::string::npos) return "/";
+    size_t end = url.find_first_of("?#", start);
+    return url.substr(start, (end == std::string::npos)? std::string::npos : end - start);
+}
+
+std::string jsonRpcMethod(const std::string& body)
+{
+    static const char name[] = "\"method\"";
+    size_t pos = body.find(name);
+    if(pos == std::string::npos) return std::string();
+    pos += sizeof(name) - 1;
+    auto skipSpaces = [&body](size_t pos)
+    {
+        while(pos < body.size() && (body[pos] == ' ' || body[pos] == '\t' || body[pos] == '\r' || body[pos] == '\n')) ++pos;
+        return pos;
+    };
+    pos = skipSpaces(pos);
+    if(pos == body.size() || body[pos] != ':') return std::string();
+    pos = skipSpaces(pos + 1);
+    if(pos == body.size() || body[pos] != '"') return std::string();
+    size_t end = body.find('"', ++pos);
+    if(end == std::string::npos) return std::string();
+    return body.substr(pos, end - pos);
+}
+
+UpstreamCache::UpstreamCache(const std::map<std::string, int>& ttls_ms)
+{
+    for(auto& item : ttls_ms)
+    {
+        if(item.second <= 0) continue;
+        m_ttls.emplace(item.first, std::chrono::milliseconds(item.second));
+    }
+}
+
+UpstreamCache::Clock::duration UpstreamCache::ttl(const std::string& path, const std::string& body) const
+{
+    if(!body.empty())
+    {//the method is more specific than the path
+        std::string method = jsonRpcMethod(body);
+        if(!method.empty())
+        {
+            auto it = m_ttls.find(path + ':' + method);
+            if(it != m_ttls.end()) return it->second;
+        }
+    }
+    auto it = m_ttls.find(path);
+    return (it == m_ttls.end())? Clock::duration::zero() : it->second;
+}
+
+UpstreamCache::Lookup UpstreamCache::lookup(const std::string& url, const std::string& body, const TaskPtr& bt,
+                                            const Input*& reply, std::string& key)
+{
+    if(!enabled() || ttl(urlPath(url), body) == Clock::duration::zero()) return Lookup::Bypass;
+
+    key.reserve(url.size() + 1 + body.size());
+    key.assign(url).append(1, '\n').append(body);
+    Clock::time_point now = Clock::now();
+
+    auto it = m_entries.find(key);
+    if(it != m_entries.end())
+    {
+        Entry& entry = it->second;
+        if(entry.pending)
+        {
+            entry.waiters.push_back(bt);
+            ++m_coalesced;
+            return Lookup::Joined;
+        }
+        if(now < entry.expires)
+        {
+            reply = &entry.reply;
+            ++m_hits;
+            return Lookup::Hit;
+        }
+        m_entries.erase(it);
+    }
+
+    if(MAX_ENTRIES <= m_entries.size())
+    {
+        sweep(now);
+        if(MAX_ENTRIES <= m_entries.size()) return Lookup::Bypass;
+    }
+    m_entries.emplace(key, Entry());
+    ++m_misses;
+    return Lookup::Miss;
+}
+
+std::vector<UpstreamCache::TaskPtr> UpstreamCache::complete(const std::string& key, const Input* reply)
+{
+    auto it = m_entries.find(key);
+    assert(it != m_entries.end() && it->second.pending);
+    if(it == m_entries.end()) return std::vector<TaskPtr>();
+    std::vector<TaskPtr> waiters = std::move(it->second.waiters);
+
+    if(!reply || reply->resp_code != 200)
+    {
+        m_entries.erase(it);
+        return waiters;
+    }
+    size_t pos = key.find('\n');
+    Entry& entry = it->second;
+    entry.reply = *reply;
+    entry.expires = Clock::now() + ttl(urlPath(key.substr(0, pos)), key.substr(pos + 1));
+    entry.pending = false;
+    return waiters;
+}
+
+void UpstreamCache::sweep(Clock::time_point now)
+{
+    for(auto it = m_entries.begin(); it != m_entries.end();)
+    {
+        if(!it->second.pending && it->second.expires <= now) it = m_entries.erase(it);
+        else ++it;
+    }
+}
+
+}//namespace graft
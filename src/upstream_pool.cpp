@@ -0,0 +1,152 @@
+#include "upstream_pool.h"
+#include "connection.h"
+#include "mongoosex.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace graft
+{
+
+namespace
+{
+
+//"[scheme://]host[:port][/target]" -> "scheme://host:port", "host:port", "/target";
+//false for a url with the user info, the connection is not pooled then
+bool splitUrl(const std::string& url, std::string& key, std::string& host, std::string& target)
+{
+    size_t start = url.find("://");
+    std::string scheme = (start == std::string::npos)? "http" : url.substr(0, start);
+    start = (start == std::string::npos)? 0 : start + 3;
+    size_t end = url.find_first_of("/?#", start);
+    if(end == std::string::npos) end = url.size();
+    host = url.substr(start, end - start);
+    if(host.empty() || host.find('@') != std::string::npos) return false;
+    target = url.substr(end);
+    if(target.empty() || target[0] != '/') target.insert(0, "/");
+    key = scheme + "://" + host;
+    return true;
+}
+
+} //namespace
+
+UpstreamPool::UpstreamPool(size_t maxPerHost, double idleTimeout)
+    : m_maxPerHost(maxPerHost)
+    , m_idleTimeout(idleTimeout)
+{
+}
+
+mg_connection* UpstreamPool::send(mg_mgr* mgr, const std::string& url, const char* extra_headers,
+                                  const std::string& body, Handler handler, void* user_data, bool fresh, bool& reused)
+{
+    reused = false;
+    std::string key, host, target;
+    Host* h = (0 < m_maxPerHost && splitUrl(url, key, host, target))? &m_hosts[key] : nullptr;
+
+    if(h && !fresh && !h->idle.empty())
+    {
+        //the last one is the warmest
+        mg_connection* nc = h->idle.back();
+        h->idle.pop_back();
+        --m_idle;
+        m_entries[nc].idle = false;
+        mg_set_timer(nc, 0);
+        nc->handler = handler;
+        nc->user_data = user_data;
+        mg::mg_send_http_request_x(nc, host, target, extra_headers, body);
+        ++m_reuses;
+        reused = true;
+        return nc;
+    }
+
+    mg_connection* nc = mg::mg_connect_http_x(mgr, handler, url.c_str(), extra_headers, body);
+    if(!nc) return nullptr;
+    nc->user_data = user_data;
+    ++m_connects;
+    if(h && h->total < m_maxPerHost)
+    {
+        ++h->total;
+        m_entries.emplace(nc, Entry{h, false});
+    }
+    return nc;
+}
+
+void UpstreamPool::release(mg_connection* nc, bool reusable)
+{
+    auto it = m_entries.find(nc);
+    if(it == m_entries.end())
+    {//a one-time connection
+        nc->handler = static_empty_ev_handler;
+        nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+        return;
+    }
+    assert(!it->second.idle);
+    nc->handler = idleHandler;
+    nc->user_data = this;
+    if(!reusable || (nc->flags & (MG_F_CLOSE_IMMEDIATELY | MG_F_SEND_AND_CLOSE)))
+    {//the entry is removed on MG_EV_CLOSE
+        ++m_evictions;
+        nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+        return;
+    }
+    it->second.idle = true;
+    it->second.host->idle.push_back(nc);
+    ++m_idle;
+    mg_set_timer(nc, mg_time() + m_idleTimeout);
+}
+
+void UpstreamPool::closed(mg_connection* nc)
+{
+    nc->handler = static_empty_ev_handler;
+    forget(nc);
+}
+
+void UpstreamPool::forget(mg_connection* nc)
+{
+    auto it = m_entries.find(nc);
+    if(it == m_entries.end()) return;
+    Host& h = *it->second.host;
+    if(it->second.idle)
+    {
+        h.idle.erase(std::find(h.idle.begin(), h.idle.end(), nc));
+        --m_idle;
+    }
+    --h.total;
+    m_entries.erase(it);
+}
+
+void UpstreamPool::evict(mg_connection* nc)
+{
+    ++m_evictions;
+    mg_set_timer(nc, 0);
+    nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+}
+
+void UpstreamPool::idleHandler(mg_connection* nc, int ev, void*)
+{
+    static_cast<UpstreamPool*>(nc->user_data)->onIdleEvent(nc, ev);
+}
+
+void UpstreamPool::onIdleEvent(mg_connection* nc, int ev)
+{
+    switch(ev)
+    {
+    case MG_EV_TIMER:
+    {//idle timeout
+        mg_set_timer(nc, 0);
+        nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+    } break;
+    case MG_EV_RECV:
+    {//nothing is expected from an idle connection, a reply to nothing is a broken stream
+        if(!(nc->flags & MG_F_CLOSE_IMMEDIATELY)) evict(nc);
+    } break;
+    case MG_EV_CLOSE:
+    {
+        forget(nc);
+    } break;
+    default:
+        break;
+    }
+}
+
+}//namespace graft
@@ -10,10 +10,27 @@
 #include "payrequest.h"
 #include "paystatusrequest.h"
 #include "rejectpayrequest.h"
+#include "sendsupernodeannouncerequest.h"
+#include "multicast.h"
+#include "authorizertatxrequest.h"
 #include "requestdefines.h"
+#include "requesttools.h"
 #include "inout.h"
+#include "graft_utility.hpp"
+#include "rta/paymentstore.h"
+#include "rta/serverstate.h"
+#include <thread_pool/thread_pool.hpp>
 #include <deque>
+#include <condition_variable>
+#include <numeric>
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <limits>
 #include <jsonrpc.h>
+#include <locale> // epee::string_coding uses std::locale but misses include
+#include <string_coding.h>
+#include <string_tools.h>
 #include <boost/uuid/uuid_io.hpp>
 
 GRAFT_DEFINE_IO_STRUCT(Payment,
@@ -146,6 +163,71 @@ TEST(InOut, serialization)
     output.loadT<serializer::Nothing>(a);
 }
 
+TEST(InOut, received)
+{
+    using namespace graft;
+
+    auto str = [](const char* buf, const char* s)->mg_str { const char* p = strstr(buf, s); return mg_str{p, strlen(s)}; };
+
+    char buf[] = "POST /dapi/v2.0/sale?x=1 HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json\r\n\r\n{\"x\":1}";
+    http_message hm;
+    memset(&hm, 0, sizeof(hm));
+    hm.message = mg_str{buf, strlen(buf)};
+    hm.method = str(buf, "POST");
+    hm.uri = str(buf, "/dapi/v2.0/sale");
+    hm.query_string = str(buf, "x=1");
+    hm.proto = str(buf, "HTTP/1.1");
+    hm.header_names[0] = str(buf, "Host");
+    hm.header_values[0] = str(buf, "localhost");
+    hm.header_names[1] = str(buf, "Content-Type");
+    hm.header_values[1] = str(buf, "application/json");
+    hm.body = str(buf, "{\"x\":1}");
+
+    Input input;
+    input = hm;
+    //the receive buffer is reused after the event
+    memset(buf, '#', sizeof(buf) - 1);
+
+    EXPECT_EQ(input.body, "{\"x\":1}");
+    EXPECT_EQ(input.data(), "{\"x\":1}");
+    EXPECT_EQ(input.method_view(), "POST");
+    EXPECT_EQ(input.uri_view(), "/dapi/v2.0/sale");
+    EXPECT_EQ(input.query_string_view(), "x=1");
+    EXPECT_EQ(input.proto_view(), "HTTP/1.1");
+    EXPECT_EQ(input.header("content-type"), "application/json");
+    EXPECT_TRUE(input.header("Accept").empty());
+    auto headers = input.header_views();
+    ASSERT_EQ(headers.size(), 2);
+    EXPECT_EQ(headers[0].first, "Host");
+    EXPECT_EQ(headers[0].second, "localhost");
+    EXPECT_TRUE(input.method.empty());
+    EXPECT_TRUE(input.headers.empty());
+
+    //the copies share the body
+    Output output;
+    output.body = input.body;
+    Input copy = input;
+    EXPECT_EQ(output.body.data(), input.body.data());
+    EXPECT_EQ(copy.body.data(), input.body.data());
+    EXPECT_EQ(copy.uri_view().data(), input.uri_view().data());
+
+    //a modification does not affect the others
+    output.body.clear();
+    EXPECT_EQ(input.body, "{\"x\":1}");
+    output.body = "abc";
+    EXPECT_TRUE(output.body.data() != input.body.data());
+    EXPECT_EQ(input.body, "{\"x\":1}");
+
+    //a constructed Input refers to its fields
+    input.reset();
+    EXPECT_TRUE(input.body.empty());
+    input.method = "GET";
+    input.headers.emplace_back("Accept", "*/*");
+    EXPECT_EQ(input.method_view(), "GET");
+    EXPECT_EQ(input.header("accept"), "*/*");
+    EXPECT_EQ(copy.body, "{\"x\":1}");
+}
+
 TEST(InOut, makeUri)
 {
     {
@@ -364,49 +446,1580 @@ TEST(Context, multithreaded)
     };
     auto f_b = [&] ()
     {
-        graft::Context ctx(m);
-        int cnt = 0;
-        for(int i=0; i<pass_cnt; ++i)
+        graft::Context ctx(m);
+        int cnt = 0;
+        for(int i=0; i<pass_cnt; ++i)
+        {
+            std::for_each(v_keys.rbegin(), v_keys.rend(), [&] (auto& key)
+            {
+                while( stop < th_count - 1 && cnt == g_count);
+                ctx.global.apply(key, f);
+                cnt = ++g_count;
+            });
+        }
+        ++stop;
+    };
+
+    std::thread ths[th_count];
+    for(int i=0; i < th_count; ++i)
+    {
+        ths[i] = (i%2)? std::thread(f_f) : std::thread(f_b);
+    }
+
+    int main_count = 0;
+    while( stop < th_count )
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        ++g_count;
+        ++main_count;
+    }
+
+    for(int i=0; i < th_count; ++i)
+    {
+        ths[i].join();
+    }
+
+    uint64_t sum = 0;
+    {
+        graft::Context ctx(m);
+        std::for_each(v_keys.begin(), v_keys.end(), [&] (auto& key)
+        {
+            uint64_t v = ctx.global[key];
+            sum += v;
+        });
+    }
+    EXPECT_EQ(sum, g_count-main_count);
+}
+
+TEST(Context, shared)
+{
+    graft::GlobalContextMap m;
+    graft::Context ctx(m);
+
+    ctx.global["n"] = uint64_t(5);
+    ctx.global["s"] = std::string("value");
+    EXPECT_EQ(ctx.global.get("n", uint64_t(0)), 5);
+    EXPECT_EQ(ctx.global.get("absent", std::string("default")), "default");
+    EXPECT_THROW(ctx.global.get("n", 0), std::bad_cast);
+
+    //readers share the value, an update replaces it
+    std::shared_ptr<const std::string> s1 = ctx.global.getShared<std::string>("s");
+    std::shared_ptr<const std::string> s2 = ctx.global.getShared<std::string>("s");
+    ASSERT_TRUE(s1);
+    EXPECT_EQ(s1.get(), s2.get());
+    std::function<bool(std::string&)> f = [](std::string& v)->bool { v += "1"; return true; };
+    EXPECT_TRUE(ctx.global.apply("s", f));
+    EXPECT_EQ(*s1, "value");
+    EXPECT_EQ(*ctx.global.getShared<std::string>("s"), "value1");
+    EXPECT_FALSE(ctx.global.getShared<std::string>("absent"));
+
+    auto v = std::make_shared<const std::vector<int>>(std::vector<int>{1, 2, 3});
+    ctx.global.setShared("v", v);
+    EXPECT_EQ(ctx.global.getShared<std::vector<int>>("v").get(), v.get());
+    std::vector<int> vc = ctx.global["v"];
+    EXPECT_EQ(vc, *v);
+}
+
+TEST(Context, serverState)
+{
+    graft::GlobalContextMap m;
+    graft::Context ctx(m);
+    EXPECT_FALSE(ctx.state());
+
+    auto state = std::make_shared<graft::ServerState>();
+    state->testnet = true;
+    state->cryptonode_rpc_address = "localhost:28881";
+    m.serverState.store(state);
+    graft::ServerStatePtr s1 = ctx.stateSnapshot();
+    ASSERT_TRUE(s1);
+    EXPECT_EQ(s1.get(), state.get());
+    EXPECT_TRUE(s1->testnet);
+
+    //reload, the taken snapshot does not change
+    auto reloaded = std::make_shared<graft::ServerState>(*state);
+    reloaded->cryptonode_rpc_address = "localhost:38881";
+    m.serverState.store(reloaded);
+    EXPECT_EQ(s1->cryptonode_rpc_address, "localhost:28881");
+    EXPECT_EQ(ctx.state()->cryptonode_rpc_address, "localhost:38881");
+
+    //the view pins the snapshot that only the cell holds, it is reclaimed after the view is released
+    std::weak_ptr<const graft::ServerState> weak = ctx.stateSnapshot();
+    {
+        graft::Context::State view = ctx.state();
+        EXPECT_EQ(view.get(), weak.lock().get());
+        reloaded.reset();
+        for(int i = 0; i < 4; ++i) m.serverState.store(std::make_shared<graft::ServerState>(*state));
+        EXPECT_FALSE(weak.expired());
+        EXPECT_EQ(view->cryptonode_rpc_address, "localhost:38881");
+        graft::Context::State copy = view;
+        EXPECT_EQ(copy.get(), view.get());
+    }
+    for(int i = 0; i < 4; ++i) m.serverState.store(std::make_shared<graft::ServerState>(*state));
+    EXPECT_TRUE(weak.expired());
+
+    //readers during swaps see one of the published snapshots
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> reads{0}, invalid{0};
+    std::vector<std::thread> readers;
+    for(int i = 0; i < 2; ++i)
+    {
+        readers.emplace_back([&]
+        {
+            graft::Context rctx(m);
+            while(!stop.load())
+            {
+                graft::Context::State s = rctx.state();
+                if(!s || s->cryptonode_rpc_address.compare(0, 10, "localhost:") != 0) ++invalid;
+                ++reads;
+            }
+        });
+    }
+    for(int i = 0; i < 1000; ++i)
+    {
+        auto next = std::make_shared<graft::ServerState>(*state);
+        next->cryptonode_rpc_address = "localhost:" + std::to_string(i);
+        m.serverState.store(std::move(next));
+        if(i % 100 == 0) std::this_thread::yield();
+    }
+    stop = true;
+    for(auto& th : readers) th.join();
+    EXPECT_EQ(invalid, 0);
+    EXPECT_EQ(ctx.state()->cryptonode_rpc_address, "localhost:999");
+}
+
+namespace
+{
+thread_local uint64_t t_allocations = 0;
+}
+
+//counts the allocations of the current thread for Context.allocations
+void* operator new(std::size_t size)
+{
+    ++t_allocations;
+    void* p = std::malloc(size ? size : 1);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+//the global context operations of the pay and authorize handlers for one payment,
+//with boost::any values as before and with ContextSlot
+TEST(Context, allocations)
+{
+    struct Tx
+    {
+        std::vector<std::string> inputs;
+        std::vector<std::string> outputs;
+        std::vector<uint8_t> extra;
+    };
+    Tx tx;
+    for(int i = 0; i < 16; ++i)
+    {
+        tx.inputs.emplace_back(64, 'i');
+        tx.outputs.emplace_back(64, 'o');
+    }
+    tx.extra.resize(1024);
+
+    using ServicePtr = std::shared_ptr<int>; //stands for SupernodePtr, FullSupernodeListPtr and PaymentStorePtr
+    const ServicePtr service = std::make_shared<int>(0);
+    const std::string services[] = { "supernode", "fsl", "payments" };
+    const std::string paymentIdKey = "tx_id:tx_id_to_payment_id", txKey = "tx_id:tx_id_to_tx";
+    const std::string paymentId(36, 'p');
+    const std::chrono::seconds ttl(60);
+    const int votes = 4;
+
+    uint64_t anyAllocations = 0;
+    {
+        graft::ConcurrentMap<std::string, boost::any> m;
+        for(auto& key : services) m.addOrUpdate(key, boost::any(service));
+        auto get = [&m](const std::string& key, auto defval)
+        {
+            return boost::any_cast<decltype(defval)>(m.valueFor(key, boost::any(defval)));
+        };
+        const uint64_t start = t_allocations;
+        //pay
+        for(auto& key : services) get(key, ServicePtr());
+        m.addOrUpdate(paymentIdKey, boost::any(paymentId), ttl);
+        //authorize request
+        get(services[0], ServicePtr());
+        m.hasKey(txKey);
+        m.addOrUpdate(txKey, boost::any(tx), ttl);
+        m.addOrUpdate(paymentIdKey, boost::any(paymentId), ttl);
+        //authorize responses
+        for(int i = 0; i < votes; ++i)
+        {
+            get(services[0], ServicePtr());
+            m.hasKey(paymentIdKey);
+            get(paymentIdKey, std::string());
+            get(services[2], ServicePtr());
+            m.hasKey(txKey);
+        }
+        Tx signedTx = get(txKey, Tx());
+        anyAllocations = t_allocations - start;
+    }
+
+    uint64_t slotAllocations = 0;
+    {
+        graft::GlobalContextMap m;
+        graft::Context ctx(m);
+        for(auto& key : services) ctx.global[key] = service;
+        const uint64_t start = t_allocations;
+        //pay
+        for(auto& key : services) ctx.global.get(key, ServicePtr());
+        ctx.global.set(paymentIdKey, paymentId, ttl);
+        //authorize request
+        ctx.global.get(services[0], ServicePtr());
+        ctx.global.hasKey(txKey);
+        ctx.global.set(txKey, tx, ttl);
+        ctx.global.set(paymentIdKey, paymentId, ttl);
+        //authorize responses
+        for(int i = 0; i < votes; ++i)
+        {
+            ctx.global.get(services[0], ServicePtr());
+            ctx.global.hasKey(paymentIdKey);
+            ctx.global.get(paymentIdKey, std::string());
+            ctx.global.get(services[2], ServicePtr());
+            ctx.global.hasKey(txKey);
+        }
+        std::shared_ptr<const Tx> stored = ctx.global.getShared<Tx>(txKey);
+        ASSERT_TRUE(stored);
+        Tx signedTx = *stored;
+        slotAllocations = t_allocations - start;
+    }
+    std::cout << "pay/authorize global context allocations: boost::any " << anyAllocations
+              << ", ContextSlot " << slotAllocations << std::endl;
+    EXPECT_LT(slotAllocations, anyAllocations);
+}
+
+TEST(Context, local)
+{
+    graft::GlobalContextMap m;
+    graft::Context ctx(m);
+
+    //literal and std::string keys find the same entry
+    ctx.local["payment_id"] = std::string("id");
+    const std::string key = "payment_id";
+    EXPECT_TRUE(ctx.local.hasKey(key));
+    std::string id = ctx.local[key];
+    EXPECT_EQ(id, "id");
+    EXPECT_THROW(int i = ctx.local["payment_id"], boost::bad_any_cast);
+    EXPECT_THROW(int i = ctx.local["absent"], boost::bad_any_cast);
+
+    //references stay valid while other keys are added, in place and allocated
+    std::string& ref = ctx.local["payment_id"];
+    std::vector<std::string> keys;
+    for(int i = 0; i < 20; ++i) keys.push_back("key" + std::to_string(i));
+    for(auto& k : keys) ctx.local[k] = std::vector<int>(100, 1);
+    EXPECT_EQ(&ref, &static_cast<std::string&>(ctx.local[key]));
+    ref += "1";
+    std::string id1 = ctx.local["payment_id"];
+    EXPECT_EQ(id1, "id1");
+
+    //a const reference reads the value stored as non-const, and the other way round
+    const std::string& cref = ctx.local["payment_id"];
+    EXPECT_EQ(&cref, &ref);
+    const std::string cs = "const";
+    ctx.local["const"] = cs;
+    std::string& fromConst = ctx.local["const"];
+    EXPECT_EQ(fromConst, "const");
+
+    //removed entries are reused, values are replaced with another type
+    for(size_t i = 0; i < keys.size(); i += 2) ctx.local.remove(keys[i]);
+    for(size_t i = 0; i < keys.size(); ++i) EXPECT_EQ(ctx.local.hasKey(keys[i]), i % 2 == 1);
+    ctx.local[keys[0]] = 5;
+    ctx.local[keys[1]] = 6;
+    int v0 = ctx.local[keys[0]], v1 = ctx.local[keys[1]];
+    EXPECT_EQ(v0 + v1, 11);
+
+    //a character buffer is copied, only a key tagged as literal is referenced
+    char buffer[32] = "buffer_key";
+    ctx.local[buffer] = 1;
+    std::strcpy(buffer, "other");
+    EXPECT_TRUE(ctx.local.hasKey("buffer_key"));
+    EXPECT_FALSE(ctx.local.hasKey(buffer));
+    ctx.local[GRAFT_FUNCTION_KEY] = 2;
+    int f = ctx.local[std::string(__FUNCTION__)];
+    EXPECT_EQ(f, 2);
+    EXPECT_TRUE(ctx.local.hasKey(graft::LocalKey(graft::LocalKey::literal, __FUNCTION__)));
+}
+
+namespace
+{
+
+enum class HandlerState : int { ClientRequest = 0, MulticastReply, StatusReply };
+
+//the local context operations of saleClientHandler for one sale, as they were
+void saleClientHandlerBefore(std::map<std::string, boost::any>& local, const graft::SaleData& data, const std::string& payment_id)
+{
+    for(int call = 0; call < 3; ++call)
+    {
+        auto it = local.find(__FUNCTION__);
+        HandlerState state = (it != local.end())? boost::any_cast<HandlerState>(it->second) : HandlerState::ClientRequest;
+        switch(state)
+        {
+        case HandlerState::ClientRequest:
+            local[__FUNCTION__] = HandlerState::MulticastReply;
+            local["sale_data"] = data;
+            local["payment_id"] = payment_id;
+            break;
+        case HandlerState::MulticastReply:
+        {
+            local[__FUNCTION__] = HandlerState::StatusReply;
+            graft::SaleData d = boost::any_cast<graft::SaleData&>(local["sale_data"]);
+            std::string id = boost::any_cast<std::string&>(local["payment_id"]);
+            EXPECT_EQ(d.Amount, data.Amount);
+        }
+            break;
+        case HandlerState::StatusReply:
+        {
+            std::string id = boost::any_cast<std::string&>(local["payment_id"]);
+            EXPECT_EQ(id, payment_id);
+        }
+            break;
+        }
+    }
+}
+
+//the same with Context::Local
+void saleClientHandlerAfter(graft::Context& ctx, const graft::SaleData& data, const std::string& payment_id)
+{
+    for(int call = 0; call < 3; ++call)
+    {
+        HandlerState state = ctx.local.hasKey(GRAFT_FUNCTION_KEY)? ctx.local[GRAFT_FUNCTION_KEY] : HandlerState::ClientRequest;
+        switch(state)
+        {
+        case HandlerState::ClientRequest:
+            ctx.local[GRAFT_FUNCTION_KEY] = HandlerState::MulticastReply;
+            ctx.local["sale_data"] = data;
+            ctx.local["payment_id"] = payment_id;
+            break;
+        case HandlerState::MulticastReply:
+        {
+            ctx.local[GRAFT_FUNCTION_KEY] = HandlerState::StatusReply;
+            graft::SaleData d = ctx.local["sale_data"];
+            std::string id = ctx.local["payment_id"];
+            EXPECT_EQ(d.Amount, data.Amount);
+        }
+            break;
+        case HandlerState::StatusReply:
+        {
+            std::string id = ctx.local["payment_id"];
+            EXPECT_EQ(id, payment_id);
+        }
+            break;
+        }
+    }
+}
+
+}
+
+TEST(Context, DISABLED_localBenchmark)
+{
+    const graft::SaleData data(std::string(95, 'F'), 100, 1000);
+    const std::string payment_id(36, 'p');
+    graft::GlobalContextMap m;
+    const int requests = 100000;
+
+    uint64_t beforeAllocations = t_allocations;
+    auto begin = std::chrono::steady_clock::now();
+    for(int i = 0; i < requests; ++i)
+    {
+        std::map<std::string, boost::any> local;
+        saleClientHandlerBefore(local, data, payment_id);
+    }
+    auto before = std::chrono::steady_clock::now() - begin;
+    beforeAllocations = t_allocations - beforeAllocations;
+
+    //a context per request as a task has
+    uint64_t afterAllocations = t_allocations;
+    begin = std::chrono::steady_clock::now();
+    for(int i = 0; i < requests; ++i)
+    {
+        graft::Context ctx(m);
+        saleClientHandlerAfter(ctx, data, payment_id);
+    }
+    auto after = std::chrono::steady_clock::now() - begin;
+    afterAllocations = t_allocations - afterAllocations;
+
+    using us = std::chrono::microseconds;
+    std::cout << "sale handler local context per request: std::map " << std::chrono::duration_cast<us>(before).count() * 1000 / requests
+              << " ns, " << beforeAllocations / requests << " allocations; LocalContextMap "
+              << std::chrono::duration_cast<us>(after).count() * 1000 / requests
+              << " ns, " << afterAllocations / requests << " allocations" << std::endl;
+    EXPECT_LT(afterAllocations, beforeAllocations);
+}
+
+namespace
+{
+
+using SaxCounts = std::map<std::string, int>;
+
+GRAFT_DEFINE_IO_STRUCT_INITED(SaxNested,
+    (std::vector<graft::SignedKeyImageStr>, images, std::vector<graft::SignedKeyImageStr>()),
+    (SaxCounts, counts, SaxCounts()),
+    (graft::JsonRpcError, error, graft::JsonRpcError()),
+    (double, ratio, 0.5),
+    (bool, flag, false),
+    (int, untouched, 7)
+);
+
+graft::SendSupernodeAnnounceJsonRpcRequest makeAnnounce(int images)
+{
+    graft::SendSupernodeAnnounceJsonRpcRequest req;
+    req.method = "send_supernode_announce";
+    req.id = 1;
+    req.params.timestamp = 1536000000;
+    req.params.address = std::string(95, 'F');
+    req.params.stake_amount = 50000000000000;
+    req.params.height = 150000;
+    req.params.secret_viewkey = std::string(64, 'a');
+    req.params.network_address = "http://1.2.3.4:28690/dapi/v2.0";
+    for(int i = 0; i < images; ++i)
+    {
+        graft::SignedKeyImageStr ki;
+        ki.key_image = std::string(63, 'k') + char('0' + i % 10);
+        ki.signature = std::string(127, 's') + char('0' + i % 10);
+        req.params.signed_key_images.push_back(ki);
+    }
+    return req;
+}
+
+}
+
+TEST(InOut, sax)
+{
+    using namespace graft;
+
+    std::string json = "{\"unknown\":{\"a\":[1,{\"b\":[]}],\"c\":\"x\"},"
+                       "\"images\":[{\"key_image\":\"k\\\"1\",\"signature\":\"s1\",\"extra\":[1,2]},{\"key_image\":\"k2\"}],"
+                       "\"counts\":{\"x\":1,\"y\":2},\"error\":{\"code\":-32600,\"message\":\"msg\"},"
+                       "\"ratio\":2,\"flag\":\"true\"}";
+    SaxNested sax;
+    serializer::JSON<SaxNested>::deserialize(json, sax);
+    SaxNested dom = SaxNested::fromJson(json);
+    for(const SaxNested* r : {&sax, &dom})
+    {
+        ASSERT_EQ(r->images.size(), 2);
+        EXPECT_EQ(r->images[0].key_image, "k\"1");
+        EXPECT_EQ(r->images[0].signature, "s1");
+        EXPECT_EQ(r->images[1].key_image, "k2");
+        EXPECT_EQ(r->counts.at("y"), 2);
+        EXPECT_EQ(r->error.code, -32600);
+        EXPECT_EQ(r->error.message, "msg");
+        EXPECT_EQ(r->ratio, 2.0);
+        EXPECT_EQ(r->flag, false); //type mismatch is ignored
+        EXPECT_EQ(r->untouched, 7);
+    }
+
+    //a parse error is reported as before
+    Input input;
+    input.body = "{\"images\":[";
+    EXPECT_THROW(input.get<SaxNested>(), serializer::JsonParseError);
+    EXPECT_FALSE(input.get(sax));
+    input.body = "[1]";
+    EXPECT_TRUE(input.get(sax));
+    EXPECT_EQ(sax.untouched, 7);
+
+    //JSON_B64 inner document
+    UpdateSaleStatusBroadcast ussb;
+    ussb.PaymentID = "payment";
+    ussb.Status = 3;
+    Output output;
+    output.loadT<serializer::JSON_B64>(ussb);
+    input.body = output.body;
+    UpdateSaleStatusBroadcast ussb1 = input.getT<serializer::JSON_B64, UpdateSaleStatusBroadcast>();
+    EXPECT_EQ(ussb1.PaymentID, ussb.PaymentID);
+    EXPECT_EQ(ussb1.Status, ussb.Status);
+}
+
+TEST(InOut, DISABLED_saxBenchmark)
+{
+    using namespace graft;
+    using us = std::chrono::microseconds;
+
+    auto measure = [](int count, std::function<void()> f, uint64_t& allocations)->int64_t
+    {
+        allocations = t_allocations;
+        auto begin = std::chrono::steady_clock::now();
+        for(int i = 0; i < count; ++i) f();
+        auto duration = std::chrono::steady_clock::now() - begin;
+        allocations = (t_allocations - allocations) / count;
+        return std::chrono::duration_cast<us>(duration).count() / count;
+    };
+
+    {//the announce with a large array of key images
+        const std::string json = makeAnnounce(1000).toJson().GetString();
+        const int count = 200;
+        SendSupernodeAnnounceJsonRpcRequest dom, sax;
+        uint64_t domAllocations, saxAllocations;
+        int64_t domTime = measure(count, [&]{ dom = SendSupernodeAnnounceJsonRpcRequest::fromJson(json); }, domAllocations);
+        int64_t saxTime = measure(count, [&]{ serializer::JSON<SendSupernodeAnnounceJsonRpcRequest>::deserialize(json, sax); }, saxAllocations);
+        EXPECT_EQ(std::string(sax.toJson().GetString()), dom.toJson().GetString());
+        std::cout << "SupernodeAnnounce " << json.size() << " bytes: DOM " << domTime << " us, " << domAllocations
+                  << " allocations; SAX " << saxTime << " us, " << saxAllocations << " allocations" << std::endl;
+    }
+
+    {//the multicast with JSON_B64 inner document, as the multicast handlers parse it
+        UpdateSaleStatusBroadcast ussb;
+        ussb.PaymentID = std::string(36, 'p');
+        ussb.Status = 2;
+        ussb.address = std::string(95, 'F');
+        ussb.signature = std::string(128, 's');
+        MulticastRequestJsonRpc req;
+        req.method = "multicast";
+        req.params.sender_address = std::string(95, 'F');
+        req.params.receiver_addresses.assign(8, std::string(95, 'R'));
+        req.params.callback_uri = "/cryptonode/update_sale_status";
+        req.params.data = serializer::JSON_B64<UpdateSaleStatusBroadcast>::serialize(ussb);
+        const std::string json = req.toJson().GetString();
+        const int count = 10000;
+        MulticastRequestJsonRpc domReq, saxReq;
+        UpdateSaleStatusBroadcast domInner, saxInner;
+        uint64_t domAllocations, saxAllocations;
+        int64_t domTime = measure(count, [&]
+        {
+            domReq = MulticastRequestJsonRpc::fromJson(json);
+            domInner = UpdateSaleStatusBroadcast::fromJson(utils::base64_decode(domReq.params.data));
+        }, domAllocations);
+        int64_t saxTime = measure(count, [&]
+        {
+            serializer::JSON<MulticastRequestJsonRpc>::deserialize(json, saxReq);
+            serializer::JSON_B64<UpdateSaleStatusBroadcast>::deserialize(saxReq.params.data, saxInner);
+        }, saxAllocations);
+        EXPECT_EQ(std::string(saxReq.toJson().GetString()), domReq.toJson().GetString());
+        EXPECT_EQ(std::string(saxInner.toJson().GetString()), domInner.toJson().GetString());
+        std::cout << "MulticastRequestJsonRpc " << json.size() << " bytes: DOM " << domTime << " us, " << domAllocations
+                  << " allocations; SAX " << saxTime << " us, " << saxAllocations << " allocations" << std::endl;
+        EXPECT_LT(saxAllocations, domAllocations);
+    }
+}
+
+TEST(InOut, DISABLED_serializeBenchmark)
+{
+    using namespace graft;
+    using us = std::chrono::microseconds;
+
+    //the body was written to StringBuffer through DOM and copied to the body with GetString(), now it is written in place
+    auto compare = [](const char* name, int count, auto& t)
+    {
+        uint64_t domAllocations = t_allocations;
+        auto begin = std::chrono::steady_clock::now();
+        for(int i = 0; i < count; ++i)
+        {
+            Output output;
+            output.body = t.toJson().GetString();
+        }
+        auto domTime = std::chrono::steady_clock::now() - begin;
+        domAllocations = (t_allocations - domAllocations) / count;
+
+        uint64_t allocations = t_allocations;
+        begin = std::chrono::steady_clock::now();
+        size_t size = 0;
+        for(int i = 0; i < count; ++i)
+        {
+            Output output;
+            output.load(t);
+            size = output.body.size();
+        }
+        auto time = std::chrono::steady_clock::now() - begin;
+        allocations = (t_allocations - allocations) / count;
+
+        Output output;
+        output.load(t);
+        EXPECT_EQ(output.body, std::string(t.toJson().GetString()));
+        std::cout << name << " " << size << " bytes: DOM + GetString " << std::chrono::duration_cast<us>(domTime).count() * 1000 / count
+                  << " ns, " << domAllocations << " allocations, " << 2 * size << " bytes written and copied; in place "
+                  << std::chrono::duration_cast<us>(time).count() * 1000 / count << " ns, " << allocations << " allocations, "
+                  << size << " bytes written" << std::endl;
+        EXPECT_LT(allocations, domAllocations);
+    };
+
+    SaleResponseJsonRpc sale;
+    sale.result.PaymentID = std::string(36, 'p');
+    sale.result.BlockNumber = 150000;
+    compare("/sale response", 100000, sale);
+
+    SendSupernodeAnnounceJsonRpcRequest announce = makeAnnounce(1000);
+    compare("SupernodeAnnounce", 200, announce);
+}
+
+namespace
+{
+
+//as SaleDataMulticast and AuthorizeRtaTxResponse that are defined in the sources of the handlers
+GRAFT_DEFINE_IO_STRUCT_INITED(BinSaleData,
+    (std::string, Address, std::string()),
+    (uint64_t, BlockNumber, 0),
+    (uint64_t, Amount, 0)
+);
+
+GRAFT_DEFINE_IO_STRUCT_INITED(BinSaleDataMulticast,
+    (BinSaleData, sale_data, BinSaleData()),
+    (std::string, paymentId, std::string()),
+    (int, status, 0),
+    (std::string, details, std::string())
+);
+
+GRAFT_DEFINE_IO_STRUCT_INITED(BinAuthResponse,
+    (std::string, tx_id, std::string()),
+    (int, result, 0),
+    (graft::SupernodeSignature, signature, graft::SupernodeSignature())
+);
+
+std::string hexString(size_t len, unsigned seed)
+{
+    std::string res(len, '0');
+    for(size_t i = 0; i < len; ++i) res[i] = "0123456789abcdef"[(seed + i * 7) % 16];
+    return res;
+}
+
+}
+
+TEST(InOut, binary)
+{
+    using namespace graft;
+
+    SaxNested nested;
+    for(int i = 0; i < 20; ++i)
+    {
+        SignedKeyImageStr ki;
+        ki.key_image = hexString(64, i);
+        ki.signature = i % 2? std::string(40, 'S') : hexString(17, i); //not hex
+        nested.images.push_back(ki);
+    }
+    nested.counts = {{"a", -1}, {"b", -200}, {"c", 70000}, {std::string(40, 'k'), std::numeric_limits<int>::min()}};
+    nested.error.code = -32601;
+    nested.error.message = "ABCDEF0123456789ABCDEF"; //upper case hex stays a string
+    nested.ratio = -0.125;
+    nested.flag = true;
+    nested.untouched = 5;
+
+    std::string binary = serializer::bin::toBinary(nested);
+    EXPECT_TRUE(serializer::bin::isBinary(binary));
+    EXPECT_LT(binary.size(), serializer::sax::toJson(nested).size());
+    SaxNested restored;
+    serializer::bin::fromBinary(binary.data(), binary.size(), restored);
+    EXPECT_EQ(serializer::sax::toJson(restored), serializer::sax::toJson(nested));
+
+    //a reader of another struct takes the members it knows
+    SaxCounts counts;
+    serializer::bin::fromBinary(binary.data(), binary.size(), counts);
+    EXPECT_EQ(counts["untouched"], 5);
+    EXPECT_EQ(counts.at("images"), 0);
+
+    //either encoding is read by the readers of both
+    AuthorizeRtaTxRequest req;
+    req.tx_hex = hexString(4000, 3);
+    req.payment_id = "5a1c3e04-fb6e-4d5c-9dbd-2b2d1f6f7b52";
+    Output out;
+    out.loadT<serializer::BIN_B64>(req);
+    Input in;
+    in.load(out.body.data(), out.body.size());
+    AuthorizeRtaTxRequest res;
+    EXPECT_TRUE(in.getT<serializer::JSON_B64>(res));
+    EXPECT_EQ(res.tx_hex, req.tx_hex);
+    EXPECT_EQ(res.payment_id, req.payment_id);
+    out.loadT<serializer::JSON_B64>(req);
+    in.load(out.body.data(), out.body.size());
+    EXPECT_TRUE(in.getT<serializer::BIN_B64>(res));
+    EXPECT_EQ(res.tx_hex, req.tx_hex);
+
+    //the payloads of the supernodes are sent in JSON and read in both encodings
+    EXPECT_FALSE(serializer::bin::isBinary(utils::base64_decode(serializer::RTA_B64<AuthorizeRtaTxRequest>::serialize(req))));
+    out.loadT<serializer::BIN_B64>(req);
+    in.load(out.body.data(), out.body.size());
+    res = AuthorizeRtaTxRequest();
+    EXPECT_TRUE(in.getT<serializer::RTA_B64>(res));
+    EXPECT_EQ(res.tx_hex, req.tx_hex);
+
+    //malformed input
+    for(size_t len : {size_t(1), binary.size() / 2, binary.size() - 1})
+    {
+        EXPECT_THROW(serializer::bin::fromBinary(binary.data(), len, restored), serializer::bin::BinaryParseError);
+    }
+    std::string deep(1, serializer::bin::MAGIC);
+    deep += serializer::bin::VERSION;
+    deep += std::string(1000, '\x91');
+    deep += '\xc0';
+    EXPECT_THROW(serializer::bin::fromBinary(deep.data(), deep.size(), counts), serializer::bin::BinaryParseError);
+    out.body = utils::base64_encode(binary.substr(0, binary.size() - 3));
+    in.load(out.body.data(), out.body.size());
+    EXPECT_FALSE(in.getT<serializer::BIN_B64>(restored));
+}
+
+TEST(InOut, DISABLED_binaryBenchmark)
+{
+    using namespace graft;
+    using us = std::chrono::microseconds;
+
+    auto compare = [](const char* name, int count, auto& t)
+    {
+        using T = typename std::decay<decltype(t)>::type;
+        auto measure = [count](auto f)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            for(int i = 0; i < count; ++i) f();
+            return std::chrono::duration_cast<us>(std::chrono::steady_clock::now() - begin).count() * 1000 / count;
+        };
+
+        std::string json = serializer::sax::toJson(t);
+        std::string binary = serializer::bin::toBinary(t);
+        T out;
+        auto jsonWrite = measure([&]{ serializer::sax::toJson(t); });
+        auto jsonRead = measure([&]{ serializer::sax::fromJson(json, out); });
+        auto binWrite = measure([&]{ serializer::bin::toBinary(t); });
+        auto binRead = measure([&]{ serializer::bin::fromBinary(binary.data(), binary.size(), out); });
+        EXPECT_EQ(serializer::sax::toJson(out), json);
+
+        std::cout << name << ": JSON " << json.size() << " bytes (" << utils::base64_encode(json).size()
+                  << " in base64), write " << jsonWrite << " ns, read " << jsonRead << " ns; binary " << binary.size()
+                  << " bytes (" << utils::base64_encode(binary).size() << " in base64), write " << binWrite
+                  << " ns, read " << binRead << " ns" << std::endl;
+        EXPECT_LT(binary.size(), json.size());
+    };
+
+    BinSaleDataMulticast sale;
+    sale.sale_data.Address = std::string(95, 'F');
+    sale.sale_data.BlockNumber = 150000;
+    sale.sale_data.Amount = 12345000000;
+    sale.paymentId = "5a1c3e04-fb6e-4d5c-9dbd-2b2d1f6f7b52";
+    sale.status = 1;
+    sale.details = "{\"items\":[{\"name\":\"coffee\",\"price\":3.5}]}";
+    compare("SaleDataMulticast", 100000, sale);
+
+    AuthorizeRtaTxRequest req;
+    req.tx_hex = hexString(24000, 5);
+    req.payment_id = sale.paymentId;
+    compare("AuthorizeRtaTxRequest", 2000, req);
+
+    BinAuthResponse resp;
+    resp.tx_id = hexString(64, 1);
+    resp.result = 0;
+    resp.signature.address = std::string(95, 'F');
+    resp.signature.result_signature = hexString(128, 2);
+    resp.signature.tx_signature = hexString(128, 3);
+    compare("AuthorizeRtaTxResponse", 100000, resp);
+}
+
+TEST(Utils, codecs)
+{
+    using namespace graft;
+
+    //the SIMD implementations take the blocks, the rest is scalar; the results are the same as of epee
+    std::mt19937 rng(7);
+    for(bool scalar : {false, true})
+    {
+        utils::force_scalar_codecs(scalar);
+        for(size_t size = 0; size < 300; ++size)
+        {
+            std::string data(size, 0);
+            for(char& c : data) c = static_cast<char>(rng());
+
+            std::string b64 = utils::base64_encode(data);
+            EXPECT_EQ(b64, epee::string_encoding::base64_encode(data));
+            EXPECT_EQ(utils::base64_decode(b64), data);
+            std::string broken = b64;
+            if(!broken.empty()) broken[rng() % broken.size()] = "=.-_ \x80"[rng() % 6];
+            EXPECT_EQ(utils::base64_decode(broken), epee::string_encoding::base64_decode(broken));
+
+            std::string hex = utils::to_hex(data);
+            EXPECT_EQ(hex, epee::string_tools::buff_to_hex_nodelimer(data));
+            std::string upper = hex;
+            for(char& c : upper) c = static_cast<char>(std::toupper(c));
+            std::string bin;
+            EXPECT_TRUE(utils::from_hex(upper, bin));
+            EXPECT_EQ(bin, data);
+            if(hex.empty()) continue;
+            hex[rng() % hex.size()] = 'g';
+            EXPECT_FALSE(utils::from_hex(hex, bin));
+            hex.pop_back();
+            EXPECT_FALSE(utils::from_hex(hex, bin));
+        }
+    }
+    utils::force_scalar_codecs(false);
+
+    crypto::hash hash;
+    for(size_t i = 0; i < sizeof(hash); ++i) hash.data[i] = static_cast<char>(i * 37);
+    std::string hex = utils::pod_to_hex(hash);
+    EXPECT_EQ(hex, epee::string_tools::pod_to_hex(hash));
+    crypto::hash parsed;
+    EXPECT_TRUE(utils::hex_to_pod(hex, parsed));
+    EXPECT_EQ(parsed, hash);
+    EXPECT_FALSE(utils::hex_to_pod(hex + "00", parsed));
+    //a failed parse leaves the pod as it was
+    std::string bad = hex;
+    bad.back() = 'g';
+    EXPECT_FALSE(utils::hex_to_pod(bad, parsed));
+    EXPECT_EQ(parsed, hash);
+}
+
+TEST(Utils, DISABLED_codecsBenchmark)
+{
+    using namespace graft;
+    using us = std::chrono::microseconds;
+
+    auto measure = [](int count, auto f)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        for(int i = 0; i < count; ++i) f();
+        return std::chrono::duration_cast<us>(std::chrono::steady_clock::now() - begin).count() * 1000 / count;
+    };
+
+    std::cout << "codecs: " << utils::codec_implementation() << std::endl;
+    std::mt19937 rng(11);
+    //a key image, a signature, a typical tx and a large tx
+    for(size_t size : {32, 64, 2500, 25000})
+    {
+        std::string data(size, 0);
+        for(char& c : data) c = static_cast<char>(rng());
+        std::string b64 = utils::base64_encode(data);
+        std::string hex = utils::to_hex(data);
+        const int count = size < 1000? 200000 : 20000;
+        std::string bin;
+
+        auto epeeB64Enc = measure(count, [&]{ epee::string_encoding::base64_encode(data); });
+        auto epeeB64Dec = measure(count, [&]{ epee::string_encoding::base64_decode(b64); });
+        auto epeeHexEnc = measure(count, [&]{ epee::string_tools::buff_to_hex_nodelimer(data); });
+        auto epeeHexDec = measure(count, [&]{ epee::string_tools::parse_hexstr_to_binbuff(hex, bin); });
+        auto b64Enc = measure(count, [&]{ utils::base64_encode(data); });
+        auto b64Dec = measure(count, [&]{ utils::base64_decode(b64); });
+        auto hexEnc = measure(count, [&]{ utils::to_hex(data); });
+        auto hexDec = measure(count, [&]{ utils::from_hex(hex, bin); });
+
+        std::cout << size << " bytes, epee / graft ns: base64 encode " << epeeB64Enc << " / " << b64Enc
+                  << ", decode " << epeeB64Dec << " / " << b64Dec << "; hex encode " << epeeHexEnc << " / " << hexEnc
+                  << ", decode " << epeeHexDec << " / " << hexDec << std::endl;
+    }
+}
+
+TEST(ConcurrentMap, common)
+{
+    graft::ConcurrentMap<std::string, int> m(4);
+    const int count = 10000; //many times the initial capacity of the shards
+    for(int i = 0; i < count; ++i)
+    {
+        m.addOrUpdate(std::to_string(i), i);
+    }
+    EXPECT_EQ(m.size(), count);
+    for(int i = 0; i < count; i += 2)
+    {
+        m.remove(std::to_string(i));
+    }
+    m.remove("absent");
+    EXPECT_EQ(m.size(), count / 2);
+    for(int i = 0; i < count; ++i)
+    {
+        EXPECT_EQ(m.hasKey(std::to_string(i)), i % 2 == 1);
+        EXPECT_EQ(m.valueFor(std::to_string(i), -1), (i % 2)? i : -1);
+    }
+    //the removed slots are reused
+    for(int i = 0; i < count; i += 2)
+    {
+        m.addOrUpdate(std::to_string(i), -i);
+    }
+    EXPECT_EQ(m.size(), count);
+    EXPECT_EQ(m.valueFor("10"), -10);
+
+    std::function<bool(int&)> f = [](int& v)->bool { v += 100; return true; };
+    EXPECT_TRUE(m.apply("11", f));
+    EXPECT_FALSE(m.apply("absent", f));
+    EXPECT_EQ(m.valueFor("11"), 111);
+    //a declined change is not published, and no entry is added for it
+    std::function<bool(int&)> decline = [](int& v)->bool { v = -1; return false; };
+    EXPECT_FALSE(m.apply("11", decline));
+    EXPECT_EQ(m.valueFor("11"), 111);
+    EXPECT_FALSE(m.applyOrAdd("declined", decline));
+    EXPECT_FALSE(m.hasKey("declined"));
+    EXPECT_EQ(m.size(), count);
+
+    //ttl
+    m.addOrUpdate("ttl", 1, std::chrono::seconds(1));
+    m.addOrUpdate("touched", 1, std::chrono::seconds(3));
+    EXPECT_TRUE(m.hasKey("ttl"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    EXPECT_TRUE(m.hasKey("touched"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    EXPECT_FALSE(m.hasKey("ttl"));
+    EXPECT_EQ(m.size(), count + 2);
+    m.cleanup();
+    EXPECT_EQ(m.size(), count + 1);
+    EXPECT_EQ(m.expiredCount(), 1);
+    EXPECT_TRUE(m.hasKey("touched"));
+    EXPECT_TRUE(m.hasKey("11"));
+}
+
+TEST(TimingWheel, common)
+{
+    struct Item : public graft::TimingWheelHook
+    {
+        int64_t fired = -1;
+    };
+
+    graft::TimingWheel<> wheel(1000);
+    //deadlines in the levels and at their boundaries
+    std::vector<int64_t> deadlines = { 1000, 1001, 1063, 1064, 1065, 1000 + 4095, 1000 + 4096, 1000 + 300000, 1000 + 20000000 };
+    std::vector<Item> items(deadlines.size());
+    for(size_t i = 0; i < items.size(); ++i)
+    {
+        wheel.schedule(&items[i], deadlines[i]);
+    }
+    Item canceled, rescheduled;
+    wheel.schedule(&canceled, 1010);
+    wheel.schedule(&rescheduled, 1020);
+    wheel.cancel(&canceled);
+    wheel.schedule(&rescheduled, 1030);
+    EXPECT_EQ(wheel.size(), items.size() + 1);
+
+    auto fire = [&wheel](graft::TimingWheelHook* h)
+    {
+        static_cast<Item*>(h)->fired = wheel.now();
+    };
+    //one tick at a time, and a long jump
+    for(int64_t now = 1001; now <= 1000 + 5000; ++now) wheel.advance(now, fire);
+    wheel.advance(1000 + 30000000, fire);
+    EXPECT_EQ(wheel.size(), 0);
+    EXPECT_EQ(wheel.now(), 1000 + 30000000);
+
+    //the past deadline fires on the next tick
+    EXPECT_EQ(items[0].fired, 1001);
+    for(size_t i = 1; i < items.size(); ++i)
+    {
+        EXPECT_EQ(items[i].fired, deadlines[i]);
+    }
+    EXPECT_EQ(canceled.fired, -1);
+    EXPECT_EQ(rescheduled.fired, 1030);
+}
+
+TEST(PaymentStore, common)
+{
+    graft::PaymentStore payments;
+    const std::string id = "payment";
+    EXPECT_FALSE(payments.has(id));
+    EXPECT_EQ(payments.status(id), static_cast<int>(graft::RTAStatus::None));
+    EXPECT_FALSE(payments.updateExisting(id, [](graft::PaymentRecord&) { return true; }));
+    //a check that declines the update does not create the record
+    EXPECT_FALSE(payments.update(id, [](graft::PaymentRecord &record) { return record.sale.is_initialized(); }));
+    EXPECT_FALSE(payments.has(id));
+
+    EXPECT_TRUE(payments.update(id, [](graft::PaymentRecord &record) {
+        record.sale = graft::SaleData("address", 10, 100);
+        record.saleDetails = std::string("details");
+        record.status = static_cast<int>(graft::RTAStatus::Waiting);
+        return true;
+    }));
+    EXPECT_EQ(payments.status(id), static_cast<int>(graft::RTAStatus::Waiting));
+    EXPECT_TRUE(payments.read(id, [](const graft::PaymentRecord &record) {
+        ASSERT_TRUE(record.sale);
+        EXPECT_EQ(record.sale->Amount, 100);
+        EXPECT_EQ(record.saleDetails.value_or(std::string()), "details");
+        EXPECT_FALSE(record.pay);
+    }));
+
+    //an update changes several fields at once and keeps the others
+    EXPECT_TRUE(payments.updateExisting(id, [](graft::PaymentRecord &record) {
+        record.pay = graft::PayData("wallet", 10, 100);
+        record.txId = "tx";
+        record.status = static_cast<int>(graft::RTAStatus::InProgress);
+        return true;
+    }));
+    EXPECT_TRUE(payments.read(id, [](const graft::PaymentRecord &record) {
+        EXPECT_TRUE(record.sale);
+        EXPECT_TRUE(record.pay);
+        EXPECT_EQ(record.txId, "tx");
+        EXPECT_EQ(record.status, static_cast<int>(graft::RTAStatus::InProgress));
+    }));
+    EXPECT_EQ(payments.size(), 1);
+
+    payments.remove(id);
+    EXPECT_FALSE(payments.has(id));
+    EXPECT_EQ(payments.size(), 0);
+}
+
+namespace
+{
+
+//readers and writers over payment-like keys, returns million operations per second
+template<typename Map>
+double contextMapBenchmark(Map& m, int threadCount, int keyCount, int opsPerThread, int writePercent)
+{
+    std::vector<std::string> keys;
+    for(int i = 0; i < keyCount; ++i)
+    {
+        keys.push_back("6d8bcfa4-5d4e-4f2e-9e7c-" + std::to_string(1000000 + i) + "sale_status");
+        m.addOrUpdate(keys.back(), boost::any(uint64_t(0)));
+    }
+    std::atomic<uint64_t> writes(0);
+    std::function<bool(boost::any&)> inc = [](boost::any& a)->bool { ++boost::any_cast<uint64_t&>(a); return true; };
+
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> ths;
+    for(int t = 0; t < threadCount; ++t)
+    {
+        ths.emplace_back([&, t]
+        {
+            uint64_t rnd = 88172645463325252ULL + t, w = 0;
+            for(int i = 0; i < opsPerThread; ++i)
+            {
+                rnd ^= rnd << 13; rnd ^= rnd >> 7; rnd ^= rnd << 17;
+                const std::string& key = keys[rnd % keys.size()];
+                if(int(rnd % 100) < writePercent)
+                {
+                    m.apply(key, inc);
+                    ++w;
+                }
+                else
+                {
+                    boost::any_cast<uint64_t>(m.valueFor(key, boost::any()));
+                }
+            }
+            writes += w;
+        });
+    }
+    for(auto& th : ths) th.join();
+    auto end = std::chrono::steady_clock::now();
+
+    uint64_t sum = 0;
+    for(auto& key : keys) sum += boost::any_cast<uint64_t>(m.valueFor(key, boost::any()));
+    EXPECT_EQ(sum, writes);
+    double us = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+    return threadCount * opsPerThread / us;
+}
+
+}
+
+TEST(ConcurrentMap, DISABLED_benchmark)
+{
+    const int threadCount = 4, opsPerThread = 50000;
+    for(int keyCount : { 1000, 50000 })
+    {
+        for(int writePercent : { 5, 50 })
+        {
+            graft::TSHashtable<std::string, boost::any> old_map;
+            double old_mops = contextMapBenchmark(old_map, threadCount, keyCount, opsPerThread, writePercent);
+            graft::ConcurrentMap<std::string, boost::any> new_map;
+            double new_mops = contextMapBenchmark(new_map, threadCount, keyCount, opsPerThread, writePercent);
+            std::cout << "GlobalContextMap " << keyCount << " keys, " << writePercent << "% writes, "
+                      << threadCount << " threads: TSHashtable " << old_mops << " Mops/s, ConcurrentMap "
+                      << new_mops << " Mops/s" << std::endl;
+        }
+    }
+}
+
+TEST(ThreadPool, idleLatency)
+{
+    using TP = tp::ThreadPoolImpl<tp::FixedFunction<void(), 64>, tp::MPMCBoundedQueue>;
+    using clock = std::chrono::steady_clock;
+
+    //measures latency between post and start of a job in microseconds
+    auto run = [](tp::ThreadPoolOptions::IdleMode mode, int batch, int batches,
+            std::chrono::microseconds pause, std::chrono::microseconds work) -> std::vector<int64_t>
+    {
+        tp::ThreadPoolOptions th_op;
+        th_op.setThreadCount(4);
+        th_op.setQueueSize(256);
+        th_op.setIdleMode(mode);
+        TP pool(th_op);
+
+        const int total = batch * batches;
+        std::vector<int64_t> latencies(total);
+        std::atomic<int> done(0);
+        for(int b = 0; b < batches; ++b)
+        {
+            for(int i = 0; i < batch; ++i)
+            {
+                int64_t* res = &latencies[b*batch + i];
+                auto posted = clock::now();
+                auto job = [res, posted, work, &done]()
+                {
+                    auto started = clock::now();
+                    *res = std::chrono::duration_cast<std::chrono::microseconds>(started - posted).count();
+                    while(clock::now() - started < work);
+                    ++done;
+                };
+                //queues may be full under saturated load
+                while(!pool.tryPost(job)) std::this_thread::yield();
+            }
+            std::this_thread::sleep_for(pause);
+        }
+        while(done < total) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::sort(latencies.begin(), latencies.end());
+        return latencies;
+    };
+
+    struct Load
+    {
+        const char* name;
+        int batch;
+        int batches;
+        std::chrono::microseconds pause;
+        std::chrono::microseconds work;
+    } loads[] =
+    {
+        { "low", 1, 200, std::chrono::microseconds(2000), std::chrono::microseconds(10) },
+        { "medium", 4, 200, std::chrono::microseconds(500), std::chrono::microseconds(50) },
+        { "saturated", 16, 50, std::chrono::microseconds(100), std::chrono::microseconds(50) },
+    };
+
+    for(auto& load : loads)
+    {
+        for(auto mode : { tp::ThreadPoolOptions::IdleMode::Sleep, tp::ThreadPoolOptions::IdleMode::Park })
+        {
+            std::vector<int64_t> l = run(mode, load.batch, load.batches, load.pause, load.work);
+            ASSERT_EQ(l.size(), load.batch * load.batches);
+            int64_t sum = std::accumulate(l.begin(), l.end(), int64_t(0));
+            std::cout << "ThreadPool " << ((mode == tp::ThreadPoolOptions::IdleMode::Park)? "park " : "sleep")
+                      << " load " << load.name << ": mean " << sum / int64_t(l.size())
+                      << " us, p50 " << l[l.size()/2] << " us, p99 " << l[l.size()*99/100] << " us" << std::endl;
+        }
+    }
+}
+
+TEST(ThreadPool, workStealingDeque)
+{
+    const int items = 100000;
+    const int thieves = 3;
+    tp::WorkStealingDeque<int*> deque(256);
+    std::vector<int> taken(items, 0);
+    std::atomic<bool> done(false);
+
+    auto thief = [&]()
+    {
+        int* p;
+        while(!done || deque.size())
+        {
+            if(deque.steal(p)) ++*p;
+        }
+    };
+    std::vector<std::thread> ths;
+    for(int i = 0; i < thieves; ++i) ths.emplace_back(thief);
+
+    int* p;
+    for(int i = 0; i < items; ++i)
+    {
+        while(!deque.push(&taken[i]))
+        {
+            if(deque.pop(p)) ++*p;
+        }
+        if(i % 3 == 0 && deque.pop(p)) ++*p;
+    }
+    done = true;
+    for(auto& th : ths) th.join();
+
+    EXPECT_EQ(0, deque.size());
+    EXPECT_EQ(items, std::count(taken.begin(), taken.end(), 1));
+}
+
+TEST(ThreadPool, stealing)
+{
+    using TP = tp::ThreadPoolImpl<tp::FixedFunction<void(), 64>, tp::MPMCBoundedQueue>;
+
+    //a long job posts short ones from the worker thread and then blocks until the other workers have taken them,
+    //the owner does not run any of them, so each one done is a steal
+    for(auto mode : { tp::ThreadPoolOptions::StealMode::Ring, tp::ThreadPoolOptions::StealMode::Random })
+    {
+        tp::ThreadPoolOptions th_op;
+        th_op.setThreadCount(4);
+        th_op.setQueueSize(256);
+        th_op.setStealMode(mode);
+        TP pool(th_op);
+
+        const int short_cnt = 100;
+        std::mutex mutex;
+        std::condition_variable cv;
+        //under the mutex
+        int short_done = 0;
+        int short_done_before_long = -1;
+        bool long_done = false;
+
+        pool.post([&]()
+        {
+            for(int i = 0; i < short_cnt; ++i)
+            {
+                pool.post([&]()
+                {
+                    std::lock_guard<std::mutex> lk(mutex);
+                    ++short_done;
+                    cv.notify_all();
+                });
+            }
+            std::unique_lock<std::mutex> lk(mutex);
+            //the timeout only keeps the test from hanging
+            cv.wait_for(lk, std::chrono::seconds(10), [&]{ return short_done == short_cnt; });
+            short_done_before_long = short_done;
+            long_done = true;
+            cv.notify_all();
+        });
+
+        {
+            std::unique_lock<std::mutex> lk(mutex);
+            cv.wait_for(lk, std::chrono::seconds(20), [&]{ return long_done && short_done == short_cnt; });
+            ASSERT_TRUE(long_done);
+        }
+
+        TP::StealStats stats = pool.getStealStats();
+        std::cout << "ThreadPool " << ((mode == tp::ThreadPoolOptions::StealMode::Random)? "random" : "ring  ")
+                  << " stealing: " << short_done_before_long << " of " << short_cnt
+                  << " short jobs done while the long one was blocked, steals "
+                  << stats.successes << " of " << stats.attempts << " attempts" << std::endl;
+        EXPECT_EQ(short_cnt, short_done_before_long);
+        EXPECT_LE(static_cast<uint64_t>(short_done_before_long), stats.successes);
+    }
+}
+
+//a mixed RTA workload: sale, status polls, pay, auth sample votes and a status update per payment,
+//interleaved over payments; each job updates the record of its payment
+TEST(ThreadPool, affinity)
+{
+    using TP = tp::ThreadPoolImpl<tp::FixedFunction<void(), 64>, tp::MPMCBoundedQueue>;
+    using Record = std::array<uint64_t, 16>;
+    const size_t threads = 4;
+    const int payments = 1999; //not a multiple of threads, round-robin would pin payments otherwise
+    const int jobsPerPayment = 1 + 4 + 1 + 8 + 1;
+
+    struct Result
+    {
+        int64_t us;
+        double sameWorker;
+        //the jobs that ran on another worker than the one of their key, and the steals
+        int offHome;
+        uint64_t steals;
+    };
+
+    auto run = [&](bool affinity) -> Result
+    {
+        tp::ThreadPoolOptions th_op;
+        th_op.setThreadCount(threads);
+        th_op.setQueueSize(1024);
+        TP pool(th_op);
+
+        graft::ConcurrentMap<std::string, Record> records;
+        std::vector<std::string> ids;
+        std::vector<size_t> keys;
+        for(int i = 0; i < payments; ++i)
+        {
+            ids.push_back(graft::generatePaymentID());
+            keys.push_back(std::max<size_t>(1, std::hash<std::string>()(ids.back())));
+        }
+        //the worker of the previous job of each payment
+        std::vector<std::atomic<size_t>> lastWorker(payments);
+        for(auto& w : lastWorker) w = threads;
+        std::atomic<int> done(0), same(0), offHome(0);
+
+        auto begin = std::chrono::steady_clock::now();
+        for(int j = 0; j < jobsPerPayment; ++j)
+        {
+            for(int i = 0; i < payments; ++i)
+            {
+                const size_t home = keys[i] % threads;
+                auto job = [&records, &ids, &lastWorker, &same, &offHome, &done, i, j, home]()
+                {
+                    const std::string& id = ids[i];
+                    std::function<bool(Record&)> f = [j](Record& r) { r[j % r.size()] += j; return true; };
+                    if(j == 0) records.addOrUpdate(id, Record{});
+                    else if(j < 5) records.valueFor(id);
+                    else records.apply(id, f);
+                    size_t worker = tp::Worker<tp::FixedFunction<void(), 64>, tp::MPMCBoundedQueue>::getWorkerIdForCurrentThread();
+                    if(lastWorker[i].exchange(worker) == worker) ++same;
+                    if(worker != home) ++offHome;
+                    ++done;
+                };
+                while(!pool.tryPost(job, affinity? keys[i] : 0)) std::this_thread::yield();
+            }
+        }
+        while(done < payments * jobsPerPayment) std::this_thread::yield();
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count();
+        return Result{us, double(same) / (payments * (jobsPerPayment - 1)), offHome, pool.getStealStats().successes};
+    };
+
+    Result roundRobin = run(false);
+    Result affine = run(true);
+    //the share depends on stealing, that is on the number of cores
+    std::cout << "ThreadPool mixed RTA workload, " << payments << " payments, " << payments * jobsPerPayment << " jobs: "
+              << "round-robin " << roundRobin.us << " us, " << int(roundRobin.sameWorker * 100) << "% on the worker of the previous job; "
+              << "affinity " << affine.us << " us, " << int(affine.sameWorker * 100) << "%" << std::endl;
+    //the jobs of a key run on the worker of the key unless an idle worker has stolen them
+    EXPECT_LE(static_cast<uint64_t>(affine.offHome), affine.steals);
+
+    //the key of a client request
+    EXPECT_EQ(graft::jsonStringField("{\"Address\":\"a\", \"PaymentID\" : \"p1\"}", "PaymentID"), "p1");
+    EXPECT_EQ(graft::jsonStringField("{\"PaymentID\":5}", "PaymentID"), "");
+    EXPECT_EQ(graft::jsonStringField("{}", "PaymentID"), "");
+
+    //the key of a multicast is found at either end of a large payload, only the ends are decoded
+    auto multicast = [](const std::string& payload)
+    {
+        graft::Input in;
+        in.load("{\"jsonrpc\":\"2.0\",\"params\":{\"data\":\"" + graft::utils::base64_encode(payload) + "\"}}");
+        return in;
+    };
+    const std::string big(10000, 'a');
+    const std::string id = graft::generatePaymentID();
+    graft::Router::AffinityKey sale = graft::multicastPaymentIdAffinity("paymentId");
+    graft::Router::AffinityKey auth = graft::multicastPaymentIdAffinity("payment_id");
+    graft::Router::vars_t vars;
+    EXPECT_EQ(sale(vars, multicast("{\"paymentId\":\"" + id + "\",\"details\":\"" + big + "\"}")), id);
+    EXPECT_EQ(auth(vars, multicast("{\"tx_hex\":\"" + big + "\",\"payment_id\":\"" + id + "\"}")), id);
+    EXPECT_EQ(auth(vars, multicast("{\"payment_id\":\"" + id + "\"}")), id);
+    EXPECT_EQ(auth(vars, multicast("{\"tx_hex\":\"" + big + "\"}")), "");
+
+    //the same in the binary encoding, the key is a string and a hex id is written as HEX_EXT
+    graft::AuthorizeRtaTxRequest req;
+    req.tx_hex = hexString(10000, 5);
+    req.payment_id = id;
+    EXPECT_EQ(auth(vars, multicast(graft::serializer::bin::toBinary(req))), id);
+    req.payment_id = hexString(64, 1);
+    EXPECT_EQ(auth(vars, multicast(graft::serializer::bin::toBinary(req))), req.payment_id);
+    req.tx_hex.clear();
+    EXPECT_EQ(auth(vars, multicast(graft::serializer::bin::toBinary(req))), req.payment_id);
+    req.payment_id = std::string(300, 'p');
+    EXPECT_EQ(auth(vars, multicast(graft::serializer::bin::toBinary(req))), req.payment_id);
+    req.payment_id.clear();
+    req.tx_hex = hexString(10000, 5);
+    EXPECT_EQ(auth(vars, multicast(graft::serializer::bin::toBinary(req))), "");
+}
+
+namespace
+{
+
+class PooledObject : public graft::SelfHolder<PooledObject>
+{
+    template<typename> friend class graft::PoolAllocator;
+    PooledObject(int v) : value(v) { }
+public:
+    int value;
+    char payload[200];
+    void release() { releaseItself(); }
+};
+
+}
+
+TEST(MemoryPool, common)
+{
+    graft::MemoryPool pool(16);
+    graft::MemoryPool::setLocal(&pool);
+    {
+        PooledObject::Ptr ptr = PooledObject::Create(5);
+        EXPECT_EQ(ptr->value, 5);
+        EXPECT_EQ(ptr, ptr->getSelf());
+        ptr->release();
+    }
+    //the object and the control block are returned to the pool in single block
+    EXPECT_EQ(pool.hits(), 0);
+    EXPECT_EQ(pool.misses(), 1);
+    for(int i = 0; i < 10; ++i)
+    {
+        PooledObject::Ptr ptr = PooledObject::Create(i);
+        ptr->release();
+    }
+    EXPECT_EQ(pool.hits(), 10);
+    EXPECT_EQ(pool.misses(), 1);
+    graft::MemoryPool::setLocal(nullptr);
+
+    //blocks allocated by one thread and freed by another
+    const int count = 10000;
+    tp::MPMCBoundedQueue<void*> queue(1024);
+    std::thread producer([&]
+    {
+        for(int i = 0; i < count; ++i)
+        {
+            void* p = pool.allocate(100);
+            while(!queue.push(p)) std::this_thread::yield();
+        }
+    });
+    for(int i = 0; i < count; )
+    {
+        void* p;
+        if(!queue.pop(p)) { std::this_thread::yield(); continue; }
+        pool.deallocate(p, 100);
+        ++i;
+    }
+    producer.join();
+    EXPECT_EQ(pool.hits() + pool.misses(), 11 + count);
+    EXPECT_LT(0, pool.hits() - 10);
+}
+
+TEST(MemoryPool, DISABLED_benchmark)
+{
+    graft::MemoryPool pool(16);
+
+    //allocation time, pool vs operator new
+    auto measure = [](auto make)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        for(int i = 0; i < 100000; ++i)
         {
-            std::for_each(v_keys.rbegin(), v_keys.rend(), [&] (auto& key)
-            {
-                while( stop < th_count - 1 && cnt == g_count);
-                ctx.global.apply(key, f);
-                cnt = ++g_count;
-            });
+            auto ptr = make(i);
         }
-        ++stop;
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / 100000;
     };
+    double ns_pool = measure([&pool](int i){ return std::allocate_shared<std::array<char,600>>(graft::PoolAllocator<char>(pool)); });
+    double ns_new = measure([](int i){ return std::make_shared<std::array<char,600>>(); });
+    std::cout << "allocate_shared with pool " << ns_pool << " ns, make_shared " << ns_new << " ns" << std::endl;
+}
 
-    std::thread ths[th_count];
-    for(int i=0; i < th_count; ++i)
+TEST(Trace, registry)
+{
+    graft::TraceRegistry& registry = graft::TraceRegistry::instance();
+    registry.clear();
+    registry.setSampleRate(2);
+
+    for(int i = 0; i < 4; ++i)
     {
-        ths[i] = (i%2)? std::thread(f_f) : std::thread(f_b);
+        graft::TraceSpan span;
+        span.mark(graft::TraceStage::accept);
+        span.mark(graft::TraceStage::enqueue);
+        span.mark(graft::TraceStage::worker_start);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        span.mark(graft::TraceStage::worker_finish);
+        span.mark(graft::TraceStage::respond);
+        EXPECT_EQ(span.size(), 5);
+        registry.record("/test", span);
     }
+    //the span does not grow above the limit
+    graft::TraceSpan span;
+    for(size_t i = 0; i < graft::TraceSpan::MAX_MARKS + 3; ++i) span.mark(graft::TraceStage::resume);
+    EXPECT_EQ(span.size(), graft::TraceSpan::MAX_MARKS);
+    EXPECT_EQ(span.dropped(), 3);
+
+    std::string hist = registry.histogramsJson();
+    EXPECT_NE(hist.find("\"route\":\"/test\""), std::string::npos);
+    EXPECT_NE(hist.find("{\"stage\":\"worker_finish\",\"count\":4"), std::string::npos);
+    EXPECT_NE(hist.find("{\"stage\":\"total\",\"count\":4"), std::string::npos);
+    EXPECT_EQ(hist.find("\"stage\":\"accept\""), std::string::npos);
+
+    std::string chrome = registry.chromeTraceJson();
+    size_t events = 0;
+    for(size_t pos = chrome.find("\"ph\":\"X\""); pos != std::string::npos; pos = chrome.find("\"ph\":\"X\"", pos + 1)) ++events;
+    EXPECT_EQ(events, 2*4); //2 sampled spans of 4 intervals
+    registry.setSampleRate(0);
+    registry.clear();
+}
 
-    int main_count = 0;
-    while( stop < th_count )
+TEST(Metrics, common)
+{
+    graft::Metrics& metrics = graft::Metrics::instance();
+    const std::string labels = graft::Metrics::labels({{"route", "/test/\"q\""}, {"code", "200"}});
+    EXPECT_EQ(labels, "route=\"/test/\\\"q\\\"\",code=\"200\"");
+
+    graft::Counter& counter = metrics.counter("test_metrics_total", "Test counter.", labels);
+    EXPECT_EQ(&counter, &metrics.counter("test_metrics_total", "Test counter.", labels));
+    EXPECT_THROW(metrics.gauge("test_metrics_total", "Test counter."), std::logic_error);
+
+    graft::Histogram& hist = metrics.histogram("test_metrics_seconds", "Test histogram.", "", {0.001, 0.01});
+    const int threadCount = 4, count = 100000;
+    std::vector<std::thread> threads;
+    for(int t = 0; t < threadCount; ++t)
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        ++g_count;
-        ++main_count;
+        threads.emplace_back([&]
+        {
+            for(int i = 0; i < count; ++i)
+            {
+                counter.inc();
+            }
+            hist.observe(std::chrono::microseconds(500));
+            hist.observe(std::chrono::milliseconds(5));
+            hist.observe(std::chrono::seconds(1));
+        });
     }
+    for(auto& th : threads) th.join();
+    EXPECT_EQ(counter.value(), threadCount * count);
 
-    for(int i=0; i < th_count; ++i)
+    graft::Histogram::Snapshot snap = hist.snapshot();
+    EXPECT_EQ(snap.count, 3 * threadCount);
+    EXPECT_EQ(snap.buckets, std::vector<uint64_t>({threadCount, threadCount, threadCount}));
+    EXPECT_NEAR(snap.sum, threadCount * 1.0055, 1e-9);
+
+    graft::Gauge& gauge = metrics.gauge("test_metrics_gauge", "Test gauge.");
+    gauge.set(5);
+    gauge.add(-2);
+    EXPECT_EQ(gauge.value(), 3);
+
+    //the series above the limit are merged
+    for(size_t i = 0; i < graft::Metrics::MAX_SERIES + 10; ++i)
     {
-        ths[i].join();
+        metrics.counter("test_metrics_many_total", "Test cardinality.", graft::Metrics::labels({{"n", std::to_string(i)}})).inc();
     }
+    EXPECT_EQ(metrics.counter("test_metrics_many_total", "", "overflow=\"true\"").value(), 10);
+
+    std::string text = metrics.exposition();
+    EXPECT_NE(text.find("# TYPE test_metrics_total counter\ntest_metrics_total{" + labels + "} 400000\n"), std::string::npos);
+    EXPECT_NE(text.find("# TYPE test_metrics_gauge gauge\ntest_metrics_gauge 3\n"), std::string::npos);
+    EXPECT_NE(text.find("test_metrics_seconds_bucket{le=\"0.001\"} 4\n"
+                        "test_metrics_seconds_bucket{le=\"0.01\"} 8\n"
+                        "test_metrics_seconds_bucket{le=\"+Inf\"} 12\n"), std::string::npos);
+    EXPECT_NE(text.find("test_metrics_seconds_count 12\n"), std::string::npos);
+
+    //the size of the global context is tracked
+    graft::GlobalContextMap gcm;
+    gcm.addOrUpdate("a", 1);
+    gcm.addOrUpdate("a", 2);
+    gcm.addOrUpdate("b", 3);
+    EXPECT_EQ(gcm.size(), 2);
+    gcm.remove("a");
+    gcm.remove("c");
+    EXPECT_EQ(gcm.size(), 1);
+}
 
-    uint64_t sum = 0;
+TEST(AdmissionQueue, common)
+{
+    using AQ = graft::AdmissionQueue<int>;
+    using namespace std::chrono;
+    AQ::clock::time_point now = AQ::clock::now();
+    AQ aq(3, milliseconds(5), milliseconds(100));
+    std::vector<int> shed;
+    //priorities
+    EXPECT_TRUE(aq.push(graft::Priority::Low, 1, shed, now));
+    EXPECT_TRUE(aq.push(graft::Priority::Normal, 2, shed, now));
+    EXPECT_TRUE(aq.push(graft::Priority::Low, 3, shed, now));
+    //full, the newest low priority item is pushed out
+    EXPECT_TRUE(aq.push(graft::Priority::High, 4, shed, now));
+    EXPECT_EQ(shed, std::vector<int>({3}));
+    EXPECT_FALSE(aq.push(graft::Priority::Low, 5, shed, now));
+    EXPECT_EQ(aq.size(), 3);
+    int v;
+    std::vector<int> res;
+    while(aq.pop(v, shed, now)) res.push_back(v);
+    EXPECT_EQ(res, std::vector<int>({4, 2, 1}));
+    EXPECT_EQ(shed.size(), 1);
+
+    //CoDel, the delay is above the target for longer than the interval
+    AQ codel(100, milliseconds(5), milliseconds(100));
+    shed.clear(); res.clear();
+    for(int i = 0; i < 50; ++i)
     {
-        graft::Context ctx(m);
-        std::for_each(v_keys.begin(), v_keys.end(), [&] (auto& key)
-        {
-            uint64_t v = ctx.global[key];
-            sum += v;
-        });
+        codel.push((i%10)? graft::Priority::Normal : graft::Priority::High, i, shed, now);
     }
-    EXPECT_EQ(sum, g_count-main_count);
+    for(int i = 0; i < 50; ++i)
+    {
+        auto t = now + milliseconds(50 + 10*i);
+        if(codel.pop(v, shed, t)) res.push_back(v);
+    }
+    EXPECT_FALSE(shed.empty());
+    EXPECT_EQ(res.size() + shed.size(), 50);
+    for(int s : shed)
+    {//high priority items are never dropped
+        EXPECT_NE(s%10, 0);
+    }
+
+    //Retry-After is estimated from the drain rate
+    AQ rate(1000, milliseconds(5), milliseconds(100));
+    EXPECT_EQ(rate.retryAfter(), 1);
+    for(int i = 0; i < 100; ++i)
+    {//10 items per second
+        rate.onDone(now + milliseconds(100*i));
+    }
+    EXPECT_NEAR(rate.drainRate(), 10, 1);
+    for(int i = 0; i < 49; ++i) rate.push(graft::Priority::Normal, i, shed, now);
+    EXPECT_EQ(rate.retryAfter(), 5);
 }
 
 /////////////////////////////////
@@ -422,6 +2035,10 @@ protected:
         std::string port = "1234";
         int connect_timeout_ms = 1000;
         int poll_timeout_ms = 1000;
+        //the connections are kept after the reply, and closed after idle_close_ms if it is not 0
+        bool keep_alive = false;
+        int idle_close_ms = 0;
+        std::atomic<int> accepted{0};
     public:
         void run()
         {
@@ -483,7 +2100,8 @@ protected:
                 if(!res) break;
                 mg_send_head(client, status_code, data.size(), headers.c_str());
                 mg_send(client, data.c_str(), data.size());
-                client->flags |= MG_F_SEND_AND_CLOSE;
+                if(!keep_alive) client->flags |= MG_F_SEND_AND_CLOSE;
+                else if(idle_close_ms) mg_set_timer(client, mg_time() + idle_close_ms / 1000.0);
             } break;
             case MG_EV_CLOSE:
             {
@@ -491,6 +2109,7 @@ protected:
             } break;
             case MG_EV_ACCEPT:
             {
+                ++accepted;
                 mg_set_timer(client, mg_time() + connect_timeout_ms);
             } break;
             case MG_EV_TIMER:
@@ -606,6 +2225,11 @@ public:
         std::string get_body(){ return m_body; }
         std::string get_message(){ return m_message; }
         int get_resp_code(){ return m_resp_code; }
+        std::string get_header(const std::string& name)
+        {
+            auto it = m_headers.find(name);
+            return (it == m_headers.end())? std::string() : it->second;
+        }
 
         ~Client()
         {
@@ -633,6 +2257,11 @@ public:
                 http_message* hm = static_cast<http_message*>(ev_data);
                 m_resp_code = hm->resp_code;
                 m_body = std::string(hm->body.p, hm->body.len);
+                for(int i = 0; i < MG_MAX_HTTP_HEADERS && hm->header_names[i].p; ++i)
+                {
+                    m_headers[std::string(hm->header_names[i].p, hm->header_names[i].len)] =
+                            std::string(hm->header_values[i].p, hm->header_values[i].len);
+                }
                 client->flags |= MG_F_CLOSE_IMMEDIATELY;
                 client->handler = graft::static_empty_ev_handler;
                 m_exit = true;
@@ -657,6 +2286,7 @@ public:
         mg_mgr m_mgr;
         mg_connection* client = nullptr;
         int m_resp_code = 0;
+        std::map<std::string, std::string> m_headers;
         std::string m_body;
         std::string m_message;
     };
@@ -774,6 +2404,15 @@ private:
 
         mainServer.copts = copts;
         mainServer.run();
+
+        //as GraftServer::initGlobalContext and prepareDataDirAndSupernodes do, without supernode wallets
+        graft::GlobalContextMap& gcm = mainServer.plooper.load()->getGcm();
+        graft::Context ctx(gcm);
+        ctx.global[CONTEXT_KEY_PAYMENTS] = std::make_shared<graft::PaymentStore>();
+        auto state = std::make_shared<graft::ServerState>();
+        state->testnet = copts.testnet;
+        state->cryptonode_rpc_address = copts.cryptonode_rpc_address;
+        gcm.serverState.store(std::move(state));
     }
 
 protected:
@@ -1650,6 +3289,12 @@ TEST_F(GraftServerPostponeTest, common)
     std::string body = client.get_body();
     EXPECT_EQ(body, "Postpone task response timeout");
 
+    //the callback of no postponed task fails
+    client.serve("http://localhost:9084/callback/00000000-0000-0000-0000-000000000001", "", post_data);
+    EXPECT_EQ(false, client.get_closed());
+    EXPECT_EQ(500, client.get_resp_code());
+    EXPECT_EQ(client.get_body(), "Postponed task not found");
+
     mainServer.stop_and_wait_for();
     crypton.stop_and_wait_for();
 }
@@ -1693,6 +3338,240 @@ TEST_F(GraftServerForwardTest, inner)
     crypton.stop_and_wait_for();
 }
 
+TEST_F(GraftServerForwardTest, keepAlive)
+{
+    using us = std::chrono::microseconds;
+
+    class KeepAliveCryptoN : public TempCryptoNodeServer
+    {
+    protected:
+        virtual bool onHttpRequest(const http_message *hm, int& status_code, std::string& headers, std::string& data) override
+        {
+            data = std::string(hm->body.p, hm->body.len);
+            headers = "Content-Type: application/json";
+            return true;
+        }
+    };
+
+    //a connection per forward before, the connection of the pool after
+    const int requests = 300;
+    int connects[2];
+    for(int pooled = 0; pooled < 2; ++pooled)
+    {
+        KeepAliveCryptoN crypton;
+        crypton.keep_alive = true;
+        crypton.run();
+        MainServer mainServer;
+        mainServer.copts.upstream_keepalive_max_per_host = pooled? 8 : 0;
+        graft::registerForwardRequests(mainServer.router);
+        mainServer.run();
+
+        std::vector<int64_t> latencies;
+        for(int i = 0; i < requests; ++i)
+        {
+            std::string post_data = "data " + std::to_string(i);
+            Client client;
+            auto begin = std::chrono::steady_clock::now();
+            client.serve("http://localhost:9084/json_rpc", "", post_data);
+            latencies.push_back(std::chrono::duration_cast<us>(std::chrono::steady_clock::now() - begin).count());
+            EXPECT_EQ(200, client.get_resp_code());
+            EXPECT_EQ(client.get_body(), post_data);
+        }
+        std::sort(latencies.begin(), latencies.end());
+        connects[pooled] = crypton.accepted;
+        std::cout << (pooled? "keep-alive pool: " : "connection per request: ") << connects[pooled]
+                  << " connects for " << requests << " forwards, p50 " << latencies[requests / 2] << " us, p99 "
+                  << latencies[requests * 99 / 100] << " us" << std::endl;
+
+        mainServer.stop_and_wait_for();
+        crypton.stop_and_wait_for();
+    }
+    EXPECT_EQ(connects[0], requests);
+    EXPECT_EQ(connects[1], 1);
+
+    //the idle connection closed by the cryptonode is evicted, the next forward makes a new one
+    KeepAliveCryptoN crypton;
+    crypton.keep_alive = true;
+    crypton.idle_close_ms = 20;
+    crypton.run();
+    MainServer mainServer;
+    graft::registerForwardRequests(mainServer.router);
+    mainServer.run();
+    for(int i = 0; i < 2; ++i)
+    {
+        Client client;
+        client.serve("http://localhost:9084/json_rpc", "", "some data");
+        EXPECT_EQ(200, client.get_resp_code());
+        EXPECT_EQ(client.get_body(), "some data");
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    EXPECT_EQ(crypton.accepted, 2);
+    graft::Gauge& idle = graft::Metrics::instance().gauge("graft_upstream_connections_idle", "Idle kept-alive upstream connections.",
+                                                          graft::Metrics::labels({{"looper", "0"}}));
+    EXPECT_EQ(idle.value(), 0);
+    mainServer.stop_and_wait_for();
+    crypton.stop_and_wait_for();
+}
+
+TEST_F(GraftServerForwardTest, cache)
+{
+    //replies with the number of the request, slowly enough for the identical requests to meet in flight
+    class CountingCryptoN : public TempCryptoNodeServer
+    {
+    public:
+        std::atomic<int> requests{0};
+    protected:
+        virtual bool onHttpRequest(const http_message *hm, int& status_code, std::string& headers, std::string& data) override
+        {
+            data = std::string(hm->body.p, hm->body.len) + " " + std::to_string(++requests);
+            headers = "Content-Type: application/json\r\nConnection: close";
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            return true;
+        }
+    };
+
+    CountingCryptoN crypton;
+    crypton.run();
+    MainServer mainServer;
+    mainServer.copts.upstream_cache_ttl_ms = { {"/getheight", 500}, {"/json_rpc:get_info", 500} };
+    graft::registerForwardRequests(mainServer.router);
+    mainServer.run();
+
+    auto serve = [](const std::string& path, const std::string& post_data)
+    {
+        Client client;
+        client.serve("http://localhost:9084" + path, "", post_data);
+        EXPECT_EQ(200, client.get_resp_code());
+        return client.get_body();
+    };
+    const std::string labels = graft::Metrics::labels({{"looper", "0"}});
+    graft::Counter& saved = graft::Metrics::instance().counter("graft_upstream_requests_saved_total",
+                                                               "Upstream requests not sent owing to the cache and the coalescing.", labels);
+    uint64_t saved0 = saved.value();
+
+    //the concurrent identical requests make one upstream call
+    const int clients = 8;
+    std::vector<std::string> bodies(clients);
+    std::vector<std::thread> threads;
+    for(int i = 0; i < clients; ++i)
+    {
+        threads.emplace_back([&, i]{ bodies[i] = serve("/getheight", "{}"); });
+    }
+    for(auto& th : threads) th.join();
+    EXPECT_EQ(crypton.requests, 1);
+    for(auto& body : bodies) EXPECT_EQ(body, "{} 1");
+
+    //the cached reply is used until it expires, the body is a part of the key
+    EXPECT_EQ(serve("/getheight", "{}"), "{} 1");
+    EXPECT_EQ(serve("/getheight", "{ }"), "{ } 2");
+    std::this_thread::sleep_for(std::chrono::milliseconds(600));
+    EXPECT_EQ(serve("/getheight", "{}"), "{} 3");
+
+    //JSON-RPC requests are cached by the method
+    std::string get_info = "{\"json_rpc\":\"2.0\",\"id\":0,\"method\" : \"get_info\"}";
+    EXPECT_EQ(serve("/json_rpc", get_info), get_info + " 4");
+    EXPECT_EQ(serve("/json_rpc", get_info), get_info + " 4");
+    std::string get_block = "{\"json_rpc\":\"2.0\",\"id\":0,\"method\":\"get_block\"}";
+    EXPECT_EQ(serve("/json_rpc", get_block), get_block + " 5");
+    EXPECT_EQ(serve("/json_rpc", get_block), get_block + " 6");
+
+    //the metrics are published by the looper
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(saved.value() - saved0, clients - 1 + 2);
+
+    mainServer.stop_and_wait_for();
+    crypton.stop_and_wait_for();
+}
+
+TEST_F(GraftServerForwardTest, backends)
+{
+    using ms = std::chrono::milliseconds;
+
+    class DelayCryptoN : public TempCryptoNodeServer
+    {
+    public:
+        std::atomic<int> delay_ms{0};
+        std::atomic<int> requests{0};
+    protected:
+        virtual bool onHttpRequest(const http_message *hm, int& status_code, std::string& headers, std::string& data) override
+        {
+            ++requests;
+            std::this_thread::sleep_for(ms(delay_ms));
+            data = std::string(hm->body.p, hm->body.len);
+            headers = "Content-Type: application/json\r\nConnection: close";
+            return true;
+        }
+    };
+
+    auto serve = [](const std::string& path, const std::string& post_data)
+    {
+        Client client;
+        auto begin = std::chrono::steady_clock::now();
+        client.serve("http://localhost:9084" + path, "", post_data);
+        EXPECT_EQ(200, client.get_resp_code());
+        EXPECT_EQ(client.get_body(), post_data);
+        return std::chrono::duration_cast<ms>(std::chrono::steady_clock::now() - begin);
+    };
+    const std::string labels = graft::Metrics::labels({{"looper", "0"}});
+    graft::Metrics& metrics = graft::Metrics::instance();
+    graft::Counter& hedged = metrics.counter("graft_upstream_hedged_total",
+                                             "Requests sent to a second cryptonode backend after the p95 latency.", labels);
+    graft::Counter& failovers = metrics.counter("graft_upstream_failovers_total",
+                                                "Requests sent to another cryptonode backend after a failure.", labels);
+    graft::Counter& opens = metrics.counter("graft_upstream_circuit_opens_total", "Circuits of cryptonode backends opened.", labels);
+
+    {
+        DelayCryptoN fast, slow;
+        slow.port = "1235";
+        slow.delay_ms = 300;
+        fast.run();
+        slow.run();
+        MainServer mainServer;
+        mainServer.copts.cryptonode_rpc_backends = { "127.0.0.1:1235", "127.0.0.1:1234" };
+        mainServer.copts.upstream_hedge_paths = { "/getheight" };
+        graft::registerForwardRequests(mainServer.router);
+        mainServer.run();
+
+        //the slow backend is tried once, then the requests go to the fast one
+        for(int i = 0; i < 40; ++i) serve("/json_rpc", "data " + std::to_string(i));
+        EXPECT_EQ(slow.requests, 1);
+        EXPECT_EQ(fast.requests, 39);
+
+        //the backend with the lower latency becomes slow, the idempotent requests are hedged to the other one
+        fast.delay_ms = 300;
+        slow.delay_ms = 0;
+        uint64_t hedged0 = hedged.value();
+        for(int i = 0; i < 5; ++i)
+        {
+            EXPECT_LT(serve("/getheight", "{}").count(), 150);
+        }
+        EXPECT_EQ(slow.requests, 1 + 5);
+        std::this_thread::sleep_for(ms(100));
+        EXPECT_EQ(hedged.value() - hedged0, 5);
+
+        mainServer.stop_and_wait_for();
+        fast.stop_and_wait_for();
+        slow.stop_and_wait_for();
+    }
+
+    //the requests to the backend that is down fail over to the other one until its circuit opens
+    DelayCryptoN crypton;
+    crypton.run();
+    MainServer mainServer;
+    mainServer.copts.cryptonode_rpc_backends = { "127.0.0.1:1236", "127.0.0.1:1234" };
+    mainServer.copts.upstream_breaker_failures = 3;
+    graft::registerForwardRequests(mainServer.router);
+    mainServer.run();
+    uint64_t failovers0 = failovers.value(), opens0 = opens.value();
+    for(int i = 0; i < 10; ++i) serve("/json_rpc", "data " + std::to_string(i));
+    EXPECT_EQ(crypton.requests, 10);
+    std::this_thread::sleep_for(ms(100));
+    EXPECT_EQ(failovers.value() - failovers0, 3);
+    EXPECT_EQ(opens.value() - opens0, 1);
+    mainServer.stop_and_wait_for();
+    crypton.stop_and_wait_for();
+}
+
 GRAFT_DEFINE_IO_STRUCT(GetVersionResp,
                        (std::string, status),
                        (uint32_t, version)
@@ -1809,3 +3688,350 @@ TEST_F(GraftServerBlockingTest, common)
     mainServer.stop_and_wait_for();
     crypton.stop_and_wait_for();
 }
+
+TEST_F(GraftServerBlockingTest, async)
+{
+    class EchoCryptoN : public TempCryptoNodeServer
+    {
+    public:
+        std::atomic<int> requests{0};
+    protected:
+        virtual bool onHttpRequest(const http_message *hm, int& status_code, std::string& headers, std::string& data) override
+        {
+            ++requests;
+            data = std::string(hm->body.p, hm->body.len);
+            if(data == "ignore") return false;
+            headers = "Content-Type: application/json\r\nConnection: close";
+            return true;
+        }
+    };
+
+    EchoCryptoN crypton;
+    crypton.run();
+    const int count = 20;
+    auto action = [&](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        //all the requests are in flight at once, the worker waits for nothing until it needs the replies
+        std::vector<std::future<graft::Input>> futures;
+        std::promise<void> done;
+        std::atomic<int> callbacks{0};
+        for(int i = 0; i < count; ++i)
+        {
+            graft::Output out;
+            out.body = "request " + std::to_string(i);
+            futures.push_back(graft::TaskManager::sendUpstreamAsync(out));
+            graft::TaskManager::sendUpstreamAsync(out, [&, i](graft::Input&& in, const std::string& err)
+            {
+                EXPECT_TRUE(err.empty());
+                EXPECT_EQ(in.body, "request " + std::to_string(i));
+                if(++callbacks == count) done.set_value();
+            });
+        }
+        for(int i = 0; i < count; ++i)
+        {
+            EXPECT_EQ(futures[i].get().body, "request " + std::to_string(i));
+        }
+        done.get_future().wait();
+
+        //the deadline of the call is shorter than upstream-request-timeout
+        graft::Output out;
+        out.body = "ignore";
+        auto begin = std::chrono::steady_clock::now();
+        std::future<graft::Input> future = graft::TaskManager::sendUpstreamAsync(out, std::chrono::milliseconds(100));
+        EXPECT_THROW(future.get(), std::runtime_error);
+        EXPECT_LT(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(500));
+        return graft::Status::Ok;
+    };
+
+    MainServer mainServer;
+    mainServer.router.addRoute("/json_async", METHOD_POST|METHOD_GET,
+                               graft::Router::Handler3(nullptr, action, nullptr));
+    mainServer.run();
+
+    Client client;
+    client.serve("http://localhost:9084/json_async", "", "some data");
+    EXPECT_EQ(200, client.get_resp_code());
+    EXPECT_EQ(crypton.requests, 2 * count + 1);
+
+    mainServer.stop_and_wait_for();
+    crypton.stop_and_wait_for();
+
+    //without a looper the request fails at once
+    graft::Output out;
+    EXPECT_THROW(graft::TaskManager::sendUpstreamAsync(out).get(), std::runtime_error);
+}
+
+TEST_F(GraftServerBlockingTest, chainTip)
+{
+    class ChainCryptoN : public TempCryptoNodeServer
+    {
+    public:
+        std::atomic<uint64_t> height{100};
+        //the hashes of the blocks from fork on change
+        std::atomic<uint64_t> fork{std::numeric_limits<uint64_t>::max()};
+        std::atomic<size_t> heights{0};
+        std::atomic<size_t> hashes{0};
+
+        static std::string hash(uint64_t h, bool forked) { return (forked? "fork" : "hash") + std::to_string(h); }
+    protected:
+        virtual bool onHttpRequest(const http_message *hm, int& status_code, std::string& headers, std::string& data) override
+        {
+            std::string uri(hm->uri.p, hm->uri.len);
+            std::string body(hm->body.p, hm->body.len);
+            headers = "Content-Type: application/json\r\nConnection: close";
+            if(uri == "/getheight")
+            {
+                ++heights;
+                data = "{\"height\":" + std::to_string(height.load()) + ",\"status\":\"OK\"}";
+                return true;
+            }
+            ++hashes;
+            //{..."params":[N]...}
+            size_t pos = body.find('[');
+            uint64_t h = std::stoull(body.substr(pos + 1));
+            data = "{\"jsonrpc\":\"2.0\",\"id\":0,\"result\":\"" + hash(h, fork <= h) + "\"}";
+            return true;
+        }
+    };
+
+    ChainCryptoN crypton;
+    crypton.run();
+
+    //without a looper the daemon client makes the requests in place
+    const size_t depth = 8;
+    graft::ChainTip tip(std::make_shared<graft::DaemonRpcClient>("localhost:" + crypton.port, "", ""), depth);
+    std::string hash;
+    EXPECT_EQ(tip.height(), 0u);
+    EXPECT_FALSE(tip.getBlockHash(99, hash));
+
+    std::vector<uint64_t> blocks;
+    int id = tip.subscribe([&blocks](const graft::ChainTip::SnapshotPtr& snapshot){ blocks.push_back(snapshot->height); });
+
+    EXPECT_TRUE(tip.poll());
+    EXPECT_EQ(tip.height(), 100u);
+    EXPECT_EQ(crypton.hashes, depth);
+    EXPECT_TRUE(tip.getBlockHash(99, hash));
+    EXPECT_EQ(hash, "hash99");
+    EXPECT_TRUE(tip.getBlockHash(100 - depth, hash));
+    EXPECT_FALSE(tip.getBlockHash(100 - depth - 1, hash));
+    EXPECT_FALSE(tip.getBlockHash(100, hash));
+
+    //no new block, only the height and the checked top block are asked
+    EXPECT_TRUE(tip.poll());
+    EXPECT_EQ(crypton.heights, 2u);
+    EXPECT_EQ(crypton.hashes, depth + 1);
+    EXPECT_EQ(blocks, std::vector<uint64_t>({100}));
+    EXPECT_EQ(tip.snapshot()->hashes.back(), "hash99");
+
+    //the new blocks and the checked one below the previous tip are asked
+    crypton.height = 103;
+    EXPECT_TRUE(tip.poll());
+    EXPECT_EQ(crypton.hashes, depth + 1 + 4);
+    graft::ChainTip::SnapshotPtr snapshot = tip.snapshot();
+    ASSERT_TRUE(snapshot);
+    EXPECT_EQ(snapshot->first, 103 - depth);
+    ASSERT_EQ(snapshot->hashes.size(), depth);
+    for(size_t i = 0; i < depth; ++i)
+    {
+        EXPECT_EQ(snapshot->hashes[i], ChainCryptoN::hash(snapshot->first + i, false));
+    }
+
+    //the checked block changed, the whole ring is asked again
+    crypton.fork = 102;
+    crypton.height = 104;
+    EXPECT_TRUE(tip.poll());
+    EXPECT_EQ(crypton.hashes, depth + 1 + 4 + 2 + (depth - 2));
+    EXPECT_TRUE(tip.getBlockHash(102, hash));
+    EXPECT_EQ(hash, "fork102");
+    EXPECT_TRUE(tip.getBlockHash(101, hash));
+    EXPECT_EQ(hash, "hash101");
+    EXPECT_EQ(blocks, std::vector<uint64_t>({100, 103, 104}));
+
+    //the top block changed at the same height, the whole ring is asked again and published
+    crypton.fork = std::numeric_limits<uint64_t>::max();
+    size_t asked = crypton.hashes;
+    EXPECT_TRUE(tip.poll());
+    EXPECT_EQ(crypton.hashes, asked + 1 + (depth - 1));
+    EXPECT_TRUE(tip.getBlockHash(103, hash));
+    EXPECT_EQ(hash, "hash103");
+    EXPECT_TRUE(tip.getBlockHash(102, hash));
+    EXPECT_EQ(hash, "hash102");
+    EXPECT_EQ(blocks, std::vector<uint64_t>({100, 103, 104, 104}));
+
+    //the height went down below the previous ring, nothing is reused
+    crypton.height = 104 - depth - 2;
+    asked = crypton.hashes;
+    EXPECT_TRUE(tip.poll());
+    EXPECT_EQ(crypton.hashes, asked + depth);
+    snapshot = tip.snapshot();
+    ASSERT_TRUE(snapshot);
+    EXPECT_EQ(snapshot->height, 104 - depth - 2);
+    EXPECT_EQ(snapshot->first, 104 - 2 * depth - 2);
+    ASSERT_EQ(snapshot->hashes.size(), depth);
+    for(size_t i = 0; i < depth; ++i)
+    {
+        EXPECT_EQ(snapshot->hashes[i], ChainCryptoN::hash(snapshot->first + i, false));
+    }
+    EXPECT_EQ(blocks, std::vector<uint64_t>({100, 103, 104, 104, 104 - depth - 2}));
+
+    //a failed poll keeps the snapshot
+    tip.unsubscribe(id);
+    crypton.stop_and_wait_for();
+    crypton.height = 105;
+    EXPECT_FALSE(tip.poll());
+    EXPECT_EQ(tip.height(), 104 - depth - 2);
+    EXPECT_TRUE(tip.getBlockHash(104 - depth - 3, hash));
+    EXPECT_EQ(blocks.size(), 5u);
+}
+
+/////////////////////////////////
+// GraftServerAdmissionTest fixture
+
+class GraftServerAdmissionTest : public GraftServerTestBase
+{
+public:
+    struct LoadResult
+    {
+        int ok = 0;
+        int busy = 0;
+        int high_ok = 0;
+        int retry_after = 0;
+        double seconds = 0;
+        std::vector<double> latencies_ms;
+    };
+
+    //sends request_count requests from client_count concurrent clients, each fifth request is high priority
+    static LoadResult load(int admission_queue_len, int client_count, int request_count)
+    {
+        auto action = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            output.body = input.body;
+            return graft::Status::Ok;
+        };
+
+        MainServer mainServer;
+        mainServer.copts.workers_count = 2;
+        mainServer.copts.worker_queue_len = 2;
+        mainServer.copts.admission_queue_len = admission_queue_len;
+        mainServer.router.addRoute("/normal", METHOD_POST, graft::Router::Handler3(nullptr, action, nullptr));
+        mainServer.router.addRoute("/high", METHOD_POST, graft::Router::Handler3(nullptr, action, nullptr), graft::Priority::High);
+        mainServer.run();
+
+        LoadResult lr;
+        std::mutex mutex;
+        std::atomic<int> next{0};
+        auto begin = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for(int c = 0; c < client_count; ++c)
+        {
+            threads.emplace_back([&]
+            {
+                for(int i = next++; i < request_count; i = next++)
+                {
+                    bool high = (i % 5 == 0);
+                    Client client;
+                    auto start = std::chrono::steady_clock::now();
+                    client.serve(std::string("http://localhost:9084/") + (high? "high" : "normal"), "", "load");
+                    std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+
+                    std::lock_guard<std::mutex> lk(mutex);
+                    lr.latencies_ms.push_back(ms.count());
+                    if(client.get_resp_code() == 200)
+                    {
+                        ++lr.ok;
+                        if(high) ++lr.high_ok;
+                    }
+                    else if(client.get_resp_code() == 503)
+                    {
+                        ++lr.busy;
+                        if(0 < std::atoi(client.get_header("Retry-After").c_str())) ++lr.retry_after;
+                    }
+                }
+            });
+        }
+        for(auto& th : threads) th.join();
+        lr.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        mainServer.stop_and_wait_for();
+        std::sort(lr.latencies_ms.begin(), lr.latencies_ms.end());
+        return lr;
+    }
+};
+
+TEST_F(GraftServerAdmissionTest, overload)
+{
+    const int client_count = 40;
+    const int request_count = 400;
+
+    LoadResult no_queue = load(0, client_count, request_count);
+    LoadResult queue = load(256, client_count, request_count);
+
+    auto print = [](const char* name, LoadResult& lr)
+    {
+        auto& l = lr.latencies_ms;
+        std::cout << name << ": ok " << lr.ok << ", 503 " << lr.busy
+                  << ", throughput " << lr.ok / lr.seconds << " req/s"
+                  << ", latency p50 " << l[l.size()/2] << " ms, p99 " << l[l.size()*99/100] << " ms" << std::endl;
+    };
+    print("503 at once", no_queue);
+    print("admission queue", queue);
+
+    EXPECT_EQ(no_queue.ok + no_queue.busy, request_count);
+    EXPECT_EQ(queue.ok + queue.busy, request_count);
+    EXPECT_EQ(no_queue.busy, no_queue.retry_after);
+    EXPECT_EQ(queue.busy, queue.retry_after);
+    EXPECT_LT(no_queue.ok, queue.ok);
+    //high priority requests are never shed while the queue is not full of them
+    EXPECT_EQ(queue.high_ok, request_count / 5);
+}
+
+TEST_F(GraftServerTestBase, jobReadyNotifications)
+{
+    auto action = [](const graft::Router::vars_t& vars, const graft::Input& input, graft::Context& ctx, graft::Output& output)->graft::Status
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        output.body = input.body;
+        return graft::Status::Ok;
+    };
+
+    MainServer mainServer;
+    mainServer.copts.workers_count = 4;
+    mainServer.copts.result_drain_budget = 8;
+    mainServer.router.addRoute("/job", METHOD_POST, graft::Router::Handler3(nullptr, action, nullptr));
+    mainServer.run();
+
+    const int client_count = 16;
+    const int request_count = 800;
+    std::atomic<int> next{0};
+    std::atomic<int> ok{0};
+    std::vector<std::thread> threads;
+    for(int c = 0; c < client_count; ++c)
+    {
+        threads.emplace_back([&]
+        {
+            for(int i = next++; i < request_count; i = next++)
+            {
+                Client client;
+                client.serve("http://localhost:9084/job", "", "job");
+                if(client.get_resp_code() == 200) ++ok;
+            }
+        });
+    }
+    for(auto& th : threads) th.join();
+    EXPECT_EQ(ok, request_count);
+
+    //the looper is idle now
+    graft::Looper* looper = mainServer.plooper.load();
+    uint64_t jobs = looper->getJobCount();
+    uint64_t notifications = looper->getNotifyCount();
+    uint64_t wakeups = looper->getWakeupCount();
+    //without coalescing each job made an eventfd write and the looper read it back, up to 2 syscalls per job
+    std::cout << "jobs " << jobs << ", job ready notifications " << notifications << ", wakeups " << wakeups
+              << ", notify syscalls per request " << double(notifications + wakeups) / request_count
+              << " (up to 2 without coalescing)" << std::endl;
+    EXPECT_EQ(jobs, request_count);
+    EXPECT_LE(notifications, jobs);
+
+    mainServer.stop_and_wait_for();
+}